@@ -18,7 +18,12 @@ void BackupEngine::Run(const BackupTask &task, bool dryRun) {
   if (m_strategy) {
     m_aborted = false;
     BackupTask activeTask = task;
-    activeTask.IsAborted = [this]() { return m_aborted.load(); };
+    // A caller-supplied check (e.g. SetScheduler's) still applies, so an
+    // abort that lands before this run starts is not lost.
+    std::function<bool()> outer = task.IsAborted;
+    activeTask.IsAborted = [this, outer]() {
+      return m_aborted.load() || (outer && outer());
+    };
     m_strategy->Execute(activeTask, m_logger, dryRun);
   } else {
     if (m_logger) {
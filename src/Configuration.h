@@ -10,6 +10,7 @@ namespace fs = std::filesystem;
 #include <experimental/filesystem>
 namespace fs = std::experimental::filesystem;
 #endif
+#include <algorithm>
 #include <fstream>
 #include <shlobj.h>
 #include <sstream>
@@ -21,6 +22,11 @@ namespace fs = std::experimental::filesystem;
 
 enum class ScheduleFrequency { Manual, Daily, Weekly };
 
+// Upper bound for BackupUnit::workerCount.
+const int kMaxWorkerCount = 64;
+// Upper bound for BackupSet::maxThreads.
+const int kMaxSetThreads = 256;
+
 struct BackupUnit {
   std::wstring name;
   std::wstring source;
@@ -34,9 +40,34 @@ struct BackupUnit {
   bool blockCloneMode = false; // Delta Block Strategy
   bool shadowCopyMode = false; // VSS Shadow Copy Strategy
   bool comparisonMode = false; // Brand new Comparing Engine
+  bool pipelineMode = false;   // Staged Pipeline Engine
+  bool uringMode = false;      // Pipeline Engine copying through io_uring
   bool criteriaSize = true;
   bool criteriaTime = true;
   bool criteriaData = false;
+  // Target catalog (see TargetCatalog): where it lives and how far it is
+  // trusted on repeat runs.
+  CatalogMode catalogMode = CatalogMode::Off;
+  bool catalogInTarget = false; // Target root instead of the config folder
+  int catalogRevalidatePercent = 5;
+  // Parallel engine: size from which a file is copied by several workers at
+  // once (0 = never).
+  int rangeCopyThresholdMB = 1024;
+  VerifyMethod verifyMethod = VerifyMethod::Hash;
+  // Parallel / Comparing engines: worker threads, or their ceiling when the
+  // count adapts to measured throughput.
+  int workerCount = 4;
+  bool adaptiveWorkers = false;
+  // Parallel / Comparing / Pipeline engines: memory for queued traversal
+  // items before they spill to a temporary file (0 = unbounded).
+  int traversalBudgetMB = 0;
+  // Parallel engine: job journal (see JobJournal), so that an interrupted
+  // run resumes where it stopped; how often it is made durable, in ms.
+  bool resumable = false;
+  int journalSyncMs = 1000;
+  // Include/exclude rules, ';' separated (see PathFilter), e.g.
+  // "node_modules/; *.tmp; /build; size>4G". Empty backs up everything.
+  std::wstring filterRules;
 };
 
 struct BackupSet {
@@ -49,6 +80,13 @@ struct BackupSet {
   int scheduleMinute = 0;
   int scheduleDayOfWeek = 0;     // 0=Sun, 1=Mon,...
   std::wstring lastScheduledRun; // To prevent multiple runs in same slot
+
+  // Set runs (SetScheduler): units running at once (1 = one after another),
+  // worker threads shared by them, and MB being copied at once (0 = no cap).
+  // Units that share a source or target volume always run one at a time.
+  int concurrentUnits = 1;
+  int maxThreads = 16;
+  int maxInFlightMB = 0;
 };
 
 class ConfigManager {
@@ -68,6 +106,41 @@ public:
     return L"config.txt";
   }
 
+  // File of a unit in a folder next to config.txt, named after the unit and
+  // its target.
+  static std::wstring GetUnitFilePath(const BackupUnit &unit,
+                                      const wchar_t *folder,
+                                      const wchar_t *extension) {
+    std::wstring safeName;
+    for (wchar_t c : unit.name)
+      safeName += (iswalnum(c) || c == L'-' || c == L'_') ? c : L'_';
+    wchar_t suffix[16];
+    swprintf_s(suffix, L"_%08zx",
+               std::hash<std::wstring>()(unit.target) & 0xFFFFFFFF);
+    fs::path dir = fs::path(GetConfigPath()).parent_path() / folder;
+    return (dir / (safeName + suffix + extension)).wstring();
+  }
+
+  // Catalog file for a unit: either in the target root, or in a "catalogs"
+  // folder next to config.txt.
+  static std::wstring GetCatalogPath(const BackupUnit &unit) {
+    if (unit.catalogInTarget)
+      return (fs::path(unit.target) / L".surebackup.sbcat").wstring();
+    return GetUnitFilePath(unit, L"catalogs", L".sbcat");
+  }
+
+  // Job journal of a unit, in a "journals" folder next to config.txt. It
+  // exists only while a run of the unit is unfinished.
+  static std::wstring GetJournalPath(const BackupUnit &unit) {
+    return GetUnitFilePath(unit, L"journals", L".sbjrnl");
+  }
+
+  // Execution plan of a unit's last preview, in a "plans" folder next to
+  // config.txt.
+  static std::wstring GetPlanPath(const BackupUnit &unit) {
+    return GetUnitFilePath(unit, L"plans", L".sbplan");
+  }
+
   static std::vector<BackupSet> Load() {
     std::vector<BackupSet> sets;
     std::wifstream fin(GetConfigPath());
@@ -90,7 +163,8 @@ public:
         continue;
       if (line[0] == L'[') {
         BackupSet s;
-        // Format: [Name|Description|Frequency|Hour|Minute|DayOfWeek|LastRun]
+        // Format: [Name|Description|Frequency|Hour|Minute|DayOfWeek|LastRun|
+        //          ConcurrentUnits|MaxThreads|InFlightMB]
         std::wstring content = line.substr(1, line.find(L']') - 1);
         std::wstringstream ss(content);
         std::wstring part;
@@ -110,6 +184,13 @@ public:
             s.scheduleDayOfWeek = _wtoi(part.c_str());
           else if (i == 6)
             s.lastScheduledRun = part;
+          else if (i == 7)
+            s.concurrentUnits = std::max(_wtoi(part.c_str()), 1);
+          else if (i == 8)
+            s.maxThreads =
+                std::min(std::max(_wtoi(part.c_str()), 1), kMaxSetThreads);
+          else if (i == 9)
+            s.maxInFlightMB = std::max(_wtoi(part.c_str()), 0);
           i++;
         }
         sets.push_back(s);
@@ -130,6 +211,27 @@ public:
         std::getline(ss, p_time, L'|');
         std::getline(ss, p_data, L'|');
 
+        std::wstring c_mode, c_where, c_percent;
+        std::getline(ss, c_mode, L'|');
+        std::getline(ss, c_where, L'|');
+        std::getline(ss, c_percent, L'|');
+
+        std::wstring r_threshold, v_method, w_count, w_mode;
+        std::getline(ss, r_threshold, L'|');
+        std::getline(ss, v_method, L'|');
+        std::getline(ss, w_count, L'|');
+        std::getline(ss, w_mode, L'|');
+
+        std::wstring t_budget;
+        std::getline(ss, t_budget, L'|');
+
+        std::wstring j_mode, j_sync;
+        std::getline(ss, j_mode, L'|');
+        std::getline(ss, j_sync, L'|');
+
+        std::wstring f_rules;
+        std::getline(ss, f_rules, L'|');
+
         BackupMode modeEnum = BackupMode::Copy;
         if (mode == L"SYNC")
           modeEnum = BackupMode::Sync;
@@ -144,6 +246,8 @@ public:
         bool blockClone = (threaded == L"BLOCK");
         bool shadowCopy = (threaded == L"VSS");
         bool comparing = (threaded == L"COMPARE");
+        bool pipeline = (threaded == L"PIPELINE");
+        bool uring = (threaded == L"URING");
 
         BackupUnit unit;
         unit.name = name;
@@ -156,9 +260,32 @@ public:
         unit.blockCloneMode = blockClone;
         unit.shadowCopyMode = shadowCopy;
         unit.comparisonMode = comparing;
+        unit.pipelineMode = pipeline;
+        unit.uringMode = uring;
         unit.criteriaSize = (p_size == L"1");
         unit.criteriaTime = (p_time == L"1");
         unit.criteriaData = (p_data == L"1");
+        if (c_mode == L"RECORD")
+          unit.catalogMode = CatalogMode::Record;
+        else if (c_mode == L"TRUST")
+          unit.catalogMode = CatalogMode::Trust;
+        unit.catalogInTarget = (c_where == L"TARGET");
+        if (!c_percent.empty())
+          unit.catalogRevalidatePercent = _wtoi(c_percent.c_str());
+        if (!r_threshold.empty())
+          unit.rangeCopyThresholdMB = _wtoi(r_threshold.c_str());
+        if (v_method == L"COMPARE")
+          unit.verifyMethod = VerifyMethod::Compare;
+        if (!w_count.empty())
+          unit.workerCount =
+              std::min(std::max(_wtoi(w_count.c_str()), 1), kMaxWorkerCount);
+        unit.adaptiveWorkers = (w_mode == L"ADAPTIVE");
+        if (!t_budget.empty())
+          unit.traversalBudgetMB = std::max(_wtoi(t_budget.c_str()), 0);
+        unit.resumable = (j_mode == L"RESUMABLE");
+        if (!j_sync.empty())
+          unit.journalSyncMs = std::max(_wtoi(j_sync.c_str()), 0);
+        unit.filterRules = f_rules;
 
         currentSet->units.push_back(unit);
       }
@@ -172,7 +299,8 @@ public:
       fout << L"[" << s.name << L"|" << s.description << L"|"
            << (int)s.scheduleFreq << L"|" << s.scheduleHour << L"|"
            << s.scheduleMinute << L"|" << s.scheduleDayOfWeek << L"|"
-           << s.lastScheduledRun << L"]" << std::endl;
+           << s.lastScheduledRun << L"|" << s.concurrentUnits << L"|"
+           << s.maxThreads << L"|" << s.maxInFlightMB << L"]" << std::endl;
       for (const auto &u : s.units) {
         std::wstring modeStr = L"COPY";
         if (u.mode == BackupMode::Sync)
@@ -191,11 +319,29 @@ public:
                             ? L"VSS"
                             : (u.comparisonMode
                                    ? L"COMPARE"
-                                   : (u.parallelMode ? L"PARALLEL"
-                                                     : L"STANDARD"))))
+                                   : (u.uringMode
+                                          ? L"URING"
+                                          : (u.pipelineMode
+                                                 ? L"PIPELINE"
+                                                 : (u.parallelMode
+                                                        ? L"PARALLEL"
+                                                        : L"STANDARD"))))))
              << L"|" << (u.criteriaSize ? L"1" : L"0") << L"|"
              << (u.criteriaTime ? L"1" : L"0") << L"|"
-             << (u.criteriaData ? L"1" : L"0") << std::endl;
+             << (u.criteriaData ? L"1" : L"0") << L"|"
+             << (u.catalogMode == CatalogMode::Trust
+                     ? L"TRUST"
+                     : (u.catalogMode == CatalogMode::Record ? L"RECORD"
+                                                             : L"OFF"))
+             << L"|" << (u.catalogInTarget ? L"TARGET" : L"CONFIG") << L"|"
+             << u.catalogRevalidatePercent << L"|" << u.rangeCopyThresholdMB
+             << L"|"
+             << (u.verifyMethod == VerifyMethod::Compare ? L"COMPARE" : L"HASH")
+             << L"|" << u.workerCount << L"|"
+             << (u.adaptiveWorkers ? L"ADAPTIVE" : L"FIXED") << L"|"
+             << u.traversalBudgetMB << L"|"
+             << (u.resumable ? L"RESUMABLE" : L"RESTART") << L"|"
+             << u.journalSyncMs << L"|" << u.filterRules << std::endl;
       }
       fout << std::endl;
     }
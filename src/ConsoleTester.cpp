@@ -1,3 +1,4 @@
+#ifdef _WIN32
 #ifndef UNICODE
 #define UNICODE
 #endif
@@ -7,17 +8,39 @@
 
 #include <shlwapi.h>
 #include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
+#include <atomic>
+#include <chrono>
+#include <clocale>
+#include <condition_variable>
+#include <cstring>
+#include <cwchar>
+#include <deque>
 #include <fcntl.h>
 #include <filesystem>
 #include <fstream>
-#include <io.h>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "BackupEngine.h"
+#include "Strategies/BackupUtils.h"
+#include "Strategies/DevicePools.h"
+#include "Strategies/LogPipeline.h"
+#include "Strategies/LogWriter.h"
+#include "Strategies/ParallelBackupStrategy.h"
+#include "Strategies/PathFilter.h"
+#include "Strategies/ParallelTreeWalker.h"
+#include "Strategies/PipelineBackupStrategy.h"
 #include "Strategies/StandardBackupStrategy.h"
 
 class ConsoleLogger : public IBackupLogger {
@@ -73,8 +96,877 @@ void RunTest(IBackupStrategy *strategy, const std::wstring &name) {
   strategy->Execute(task, &logger, true);
 }
 
-int main() {
-  _setmode(_fileno(stdout), _O_U16TEXT);
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+static void PrintRate(const wchar_t *label, long long dirs, long long entries,
+                      double secs) {
+  if (secs <= 0)
+    secs = 1e-9;
+  std::wcout << label << L": " << dirs << L" dirs, " << entries
+             << L" entries in " << secs << L" s  (" << (long long)(dirs / secs)
+             << L" dirs/s, " << (long long)(entries / secs) << L" entries/s)"
+             << std::endl;
+}
+
+// Enumeration benchmark: the legacy single-threaded recursive iterator that
+// ScanSource used to run versus the work-stealing ParallelTreeWalker.
+void BenchEnumeration(const fs::path &root, int threads) {
+  std::wcout << L"\n--- Enumeration benchmark: " << root.wstring() << L" ---"
+             << std::endl;
+
+  {
+    long long dirs = 1, entries = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::error_code ec;
+    fs::recursive_directory_iterator it(
+        root, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+      entries++;
+      if (it->is_directory(ec) && !it->is_symlink(ec))
+        dirs++;
+    }
+    PrintRate(L"recursive_directory_iterator", dirs, entries,
+              SecondsSince(start));
+  }
+
+  {
+    std::atomic<long long> entries(0);
+    typedef ParallelTreeWalker<fs::path> Walker;
+    Walker walker(threads);
+    auto start = std::chrono::steady_clock::now();
+    Walker::Stats stats = walker.Run(
+        {root}, [&](fs::path &dir, Walker::Context &ctx) {
+          long long local = 0;
+          std::error_code ec;
+          fs::directory_iterator it(
+              dir, fs::directory_options::skip_permission_denied, ec);
+          for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+            local++;
+            if (it->is_directory(ec) && !it->is_symlink(ec))
+              ctx.Push(it->path());
+          }
+          entries += local;
+        });
+    std::wstringstream label;
+    label << L"ParallelTreeWalker (" << walker.ThreadCount() << L" threads, "
+          << stats.steals << L" steals)";
+    PrintRate(label.str().c_str(), stats.visited, entries,
+              SecondsSince(start));
+  }
+}
+
+// The scheduler the Parallel and Comparing engines used before
+// ParallelTreeWalker: one shared deque, one mutex and one condition variable
+// notified on every push, with termination tracked through a count of busy
+// workers. Kept here as the baseline for --bench-sched.
+template <typename Item> class GlobalQueueWalker {
+public:
+  class Context {
+  public:
+    void Push(Item item) {
+      {
+        std::lock_guard<std::mutex> lock(m_walker->m_mutex);
+        m_walker->m_queue.push_back(std::move(item));
+      }
+      m_walker->m_cv.notify_all();
+    }
+
+  private:
+    friend class GlobalQueueWalker;
+    explicit Context(GlobalQueueWalker *walker) : m_walker(walker) {}
+    GlobalQueueWalker *m_walker;
+  };
+
+  explicit GlobalQueueWalker(int numThreads) : m_numThreads(numThreads) {}
+
+  long long Run(std::vector<Item> roots,
+                const std::function<void(Item &, Context &)> &visit) {
+    m_queue.assign(roots.begin(), roots.end());
+    m_busy = 0;
+    m_finished = false;
+    std::atomic<long long> visited(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < m_numThreads; ++i) {
+      workers.push_back(std::thread([&]() {
+        Context ctx(this);
+        while (true) {
+          Item item;
+          {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [&] { return !m_queue.empty() || m_finished; });
+            if (m_finished)
+              return;
+            item = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_busy++;
+          }
+          visit(item, ctx);
+          visited++;
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if (--m_busy == 0 && m_queue.empty()) {
+            m_finished = true;
+            m_cv.notify_all();
+          }
+        }
+      }));
+    }
+    for (auto &t : workers)
+      t.join();
+    return visited;
+  }
+
+private:
+  int m_numThreads;
+  std::deque<Item> m_queue;
+  int m_busy = 0;
+  bool m_finished = false;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+};
+
+// Scheduler contention benchmark on a tree of empty files (1000 per
+// directory), created under <dir> on the first run and reused afterwards.
+// Every directory and every file is one work item, as in the Parallel
+// engine. Each scheduler runs twice: visiting items without any I/O, which
+// measures the scheduler alone, and stat()ing every entry.
+void BenchScheduler(const fs::path &dir, long long files, int threads) {
+  if (threads <= 0)
+    threads = ParallelTreeWalker<int>::DefaultThreadCount();
+  const long long perDir = 1000;
+  fs::path root = dir / (L"surebackup_sched_bench_" + std::to_wstring(files));
+  std::wcout << L"\n--- Scheduler benchmark: " << files << L" empty files in "
+             << root.wstring() << L", " << threads << L" threads ---"
+             << std::endl;
+
+  if (!fs::exists(root / L"complete")) {
+    auto start = std::chrono::steady_clock::now();
+    for (long long i = 0; i < files; ++i) {
+      fs::path sub = root / (L"d" + std::to_wstring(i / perDir));
+      if (i % perDir == 0)
+        fs::create_directories(sub);
+      std::ofstream(sub / (L"f" + std::to_wstring(i % perDir)));
+    }
+    std::ofstream(root / L"complete");
+    std::wcout << L"Created in " << SecondsSince(start) << L" s" << std::endl;
+  }
+
+  struct Entry {
+    fs::path path;
+    bool isDir = false;
+  };
+  auto run = [&](auto &walker, auto &runWalk, bool withIo) {
+    typedef typename std::remove_reference<decltype(walker)>::type Walker;
+    auto visit = [&](Entry &entry, typename Walker::Context &ctx) {
+      std::error_code ec;
+      if (!entry.isDir) {
+        if (withIo)
+          (void)fs::symlink_status(entry.path, ec);
+        return;
+      }
+      for (fs::directory_iterator it(entry.path, ec), end; !ec && it != end;
+           it.increment(ec))
+        ctx.Push(Entry{it->path(), it->is_directory(ec)});
+    };
+    auto start = std::chrono::steady_clock::now();
+    long long items = runWalk(walker, visit);
+    double secs = SecondsSince(start);
+    if (secs <= 0)
+      secs = 1e-9;
+    return std::make_pair(items, secs);
+  };
+  auto report = [](const std::wstring &label, std::pair<long long, double> r) {
+    std::wcout << label << L": " << r.first << L" items in " << r.second
+               << L" s  (" << (long long)(r.first / r.second) << L" items/s)"
+               << std::endl;
+  };
+
+  for (int pass = 0; pass < 2; ++pass) {
+    bool withIo = pass == 1;
+    const wchar_t *mode = withIo ? L", stat" : L", no I/O";
+    {
+      GlobalQueueWalker<Entry> walker(threads);
+      auto runWalk = [&](GlobalQueueWalker<Entry> &w, auto &visit) {
+        return w.Run({Entry{root, true}}, visit);
+      };
+      report(std::wstring(L"Global deque + mutex + cv") + mode,
+             run(walker, runWalk, withIo));
+    }
+    {
+      ParallelTreeWalker<Entry> walker(threads);
+      ParallelTreeWalker<Entry>::Stats stats;
+      auto runWalk = [&](ParallelTreeWalker<Entry> &w, auto &visit) {
+        stats = w.Run({Entry{root, true}}, visit);
+        return stats.visited;
+      };
+      auto result = run(walker, runWalk, withIo);
+      std::wstringstream label;
+      label << L"ParallelTreeWalker" << mode << L" (" << stats.steals
+            << L" steals, " << stats.parks << L" parks)";
+      report(label.str(), result);
+    }
+  }
+}
+
+// Copy benchmark: RobustCopy (CopyFileExW on Windows, copy_file_range /
+// sendfile elsewhere) versus a plain buffered read/write loop. Run it once per
+// file system of interest (e.g. a tmpfs and an ext4 directory). The source
+// file is written just before, so both runs read from the page cache and
+// the numbers compare the copy paths rather than the source disk.
+void BenchCopy(const fs::path &dir, long long sizeMb) {
+  std::wcout << L"\n--- Copy benchmark: " << dir.wstring() << L", " << sizeMb
+             << L" MB ---" << std::endl;
+
+  fs::path source = dir / L"surebackup_bench_src.bin";
+  fs::path target = dir / L"surebackup_bench_dst.bin";
+  {
+    std::ofstream out(source, std::ios::binary | std::ios::trunc);
+    std::vector<char> block(1024 * 1024);
+    for (size_t i = 0; i < block.size(); ++i)
+      block[i] = (char)(i * 131 + 7);
+    for (long long i = 0; i < sizeMb; ++i)
+      out.write(block.data(), (std::streamsize)block.size());
+  }
+  const double mb = (double)sizeMb;
+
+  auto report = [&](const wchar_t *label, double secs) {
+    if (secs <= 0)
+      secs = 1e-9;
+    std::wcout << label << L": " << secs << L" s  (" << (long long)(mb / secs)
+               << L" MB/s)" << std::endl;
+  };
+
+  {
+    fs::remove(target);
+    auto start = std::chrono::steady_clock::now();
+    {
+      std::ifstream in(source, std::ios::binary);
+      std::ofstream out(target, std::ios::binary | std::ios::trunc);
+      std::vector<char> buffer(64 * 1024);
+      while (in.read(buffer.data(), (std::streamsize)buffer.size()) ||
+             in.gcount() > 0)
+        out.write(buffer.data(), in.gcount());
+    }
+    report(L"Buffered read/write (64 KB)", SecondsSince(start));
+  }
+
+  {
+    fs::remove(target);
+    std::wstring err;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = BackupUtils::RobustCopy(source, target, false, err);
+    double secs = SecondsSince(start);
+    if (ok)
+      report(L"RobustCopy", secs);
+    else
+      std::wcout << L"RobustCopy failed: " << err << std::endl;
+    if (ok && !BackupUtils::CompareFilesBinary(source, target))
+      std::wcout << L"RobustCopy produced a different file!" << std::endl;
+  }
+
+  // Verified copies: re-reading both files against hashing the source on
+  // the way and reading back only the target (uncached).
+  {
+    fs::remove(target);
+    std::wstring err;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = BackupUtils::RobustCopy(source, target, false, err) &&
+              BackupUtils::CompareFilesBinary(source, target);
+    double secs = SecondsSince(start);
+    if (ok)
+      report(L"Copy + compare verify", secs);
+    else
+      std::wcout << L"Copy + compare verify failed: " << err << std::endl;
+  }
+  {
+    fs::remove(target);
+    std::wstring err;
+    unsigned long long hash = 0;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = BackupUtils::RobustCopy(source, target, false, err, nullptr,
+                                      nullptr, &hash) &&
+              BackupUtils::VerifyCopy(source, target, hash);
+    double secs = SecondsSince(start);
+    if (ok)
+      report(L"Copy + hash verify", secs);
+    else
+      std::wcout << L"Copy + hash verify failed: " << err << std::endl;
+  }
+
+  fs::remove(source);
+  fs::remove(target);
+}
+
+void BenchCompare(const fs::path &dir, long long sizeMb) {
+  std::wcout << L"\n--- Compare benchmark: " << dir.wstring() << L", " << sizeMb
+             << L" MB, kernel " << BackupUtils::BuffersEqualKernel() << L" ---"
+             << std::endl;
+  auto report = [](const wchar_t *label, double bytes, double secs) {
+    if (secs <= 0)
+      secs = 1e-9;
+    std::wcout << label << L": " << secs << L" s  (" << bytes / secs / 1e9
+               << L" GB/s)" << std::endl;
+  };
+
+  // The kernel alone, on two identical in-memory blocks.
+  {
+    const size_t block = BackupUtils::kCompareBlockSize;
+    std::vector<char> a(block), b(block);
+    for (size_t i = 0; i < block; ++i)
+      a[i] = b[i] = (char)(i * 131 + 7);
+    const int rounds = 256;
+    volatile bool sink = true;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i)
+      sink = sink && BackupUtils::BuffersEqual(a.data(), b.data(), block);
+    report(L"BuffersEqual (memory)", (double)block * rounds,
+           SecondsSince(start));
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i)
+      sink = sink && std::memcmp(a.data(), b.data(), block) == 0;
+    report(L"memcmp (memory)", (double)block * rounds, SecondsSince(start));
+  }
+
+  // Whole files; both are in the page cache, so this measures the
+  // comparison loop rather than the disk.
+  fs::path first = dir / L"surebackup_bench_a.bin";
+  fs::path second = dir / L"surebackup_bench_b.bin";
+  {
+    std::vector<char> block(1024 * 1024);
+    for (size_t i = 0; i < block.size(); ++i)
+      block[i] = (char)(i * 131 + 7);
+    std::ofstream a(first, std::ios::binary | std::ios::trunc);
+    std::ofstream b(second, std::ios::binary | std::ios::trunc);
+    for (long long i = 0; i < sizeMb; ++i) {
+      a.write(block.data(), (std::streamsize)block.size());
+      b.write(block.data(), (std::streamsize)block.size());
+    }
+  }
+  const double bytes = (double)sizeMb * 1024 * 1024;
+  BackupUtils::CompareFilesBinary(first, second); // Warm the cache
+
+  long long callbacks = 0;
+  auto start = std::chrono::steady_clock::now();
+  bool same = BackupUtils::CompareFilesBinary(
+      first, second, nullptr, [&](long long, long long) { callbacks++; });
+  report(same ? L"Identical files" : L"Identical files (MISMATCH!)", bytes,
+         SecondsSince(start));
+  std::wcout << L"  progress callbacks: " << callbacks << std::endl;
+
+  {
+    std::fstream b(second, std::ios::binary | std::ios::in | std::ios::out);
+    b.seekp(100);
+    b.put('X');
+  }
+  start = std::chrono::steady_clock::now();
+  same = BackupUtils::CompareFilesBinary(first, second);
+  report(same ? L"Early mismatch (NOT DETECTED!)" : L"Early mismatch", bytes,
+         SecondsSince(start));
+
+  fs::remove(first);
+  fs::remove(second);
+}
+
+// Whole-engine benchmark: Parallel against Pipeline with copy threads and
+// with io_uring, each copying the same tree into an empty target. The tree
+// (files of sizeKb each, 1000 per directory) is created under <dir> on the
+// first run and reused afterwards; it stays in the page cache unless caches
+// are dropped between runs, so cold numbers need that done by hand. The
+// target sits next to it, so pass a directory on the device under test.
+void BenchEngines(const fs::path &dir, long long files, long long sizeKb,
+                  int workers) {
+  const long long perDir = 1000;
+  fs::path root = dir / (L"surebackup_engine_bench_" + std::to_wstring(files) +
+                         L"x" + std::to_wstring(sizeKb) + L"K");
+  fs::path source = root / L"src";
+  fs::path target = root / L"dst";
+  std::wcout << L"\n--- Engine benchmark: " << files << L" files of " << sizeKb
+             << L" KB in " << root.wstring() << L", " << workers
+             << L" workers ---" << std::endl;
+
+  if (!fs::exists(root / L"complete")) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<char> block(1024 * 1024);
+    for (size_t i = 0; i < block.size(); ++i)
+      block[i] = (char)(i * 131 + 7);
+    for (long long i = 0; i < files; ++i) {
+      fs::path sub = source / (L"d" + std::to_wstring(i / perDir));
+      if (i % perDir == 0)
+        fs::create_directories(sub);
+      std::ofstream out(sub / (L"f" + std::to_wstring(i % perDir)),
+                        std::ios::binary);
+      for (long long left = sizeKb * 1024; left > 0;) {
+        std::streamsize n = (std::streamsize)std::min<long long>(
+            left, (long long)block.size());
+        block[0] = (char)i; // Files differ from each other
+        out.write(block.data(), n);
+        left -= n;
+      }
+    }
+    std::ofstream(root / L"complete");
+    std::wcout << L"Created in " << SecondsSince(start) << L" s" << std::endl;
+  }
+
+  // Engine diagnostics only: devices, copy backend, io_uring stats, errors.
+  class BenchLogger : public IBackupLogger {
+  public:
+    void Log(const std::wstring &message) override {
+      std::wstringstream lines(message);
+      std::wstring line;
+      while (std::getline(lines, line)) {
+        if (line.find(L" device ") != std::wstring::npos ||
+            line.rfind(L"Copy backend", 0) == 0 ||
+            line.rfind(L"io_uring", 0) == 0 ||
+            line.find(L"Error") != std::wstring::npos ||
+            line.find(L"FAILED") != std::wstring::npos)
+          std::wcout << L"  " << line << std::endl;
+      }
+    }
+    void OnFileAction(const std::wstring &, const std::wstring &) override {}
+    void OnProgress(const std::wstring &) override {}
+    void OnProgressDetailed(const TaskProgress &) override {}
+    void OnWorkerProgress(int, const std::wstring &, int) override {}
+  };
+
+  auto run = [&](const wchar_t *label, IBackupStrategy &strategy) {
+    std::error_code ec;
+    fs::remove_all(target, ec);
+    BackupTask task;
+    task.name = label;
+    task.sourcePath = source.wstring();
+    task.targetPath = target.wstring();
+    task.mode = BackupMode::Copy;
+    task.verify = false;
+    task.workerCount = workers;
+    BenchLogger logger;
+#ifndef _WIN32
+    // Write back the previous run's target (and its removal) first, so each
+    // engine starts from the same dirty-page state.
+    ::sync();
+#endif
+    auto start = std::chrono::steady_clock::now();
+    strategy.Execute(task, &logger, false);
+    double secs = SecondsSince(start);
+    if (secs <= 0)
+      secs = 1e-9;
+    long long copiedFiles = 0, copiedBytes = 0;
+    BackupUtils::ScanSource(target, copiedFiles, copiedBytes);
+    std::wcout << label << L": " << secs << L" s  ("
+               << (long long)(copiedFiles / secs) << L" files/s, "
+               << (long long)(copiedBytes / secs / (1024 * 1024)) << L" MB/s)"
+               << (copiedFiles == files ? L"" : L"  INCOMPLETE COPY!")
+               << std::endl;
+  };
+
+  {
+    ParallelBackupStrategy strategy;
+    run(L"Parallel", strategy);
+  }
+  {
+    PipelineBackupStrategy strategy;
+    run(L"Pipeline, copy threads", strategy);
+  }
+  {
+    PipelineBackupStrategy strategy(
+        PipelineBackupStrategy::CopyBackend::IoUring);
+    run(L"Pipeline, io_uring", strategy);
+  }
+  std::error_code ec;
+  fs::remove_all(target, ec);
+}
+
+// Logging throughput of engine-like producers: each thread logs a line and
+// a worker progress update per file, once straight into a file logger
+// behind a mutex (the way SafeLog drives WindowLogger) and once through a
+// LogPipeline in front of the same logger.
+void BenchLogging(const fs::path &dir, int threads, long long lines) {
+  if (threads <= 0)
+    threads = (int)std::max(1u, std::thread::hardware_concurrency());
+  const long long perThread = std::max(1LL, lines / threads);
+  lines = perThread * threads;
+  fs::path file = dir / L"surebackup_log_bench.txt";
+  std::wcout << L"\n--- Logging benchmark: " << lines << L" lines from "
+             << threads << L" threads into " << file.wstring() << L" ---"
+             << std::endl;
+  fs::create_directories(dir);
+  if (!HeadlessLogger(file).IsOpen()) {
+    std::wcout << L"Cannot open " << file.wstring() << std::endl;
+    return;
+  }
+
+  auto produce = [&](IBackupLogger &logger, std::mutex *serialize) {
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t) {
+      producers.emplace_back([&, t] {
+        for (long long i = 0; i < perThread; ++i) {
+          const std::wstring name = L"file" + std::to_wstring(i) + L".dat";
+          const std::wstring line = L"Copy: /data/src/dir" +
+                                    std::to_wstring(t) + L"/" + name +
+                                    L" -> /data/dst/dir" +
+                                    std::to_wstring(t) + L"/" + name;
+          std::unique_lock<std::mutex> lock;
+          if (serialize)
+            lock = std::unique_lock<std::mutex>(*serialize);
+          logger.Log(line);
+          logger.OnWorkerProgress(t, name, 100);
+        }
+      });
+    }
+    for (auto &producer : producers)
+      producer.join();
+  };
+  auto report = [&](const wchar_t *label, double secs,
+                    const HeadlessLogger &sink) {
+    if (secs <= 0)
+      secs = 1e-9;
+    std::wcout << label << L": " << secs << L" s  ("
+               << (long long)(lines / secs) << L" lines/s), " << sink.Writes()
+               << L" file writes, " << sink.ProgressUpdates()
+               << L" progress updates"
+               << (sink.Lines() == lines ? L"" : L"  LINES LOST!")
+               << std::endl;
+  };
+
+  {
+    HeadlessLogger sink(file);
+    std::mutex serialize;
+    auto start = std::chrono::steady_clock::now();
+    produce(sink, &serialize);
+    report(L"Direct, serialized", SecondsSince(start), sink);
+  }
+  {
+    HeadlessLogger sink(file);
+    auto start = std::chrono::steady_clock::now();
+    LogPipeline pipeline(&sink);
+    produce(pipeline, nullptr);
+    pipeline.Flush();
+    report(L"LogPipeline", SecondsSince(start), sink);
+    std::wcout << L"  " << pipeline.FormatStats() << std::endl;
+  }
+  std::error_code ec;
+  fs::remove(file, ec);
+}
+
+// Writes a run log of lines lines and archives it, the way WindowLogger used
+// to (flush per line, then copy to the archive) and through LogWriter (group
+// flushes, then rename), uncompressed and with each codec that can be
+// loaded.
+void BenchLogFile(const fs::path &dir, long long lines) {
+  fs::path live = dir / L"surebackup_logfile_bench.txt";
+  fs::path archive = dir / L"surebackup_logfile_bench_archive.txt";
+  std::wcout << L"\n--- Log file benchmark: " << lines << L" lines into "
+             << live.wstring() << L" ---" << std::endl;
+  fs::create_directories(dir);
+  auto line = [](long long i) {
+    const std::wstring name = L"file" + std::to_wstring(i) + L".dat";
+    return L"Copy: /data/src/dir" + std::to_wstring(i / 1000) + L"/" + name +
+           L" -> /data/dst/dir" + std::to_wstring(i / 1000) + L"/" + name;
+  };
+  auto report = [&](const wchar_t *label, double writeSecs,
+                    double finalizeSecs, const fs::path &file) {
+    std::error_code ec;
+    const long long size = (long long)fs::file_size(file, ec);
+    std::wcout << label << L": " << writeSecs << L" s writing ("
+               << (long long)(lines / std::max(writeSecs, 1e-9))
+               << L" lines/s), " << finalizeSecs << L" s archiving, "
+               << size / 1024 << L" KB" << std::endl;
+    fs::remove(file, ec);
+  };
+
+  {
+    auto start = std::chrono::steady_clock::now();
+    std::wofstream out(live, std::ios::out | std::ios::trunc);
+    for (long long i = 0; i < lines; ++i) {
+      out << line(i) << std::endl;
+      out.flush();
+    }
+    const double writeSecs = SecondsSince(start);
+    start = std::chrono::steady_clock::now();
+    out.close();
+    std::error_code ec;
+    fs::copy_file(live, archive, fs::copy_options::overwrite_existing, ec);
+    const double finalizeSecs = SecondsSince(start);
+    if (ec)
+      std::wcout << L"Flush per line + copy: " << ec.message().c_str()
+                 << std::endl;
+    else
+      report(L"Flush per line + copy", writeSecs, finalizeSecs, archive);
+    fs::remove(live, ec);
+  }
+
+  for (LogWriter::Compression codec :
+       {LogWriter::Compression::None, LogWriter::Compression::Zstd,
+        LogWriter::Compression::Lz4}) {
+    const wchar_t *label = codec == LogWriter::Compression::Zstd
+                               ? L"LogWriter, zstd"
+                           : codec == LogWriter::Compression::Lz4
+                               ? L"LogWriter, LZ4"
+                               : L"LogWriter";
+    if (!LogWriter::Available(codec)) {
+      std::wcout << label << L": library not found" << std::endl;
+      continue;
+    }
+    LogWriter::Options options;
+    options.compression = codec;
+    LogWriter writer(options);
+    const std::wstring ext = LogWriter::Extension(codec);
+    std::wstring error;
+    auto start = std::chrono::steady_clock::now();
+    if (!writer.Open(live.wstring() + ext, error)) {
+      std::wcout << label << L": " << error << std::endl;
+      continue;
+    }
+    for (long long i = 0; i < lines; ++i)
+      writer.Write(line(i));
+    writer.Flush();
+    const double writeSecs = SecondsSince(start);
+    start = std::chrono::steady_clock::now();
+    const fs::path target = archive.wstring() + ext;
+    if (!writer.Finalize(target, error))
+      std::wcout << L"  " << error << std::endl;
+    const double finalizeSecs = SecondsSince(start);
+    report(label, writeSecs, finalizeSecs, target);
+    std::wcout << L"  " << writer.FormatStats() << std::endl;
+  }
+  std::error_code ec;
+  for (const wchar_t *ext : {L"", L".zst", L".lz4"})
+    fs::remove(live.wstring() + ext, ec);
+}
+
+// Classifies synthetic paths against generated exclude rules, compiled into
+// one PathFilter and, on a sample as it is orders of magnitude slower, tried
+// one rule at a time. The rules mix names, extensions, anchored paths and
+// globs; about a fifth of the paths hit one.
+void BenchFilter(long long rules, long long paths) {
+  std::wcout << L"\n--- Filter benchmark: " << rules << L" rules, " << paths
+             << L" paths ---" << std::endl;
+  unsigned long long seed = 88172645463325252ULL;
+  auto next = [&](long long range) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (long long)(seed % (unsigned long long)range);
+  };
+
+  // Every rule names something of its own, so that each one can hit.
+  std::vector<std::wstring> ruleList;
+  for (long long i = 0; i < rules; ++i) {
+    const std::wstring n = std::to_wstring(i);
+    switch (i % 10) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+      ruleList.push_back(L"skip" + n);
+      break;
+    case 4:
+    case 5:
+    case 6:
+      ruleList.push_back(L"*.x" + n);
+      break;
+    case 7:
+    case 8:
+      ruleList.push_back(L"/p" + n + L"/out");
+      break;
+    default:
+      ruleList.push_back(i % 100 == 99 ? L"tmp" + n + L"*~"
+                                       : L"cache" + n + L"-*.log");
+    }
+  }
+  std::wstring joined;
+  for (const std::wstring &rule : ruleList)
+    joined += rule + L";";
+
+  auto start = std::chrono::steady_clock::now();
+  PathFilter filter;
+  std::wstring error;
+  if (!filter.Compile(joined, error)) {
+    std::wcout << error << std::endl;
+    return;
+  }
+  std::wcout << L"Compile: " << SecondsSince(start) << L" s, "
+             << filter.FormatStats() << std::endl;
+
+  // p<k>/d<j>/.../<leaf>; one path in five is made to hit rule r.
+  std::vector<fs::path> pathList;
+  std::vector<BackupUtils::FileSnapshot> infos;
+  pathList.reserve((size_t)paths);
+  infos.reserve((size_t)paths);
+  for (long long i = 0; i < paths; ++i) {
+    const long long r = next(rules);
+    const bool hit = next(5) == 0;
+    std::wstring path = L"p" + std::to_wstring(next(rules));
+    for (long long depth = 1 + next(4); depth > 0; --depth)
+      path += L"/d" + std::to_wstring(next(1000));
+    std::wstring leaf = L"file" + std::to_wstring(i) + L".dat";
+    if (hit) {
+      const std::wstring n = std::to_wstring(r);
+      switch (r % 10) {
+      case 0:
+    case 1:
+    case 2:
+    case 3:
+        leaf = L"skip" + n;
+        break;
+      case 4:
+    case 5:
+    case 6:
+        leaf = L"file" + std::to_wstring(i) + L".x" + n;
+        break;
+      case 7:
+    case 8:
+        path = L"p" + n;
+        leaf = L"out";
+        break;
+      default:
+        leaf = r % 100 == 99 ? L"tmp" + n + L"old~"
+                             : L"cache" + n + L"-" + std::to_wstring(i) +
+                                   L".log";
+      }
+    }
+    pathList.push_back(fs::path(path + L"/" + leaf));
+    BackupUtils::FileSnapshot info;
+    info.type = BackupUtils::FileSnapshot::Type::File;
+    info.size = 4096;
+    infos.push_back(info);
+  }
+
+  start = std::chrono::steady_clock::now();
+  long long excluded = 0;
+  for (size_t i = 0; i < pathList.size(); ++i)
+    if (filter.Excludes(pathList[i], infos[i]))
+      excluded++;
+  double secs = std::max(SecondsSince(start), 1e-9);
+  std::wcout << L"Compiled: " << secs << L" s  ("
+             << (long long)(paths / secs) << L" paths/s, "
+             << (long long)(secs * 1e9 / std::max(paths, 1LL))
+             << L" ns/path), " << excluded << L" excluded" << std::endl;
+
+  // One rule at a time, the way a list of patterns is usually checked.
+  std::vector<std::unique_ptr<PathFilter>> single;
+  for (const std::wstring &rule : ruleList) {
+    single.push_back(std::make_unique<PathFilter>());
+    single.back()->Compile(rule, error);
+  }
+  const size_t sample = (size_t)std::min(paths, 2000LL);
+  long long sampleExcluded = 0, disagree = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < sample; ++i) {
+    bool hit = false;
+    for (const auto &one : single)
+      if (one->Excludes(pathList[i], infos[i])) {
+        hit = true;
+        break;
+      }
+    if (hit)
+      sampleExcluded++;
+    if (hit != filter.Excludes(pathList[i], infos[i]))
+      disagree++;
+  }
+  secs = std::max(SecondsSince(start), 1e-9);
+  std::wcout << L"Rule by rule (" << sample << L" paths): " << secs
+             << L" s  (" << (long long)(sample / secs) << L" paths/s), "
+             << sampleExcluded << L" excluded"
+             << (disagree ? L"  RESULTS DIFFER: " + std::to_wstring(disagree)
+                          : L"")
+             << std::endl;
+}
+
+// Prints how the engine classifies the device behind each path and how many
+// transfers it will run on it at once.
+void ShowDevices(const std::vector<std::wstring> &paths) {
+  DevicePools pools;
+  for (const auto &path : paths) {
+    DevicePools::Device *device = pools.Register(path);
+    std::wcout << path << L"\n  " << device->Profile().key << L" - "
+               << device->Describe() << std::endl;
+  }
+}
+
+int RunConsole(const std::vector<std::wstring> &args) {
+  // ConsoleTester --bench-walk <dir> [threads]
+  if (args.size() >= 3 && args[1] == L"--bench-walk") {
+    BenchEnumeration(args[2],
+                     args.size() >= 4 ? (int)std::wcstol(args[3].c_str(),
+                                                          nullptr, 10)
+                                      : 0);
+    return 0;
+  }
+  // ConsoleTester --bench-sched <dir> [files] [threads]
+  if (args.size() >= 3 && args[1] == L"--bench-sched") {
+    BenchScheduler(args[2],
+                   args.size() >= 4 ? std::wcstoll(args[3].c_str(), nullptr, 10)
+                                    : 1000000,
+                   args.size() >= 5 ? (int)std::wcstol(args[4].c_str(),
+                                                        nullptr, 10)
+                                    : 0);
+    return 0;
+  }
+  // ConsoleTester --bench-copy <dir> [sizeMB]
+  if (args.size() >= 3 && args[1] == L"--bench-copy") {
+    BenchCopy(args[2], args.size() >= 4
+                           ? std::wcstoll(args[3].c_str(), nullptr, 10)
+                           : 1024);
+    return 0;
+  }
+
+  // ConsoleTester --bench-compare <dir> [sizeMB]
+  if (args.size() >= 3 && args[1] == L"--bench-compare") {
+    BenchCompare(args[2], args.size() >= 4
+                              ? std::wcstoll(args[3].c_str(), nullptr, 10)
+                              : 1024);
+    return 0;
+  }
+
+  // ConsoleTester --bench-engines <dir> [files] [sizeKB] [workers]
+  if (args.size() >= 3 && args[1] == L"--bench-engines") {
+    BenchEngines(args[2],
+                 args.size() >= 4 ? std::wcstoll(args[3].c_str(), nullptr, 10)
+                                  : 1000000,
+                 args.size() >= 5 ? std::wcstoll(args[4].c_str(), nullptr, 10)
+                                  : 4,
+                 args.size() >= 6 ? (int)std::wcstol(args[5].c_str(),
+                                                      nullptr, 10)
+                                  : 8);
+    return 0;
+  }
+
+  // ConsoleTester --bench-log <dir> [threads] [lines]
+  if (args.size() >= 3 && args[1] == L"--bench-log") {
+    BenchLogging(args[2],
+                 args.size() >= 4 ? (int)std::wcstol(args[3].c_str(),
+                                                      nullptr, 10)
+                                  : 0,
+                 args.size() >= 5 ? std::wcstoll(args[4].c_str(), nullptr, 10)
+                                  : 1000000);
+    return 0;
+  }
+
+  // ConsoleTester --bench-logfile <dir> [lines]
+  if (args.size() >= 3 && args[1] == L"--bench-logfile") {
+    BenchLogFile(args[2], args.size() >= 4
+                              ? std::wcstoll(args[3].c_str(), nullptr, 10)
+                              : 1000000);
+    return 0;
+  }
+
+  // ConsoleTester --bench-filter [rules] [paths]
+  if (args.size() >= 2 && args[1] == L"--bench-filter") {
+    BenchFilter(args.size() >= 3 ? std::wcstoll(args[2].c_str(), nullptr, 10)
+                                 : 10000,
+                args.size() >= 4 ? std::wcstoll(args[3].c_str(), nullptr, 10)
+                                 : 1000000);
+    return 0;
+  }
+
+  // ConsoleTester --devices <path>...
+  if (args.size() >= 3 && args[1] == L"--devices") {
+    ShowDevices(std::vector<std::wstring>(args.begin() + 2, args.end()));
+    return 0;
+  }
 
   std::wcout << L"SureBackup Engine Console Tester" << std::endl;
   std::wcout << L"===============================" << std::endl;
@@ -86,3 +978,18 @@ int main() {
   std::cin.get();
   return 0;
 }
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t *argv[]) {
+  _setmode(_fileno(stdout), _O_U16TEXT);
+  return RunConsole(std::vector<std::wstring>(argv, argv + argc));
+}
+#else
+int main(int argc, char *argv[]) {
+  std::setlocale(LC_ALL, "");
+  std::vector<std::wstring> args;
+  for (int i = 0; i < argc; ++i)
+    args.push_back(fs::path(argv[i]).wstring());
+  return RunConsole(args);
+}
+#endif
@@ -11,6 +11,7 @@ enum class StrId {
   Menu_RunSet,
   Menu_Preview,
   Menu_Verify,
+  Menu_ApplyPlan,
   Menu_Log,
   Menu_LogHistory,
   Menu_Help,
@@ -69,6 +70,9 @@ enum class StrId {
   Dlg_Time_Title,
   Dlg_Day_Title,
   Dlg_Btn_SaveSet,
+  Dlg_SetUnitsAtOnce,
+  Dlg_SetMaxThreads,
+  Dlg_SetInFlightMB,
 
   Main_Stop,
   Main_MaxLog,
@@ -89,6 +93,15 @@ enum class StrId {
   Eng_Blk,
   Eng_Vss,
   Eng_Cmp,
+  Eng_Pipe,
+  Eng_Uring,
+  Dlg_Catalog,
+  Dlg_CatalogInTarget,
+  Dlg_Workers,
+  Dlg_WorkersAdaptive,
+  Cat_Off,
+  Cat_Record,
+  Cat_Trust,
   Err_SamePath,
   Err_AlreadyRunning,
   Ctx_SetAsSource,
@@ -132,6 +145,7 @@ public:
           {StrId::Menu_RunSet, L"バックアップ実行"},
           {StrId::Menu_Preview, L"プレビュー (Dry Run)"},
           {StrId::Menu_Verify, L"整合性チェック (Verify)"},
+          {StrId::Menu_ApplyPlan, L"プレビューの計画を実行"},
           {StrId::Menu_Help, L"ヘルプ"},
           {StrId::Menu_About, L"SureBackupについて"},
           {StrId::Menu_Set, L"セット"},
@@ -183,6 +197,9 @@ public:
           {StrId::Dlg_Time_Title, L"実行時刻 (HH:MM):"},
           {StrId::Dlg_Day_Title, L"実行曜日 (毎週):"},
           {StrId::Dlg_Btn_SaveSet, L"セットを保存"},
+          {StrId::Dlg_SetUnitsAtOnce, L"同時実行ユニット数:"},
+          {StrId::Dlg_SetMaxThreads, L"最大スレッド数:"},
+          {StrId::Dlg_SetInFlightMB, L"同時転送量上限 MB (0 = 無制限):"},
 
           {StrId::Main_Stop, L"全てのタスクを停止"},
           {StrId::Main_MaxLog, L"ログを最大化"},
@@ -203,6 +220,15 @@ public:
           {StrId::Eng_Blk, L"ブロッククローン (差分同期)"},
           {StrId::Eng_Vss, L"VSS (スナップショット)"},
           {StrId::Eng_Cmp, L"比較エンジン (整合性チェック)"},
+          {StrId::Eng_Pipe, L"パイプライン (段階並列)"},
+          {StrId::Eng_Uring, L"非同期 I/O (io_uring, Linux)"},
+          {StrId::Dlg_Catalog, L"ターゲットカタログ:"},
+          {StrId::Dlg_CatalogInTarget, L"カタログをバックアップ先フォルダに保存"},
+          {StrId::Dlg_Workers, L"ワーカー数:"},
+          {StrId::Dlg_WorkersAdaptive, L"スループットに応じて自動調整"},
+          {StrId::Cat_Off, L"使用しない"},
+          {StrId::Cat_Record, L"記録のみ"},
+          {StrId::Cat_Trust, L"カタログを信頼 (高速)"},
           {StrId::Err_SamePath,
            L"エラー: "
            L"ソースとターゲットに同じフォルダを指定することはできません。"},
@@ -248,6 +274,7 @@ public:
           {StrId::Menu_RunSet, L"Ejecutar Conjunto de Respaldo"},
           {StrId::Menu_Preview, L"Vista Previa de Respaldo (Simulación)"},
           {StrId::Menu_Verify, L"Verificar Integridad"},
+          {StrId::Menu_ApplyPlan, L"Aplicar Plan de la Vista Previa"},
           {StrId::Menu_Help, L"Ayuda"},
           {StrId::Menu_About, L"Acerca de SureBackup"},
           {StrId::Menu_Set, L"Conjunto"},
@@ -297,6 +324,10 @@ public:
           {StrId::Dlg_Time_Title, L"Hora de Ejecución (HH:MM):"},
           {StrId::Dlg_Day_Title, L"Día Activo (Semanal):"},
           {StrId::Dlg_Btn_SaveSet, L"GUARDAR CONJUNTO DE RESPALDO"},
+          {StrId::Dlg_SetUnitsAtOnce, L"Unidades a la vez:"},
+          {StrId::Dlg_SetMaxThreads, L"Hilos máximos:"},
+          {StrId::Dlg_SetInFlightMB,
+           L"MB en curso como máximo (0 = sin límite):"},
 
           {StrId::Main_Stop, L"DETENER TODAS LAS TAREAS"},
           {StrId::Main_MaxLog, L"MAXIMIZAR VISTA DE REGISTRO"},
@@ -317,6 +348,16 @@ public:
           {StrId::Eng_Blk, L"Clon de Bloques (Sincronización Delta)"},
           {StrId::Eng_Vss, L"VSS (Copia instantánea)"},
           {StrId::Eng_Cmp, L"Motor de Comparación (Verificación)"},
+          {StrId::Eng_Pipe, L"Motor en Cadena (Etapas Paralelas)"},
+          {StrId::Eng_Uring, L"E/S Asíncrona (io_uring, Linux)"},
+          {StrId::Dlg_Catalog, L"Catálogo de destino:"},
+          {StrId::Dlg_CatalogInTarget,
+           L"Guardar el catálogo en la carpeta de destino"},
+          {StrId::Dlg_Workers, L"Trabajadores:"},
+          {StrId::Dlg_WorkersAdaptive, L"Ajustar según el rendimiento medido"},
+          {StrId::Cat_Off, L"Desactivado"},
+          {StrId::Cat_Record, L"Solo registrar"},
+          {StrId::Cat_Trust, L"Confiar en el catálogo (rápido)"},
           {StrId::Err_SamePath,
            L"Error: Las carpetas de origen y destino no pueden ser idénticas."},
           {StrId::Err_AlreadyRunning,
@@ -366,6 +407,7 @@ public:
           {StrId::Menu_RunSet, L"Exécuter l'Ensemble de Sauvegarde"},
           {StrId::Menu_Preview, L"Aperçu de Sauvegarde (Simulation)"},
           {StrId::Menu_Verify, L"Vérifier l'Intégrité"},
+          {StrId::Menu_ApplyPlan, L"Appliquer le Plan de l'Aperçu"},
           {StrId::Menu_Help, L"Aide"},
           {StrId::Menu_About, L"À propos de SureBackup"},
           {StrId::Menu_Set, L"Ensemble"},
@@ -417,6 +459,10 @@ public:
           {StrId::Dlg_Time_Title, L"Heure d'Exécution (HH:MM):"},
           {StrId::Dlg_Day_Title, L"Jour Actif (Hebdomadaire):"},
           {StrId::Dlg_Btn_SaveSet, L"ENREGISTRER L'ENSEMBLE"},
+          {StrId::Dlg_SetUnitsAtOnce, L"Unités simultanées :"},
+          {StrId::Dlg_SetMaxThreads, L"Threads max :"},
+          {StrId::Dlg_SetInFlightMB,
+           L"Mo en cours au maximum (0 = illimité) :"},
 
           {StrId::Main_Stop, L"ARRÊTER TOUTES LES TÂCHES"},
           {StrId::Main_MaxLog, L"MAXIMISER LA VUE DU JOURNAL"},
@@ -437,6 +483,16 @@ public:
           {StrId::Eng_Blk, L"Clone de Bloc (Synchro Delta)"},
           {StrId::Eng_Vss, L"VSS (Instantané)"},
           {StrId::Eng_Cmp, L"Moteur de Comparaison (Vérification)"},
+          {StrId::Eng_Pipe, L"Moteur Pipeline (Étapes Parallèles)"},
+          {StrId::Eng_Uring, L"E/S Asynchrones (io_uring, Linux)"},
+          {StrId::Dlg_Catalog, L"Catalogue de destination:"},
+          {StrId::Dlg_CatalogInTarget,
+           L"Stocker le catalogue dans le dossier de destination"},
+          {StrId::Dlg_Workers, L"Threads :"},
+          {StrId::Dlg_WorkersAdaptive, L"Ajuster selon le débit mesuré"},
+          {StrId::Cat_Off, L"Désactivé"},
+          {StrId::Cat_Record, L"Enregistrer seulement"},
+          {StrId::Cat_Trust, L"Faire confiance au catalogue (rapide)"},
           {StrId::Err_SamePath, L"Erreur: Les dossiers source et cible ne "
                                 L"peuvent pas être identiques."},
           {StrId::Err_AlreadyRunning, L"Une sauvegarde est déjà en cours."},
@@ -480,6 +536,7 @@ public:
           {StrId::Menu_RunSet, L"Backup-Set Ausführen"},
           {StrId::Menu_Preview, L"Backup-Vorschau (Simulation)"},
           {StrId::Menu_Verify, L"Integrität Prüfen"},
+          {StrId::Menu_ApplyPlan, L"Vorschau-Plan Ausführen"},
           {StrId::Menu_Help, L"Hilfe"},
           {StrId::Menu_About, L"Über SureBackup"},
           {StrId::Menu_Set, L"Set"},
@@ -531,6 +588,10 @@ public:
           {StrId::Dlg_Time_Title, L"Ausführungszeit (HH:MM):"},
           {StrId::Dlg_Day_Title, L"Aktiver Tag (Wöchentlich):"},
           {StrId::Dlg_Btn_SaveSet, L"BACKUP-SET SPEICHERN"},
+          {StrId::Dlg_SetUnitsAtOnce, L"Einheiten gleichzeitig:"},
+          {StrId::Dlg_SetMaxThreads, L"Max. Threads:"},
+          {StrId::Dlg_SetInFlightMB,
+           L"Max. MB gleichzeitig in Arbeit (0 = unbegrenzt):"},
 
           {StrId::Main_Stop, L"ALLE AUFGABEN STOPPEN"},
           {StrId::Main_MaxLog, L"PROTOKOLL-ANSICHT MAXIMIEREN"},
@@ -551,6 +612,15 @@ public:
           {StrId::Eng_Blk, L"Block-Klon (Delta-Synchro)"},
           {StrId::Eng_Vss, L"VSS (Snapshot-Kopie)"},
           {StrId::Eng_Cmp, L"Vergleichs-Engine (Prüfung)"},
+          {StrId::Eng_Pipe, L"Pipeline-Engine (Parallele Stufen)"},
+          {StrId::Eng_Uring, L"Asynchrone E/A (io_uring, Linux)"},
+          {StrId::Dlg_Catalog, L"Zielkatalog:"},
+          {StrId::Dlg_CatalogInTarget, L"Katalog im Zielordner speichern"},
+          {StrId::Dlg_Workers, L"Worker:"},
+          {StrId::Dlg_WorkersAdaptive, L"An gemessenen Durchsatz anpassen"},
+          {StrId::Cat_Off, L"Aus"},
+          {StrId::Cat_Record, L"Nur aufzeichnen"},
+          {StrId::Cat_Trust, L"Katalog vertrauen (schnell)"},
           {StrId::Err_SamePath,
            L"Fehler: Quell- und Zielpfad dürfen nicht identisch sein."},
           {StrId::Err_AlreadyRunning, L"Sicherung läuft bereits."},
@@ -594,6 +664,7 @@ public:
           {StrId::Menu_RunSet, L"Run Backup Set"},
           {StrId::Menu_Preview, L"Backup Preview (Dry Run)"},
           {StrId::Menu_Verify, L"Verify (Check Integrity)"},
+          {StrId::Menu_ApplyPlan, L"Apply Preview Plan"},
           {StrId::Menu_Help, L"Help"},
           {StrId::Menu_About, L"About SureBackup"},
           {StrId::Menu_Set, L"Set"},
@@ -660,6 +731,9 @@ public:
           {StrId::Dlg_Time_Title, L"Execution Time (HH:MM):"},
           {StrId::Dlg_Day_Title, L"Active Day (Weekly):"},
           {StrId::Dlg_Btn_SaveSet, L"SAVE BACKUP SET"},
+          {StrId::Dlg_SetUnitsAtOnce, L"Units at once:"},
+          {StrId::Dlg_SetMaxThreads, L"Max threads:"},
+          {StrId::Dlg_SetInFlightMB, L"Max MB in flight (0 = no limit):"},
 
           {StrId::Main_Stop, L"STOP ALL TASKS"},
           {StrId::Main_MaxLog, L"MAXIMIZE LOG VIEW"},
@@ -680,6 +754,15 @@ public:
           {StrId::Eng_Blk, L"Block Clone (Delta Sync)"},
           {StrId::Eng_Vss, L"VSS (Snapshot Copy)"},
           {StrId::Eng_Cmp, L"Comparison Engine (Verify)"},
+          {StrId::Eng_Pipe, L"Pipeline Engine (Staged)"},
+          {StrId::Eng_Uring, L"Async I/O Engine (io_uring, Linux)"},
+          {StrId::Dlg_Catalog, L"Target Catalog:"},
+          {StrId::Dlg_CatalogInTarget, L"Store catalog in the target folder"},
+          {StrId::Dlg_Workers, L"Workers:"},
+          {StrId::Dlg_WorkersAdaptive, L"Adapt to measured throughput"},
+          {StrId::Cat_Off, L"Off"},
+          {StrId::Cat_Record, L"Record only"},
+          {StrId::Cat_Trust, L"Trust catalog (fast)"},
           {StrId::Err_SamePath,
            L"Error: Source and target folders cannot be identical."},
           {StrId::Err_AlreadyRunning, L"A backup is already running."},
@@ -0,0 +1,352 @@
+#include "SetScheduler.h"
+#include "Strategies/BackupUtils.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+struct SetScheduler::Unit {
+  enum class State { Pending, Running, Done };
+
+  SetJob job;
+  BackupUtils::DeviceProfile sourceDevice;
+  BackupUtils::DeviceProfile targetDevice;
+  State state = State::Pending;
+  std::unique_ptr<UnitLogger> logger;
+  std::unique_ptr<BackupEngine> engine;
+  std::vector<int> slots; // Pool slot of each of the unit's workers
+  TaskProgress progress;
+  ProgressRates rates;   // Zero once the unit is done
+  bool reported = false; // Progress has been seen; guarded like progress
+  bool hasRates = false; // The engine reports aggregated progress
+  std::chrono::steady_clock::time_point started;
+  std::thread thread;
+
+  // Flash devices take concurrent units; their DevicePools slots keep the
+  // queue depth in check.
+  bool SharesDevice(const Unit &other) const {
+    auto same = [](const BackupUtils::DeviceProfile &a,
+                   const BackupUtils::DeviceProfile &b) {
+      return !a.key.empty() && a.key == b.key &&
+             a.kind != BackupUtils::DeviceProfile::Kind::Flash;
+    };
+    return same(sourceDevice, other.sourceDevice) ||
+           same(sourceDevice, other.targetDevice) ||
+           same(targetDevice, other.sourceDevice) ||
+           same(targetDevice, other.targetDevice);
+  }
+};
+
+// What a unit's engine sees as its logger.
+class SetScheduler::UnitLogger : public IBackupLogger {
+public:
+  UnitLogger(SetScheduler *owner, Unit *unit) : m_owner(owner), m_unit(unit) {}
+
+  void Log(const std::wstring &message) override {
+    const std::wstring line = L"[" + m_unit->job.task.name + L"] " + message;
+    std::lock_guard<std::mutex> lock(m_owner->m_logMutex);
+    m_owner->m_logger->Log(line);
+  }
+  void OnFileAction(const std::wstring &action,
+                    const std::wstring &path) override {
+    std::lock_guard<std::mutex> lock(m_owner->m_logMutex);
+    m_owner->m_logger->OnFileAction(action, path);
+  }
+  void OnProgress(const std::wstring &path) override {
+    std::lock_guard<std::mutex> lock(m_owner->m_logMutex);
+    m_owner->m_logger->OnProgress(path);
+  }
+  void OnProgressDetailed(const TaskProgress &progress) override {
+    m_owner->UnitProgress(*m_unit, progress, nullptr);
+  }
+  void OnAggregatedProgress(const TaskProgress &progress,
+                            const ProgressRates &rates) override {
+    m_owner->UnitProgress(*m_unit, progress, &rates);
+  }
+  void OnWorkerProgress(int workerId, const std::wstring &file,
+                        int percent) override {
+    if (workerId >= 0 && workerId < (int)m_unit->slots.size()) {
+      std::lock_guard<std::mutex> lock(m_owner->m_logMutex);
+      m_owner->m_logger->OnWorkerProgress(m_unit->slots[workerId], file,
+                                          percent);
+    }
+  }
+  // The scheduler announced the set-wide pool; the unit's workers map onto
+  // its slots.
+  void OnWorkersStarted(int /*count*/) override {}
+
+private:
+  SetScheduler *m_owner;
+  Unit *m_unit;
+};
+
+SetScheduler::SetScheduler(IBackupLogger *logger, const SetBudget &budget)
+    : m_logger(logger), m_budget(budget),
+      m_devicePools(std::make_shared<DevicePools>()) {
+  m_budget.maxConcurrentUnits = std::max(1, m_budget.maxConcurrentUnits);
+  m_budget.maxThreads = std::max(1, m_budget.maxThreads);
+  if (m_budget.maxInFlightBytes > 0)
+    m_ioBudget = std::make_shared<IoBudget>(m_budget.maxInFlightBytes);
+}
+
+SetScheduler::~SetScheduler() {
+  for (auto &unit : m_units)
+    if (unit->thread.joinable())
+      unit->thread.join();
+}
+
+void SetScheduler::Run(std::vector<SetJob> jobs, bool dryRun) {
+  m_aborted = false;
+  for (auto &job : jobs) {
+    job.task.ioBudget = m_ioBudget;
+    job.task.devicePools = m_devicePools;
+    job.task.IsAborted = [this]() { return m_aborted.load(); };
+  }
+  if (m_budget.maxConcurrentUnits <= 1 || jobs.size() <= 1)
+    RunSerial(jobs, dryRun);
+  else
+    RunConcurrent(jobs, dryRun);
+}
+
+void SetScheduler::Abort() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_aborted = true;
+  if (m_serialEngine)
+    m_serialEngine->Abort();
+  for (auto &unit : m_units)
+    if (unit->state == Unit::State::Running)
+      unit->engine->Abort();
+}
+
+void SetScheduler::CancelWorker(int index) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_serialEngine) {
+    m_serialEngine->CancelWorker(index);
+    return;
+  }
+  for (auto &unit : m_units) {
+    if (unit->state != Unit::State::Running)
+      continue;
+    auto it = std::find(unit->slots.begin(), unit->slots.end(), index);
+    if (it != unit->slots.end())
+      unit->engine->CancelWorker((int)(it - unit->slots.begin()));
+  }
+}
+
+// One unit after another on the calling thread, straight into the set's
+// logger, as a set has always run.
+void SetScheduler::RunSerial(std::vector<SetJob> &jobs, bool dryRun) {
+  BackupEngine engine(m_logger);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_serialEngine = &engine;
+  }
+  for (auto &job : jobs) {
+    if (m_aborted)
+      break;
+    engine.SetStrategy(job.makeStrategy());
+    engine.Run(job.task, dryRun);
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_serialEngine = nullptr;
+}
+
+void SetScheduler::RunConcurrent(std::vector<SetJob> &jobs, bool dryRun) {
+  auto setStart = std::chrono::steady_clock::now();
+  int poolSize = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_units.clear();
+    for (auto &job : jobs) {
+      auto unit = std::make_unique<Unit>();
+      // No unit may need more threads than the whole budget.
+      job.threads = std::min(std::max(1, job.threads), m_budget.maxThreads);
+      job.task.workerCount = std::min(job.task.workerCount, job.threads);
+      unit->sourceDevice = BackupUtils::ProbeDevice(job.task.sourcePath);
+      unit->targetDevice = BackupUtils::ProbeDevice(job.task.targetPath);
+      unit->job = std::move(job);
+      unit->logger = std::make_unique<UnitLogger>(this, unit.get());
+      poolSize += unit->job.threads;
+      m_units.push_back(std::move(unit));
+    }
+    poolSize = std::min(poolSize, m_budget.maxThreads);
+    m_slotBusy.assign(poolSize, false);
+    m_running = 0;
+    m_threadsInUse = 0;
+    m_peakRunning = 0;
+  }
+
+  if (m_logger) {
+    m_logger->Log(L"Set run: " + std::to_wstring(m_units.size()) +
+                  L" units, up to " +
+                  std::to_wstring(m_budget.maxConcurrentUnits) +
+                  L" at once, " + std::to_wstring(poolSize) +
+                  L" worker threads" +
+                  (m_ioBudget ? L", " +
+                                    std::to_wstring(m_ioBudget->Capacity() /
+                                                    (1024 * 1024)) +
+                                    L" MB in flight"
+                              : L""));
+    m_logger->OnWorkersStarted(poolSize);
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      if (!m_aborted) {
+        for (size_t i = 0; i < m_units.size(); ++i)
+          if (CanStart(i))
+            Start(i, dryRun);
+      }
+      bool pending = false;
+      for (auto &unit : m_units)
+        pending |= unit->state == Unit::State::Pending;
+      if (m_running == 0 && (!pending || m_aborted))
+        break;
+      m_cv.wait(lock);
+    }
+  }
+  for (auto &unit : m_units)
+    if (unit->thread.joinable())
+      unit->thread.join();
+
+  if (m_logger) {
+    std::wstringstream ss;
+    ss << L"Set run finished in "
+       << (long long)std::chrono::duration<double>(
+              std::chrono::steady_clock::now() - setStart)
+              .count()
+       << L" s, up to " << m_peakRunning << L" units at once";
+    if (m_ioBudget)
+      ss << L", peak " << m_ioBudget->Peak() / (1024 * 1024)
+         << L" MB in flight";
+    m_logger->Log(ss.str());
+  }
+}
+
+// Called with m_mutex held.
+bool SetScheduler::CanStart(size_t index) const {
+  const Unit &unit = *m_units[index];
+  if (unit.state != Unit::State::Pending)
+    return false;
+  if (m_running >= m_budget.maxConcurrentUnits)
+    return false;
+  if (m_threadsInUse + unit.job.threads > (int)m_slotBusy.size())
+    return false;
+  for (size_t i = 0; i < m_units.size(); ++i) {
+    const Unit &other = *m_units[i];
+    bool blocks = other.state == Unit::State::Running ||
+                  (other.state == Unit::State::Pending && i < index);
+    if (i != index && blocks && unit.SharesDevice(other))
+      return false;
+  }
+  return true;
+}
+
+// Called with m_mutex held.
+void SetScheduler::Start(size_t index, bool dryRun) {
+  Unit &unit = *m_units[index];
+  unit.slots.clear();
+  for (int slot = 0; slot < (int)m_slotBusy.size() &&
+                     (int)unit.slots.size() < unit.job.threads;
+       ++slot) {
+    if (!m_slotBusy[slot]) {
+      m_slotBusy[slot] = true;
+      unit.slots.push_back(slot);
+    }
+  }
+  unit.state = Unit::State::Running;
+  unit.started = std::chrono::steady_clock::now();
+  m_running++;
+  m_threadsInUse += unit.job.threads;
+  m_peakRunning = std::max(m_peakRunning, m_running);
+
+  unit.engine = std::make_unique<BackupEngine>(unit.logger.get());
+  unit.engine->SetStrategy(unit.job.makeStrategy());
+  unit.thread = std::thread([this, &unit, dryRun]() {
+    try {
+      unit.engine->Run(unit.job.task, dryRun);
+    } catch (const std::exception &e) {
+      std::string what = e.what();
+      unit.logger->Log(L"Unit failed: " +
+                       std::wstring(what.begin(), what.end()));
+    }
+    Finished(unit);
+  });
+}
+
+void SetScheduler::Finished(Unit &unit) {
+  TaskProgress progress;
+  {
+    std::lock_guard<std::mutex> lock(m_progressMutex);
+    unit.reported = true;
+    unit.rates = ProgressRates();
+    progress = unit.progress;
+  }
+  if (m_logger) {
+    std::wstringstream ss;
+    ss << L"[" << unit.job.task.name << L"] Unit finished in "
+       << (long long)std::chrono::duration<double>(
+              std::chrono::steady_clock::now() - unit.started)
+              .count()
+       << L" s: " << progress.processedFiles << L" files, "
+       << progress.processedBytes / (1024 * 1024) << L" MB";
+    std::lock_guard<std::mutex> lock(m_logMutex);
+    m_logger->Log(ss.str());
+    for (int slot : unit.slots)
+      m_logger->OnWorkerProgress(slot, L"Idle", 0);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    unit.state = Unit::State::Done;
+    for (int slot : unit.slots)
+      m_slotBusy[slot] = false;
+    m_running--;
+    m_threadsInUse -= unit.job.threads;
+  }
+  m_cv.notify_all();
+}
+
+void SetScheduler::UnitProgress(Unit &unit, const TaskProgress &progress,
+                                const ProgressRates *rates) {
+  if (!m_logger)
+    return;
+  std::lock_guard<std::mutex> lock(m_progressMutex);
+  unit.progress = progress;
+  unit.reported = true;
+  if (rates) {
+    unit.rates = *rates;
+    unit.hasRates = true;
+  }
+
+  // Units that have not reported yet add nothing, so the set totals stay
+  // provisional until every unit has.
+  TaskProgress set;
+  ProgressRates setRates; // Summed over the units, which run side by side
+  bool anyRates = false;
+  for (auto &other : m_units) {
+    const TaskProgress &p = other->progress;
+    set.totalFiles += p.totalFiles;
+    set.processedFiles += p.processedFiles;
+    set.totalBytes += p.totalBytes;
+    set.processedBytes += p.processedBytes;
+    set.isEstimate |= p.isEstimate || !other->reported;
+    const ProgressRates &r = other->rates;
+    setRates.currentBytesPerSecond += r.currentBytesPerSecond;
+    setRates.averageBytesPerSecond += r.averageBytesPerSecond;
+    setRates.currentFilesPerSecond += r.currentFilesPerSecond;
+    setRates.averageFilesPerSecond += r.averageFilesPerSecond;
+    setRates.elapsedSeconds =
+        std::max(setRates.elapsedSeconds, r.elapsedSeconds);
+    anyRates |= other->hasRates;
+  }
+  set.currentFile = L"[" + unit.job.task.name + L"] " + progress.currentFile;
+
+  std::lock_guard<std::mutex> logLock(m_logMutex);
+  m_logger->OnUnitProgress(unit.job.task.name, progress);
+  if (anyRates)
+    m_logger->OnAggregatedProgress(set, setRates);
+  else
+    m_logger->OnProgressDetailed(set);
+}
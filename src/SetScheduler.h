@@ -0,0 +1,87 @@
+#pragma once
+
+#include "BackupEngine.h"
+#include "Strategies/DevicePools.h"
+#include "Strategies/IoBudget.h"
+#include "Strategies/Types.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Limits for running the units of a backup set together.
+struct SetBudget {
+  int maxConcurrentUnits = 1; // 1 runs the units one after another
+  int maxThreads = 16;        // Worker threads of all running units together
+  long long maxInFlightBytes = 0; // Bytes being copied at once; 0 = no cap
+};
+
+// One unit of a set run: its task and the strategy that runs it.
+struct SetJob {
+  BackupTask task;
+  std::function<std::unique_ptr<IBackupStrategy>()> makeStrategy;
+  int threads = 1; // Worker threads the strategy uses (task.workerCount)
+};
+
+// Runs the units of a backup set.
+//
+// With maxConcurrentUnits above one, a unit starts as soon as its threads
+// fit the budget and it shares no rotational, network or unknown device
+// (BackupUtils::ProbeDevice of source or target) with a running unit or
+// with an earlier unit that is still waiting. Units on such a device thus
+// run one after another in set order, while units on separate disks overlap.
+// Units on a shared flash device run together and split its transfer slots
+// through the set's DevicePools. Every unit gets its own BackupEngine; a
+// per-unit logger prefixes its log lines with the unit name, maps its
+// workers onto slots of one set-wide worker pool, and feeds the per-unit and
+// summed set progress to the set's logger.
+class SetScheduler {
+public:
+  SetScheduler(IBackupLogger *logger, const SetBudget &budget);
+  ~SetScheduler();
+  SetScheduler(const SetScheduler &) = delete;
+  SetScheduler &operator=(const SetScheduler &) = delete;
+
+  void Run(std::vector<SetJob> jobs, bool dryRun);
+
+  void Abort();
+  bool IsAborted() const { return m_aborted; }
+  // Worker index as reported to the logger (a pool slot in concurrent runs).
+  void CancelWorker(int index);
+
+private:
+  struct Unit;
+  class UnitLogger;
+
+  void RunSerial(std::vector<SetJob> &jobs, bool dryRun);
+  void RunConcurrent(std::vector<SetJob> &jobs, bool dryRun);
+  bool CanStart(size_t index) const;
+  void Start(size_t index, bool dryRun);
+  void Finished(Unit &unit);
+  // rates: null for engines that report every event.
+  void UnitProgress(Unit &unit, const TaskProgress &progress,
+                    const ProgressRates *rates);
+
+  IBackupLogger *m_logger;
+  SetBudget m_budget;
+  std::shared_ptr<IoBudget> m_ioBudget;
+  std::shared_ptr<DevicePools> m_devicePools;
+  std::atomic<bool> m_aborted{false};
+
+  mutable std::mutex m_mutex; // Unit states, slots and engines
+  std::condition_variable m_cv;
+  std::vector<std::unique_ptr<Unit>> m_units;
+  std::vector<bool> m_slotBusy;
+  int m_running = 0;
+  int m_threadsInUse = 0;
+  int m_peakRunning = 0;
+  BackupEngine *m_serialEngine = nullptr;
+
+  std::mutex m_progressMutex; // Unit progress and the set sum
+  // Calls into m_logger while units run; it is shared by all of them and
+  // need not be thread-safe. Taken last, after m_progressMutex.
+  std::mutex m_logMutex;
+};
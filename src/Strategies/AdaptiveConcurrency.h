@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// AIMD controller for the number of active workers of a parallel engine.
+//
+// Once per interval it is given the cumulative bytes and files processed and
+// compares the rates of the last interval with the one before:
+//  - a step up that raised bytes/s or files/s by 5% or more is kept and
+//    followed by another step up (additive increase);
+//  - a step up that gained nothing is undone and the limit held for a while
+//    before probing again;
+//  - bytes/s and files/s both falling by 10% or more cuts the limit by a
+//    quarter (multiplicative decrease), as when extra threads make a single
+//    disk seek between files.
+// Intervals without any progress (long directory listings, one huge file
+// being verified) carry no signal and are ignored.
+class AdaptiveConcurrency {
+public:
+  // Counters read by the background thread: cumulative bytes and files.
+  typedef std::function<void(long long &bytes, long long &files)> ReadCounters;
+  // Applies a new limit to the worker pool.
+  typedef std::function<void(int limit)> ApplyLimit;
+
+  AdaptiveConcurrency(int maxWorkers, int initial)
+      : m_max(std::max(1, maxWorkers)),
+        m_limit(std::min(std::max(1, initial), m_max)), m_lowest(m_limit),
+        m_highest(m_limit) {}
+  ~AdaptiveConcurrency() { Stop(); }
+  AdaptiveConcurrency(const AdaptiveConcurrency &) = delete;
+  AdaptiveConcurrency &operator=(const AdaptiveConcurrency &) = delete;
+
+  // Feeds one interval and returns the limit for the next one.
+  int Sample(long long bytes, long long files, double seconds) {
+    if (seconds <= 0)
+      return m_limit;
+    double byteRate = (double)(bytes - m_lastBytes) / seconds;
+    double fileRate = (double)(files - m_lastFiles) / seconds;
+    m_lastBytes = bytes;
+    m_lastFiles = files;
+    if (byteRate <= 0 && fileRate <= 0)
+      return m_limit;
+
+    if (!m_haveBaseline) {
+      m_haveBaseline = true;
+      StepUp();
+    } else {
+      bool better = byteRate >= m_byteRate * 1.05 ||
+                    fileRate >= m_fileRate * 1.05;
+      bool worse = byteRate <= m_byteRate * 0.90 &&
+                   fileRate <= m_fileRate * 0.90;
+      if (worse) {
+        SetLimit(m_limit - std::max(1, m_limit / 4));
+        m_rising = false;
+        m_hold = kHoldIntervals;
+      } else if (m_rising && better) {
+        StepUp();
+      } else if (m_rising) {
+        SetLimit(m_limit - 1);
+        m_rising = false;
+        m_hold = kHoldIntervals;
+      } else if (m_hold > 0) {
+        m_hold--;
+      } else {
+        StepUp();
+      }
+    }
+    m_byteRate = byteRate;
+    m_fileRate = fileRate;
+    return m_limit;
+  }
+
+  int Limit() const { return m_limit; }
+  int Lowest() const { return m_lowest; }
+  int Highest() const { return m_highest; }
+
+  // Samples read() every interval on a background thread and calls
+  // apply() whenever the limit changes, until Stop().
+  void Start(ReadCounters read, ApplyLimit apply,
+             std::chrono::milliseconds interval =
+                 std::chrono::milliseconds(1000)) {
+    Stop();
+    m_stop = false;
+    m_thread = std::thread([this, read, apply, interval]() {
+      auto last = std::chrono::steady_clock::now();
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (!m_cv.wait_for(lock, interval, [this] { return m_stop; })) {
+        auto now = std::chrono::steady_clock::now();
+        long long bytes = 0, files = 0;
+        read(bytes, files);
+        int before = m_limit;
+        Sample(bytes, files,
+               std::chrono::duration<double>(now - last).count());
+        last = now;
+        if (m_limit != before)
+          apply(m_limit);
+      }
+    });
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+      m_thread.join();
+  }
+
+  std::wstring Describe() const {
+    return L"Adaptive workers: " + std::to_wstring(m_lowest) + L"-" +
+           std::to_wstring(m_highest) + L" active (final " +
+           std::to_wstring(m_limit) + L" of " + std::to_wstring(m_max) + L")";
+  }
+
+private:
+  static const int kHoldIntervals = 5;
+
+  void StepUp() {
+    m_rising = m_limit < m_max;
+    SetLimit(m_limit + 1);
+  }
+  void SetLimit(int limit) {
+    m_limit = std::min(std::max(1, limit), m_max);
+    m_lowest = std::min(m_lowest, m_limit);
+    m_highest = std::max(m_highest, m_limit);
+  }
+
+  int m_max;
+  int m_limit;
+  int m_lowest;
+  int m_highest;
+  bool m_haveBaseline = false;
+  bool m_rising = false;
+  int m_hold = 0;
+  long long m_lastBytes = 0;
+  long long m_lastFiles = 0;
+  double m_byteRate = 0;
+  double m_fileRate = 0;
+
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stop = true;
+};
@@ -1,25 +1,293 @@
 #pragma once
 #include "Types.h" // Needed for BackupTask and fs namespace
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <string>
+#include <vector>
 
 namespace BackupUtils {
 typedef std::function<void(long long total, long long transferred)>
     CopyProgressCallback;
 
+// Metadata captured once per entry and carried through the pipeline so the
+// hot path never re-queries the file system for type, size or timestamps.
+// mtime is in native ticks (FILETIME units on Windows, ns on POSIX) and is
+// only comparable with other snapshots taken on the same platform.
+struct FileSnapshot {
+  enum class Type { Missing, File, Directory, Symlink, Other };
+  Type type = Type::Missing;
+  long long size = 0;
+  long long mtime = 0;
+  unsigned long long fileId = 0; // inode; 0 when the platform did not report it
+
+  bool Exists() const { return type != Type::Missing; }
+  bool IsDirectory() const { return type == Type::Directory; }
+  bool IsSymlink() const { return type == Type::Symlink; }
+};
+
+// Number of metadata queries (stat / GetFileAttributesEx) issued by the
+// snapshot helpers, used to check the one-query-per-entry budget. Each
+// engine owns one per run and hands it to the helpers below; calls without
+// one are not counted, so concurrent runs never mix their numbers.
+struct MetadataStats {
+  std::atomic<long long> sourceQueries{0};
+  std::atomic<long long> targetQueries{0};
+  std::atomic<long long> entries{0};
+
+  void Reset() {
+    sourceQueries = 0;
+    targetQueries = 0;
+    entries = 0;
+  }
+};
+// "Metadata queries: 12 source, 3 target for 15 entries"
+std::wstring FormatMetadataStats(const MetadataStats &stats);
+
+// Peak resident set (working set on Windows) of the process so far, in
+// bytes; 0 when the platform does not say.
+long long PeakResidentBytes();
+// "Peak memory: 212 MB resident (process)"
+std::wstring FormatMemoryStats();
+// "Traversal budget: 64 MB, peak 63 MB queued, 81234 items spilled (peak 9
+// MB on disk)", from the walker's memory budget statistics.
+std::wstring FormatTraversalStats(long long budget, long long peakQueued,
+                                  long long spilled, long long peakSpill);
+
+enum class MetadataRole { Source, Target };
+
+// Snapshot of an enumerated entry. On Windows this is served from the data
+// FindNextFile already returned and costs no query.
+FileSnapshot SnapshotEntry(const fs::directory_entry &entry,
+                           MetadataRole role = MetadataRole::Source,
+                           MetadataStats *stats = nullptr);
+// Snapshot of an arbitrary path; one metadata query each.
+FileSnapshot SnapshotSource(const fs::path &path,
+                            MetadataStats *stats = nullptr);
+FileSnapshot SnapshotTarget(const fs::path &path,
+                            MetadataStats *stats = nullptr);
+
+// Forwards progress to a callback at most every `bytes` bytes or
+// `interval`, whichever comes first, plus the final update. Keeps per-block
+// loops from flooding the UI with messages.
+class ProgressThrottle {
+public:
+  explicit ProgressThrottle(const CopyProgressCallback &callback,
+                            long long bytes = 16LL * 1024 * 1024,
+                            std::chrono::milliseconds interval =
+                                std::chrono::milliseconds(100))
+      : m_callback(callback), m_bytes(bytes), m_interval(interval),
+        m_last(std::chrono::steady_clock::now()) {}
+
+  void Update(long long total, long long done) {
+    if (!m_callback)
+      return;
+    if (done < total && done - m_lastDone < m_bytes) {
+      auto now = std::chrono::steady_clock::now();
+      if (now - m_last < m_interval)
+        return;
+      m_last = now;
+    } else {
+      m_last = std::chrono::steady_clock::now();
+    }
+    m_lastDone = done;
+    m_callback(total, done);
+  }
+
+private:
+  const CopyProgressCallback &m_callback;
+  long long m_bytes;
+  std::chrono::milliseconds m_interval;
+  std::chrono::steady_clock::time_point m_last;
+  long long m_lastDone = 0;
+};
+
+// Block size of the comparison and read-back loops.
+const size_t kCompareBlockSize = 4 * 1024 * 1024;
+
+// Page-aligned scratch buffer of at least size bytes, owned by the calling
+// thread and kept for its next call, so per-file helpers do not allocate.
+// slot selects one of a few independent buffers (0-3).
+char *ThreadBuffer(int slot, size_t size);
+
+// True when both buffers hold the same bytes. The kernel (AVX2, SSE2 or
+// memcmp) is picked once for the running CPU; BuffersEqualKernel names it.
+bool BuffersEqual(const void *a, const void *b, size_t length);
+const wchar_t *BuffersEqualKernel();
+
 bool CompareFilesBinary(const fs::path &p1, const fs::path &p2,
                         int *cancelFlag = nullptr,
                         CopyProgressCallback progressCallback = nullptr);
 
 void SetFileTimestamps(const fs::path &src, const fs::path &dst);
 
+// When contentHash is given, the data passes through a user-space buffer
+// and its ContentHasher digest is stored there, so the copy can be verified
+// without reading the source again. It is set to 0 when the file had to be
+// copied without hashing (symlinks, Windows files with alternate data
+// streams).
 bool RobustCopy(const fs::path &src, const fs::path &dst, bool isSymlink,
                 std::wstring &errorMsg, int *cancelFlag = nullptr,
-                CopyProgressCallback progressCallback = nullptr);
+                CopyProgressCallback progressCallback = nullptr,
+                unsigned long long *contentHash = nullptr);
+
+// Block cloning: the target shares the source's extents instead of receiving
+// a copy of the data (FICLONE on btrfs/XFS, FSCTL_DUPLICATE_EXTENTS_TO_FILE
+// on ReFS). Unsupported means the file system pair cannot clone at all and
+// the caller should fall back to RobustCopy; Failed is a per-file error.
+enum class CloneResult { Cloned, Unsupported, Failed };
+CloneResult CloneFile(const fs::path &src, const fs::path &dst,
+                      std::wstring &errorMsg);
+
+// Ranged copy: several workers fill one preallocated file with positional
+// I/O. CreateRangeTarget creates partial at the source's full size,
+// CopyRange copies [offset, offset + length) of src into it (progress is
+// reported against the range length, and contentHash receives the range's
+// ContentHasher digest when given), and
+// CommitRangeTarget gives partial the source's attributes and timestamps and
+// renames it over dst, so dst only ever holds a complete file.
+// CanCopyInRanges is false for files with data CopyRange cannot carry
+// (alternate data streams on Windows); those go through RobustCopy.
+bool CanCopyInRanges(const fs::path &src);
+bool CreateRangeTarget(const fs::path &partial, long long size,
+                       std::wstring &errorMsg);
+bool CopyRange(const fs::path &src, const fs::path &partial, long long offset,
+               long long length, std::wstring &errorMsg,
+               int *cancelFlag = nullptr,
+               CopyProgressCallback progressCallback = nullptr,
+               unsigned long long *contentHash = nullptr);
+bool CommitRangeTarget(const fs::path &src, const fs::path &partial,
+                       const fs::path &dst, std::wstring &errorMsg);
+
+// Durability for the job journal and the target catalog. SyncFile flushes
+// one file's data to its device. SyncDirectory makes the creations and
+// renames inside dir durable; NTFS and ReFS journal those themselves, so
+// it does nothing on Windows. SyncFileSystem flushes every file of the
+// file system holding path (syncfs), and is false where the platform has
+// no such call; callers then sync file by file.
+bool SyncFile(const fs::path &path);
+bool SyncDirectory(const fs::path &dir);
+bool SyncFileSystem(const fs::path &path);
+
+// Orders file names the way the file system resolves them: case-insensitive
+// ordinal on Windows, byte-wise elsewhere.
+int CompareNames(const fs::path &a, const fs::path &b);
+
+// The storage a path lives on, as far as scheduling I/O is concerned.
+struct DeviceProfile {
+  enum class Kind { Unknown, Rotational, Flash, Network };
+  // Equal for paths on the same physical disk ("disk:sda", "disk:2") or
+  // network server ("net:nas", "unc:\\\\nas"). Falls back to the volume or
+  // file system id when the disk is unknown; empty if nothing resolved.
+  std::wstring key;
+  std::wstring name; // For logs
+  Kind kind = Kind::Unknown;
+  int queueDepth = 0; // Requests the device accepts at once; 0 = unknown
+};
+
+// Probes the device behind a path: st_dev, mountinfo and /sys/block on
+// Linux, volume disk extents and the seek penalty property on Windows.
+// Paths that do not exist yet resolve through their nearest existing
+// ancestor. Costs a few system calls; call it once per root, not per file.
+DeviceProfile ProbeDevice(const fs::path &path);
+
+struct ListedEntry {
+  fs::path path;
+  FileSnapshot info;
+};
+
+// Lists one directory level into entries, sorted with CompareNames. False
+// when the directory could not be opened or read to the end; entries then
+// hold at most part of it, so callers must not derive deletions from them.
+bool ListDirectory(const fs::path &dir, MetadataRole role,
+                   std::vector<ListedEntry> &entries,
+                   MetadataStats *stats = nullptr);
+
+#ifndef _WIN32
+// Variants relative to an open directory descriptor, for walks that keep
+// their directories open (see DirHandles) and so skip resolving the full
+// path on every call. name is a single path component.
+FileSnapshot SnapshotAt(int dirFd, const char *name, MetadataRole role,
+                        MetadataStats *stats = nullptr);
+// Lists dirFd (from offset 0; not concurrently on one descriptor) with
+// getdents64. The d_type of each entry types it, so only regular files and
+// entries of unknown type cost an fstatat; directories, symlinks and
+// special files carry no size or mtime. Entries' paths hold their names
+// only. False when the directory could not be read to its end; entries then
+// holds what was read and must not stand for the whole directory.
+bool ListDirectoryAt(int dirFd, MetadataRole role,
+                     std::vector<ListedEntry> &entries,
+                     MetadataStats *stats = nullptr);
+// Removes name inside dirFd and, for a directory, everything below it,
+// without following symlinks. False with errno set on the first failure.
+bool RemoveAllAt(int dirFd, const char *name);
+#endif
+
+// Merge-joins two sorted listings. visit is called once per distinct name
+// with the matching source and/or target entry (the other side is null).
+typedef std::function<void(const ListedEntry *source,
+                           const ListedEntry *target)>
+    JoinVisitor;
+void MergeJoin(const std::vector<ListedEntry> &source,
+               const std::vector<ListedEntry> &target,
+               const JoinVisitor &visit);
 
 bool NeedsUpdate(const fs::path &source, const fs::path &target,
                  const BackupTask &task, int *cancelFlag = nullptr,
                  CopyProgressCallback progressCallback = nullptr);
+// Snapshot-based variant: decides from metadata already in hand and only
+// touches the files again when criteriaData requests a content comparison.
+bool NeedsUpdate(const FileSnapshot &sourceInfo,
+                 const FileSnapshot &targetInfo, const fs::path &source,
+                 const fs::path &target, const BackupTask &task,
+                 int *cancelFlag = nullptr,
+                 CopyProgressCallback progressCallback = nullptr);
+
+// Counts files and bytes below source using a ParallelTreeWalker. numThreads
+// <= 0 picks one worker per hardware thread. Entries filter excludes are
+// not counted, nor is anything below an excluded directory.
 void ScanSource(const fs::path &source, long long &totalFiles,
+                long long &totalBytes, int numThreads = 0,
+                const PathFilter *filter = nullptr);
+
+// Streaming scan helpers. BeginStreamingScan seeds the totals for the root and
+// marks them provisional; CountEntry adds one enumerated entry using the same
+// rules as ScanSource (directories are not counted, symlinks carry no bytes).
+void BeginStreamingScan(const fs::path &source, TaskProgress &progress);
+void CountEntry(const FileSnapshot &entry, long long &totalFiles,
                 long long &totalBytes);
+
+// Streaming 64-bit content hash (XXH64, seed 0). Fast enough to run inline
+// with a copy; used to verify targets, not as a cryptographic digest.
+class ContentHasher {
+public:
+  ContentHasher();
+  void Update(const void *data, size_t length);
+  unsigned long long Final() const;
+
+private:
+  unsigned long long m_acc[4];
+  unsigned long long m_total = 0;
+  unsigned char m_stripe[32];
+  size_t m_stripeLength = 0;
+};
+
+// ContentHasher digest of [offset, offset + length) of path (length < 0:
+// to the end of the file). The data is read bypassing the page cache where
+// the file system allows it, so a freshly written file is read back from
+// the media rather than from memory.
+bool HashFile(const fs::path &path, unsigned long long &hash,
+              long long offset = 0, long long length = -1,
+              int *cancelFlag = nullptr,
+              CopyProgressCallback progressCallback = nullptr);
+
+// Post-copy verification. With the source's hash from the copy only the
+// target is read back; without one (sourceHash 0) both files are compared.
+bool VerifyCopy(const fs::path &source, const fs::path &target,
+                unsigned long long sourceHash, int *cancelFlag = nullptr,
+                CopyProgressCallback progressCallback = nullptr);
+
+// CRC-32 (IEEE 802.3). Pass the previous result as crc to continue a running
+// checksum over several buffers.
+unsigned int Crc32(const void *data, size_t length, unsigned int crc = 0);
 } // namespace BackupUtils
@@ -0,0 +1,713 @@
+// POSIX implementations of the BackupUtils file operations. The Windows
+// versions (CopyFileExW based) live in BackupUtils.cpp.
+#ifndef _WIN32
+
+#include "BackupUtils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/sysmacros.h>
+#endif
+
+namespace BackupUtils {
+
+namespace {
+// Bytes moved per kernel call. Small enough that progress and cancellation
+// stay responsive, large enough that syscall overhead is negligible.
+const size_t kCopyChunk = 8 * 1024 * 1024;
+const size_t kBufferSize = 1024 * 1024;
+// Offset and buffer alignment that satisfies O_DIRECT on common devices.
+const long long kDirectAlign = 4096;
+
+std::wstring ErrnoMessage(int err) {
+  std::string msg = std::strerror(err);
+  return std::wstring(msg.begin(), msg.end());
+}
+
+// Closes the descriptor on scope exit.
+struct Fd {
+  int fd;
+  explicit Fd(int f) : fd(f) {}
+  ~Fd() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+  Fd(const Fd &) = delete;
+  Fd &operator=(const Fd &) = delete;
+};
+
+// errno values meaning "this primitive cannot copy between these two files",
+// as opposed to a real I/O error; the caller then tries the next primitive.
+bool IsUnsupported(int err) {
+  return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP ||
+         err == ENOTSUP || err == EBADF || err == EPERM;
+}
+
+bool WriteAll(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t n = ::write(fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+enum class CopyMethod { CopyFileRange, SendFile, ReadWrite };
+
+// Copies up to kCopyChunk bytes from in to out at the current file offsets.
+// Returns the bytes copied, 0 at end of file, or -1 with errno set. On an
+// unsupported-primitive error the method is downgraded and the call retried.
+// All three primitives advance the descriptors' file offsets, so switching
+// method part way through a file is safe. Data read through the buffer is
+// fed to hasher when given.
+ssize_t CopyChunk(int in, int out, CopyMethod &method,
+                  std::vector<char> &buffer, ContentHasher *hasher) {
+  for (;;) {
+#ifdef __linux__
+    if (method == CopyMethod::CopyFileRange) {
+      // In-kernel copy; reflinks or server-side copies where the file
+      // system supports it.
+      ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, kCopyChunk, 0);
+      if (n >= 0)
+        return n;
+      if (errno == EINTR)
+        continue;
+      if (!IsUnsupported(errno))
+        return -1;
+      method = CopyMethod::SendFile;
+      continue;
+    }
+    if (method == CopyMethod::SendFile) {
+      ssize_t n = ::sendfile(out, in, nullptr, kCopyChunk);
+      if (n >= 0)
+        return n;
+      if (errno == EINTR)
+        continue;
+      if (!IsUnsupported(errno))
+        return -1;
+      method = CopyMethod::ReadWrite;
+      continue;
+    }
+#endif
+    if (buffer.empty())
+      buffer.resize(kBufferSize);
+    ssize_t n;
+    do {
+      n = ::read(in, buffer.data(), buffer.size());
+    } while (n < 0 && errno == EINTR);
+    if (n > 0 && !WriteAll(out, buffer.data(), (size_t)n))
+      return -1;
+    if (n > 0 && hasher)
+      hasher->Update(buffer.data(), (size_t)n);
+    return n;
+  }
+}
+} // namespace
+
+bool CompareFilesBinary(const fs::path &p1, const fs::path &p2, int *cancelFlag,
+                        CopyProgressCallback progressCallback) {
+  Fd f1(::open(p1.c_str(), O_RDONLY | O_CLOEXEC));
+  Fd f2(::open(p2.c_str(), O_RDONLY | O_CLOEXEC));
+  if (f1.fd < 0 || f2.fd < 0)
+    return false;
+
+  struct stat st1, st2;
+  if (::fstat(f1.fd, &st1) != 0 || ::fstat(f2.fd, &st2) != 0)
+    return false;
+  if (st1.st_size != st2.st_size)
+    return false;
+#ifdef POSIX_FADV_SEQUENTIAL
+  ::posix_fadvise(f1.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  ::posix_fadvise(f2.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  char *b1 = ThreadBuffer(0, kCompareBlockSize);
+  char *b2 = ThreadBuffer(1, kCompareBlockSize);
+  ProgressThrottle progress(progressCallback);
+  long long processed = 0;
+  for (;;) {
+    if (cancelFlag && *cancelFlag)
+      return false;
+    ssize_t n1 = ::read(f1.fd, b1, kCompareBlockSize);
+    if (n1 < 0 && errno == EINTR)
+      continue;
+    if (n1 < 0)
+      return false;
+    if (n1 == 0)
+      break;
+    // Fill the same amount from the second file (short reads are legal).
+    ssize_t got = 0;
+    while (got < n1) {
+      ssize_t n2 = ::read(f2.fd, b2 + got, (size_t)(n1 - got));
+      if (n2 < 0 && errno == EINTR)
+        continue;
+      if (n2 <= 0)
+        return false;
+      got += n2;
+    }
+    if (!BuffersEqual(b1, b2, (size_t)n1))
+      return false;
+
+    processed += n1;
+    progress.Update((long long)st1.st_size, processed);
+  }
+  return true;
+}
+
+void SetFileTimestamps(const fs::path &src, const fs::path &dst) {
+  struct stat st;
+  if (::lstat(src.c_str(), &st) != 0)
+    return;
+  struct timespec times[2] = {st.st_atim, st.st_mtim};
+  ::utimensat(AT_FDCWD, dst.c_str(), times, AT_SYMLINK_NOFOLLOW);
+}
+
+// The target of the symbolic link path. lstat reports its length, but the
+// link can be replaced in between (and some file systems report 0), so a
+// result that fills the buffer is retried with a larger one.
+static bool ReadLinkTarget(const fs::path &path, std::string &target,
+                           std::wstring &errorMsg) {
+  struct stat st;
+  if (::lstat(path.c_str(), &st) != 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  size_t size = std::max<size_t>((size_t)st.st_size + 1, 256);
+  for (int attempt = 0; attempt < 4; ++attempt, size *= 4) {
+    target.resize(size);
+    ssize_t len = ::readlink(path.c_str(), &target[0], size);
+    if (len < 0) {
+      errorMsg = ErrnoMessage(errno);
+      return false;
+    }
+    if ((size_t)len < size) {
+      target.resize((size_t)len);
+      return true;
+    }
+  }
+  errorMsg = L"Link target truncated";
+  return false;
+}
+
+bool RobustCopy(const fs::path &src, const fs::path &dst, bool isSymlink,
+                std::wstring &errorMsg, int *cancelFlag,
+                CopyProgressCallback progressCallback,
+                unsigned long long *contentHash) {
+  if (contentHash)
+    *contentHash = 0;
+  if (cancelFlag && *cancelFlag) {
+    errorMsg = L"Operation cancelled";
+    return false;
+  }
+
+  if (isSymlink) {
+    // Recreate the link itself, like COPY_FILE_COPY_SYMLINK.
+    std::string link;
+    if (!ReadLinkTarget(src, link, errorMsg))
+      return false;
+    if (::symlink(link.c_str(), dst.c_str()) != 0) {
+      if (errno != EEXIST || ::unlink(dst.c_str()) != 0 ||
+          ::symlink(link.c_str(), dst.c_str()) != 0) {
+        errorMsg = ErrnoMessage(errno);
+        return false;
+      }
+    }
+    if (progressCallback)
+      progressCallback(0, 0);
+    SetFileTimestamps(src, dst);
+    return true;
+  }
+
+  Fd in(::open(src.c_str(), O_RDONLY | O_CLOEXEC));
+  if (in.fd < 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  struct stat st;
+  if (::fstat(in.fd, &st) != 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  Fd out(::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                st.st_mode & 07777));
+  if (out.fd < 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  ::posix_fadvise(in.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  const long long total = (long long)st.st_size;
+  long long copied = 0;
+  // Hashing needs the data in user space, so it always takes the
+  // read/write path.
+  CopyMethod method =
+      contentHash ? CopyMethod::ReadWrite : CopyMethod::CopyFileRange;
+  std::vector<char> buffer;
+  ContentHasher hasher;
+  for (;;) {
+    if (cancelFlag && *cancelFlag) {
+      // Same contract as CopyFileExW: a cancelled copy leaves no partial file.
+      ::unlink(dst.c_str());
+      errorMsg = L"Operation cancelled";
+      return false;
+    }
+    ssize_t n =
+        CopyChunk(in.fd, out.fd, method, buffer, contentHash ? &hasher : nullptr);
+    if (n < 0) {
+      errorMsg = ErrnoMessage(errno);
+      ::unlink(dst.c_str());
+      return false;
+    }
+    if (n == 0) {
+      // Some file systems (procfs-like, older FUSE) report 0 from the
+      // in-kernel primitives before the real end of file.
+      if (copied < total && method != CopyMethod::ReadWrite) {
+        method = CopyMethod::ReadWrite;
+        continue;
+      }
+      break;
+    }
+    copied += n;
+    if (progressCallback)
+      progressCallback(total, copied);
+  }
+
+  // An existing target keeps its old mode through O_TRUNC, so set it
+  // explicitly, then carry the timestamps over on the open descriptor.
+  ::fchmod(out.fd, st.st_mode & 07777);
+  struct timespec times[2] = {st.st_atim, st.st_mtim};
+  if (::futimens(out.fd, times) != 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  int fd = out.fd;
+  out.fd = -1;
+  if (::close(fd) != 0) {
+    // Deferred write errors (NFS, full disks) are only reported here.
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  if (contentHash)
+    *contentHash = hasher.Final();
+  return true;
+}
+
+CloneResult CloneFile(const fs::path &src, const fs::path &dst,
+                      std::wstring &errorMsg) {
+#if defined(__linux__) && defined(FICLONE)
+  Fd in(::open(src.c_str(), O_RDONLY | O_CLOEXEC));
+  if (in.fd < 0) {
+    errorMsg = ErrnoMessage(errno);
+    return CloneResult::Failed;
+  }
+  struct stat st;
+  if (::fstat(in.fd, &st) != 0) {
+    errorMsg = ErrnoMessage(errno);
+    return CloneResult::Failed;
+  }
+  // Clone into a fresh hidden file next to dst and rename it over dst only
+  // once the clone succeeded, so an existing target survives a refused or
+  // failed clone (the caller then falls back to copying over it).
+  std::string temp =
+      (dst.parent_path() / ("." + dst.filename().native() + ".XXXXXX"))
+          .native();
+  Fd out(::mkostemp(&temp[0], O_CLOEXEC));
+  if (out.fd < 0) {
+    errorMsg = ErrnoMessage(errno);
+    return CloneResult::Failed;
+  }
+
+  // One ioctl shares every extent of the source; the data is not touched.
+  if (::ioctl(out.fd, FICLONE, in.fd) != 0) {
+    int err = errno;
+    errorMsg = ErrnoMessage(err);
+    ::unlink(temp.c_str());
+    // EXDEV: different file systems. EOPNOTSUPP/ENOTTY/EINVAL: the file
+    // system (or this file, e.g. a swap file) cannot share extents.
+    if (err == EXDEV || err == EOPNOTSUPP || err == ENOTTY || err == EINVAL ||
+        err == ENOSYS || err == EPERM)
+      return CloneResult::Unsupported;
+    return CloneResult::Failed;
+  }
+
+  ::fchmod(out.fd, st.st_mode & 07777);
+  struct timespec times[2] = {st.st_atim, st.st_mtim};
+  ::futimens(out.fd, times);
+  if (::rename(temp.c_str(), dst.c_str()) != 0) {
+    errorMsg = ErrnoMessage(errno);
+    ::unlink(temp.c_str());
+    return CloneResult::Failed;
+  }
+  return CloneResult::Cloned;
+#else
+  (void)src;
+  (void)dst;
+  errorMsg = L"Block cloning is not available on this platform";
+  return CloneResult::Unsupported;
+#endif
+}
+
+bool CanCopyInRanges(const fs::path &) { return true; }
+
+bool CreateRangeTarget(const fs::path &partial, long long size,
+                       std::wstring &errorMsg) {
+  Fd out(::open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0600));
+  if (out.fd < 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  // Reserve the blocks up front so concurrent ranges do not fragment the
+  // file. File systems without fallocate get a sparse file of the right size.
+  int err = size > 0 ? ::posix_fallocate(out.fd, 0, (off_t)size) : 0;
+  if (err != 0 && err != EOPNOTSUPP && err != EINVAL) {
+    errorMsg = ErrnoMessage(err);
+    ::unlink(partial.c_str());
+    return false;
+  }
+  if (err != 0 && ::ftruncate(out.fd, (off_t)size) != 0) {
+    errorMsg = ErrnoMessage(errno);
+    ::unlink(partial.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool CopyRange(const fs::path &src, const fs::path &partial, long long offset,
+               long long length, std::wstring &errorMsg, int *cancelFlag,
+               CopyProgressCallback progressCallback,
+               unsigned long long *contentHash) {
+  Fd in(::open(src.c_str(), O_RDONLY | O_CLOEXEC));
+  if (in.fd < 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  Fd out(::open(partial.c_str(), O_WRONLY | O_CLOEXEC));
+  if (out.fd < 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  ::posix_fadvise(in.fd, (off_t)offset, (off_t)length, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  // Positional I/O only: the workers share no file offsets.
+  bool inKernel = contentHash == nullptr;
+  std::vector<char> buffer;
+  ContentHasher hasher;
+  long long copied = 0;
+  while (copied < length) {
+    if (cancelFlag && *cancelFlag) {
+      errorMsg = L"Operation cancelled";
+      return false;
+    }
+    size_t want = (size_t)std::min<long long>(length - copied, kCopyChunk);
+    off_t inPos = (off_t)(offset + copied);
+    off_t outPos = inPos;
+    ssize_t n = -1;
+#ifdef __linux__
+    if (inKernel) {
+      n = ::copy_file_range(in.fd, &inPos, out.fd, &outPos, want, 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && IsUnsupported(errno)) {
+        inKernel = false;
+        continue;
+      }
+    }
+#else
+    inKernel = false;
+#endif
+    if (!inKernel) {
+      if (buffer.empty())
+        buffer.resize(kBufferSize);
+      want = std::min(want, buffer.size());
+      n = ::pread(in.fd, buffer.data(), want, inPos);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n > 0 && contentHash)
+        hasher.Update(buffer.data(), (size_t)n);
+      for (ssize_t done = 0; n > 0 && done < n;) {
+        ssize_t w = ::pwrite(out.fd, buffer.data() + done, (size_t)(n - done),
+                             outPos + done);
+        if (w < 0 && errno == EINTR)
+          continue;
+        if (w < 0) {
+          n = -1;
+          break;
+        }
+        done += w;
+      }
+    }
+    if (n < 0) {
+      errorMsg = ErrnoMessage(errno);
+      return false;
+    }
+    if (n == 0) {
+      if (inKernel) {
+        // Same early-EOF quirk as in RobustCopy.
+        inKernel = false;
+        continue;
+      }
+      errorMsg = L"Source file shrank during the copy";
+      return false;
+    }
+    copied += n;
+    if (progressCallback)
+      progressCallback(length, copied);
+  }
+
+  int fd = out.fd;
+  out.fd = -1;
+  if (::close(fd) != 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  if (contentHash)
+    *contentHash = hasher.Final();
+  return true;
+}
+
+bool CommitRangeTarget(const fs::path &src, const fs::path &partial,
+                       const fs::path &dst, std::wstring &errorMsg) {
+  struct stat st;
+  if (::stat(src.c_str(), &st) != 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  struct timespec times[2] = {st.st_atim, st.st_mtim};
+  if (::chmod(partial.c_str(), st.st_mode & 07777) != 0 ||
+      ::utimensat(AT_FDCWD, partial.c_str(), times, 0) != 0 ||
+      ::rename(partial.c_str(), dst.c_str()) != 0) {
+    errorMsg = ErrnoMessage(errno);
+    return false;
+  }
+  return true;
+}
+
+bool SyncFile(const fs::path &path) {
+  Fd f(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  return f.fd >= 0 && ::fsync(f.fd) == 0;
+}
+
+bool SyncDirectory(const fs::path &dir) {
+  Fd f(::open(dir.empty() ? "." : dir.c_str(),
+              O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  return f.fd >= 0 && ::fsync(f.fd) == 0;
+}
+
+bool SyncFileSystem(const fs::path &path) {
+#ifdef __linux__
+  Fd f(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  return f.fd >= 0 && ::syncfs(f.fd) == 0;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+bool HashFile(const fs::path &path, unsigned long long &hash,
+              long long offset, long long length, int *cancelFlag,
+              CopyProgressCallback progressCallback) {
+  // O_DIRECT makes the kernel write back any dirty pages of the range and
+  // then read from the device.
+  bool direct = false;
+#ifdef O_DIRECT
+  Fd f(::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT));
+  direct = f.fd >= 0;
+  if (!direct)
+    f.fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#else
+  Fd f(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+#endif
+  if (f.fd < 0)
+    return false;
+  struct stat st;
+  if (::fstat(f.fd, &st) != 0 || offset > (long long)st.st_size)
+    return false;
+  if (length < 0 || offset + length > (long long)st.st_size)
+    length = (long long)st.st_size - offset;
+
+  char *buffer = ThreadBuffer(2, kCompareBlockSize);
+  ProgressThrottle progress(progressCallback);
+
+  auto dropCache = [&]() {
+    // File systems without O_DIRECT (tmpfs, many FUSE mounts): flush the
+    // file and drop its cached pages so the reads below still reach the
+    // storage wherever there is one.
+    ::fdatasync(f.fd);
+#ifdef POSIX_FADV_DONTNEED
+    ::posix_fadvise(f.fd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+#endif
+  };
+  if (!direct)
+    dropCache();
+
+  ContentHasher hasher;
+  const long long end = offset + length;
+  long long pos = offset & ~(kDirectAlign - 1);
+  long long skip = offset - pos;
+  long long done = 0;
+  while (pos + skip < end) {
+    if (cancelFlag && *cancelFlag)
+      return false;
+    ssize_t n = ::pread(f.fd, buffer, kCompareBlockSize, (off_t)pos);
+    if (n < 0 && errno == EINTR)
+      continue;
+#ifdef O_DIRECT
+    if (n < 0 && errno == EINVAL && direct) {
+      // The device wants a larger alignment; read through the cache.
+      ::fcntl(f.fd, F_SETFL, ::fcntl(f.fd, F_GETFL) & ~O_DIRECT);
+      direct = false;
+      dropCache();
+      continue;
+    }
+#endif
+    if (n <= skip)
+      return false; // Error, or the file is shorter than it claimed
+    long long take = std::min<long long>(n - skip, end - (pos + skip));
+    hasher.Update(buffer + skip, (size_t)take);
+    done += take;
+    pos += n;
+    skip = 0;
+    progress.Update(length, done);
+  }
+  hash = hasher.Final();
+  return true;
+}
+
+#ifdef __linux__
+namespace {
+// Finds the mount of a file system id in /proc/self/mountinfo, whose lines
+// read "id parent major:minor root mountpoint options... - type source ...".
+bool FindMount(dev_t dev, std::string &type, std::string &source) {
+  std::ifstream in("/proc/self/mountinfo");
+  const std::string id =
+      std::to_string(major(dev)) + ":" + std::to_string(minor(dev));
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string mountId, parentId, devId;
+    fields >> mountId >> parentId >> devId;
+    size_t separator = line.find(" - ");
+    if (devId != id || separator == std::string::npos)
+      continue;
+    std::istringstream tail(line.substr(separator + 3));
+    tail >> type >> source;
+    return true;
+  }
+  return false;
+}
+
+bool IsNetworkFileSystem(const std::string &type) {
+  return type.rfind("nfs", 0) == 0 || type == "cifs" || type == "smb3" ||
+         type == "smbfs" || type == "ceph" || type == "9p" ||
+         type == "fuse.sshfs" || type == "fuse.glusterfs";
+}
+
+// First line of a sysfs attribute as a number; -1 if it cannot be read.
+int ReadSysfsNumber(const fs::path &file) {
+  std::ifstream in(file);
+  int value = -1;
+  if (!(in >> value))
+    return -1;
+  return value;
+}
+} // namespace
+#endif
+
+DeviceProfile ProbeDevice(const fs::path &path) {
+  DeviceProfile device;
+  std::error_code ec;
+  fs::path p = fs::absolute(path, ec);
+  if (ec)
+    p = path;
+  // The target root may not exist yet: use its nearest existing ancestor.
+  struct stat st;
+  while (::stat(p.c_str(), &st) != 0) {
+    if (!p.has_relative_path())
+      return device;
+    p = p.parent_path();
+  }
+  device.key = L"dev:" + std::to_wstring((unsigned long long)st.st_dev);
+  device.name = device.key;
+#ifdef __linux__
+  std::string type, source;
+  bool mounted = FindMount(st.st_dev, type, source);
+  if (mounted)
+    device.name = std::wstring(type.begin(), type.end()) + L" " + device.key;
+  if (mounted && IsNetworkFileSystem(type)) {
+    // "server:/export" (NFS) or "//server/share" (SMB): every export of a
+    // server competes for the same link.
+    std::string server = source;
+    if (server.rfind("//", 0) == 0)
+      server = server.substr(2, server.find('/', 2) - 2);
+    else
+      server = server.substr(0, server.find(':'));
+    device.key = L"net:" + std::wstring(server.begin(), server.end());
+    device.name = std::wstring(source.begin(), source.end());
+    device.kind = DeviceProfile::Kind::Network;
+    return device;
+  }
+
+  // Btrfs, overlay and other file systems report an anonymous st_dev
+  // (major 0); the mount source names the block device behind it. tmpfs and
+  // friends have none and stay Unknown.
+  dev_t block = st.st_dev;
+  struct stat sourceStat;
+  if (major(block) == 0) {
+    if (!mounted || source.rfind("/dev/", 0) != 0 ||
+        ::stat(source.c_str(), &sourceStat) != 0 ||
+        !S_ISBLK(sourceStat.st_mode))
+      return device;
+    block = sourceStat.st_rdev;
+  }
+
+  // /sys/dev/block/M:m links to the block device; a partition's queue
+  // attributes live on its parent disk. Device mapper volumes (LVM, dm-crypt)
+  // carry attributes inherited from the disks below them.
+  fs::path sys = fs::canonical("/sys/dev/block/" +
+                                   std::to_string(major(block)) + ":" +
+                                   std::to_string(minor(block)),
+                               ec);
+  if (ec)
+    return device;
+  if (fs::exists(sys / "partition", ec))
+    sys = sys.parent_path();
+  const std::string disk = sys.filename().string();
+  device.key = L"disk:" + std::wstring(disk.begin(), disk.end());
+  device.name = std::wstring(disk.begin(), disk.end());
+  int rotational = ReadSysfsNumber(sys / "queue" / "rotational");
+  if (rotational >= 0)
+    device.kind = rotational ? DeviceProfile::Kind::Rotational
+                             : DeviceProfile::Kind::Flash;
+  // SCSI/SATA disks report their tagged command queue; nr_requests is the
+  // block layer's queue, the only figure for NVMe and virtio.
+  int depth = ReadSysfsNumber(sys / "device" / "queue_depth");
+  if (depth <= 0)
+    depth = ReadSysfsNumber(sys / "queue" / "nr_requests");
+  device.queueDepth = std::max(depth, 0);
+#endif
+  return device;
+}
+
+} // namespace BackupUtils
+
+#endif // !_WIN32
@@ -0,0 +1,134 @@
+// Vectorized buffer comparison for CompareFilesBinary. The kernel is chosen
+// once at run time: AVX2 or SSE2 on x86, memcmp everywhere else.
+#include "BackupUtils.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||             \
+    defined(_M_IX86)
+#define SUREBACKUP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC accepts any intrinsic without per-function target flags.
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace BackupUtils {
+
+namespace {
+typedef bool (*EqualKernel)(const unsigned char *a, const unsigned char *b,
+                            size_t length);
+
+bool EqualScalar(const unsigned char *a, const unsigned char *b,
+                 size_t length) {
+  return std::memcmp(a, b, length) == 0;
+}
+
+#ifdef SUREBACKUP_X86
+// Both kernels XOR 128 bytes per iteration and test the OR of the results
+// once, so the loop carries no branch per vector. The tail goes to memcmp.
+TARGET_SSE2 bool EqualSse2(const unsigned char *a, const unsigned char *b,
+                           size_t length) {
+  size_t i = 0;
+  for (; i + 128 <= length; i += 128) {
+    __m128i diff = _mm_setzero_si128();
+    for (size_t k = 0; k < 128; k += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(a + i + k));
+      __m128i y = _mm_loadu_si128((const __m128i *)(b + i + k));
+      diff = _mm_or_si128(diff, _mm_xor_si128(x, y));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) !=
+        0xFFFF)
+      return false;
+  }
+  return std::memcmp(a + i, b + i, length - i) == 0;
+}
+
+TARGET_AVX2 bool EqualAvx2(const unsigned char *a, const unsigned char *b,
+                           size_t length) {
+  size_t i = 0;
+  for (; i + 128 <= length; i += 128) {
+    __m256i d0 = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)(a + i)),
+        _mm256_loadu_si256((const __m256i *)(b + i)));
+    __m256i d1 = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)(a + i + 32)),
+        _mm256_loadu_si256((const __m256i *)(b + i + 32)));
+    __m256i d2 = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)(a + i + 64)),
+        _mm256_loadu_si256((const __m256i *)(b + i + 64)));
+    __m256i d3 = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)(a + i + 96)),
+        _mm256_loadu_si256((const __m256i *)(b + i + 96)));
+    __m256i diff =
+        _mm256_or_si256(_mm256_or_si256(d0, d1), _mm256_or_si256(d2, d3));
+    if (!_mm256_testz_si256(diff, diff))
+      return false;
+  }
+  return std::memcmp(a + i, b + i, length - i) == 0;
+}
+
+bool CpuHasAvx2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  // The OS must save the YMM registers (OSXSAVE and XCR0 bits 1-2).
+  if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+bool CpuHasSse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+  return true; // Part of the x86-64 baseline
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2") != 0;
+#endif
+}
+#endif
+
+struct Kernel {
+  EqualKernel fn;
+  const wchar_t *name;
+};
+
+const Kernel &SelectKernel() {
+  static const Kernel kernel = []() -> Kernel {
+#ifdef SUREBACKUP_X86
+    if (CpuHasAvx2())
+      return {EqualAvx2, L"AVX2"};
+    if (CpuHasSse2())
+      return {EqualSse2, L"SSE2"};
+#endif
+    return {EqualScalar, L"memcmp"};
+  }();
+  return kernel;
+}
+} // namespace
+
+bool BuffersEqual(const void *a, const void *b, size_t length) {
+  return SelectKernel().fn(static_cast<const unsigned char *>(a),
+                           static_cast<const unsigned char *>(b), length);
+}
+
+const wchar_t *BuffersEqualKernel() { return SelectKernel().name; }
+
+} // namespace BackupUtils
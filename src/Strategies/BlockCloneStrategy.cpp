@@ -0,0 +1,58 @@
+#include "BlockCloneStrategy.h"
+
+void BlockCloneStrategy::Execute(const BackupTask &task, IBackupLogger *logger,
+                                 bool dryRun) {
+  m_logger = logger;
+  m_cloneAvailable = true;
+  m_clonedFiles = 0;
+  m_clonedBytes = 0;
+  m_copiedFiles = 0;
+  if (logger)
+    logger->Log(L"Block Clone Engine: files are cloned where the target "
+                L"file system supports it.");
+  StandardBackupStrategy::Execute(task, logger, dryRun);
+}
+
+bool BlockCloneStrategy::CopyFileData(
+    const fs::path &source, const fs::path &target,
+    const BackupUtils::FileSnapshot &sourceInfo, std::wstring &errorMsg,
+    BackupUtils::CopyProgressCallback progressCb,
+    unsigned long long *contentHash) {
+  if (contentHash)
+    *contentHash = 0; // A clone never passes the data through us
+  if (m_cloneAvailable) {
+    std::wstring cloneError;
+    switch (BackupUtils::CloneFile(source, target, cloneError)) {
+    case BackupUtils::CloneResult::Cloned:
+      m_clonedFiles++;
+      m_clonedBytes += sourceInfo.size;
+      if (progressCb)
+        progressCb(sourceInfo.size, sourceInfo.size);
+      return true;
+    case BackupUtils::CloneResult::Unsupported:
+      m_cloneAvailable = false;
+      if (m_logger)
+        m_logger->Log(L"NOTE: Block cloning is not available for this "
+                      L"target (" +
+                      cloneError + L"). Using regular copies.");
+      break;
+    case BackupUtils::CloneResult::Failed:
+      if (m_logger)
+        m_logger->Log(L"  Clone failed, copying instead: " +
+                      source.wstring() + L" (" + cloneError + L")");
+      break;
+    }
+  }
+
+  m_copiedFiles++;
+  return BackupUtils::RobustCopy(source, target, false, errorMsg, nullptr,
+                                 progressCb, contentHash);
+}
+
+void BlockCloneStrategy::LogStats(IBackupLogger *logger) {
+  StandardBackupStrategy::LogStats(logger);
+  logger->Log(L"Block clone: " + std::to_wstring(m_clonedFiles) +
+              L" files cloned (" + std::to_wstring(m_clonedBytes) +
+              L" bytes), " + std::to_wstring(m_copiedFiles) +
+              L" files copied");
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "StandardBackupStrategy.h"
+
+// Standard traversal, but regular files are block-cloned (reflinked) instead
+// of copied when source and target share a file system that supports it:
+// FICLONE on btrfs/XFS, FSCTL_DUPLICATE_EXTENTS_TO_FILE on ReFS. Cloning
+// costs metadata only, whatever the file size. The first clone attempt
+// probes the target; if it cannot clone, the rest of the run uses
+// RobustCopy, and individual files that fail to clone are copied too.
+class BlockCloneStrategy : public StandardBackupStrategy {
+public:
+  void Execute(const BackupTask &task, IBackupLogger *logger,
+               bool dryRun) override;
+
+protected:
+  bool CopyFileData(const fs::path &source, const fs::path &target,
+                    const BackupUtils::FileSnapshot &sourceInfo,
+                    std::wstring &errorMsg,
+                    BackupUtils::CopyProgressCallback progressCb,
+                    unsigned long long *contentHash) override;
+  void LogStats(IBackupLogger *logger) override;
+
+private:
+  IBackupLogger *m_logger = nullptr;
+  bool m_cloneAvailable = true;
+  long long m_clonedFiles = 0;
+  long long m_clonedBytes = 0;
+  long long m_copiedFiles = 0;
+};
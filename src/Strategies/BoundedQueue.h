@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// Blocking multi-producer, multi-consumer FIFO with a fixed capacity. It
+// connects the stages of PipelineBackupStrategy: a producer that runs ahead
+// blocks in Push until its consumers catch up, so the items between two
+// stages never exceed the capacity.
+//
+// The queue also records how long producers waited for room and consumers
+// waited for items, which tells the slower side of each hand-off.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity)
+      : m_capacity(std::max<size_t>(capacity, 1)) {}
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  // Blocks while the queue is full. Returns false, dropping the item, once
+  // the queue was closed.
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_items.size() >= m_capacity && !m_closed) {
+      auto start = std::chrono::steady_clock::now();
+      m_notFull.wait(lock, [&] {
+        return m_items.size() < m_capacity || m_closed;
+      });
+      m_pushWait += std::chrono::steady_clock::now() - start;
+    }
+    if (m_closed)
+      return false;
+    m_items.push_back(std::move(item));
+    m_peak = std::max(m_peak, m_items.size());
+    lock.unlock();
+    m_notEmpty.notify_one();
+    return true;
+  }
+
+  // Blocks while the queue is empty. Returns false once it is closed and
+  // drained.
+  bool Pop(T &item) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_items.empty() && !m_closed) {
+      auto start = std::chrono::steady_clock::now();
+      m_notEmpty.wait(lock, [&] { return !m_items.empty() || m_closed; });
+      m_popWait += std::chrono::steady_clock::now() - start;
+    }
+    if (m_items.empty())
+      return false;
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    lock.unlock();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  // Non-blocking Pop for consumers that have other work to do while the
+  // queue is empty. Returns false when no item is queued right now; closed
+  // tells whether none will ever come again.
+  bool TryPop(T &item, bool &closed) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    closed = m_closed && m_items.empty();
+    if (m_items.empty())
+      return false;
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    lock.unlock();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  // No more items will be pushed. Consumers drain what is queued, then Pop
+  // returns false.
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed = true;
+    }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+  }
+
+  size_t Capacity() const { return m_capacity; }
+  size_t Peak() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_peak;
+  }
+  // Summed over all producers / consumers.
+  double PushWaitSeconds() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::chrono::duration<double>(m_pushWait).count();
+  }
+  double PopWaitSeconds() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::chrono::duration<double>(m_popWait).count();
+  }
+
+private:
+  const size_t m_capacity;
+  mutable std::mutex m_mutex;
+  std::condition_variable m_notEmpty;
+  std::condition_variable m_notFull;
+  std::deque<T> m_items;
+  bool m_closed = false;
+  size_t m_peak = 0;
+  std::chrono::steady_clock::duration m_pushWait{0};
+  std::chrono::steady_clock::duration m_popWait{0};
+};
@@ -1,8 +1,13 @@
 #include "ComparingBackupStrategy.h"
+#include "AdaptiveConcurrency.h"
 #include "BackupUtils.h"
+#include "DevicePools.h"
+#include "DirHandles.h"
+#include "ParallelTreeWalker.h"
+#include "PathArena.h"
+#include "PathFilter.h"
+#include <algorithm>
 #include <atomic>
-#include <condition_variable>
-#include <deque>
 #include <mutex>
 #include <sstream>
 #include <stdexcept>
@@ -11,9 +16,32 @@
 
 namespace {
 struct CompareWorkItem {
-  fs::path source;
-  fs::path target;
+  // The entry's directory and name, relative to the roots (see PathArena).
+  // The root item has no name.
+  PathArena::NodeId parent = PathArena::kRoot;
+  fs::path::string_type name;
+  BackupUtils::FileSnapshot info; // Source metadata from the enumeration
 };
+
+// Spill encoding for the traversal memory budget.
+ParallelTreeWalker<CompareWorkItem>::SpillCodec CompareWorkItemCodec() {
+  using namespace SpillEncoding;
+  ParallelTreeWalker<CompareWorkItem>::SpillCodec codec;
+  codec.bytes = [](const CompareWorkItem &item) {
+    return sizeof(CompareWorkItem) + StringBytes(item.name);
+  };
+  codec.encode = [](const CompareWorkItem &item, std::string &out) {
+    Put(out, item.parent);
+    Put(out, item.name);
+    Put(out, item.info);
+    return true;
+  };
+  codec.decode = [](const char *&p, const char *end, CompareWorkItem &item) {
+    return Get(p, end, item.parent) && Get(p, end, item.name) &&
+           Get(p, end, item.info);
+  };
+  return codec;
+}
 } // namespace
 
 void ComparingBackupStrategy::CancelWorker(int index) {
@@ -54,16 +82,28 @@ void ComparingBackupStrategy::Execute(const BackupTask &task,
     SafeLog(logger, L"ERROR: Source path does not exist.");
     return;
   }
+  if (task.filter)
+    SafeLog(logger, task.filter->FormatStats());
 
   TaskProgress progress;
   if (logger) {
-    SafeLog(logger, L"Scanning source... please wait.");
-    BackupUtils::ScanSource(sourcePath, progress.totalFiles,
-                            progress.totalBytes);
+    if (task.streamingScan) {
+      BackupUtils::BeginStreamingScan(sourcePath, progress);
+    } else {
+      SafeLog(logger, L"Scanning source... please wait.");
+      BackupUtils::ScanSource(sourcePath, progress.totalFiles,
+                              progress.totalBytes, 0, task.filter.get());
+    }
   }
 
   try {
+    m_metadata.Reset();
     ProcessDirectory(sourcePath, targetPath, task, logger, dryRun, progress);
+    if (progress.isEstimate && (!task.IsAborted || !task.IsAborted())) {
+      // All workers drained the queue, so the streamed totals are final.
+      progress.isEstimate = false;
+      logger->OnProgressDetailed(progress);
+    }
   } catch (const std::exception &e) {
     std::string what = e.what();
     SafeLog(logger,
@@ -71,6 +111,8 @@ void ComparingBackupStrategy::Execute(const BackupTask &task,
   }
 
   if (logger) {
+    SafeLog(logger, BackupUtils::FormatMetadataStats(m_metadata));
+    SafeLog(logger, BackupUtils::FormatMemoryStats());
     SafeLog(logger, L"--------------------------------------------------");
     if (task.IsAborted && task.IsAborted()) {
       SafeLog(logger, L"PROCESS INTERRUPTED BY USER.");
@@ -84,19 +126,10 @@ void ComparingBackupStrategy::Execute(const BackupTask &task,
 void ComparingBackupStrategy::ProcessDirectory(
     const fs::path &source, const fs::path &target, const BackupTask &task,
     IBackupLogger *logger, bool /*dryRun*/, TaskProgress &progress) {
-  std::deque<CompareWorkItem> queue;
-  std::mutex queueMutex;
-  std::condition_variable cv;
-  std::atomic<int> activeWorkers(0);
   std::atomic<bool> globalAbort(false);
-  std::atomic<bool> finished(false);
-
-  {
-    std::lock_guard<std::mutex> lock(queueMutex);
-    queue.push_back({source, target});
-  }
+  std::mutex progressMutex;
 
-  const int numThreads = 4;
+  const int numThreads = std::max(1, task.workerCount);
   {
     std::lock_guard<std::mutex> lock(m_cancelMutex);
     m_cancelFlags.clear();
@@ -105,129 +138,148 @@ void ComparingBackupStrategy::ProcessDirectory(
     }
   }
 
-  auto worker = [&](int threadIndex) {
-    activeWorkers++;
-    while (true) {
-      CompareWorkItem item;
-      {
-        std::unique_lock<std::mutex> lock(queueMutex);
-        cv.wait(lock, [&] {
-          return !queue.empty() || finished || globalAbort ||
-                 (task.IsAborted && task.IsAborted());
-        });
+  auto isAborted = [&] {
+    return globalAbort || (task.IsAborted && task.IsAborted());
+  };
 
-        if (globalAbort || (task.IsAborted && task.IsAborted()))
-          break;
-        if (queue.empty() && finished)
-          break;
-
-        if (queue.empty()) {
-          activeWorkers--;
-          if (activeWorkers == 0) {
-            finished = true;
-            if (logger)
-              logger->OnWorkerProgress(threadIndex, L"Idle", 0);
-            cv.notify_all();
-          } else {
-            cv.wait(lock, [&] {
-              return !queue.empty() || finished || globalAbort ||
-                     (task.IsAborted && task.IsAborted());
-            });
-            activeWorkers++;
-            if (globalAbort || (task.IsAborted && task.IsAborted()) ||
-                (queue.empty() && finished))
-              break;
-            if (!queue.empty()) {
-              item = queue.front();
-              queue.pop_front();
-            } else
-              continue;
-          }
-          if (finished)
-            break;
-        } else {
-          item = queue.front();
-          queue.pop_front();
-        }
-      }
+  std::shared_ptr<DevicePools> pools = task.devicePools;
+  if (!pools)
+    pools = std::make_shared<DevicePools>();
+  DevicePools::Device *sourceDevice = pools->Register(source);
+  DevicePools::Device *targetDevice = pools->Register(target);
+  if (task.criteriaData) {
+    SafeLog(logger, L"Source device " + sourceDevice->Describe());
+    SafeLog(logger, L"Target device " + targetDevice->Describe());
+  }
 
-      if (item.source.empty())
-        continue;
+  PathArena arena;
+  DirHandles targetDirs(arena, target, BackupUtils::MetadataRole::Target,
+                        &m_metadata);
+  typedef ParallelTreeWalker<CompareWorkItem> Walker;
+  auto visit = [&](CompareWorkItem &item, Walker::Context &ctx) {
+    const int threadIndex = ctx.WorkerIndex();
+    // Full paths exist only while the item is visited.
+    const fs::path itemSource = arena.Path(source, item.parent, item.name);
+    const fs::path itemTarget = arena.Path(target, item.parent, item.name);
 
-      int *myCancelFlag = m_cancelFlags[threadIndex].get();
-      *myCancelFlag = 0;
+    int *myCancelFlag = m_cancelFlags[threadIndex].get();
+    *myCancelFlag = 0;
 
-      auto progressCallback = [&](long long total, long long transferred) {
-        if (total > 0 && logger) {
-          int pct = (int)((transferred * 100) / total);
-          logger->OnWorkerProgress(threadIndex,
-                                   item.source.filename().wstring(), pct);
-        }
-      };
+    auto progressCallback = [&](long long total, long long transferred) {
+      if (total > 0 && logger) {
+        int pct = (int)((transferred * 100) / total);
+        logger->OnWorkerProgress(threadIndex,
+                                 itemSource.filename().wstring(), pct);
+      }
+    };
 
-      if (logger)
-        logger->OnWorkerProgress(threadIndex, item.source.filename().wstring(),
-                                 0);
+    if (logger)
+      logger->OnWorkerProgress(threadIndex, itemSource.filename().wstring(),
+                               0);
 
-      try {
-        if (fs::is_directory(item.source)) {
-          if (!fs::exists(item.target)) {
-            SafeLog(logger, L"MISSING DIR: " + item.target.wstring());
-          }
-          {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            for (const auto &entry : fs::directory_iterator(item.source)) {
-              queue.push_back(
-                  {entry.path(), item.target / entry.path().filename()});
-            }
-            cv.notify_all();
-          }
+    try {
+      BackupUtils::FileSnapshot targetInfo =
+          targetDirs.Snapshot(item.parent, item.name);
+
+      if (item.info.IsDirectory()) {
+        if (!targetInfo.Exists()) {
+          SafeLog(logger, L"MISSING DIR: " + itemTarget.wstring());
+        }
+        const PathArena::NodeId node =
+            item.name.empty() ? item.parent
+                              : arena.Add(item.parent, item.name);
+        long long foundFiles = 0, foundBytes = 0;
+        for (const auto &entry : fs::directory_iterator(itemSource)) {
+          BackupUtils::FileSnapshot info = BackupUtils::SnapshotEntry(
+              entry, BackupUtils::MetadataRole::Source, &m_metadata);
+          if (task.filter && task.filter->Excludes(source, entry.path(), info))
+            continue;
+          if (progress.isEstimate)
+            BackupUtils::CountEntry(info, foundFiles, foundBytes);
+          ctx.Push({node, entry.path().filename().native(), info});
+        }
+        if (foundFiles > 0 && logger) {
+          std::lock_guard<std::mutex> lock(progressMutex);
+          progress.totalFiles += foundFiles;
+          progress.totalBytes += foundBytes;
+          logger->OnProgressDetailed(progress);
+        }
+      } else {
+        bool mismatch = false;
+        if (!targetInfo.Exists()) {
+          SafeLog(logger, L"MISSING FILE: " + itemTarget.wstring());
+          mismatch = true;
         } else {
-          bool mismatch = false;
-          if (!fs::exists(item.target)) {
-            SafeLog(logger, L"MISSING FILE: " + item.target.wstring());
+          // A content comparison reads both files.
+          DevicePools::Slot slot(task.criteriaData ? sourceDevice : nullptr,
+                                 task.criteriaData ? targetDevice : nullptr,
+                                 isAborted);
+          // Refused only while the run aborts: the file is left unread.
+          if (slot.Refused())
+            return;
+          if (BackupUtils::NeedsUpdate(item.info, targetInfo, itemSource,
+                                       itemTarget, task, myCancelFlag,
+                                       progressCallback))
             mismatch = true;
-          } else {
-            if (BackupUtils::NeedsUpdate(item.source, item.target, task,
-                                         myCancelFlag, progressCallback))
-              mismatch = true;
-          }
+        }
 
-          if (mismatch && fs::exists(item.target)) {
-            SafeLog(logger, L"MISMATCH: " + item.source.wstring());
-          }
+        if (mismatch && targetInfo.Exists()) {
+          SafeLog(logger, L"MISMATCH: " + itemSource.wstring());
+        }
 
-          if (logger) {
-            static std::mutex s_progressMutex;
-            std::lock_guard<std::mutex> lock(s_progressMutex);
-            progress.processedFiles++;
-            if (!fs::is_symlink(item.source)) {
-              try {
-                progress.processedBytes += fs::file_size(item.source);
-              } catch (...) {
-              }
-            }
-            progress.currentFile = item.source.filename().wstring();
-            logger->OnProgressDetailed(progress);
-          }
+        if (logger) {
+          std::lock_guard<std::mutex> lock(progressMutex);
+          progress.processedFiles++;
+          if (!item.info.IsSymlink())
+            progress.processedBytes += item.info.size;
+          progress.currentFile = itemSource.filename().wstring();
+          logger->OnProgressDetailed(progress);
         }
-      } catch (...) {
-        if (task.errorPolicy == ErrorPolicy::Suspend)
-          globalAbort = true;
       }
-    }
-    activeWorkers--;
-    if (activeWorkers == 0) {
-      finished = true;
-      cv.notify_all();
+    } catch (...) {
+      if (task.errorPolicy == ErrorPolicy::Suspend)
+        globalAbort = true;
     }
   };
 
-  std::vector<std::thread> workers;
-  for (int i = 0; i < numThreads; ++i)
-    workers.push_back(std::thread(worker, i));
-  for (auto &t : workers)
-    t.join();
+  Walker walker(numThreads);
+  walker.SetMemoryBudget(task.traversalMemoryBudget, CompareWorkItemCodec());
+  if (logger)
+    logger->OnWorkersStarted(numThreads);
+
+  AdaptiveConcurrency adaptive(numThreads, 4);
+  if (task.adaptiveWorkers) {
+    walker.SetActiveLimit(adaptive.Limit());
+    adaptive.Start(
+        [&](long long &bytes, long long &files) {
+          std::lock_guard<std::mutex> lock(progressMutex);
+          bytes = progress.processedBytes;
+          files = progress.processedFiles;
+        },
+        [&](int limit) {
+          walker.SetActiveLimit(limit);
+          if (logger) {
+            for (int i = limit; i < numThreads; ++i)
+              logger->OnWorkerProgress(i, L"Idle", 0);
+          }
+        });
+  }
+
+  CompareWorkItem root{PathArena::kRoot, fs::path::string_type(),
+                       BackupUtils::SnapshotSource(source, &m_metadata)};
+  Walker::Stats walkStats = walker.Run({root}, visit, isAborted);
+  if (task.adaptiveWorkers) {
+    adaptive.Stop();
+    SafeLog(logger, adaptive.Describe());
+  }
+  if (task.traversalMemoryBudget > 0)
+    SafeLog(logger, BackupUtils::FormatTraversalStats(
+                        task.traversalMemoryBudget, walkStats.peakQueuedBytes,
+                        walkStats.spilled, walkStats.peakSpillBytes));
+  SafeLog(logger, arena.FormatStats());
+  const std::wstring handleStats = targetDirs.FormatStats();
+  if (!handleStats.empty())
+    SafeLog(logger, handleStats);
 
   if (globalAbort)
     throw std::runtime_error("Comparison suspended due to error policy.");
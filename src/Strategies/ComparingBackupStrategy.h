@@ -1,5 +1,6 @@
 #pragma once
 
+#include "BackupUtils.h"
 #include "IBackupStrategy.h"
 #include <memory>
 #include <mutex>
@@ -16,6 +17,8 @@ private:
                         const BackupTask &task, IBackupLogger *logger,
                         bool dryRun, TaskProgress &progress);
 
+  BackupUtils::MetadataStats m_metadata;
+
   std::vector<std::shared_ptr<int>> m_cancelFlags;
   std::mutex m_cancelMutex;
 
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "BackupUtils.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Per-device concurrency limits for file data transfers. A copy holds a
+// slot on the device it reads from and one on the device it writes to, so
+// each device sees only as many transfers at once as suits it:
+//   rotational disks   1: transfers run one after another instead of
+//                      interleaving and making the heads seek between files;
+//   flash              its queue depth (4 to 64), enough to keep it full;
+//   network / unknown  no limit beyond the worker count.
+// Directory listing is not gated. The units of a set run share one instance,
+// so units on the same device also share its slots.
+class DevicePools {
+public:
+  class Device {
+  public:
+    const BackupUtils::DeviceProfile &Profile() const { return m_profile; }
+    int Limit() const { return m_limit; } // 0 = unlimited
+
+    // "sda: rotational, queue depth 64, 1 transfer at a time"
+    std::wstring Describe() const {
+      std::wstringstream ss;
+      ss << m_profile.name << L": ";
+      switch (m_profile.kind) {
+      case BackupUtils::DeviceProfile::Kind::Rotational:
+        ss << L"rotational";
+        break;
+      case BackupUtils::DeviceProfile::Kind::Flash:
+        ss << L"flash";
+        break;
+      case BackupUtils::DeviceProfile::Kind::Network:
+        ss << L"network";
+        break;
+      default:
+        ss << L"unknown type";
+        break;
+      }
+      if (m_profile.queueDepth > 0)
+        ss << L", queue depth " << m_profile.queueDepth;
+      if (m_limit > 0)
+        ss << L", " << m_limit
+           << (m_limit == 1 ? L" transfer at a time" : L" transfers at once");
+      else
+        ss << L", no transfer limit";
+      return ss.str();
+    }
+
+    // "sda: peak 1, 532 waits"
+    std::wstring FormatStats() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::wstringstream ss;
+      ss << m_profile.name << L": peak " << m_peak << L", " << m_waits
+         << L" waits";
+      return ss.str();
+    }
+
+  private:
+    friend class DevicePools;
+
+    explicit Device(const BackupUtils::DeviceProfile &profile)
+        : m_profile(profile) {
+      switch (profile.kind) {
+      case BackupUtils::DeviceProfile::Kind::Rotational:
+        m_limit = 1;
+        break;
+      case BackupUtils::DeviceProfile::Kind::Flash:
+        m_limit = profile.queueDepth > 0
+                      ? std::min(std::max(profile.queueDepth, 4), 64)
+                      : 32;
+        break;
+      default:
+        m_limit = 0;
+        break;
+      }
+    }
+
+    // Returns false without holding a slot once isAborted reports true.
+    bool Acquire(const std::function<bool()> &isAborted) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (m_active >= m_limit)
+        m_waits++;
+      while (m_active >= m_limit) {
+        if (isAborted && isAborted())
+          return false;
+        m_cv.wait_for(lock, std::chrono::milliseconds(100));
+      }
+      m_active++;
+      m_peak = std::max(m_peak, m_active);
+      return true;
+    }
+
+    void Release() {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active--;
+      }
+      m_cv.notify_one();
+    }
+
+    const BackupUtils::DeviceProfile m_profile;
+    int m_limit = 0;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    int m_active = 0;
+    int m_peak = 0;
+    long long m_waits = 0;
+  };
+
+  // Holds a slot on each of up to two devices (null or unlimited devices are
+  // skipped) for its lifetime. Slots are always taken in the same order, so
+  // two transfers between the same pair of devices cannot deadlock. Refused
+  // when isAborted ended a wait: the caller must skip its transfer instead
+  // of running it ungated.
+  class Slot {
+  public:
+    Slot(Device *a, Device *b,
+         const std::function<bool()> &isAborted = nullptr) {
+      if (a == b)
+        b = nullptr;
+      if (std::less<Device *>()(b, a))
+        std::swap(a, b);
+      Take(a, isAborted);
+      Take(b, isAborted);
+    }
+    ~Slot() {
+      for (auto it = m_held.rbegin(); it != m_held.rend(); ++it)
+        (*it)->Release();
+    }
+    Slot(const Slot &) = delete;
+    Slot &operator=(const Slot &) = delete;
+
+    bool Refused() const { return m_refused; }
+
+  private:
+    void Take(Device *device, const std::function<bool()> &isAborted) {
+      if (!device || device->Limit() <= 0 || m_refused)
+        return;
+      if (device->Acquire(isAborted))
+        m_held.push_back(device);
+      else
+        m_refused = true;
+    }
+    std::vector<Device *> m_held;
+    bool m_refused = false;
+  };
+
+  // The device holding path, probed on first use. The pointer stays valid
+  // for the lifetime of the DevicePools.
+  Device *Register(const fs::path &path) {
+    BackupUtils::DeviceProfile profile = BackupUtils::ProbeDevice(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!profile.key.empty()) {
+      for (auto &device : m_devices)
+        if (device->Profile().key == profile.key)
+          return device.get();
+    }
+    m_devices.emplace_back(new Device(profile));
+    return m_devices.back().get();
+  }
+
+private:
+  std::mutex m_mutex; // m_devices
+  std::vector<std::unique_ptr<Device>> m_devices;
+};
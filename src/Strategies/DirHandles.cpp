@@ -0,0 +1,149 @@
+#include "DirHandles.h"
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#endif
+
+struct DirHandles::Handle {
+  int fd = -1;
+  ~Handle() {
+#ifndef _WIN32
+    if (fd >= 0)
+      ::close(fd);
+#endif
+  }
+};
+
+DirHandles::DirHandles(const PathArena &arena, const fs::path &root,
+                       BackupUtils::MetadataRole role,
+                       BackupUtils::MetadataStats *stats, size_t capacity)
+    : m_arena(arena), m_root(root), m_role(role), m_stats(stats),
+      m_capacity(capacity > 0 ? capacity : 1) {}
+
+DirHandles::~DirHandles() = default;
+
+fs::path DirHandles::FullPath(NodeId dir, const String &name) const {
+  return m_arena.Path(m_root, dir, name);
+}
+
+std::shared_ptr<DirHandles::Handle> DirHandles::Open(NodeId node) {
+#ifdef _WIN32
+  (void)node;
+  return nullptr;
+#else
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_index.find(node);
+    if (found != m_index.end()) {
+      m_lru.splice(m_lru.begin(), m_lru, found->second);
+      return found->second->second;
+    }
+  }
+
+  // Two workers may open the same directory at once; both descriptors are
+  // valid and the second one simply replaces the first in the cache.
+  auto handle = std::make_shared<Handle>();
+  const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+  bool relative = false;
+  if (node == PathArena::kRoot) {
+    // The root may be a symlink to the tree; follow it.
+    handle->fd = ::open(m_root.c_str(), flags);
+  } else {
+    std::shared_ptr<Handle> parent = Open(m_arena.Parent(node));
+    if (parent) {
+      const String name(m_arena.Name(node));
+      handle->fd = ::openat(parent->fd, name.c_str(), flags | O_NOFOLLOW);
+      relative = true;
+    } else {
+      handle->fd = ::open(FullPath(node, String()).c_str(), flags);
+    }
+  }
+  if (handle->fd < 0)
+    return nullptr;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_opened++;
+  if (relative)
+    m_relative++;
+  auto found = m_index.find(node);
+  if (found != m_index.end()) {
+    m_lru.erase(found->second);
+    m_index.erase(found);
+  }
+  m_lru.emplace_front(node, handle);
+  m_index[node] = m_lru.begin();
+  while (m_lru.size() > m_capacity) {
+    m_index.erase(m_lru.back().first);
+    m_lru.pop_back();
+    m_evicted++;
+  }
+  return handle;
+#endif
+}
+
+BackupUtils::FileSnapshot DirHandles::Snapshot(NodeId dir,
+                                               const String &name) {
+#ifndef _WIN32
+  if (!name.empty()) {
+    if (std::shared_ptr<Handle> handle = Open(dir))
+      return BackupUtils::SnapshotAt(handle->fd, name.c_str(), m_role,
+                                     m_stats);
+  }
+#endif
+  const fs::path path = FullPath(dir, name);
+  return m_role == BackupUtils::MetadataRole::Target
+             ? BackupUtils::SnapshotTarget(path, m_stats)
+             : BackupUtils::SnapshotSource(path, m_stats);
+}
+
+bool DirHandles::List(NodeId node,
+                      std::vector<BackupUtils::ListedEntry> &entries) {
+#ifndef _WIN32
+  if (std::shared_ptr<Handle> handle = Open(node))
+    return BackupUtils::ListDirectoryAt(handle->fd, m_role, entries, m_stats);
+#endif
+  return BackupUtils::ListDirectory(FullPath(node, String()), m_role,
+                                    entries, m_stats);
+}
+
+void DirHandles::MakeDirectory(NodeId dir, const String &name) {
+#ifndef _WIN32
+  if (!name.empty()) {
+    if (std::shared_ptr<Handle> handle = Open(dir)) {
+      if (::mkdirat(handle->fd, name.c_str(), 0777) == 0 || errno == EEXIST)
+        return;
+      const std::error_code ec(errno, std::generic_category());
+      throw fs::filesystem_error("mkdirat", FullPath(dir, name), ec);
+    }
+  }
+#endif
+  fs::create_directories(FullPath(dir, name));
+}
+
+bool DirHandles::RemoveAll(NodeId dir, const String &name) {
+#ifndef _WIN32
+  if (!name.empty()) {
+    if (std::shared_ptr<Handle> handle = Open(dir))
+      return BackupUtils::RemoveAllAt(handle->fd, name.c_str());
+  }
+#endif
+  std::error_code ec;
+  fs::remove_all(FullPath(dir, name), ec);
+  return !ec;
+}
+
+std::wstring DirHandles::FormatStats() const {
+#ifdef _WIN32
+  return std::wstring();
+#else
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return std::wstring(L"Directory handles (") +
+         (m_role == BackupUtils::MetadataRole::Target ? L"target" : L"source") +
+         L"): " + std::to_wstring(m_opened) + L" opened, " +
+         std::to_wstring(m_relative) + L" relative, " +
+         std::to_wstring(m_evicted) + L" evicted";
+#endif
+}
@@ -0,0 +1,191 @@
+#include "ExecutionPlan.h"
+#include "RecordLog.h"
+
+namespace {
+using RecordLog::Get;
+using RecordLog::Put;
+
+// RecordLog framing. Payload: u8 op, u8 source type, i64 size, i64 mtime,
+// UTF-8 path.
+const char kMagic[8] = {'S', 'B', 'P', 'L', 'A', 'N', '\0', '\0'};
+const unsigned int kVersion = 1;
+const size_t kPayloadFixed = 2 + 8 + 8;
+// Records are written in blocks of about this size.
+const size_t kWriteBlock = 1024 * 1024;
+
+void EncodeRecord(std::vector<char> &out, ExecutionPlan::Op op,
+                  const BackupUtils::FileSnapshot &source,
+                  const std::string &path) {
+  const size_t start = RecordLog::BeginRecord(out);
+  Put<unsigned char>(out, (unsigned char)op);
+  Put<unsigned char>(out, (unsigned char)source.type);
+  Put<long long>(out, source.size);
+  Put<long long>(out, source.mtime);
+  out.insert(out.end(), path.begin(), path.end());
+  RecordLog::EndRecord(out, start);
+}
+} // namespace
+
+std::string ExecutionPlan::KeyFor(const fs::path &relative) {
+  return relative.generic_u8string();
+}
+
+bool ExecutionPlan::Create(const fs::path &file, const fs::path &source,
+                           const fs::path &target, std::wstring &errorMsg) {
+  Abandon();
+  Clear();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::error_code ec;
+  fs::create_directories(file.parent_path(), ec);
+  m_out.open(file, std::ios::binary | std::ios::trunc);
+  if (!m_out.is_open()) {
+    errorMsg = L"Cannot create plan " + file.wstring();
+    return false;
+  }
+  m_file = file;
+  m_fileBytes = 0;
+  m_buffer.clear();
+  RecordLog::PutHeader(m_buffer, kMagic, kVersion);
+  EncodeRecord(m_buffer, Op::Job, BackupUtils::FileSnapshot(),
+               RecordLog::JobKey(source, target));
+  return true;
+}
+
+void ExecutionPlan::Add(Op op, const std::string &path,
+                        const BackupUtils::FileSnapshot &source) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_out.is_open())
+    return;
+  EncodeRecord(m_buffer, op, source, path);
+  Count({op, source, std::string()});
+  if (m_buffer.size() >= kWriteBlock)
+    WriteBuffer();
+}
+
+void ExecutionPlan::WriteBuffer() {
+  m_out.write(m_buffer.data(), (std::streamsize)m_buffer.size());
+  m_fileBytes += (long long)m_buffer.size();
+  m_buffer.clear();
+}
+
+bool ExecutionPlan::Finish(std::wstring &errorMsg) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_out.is_open())
+    return false;
+  EncodeRecord(m_buffer, Op::End, BackupUtils::FileSnapshot(), std::string());
+  WriteBuffer();
+  m_out.close();
+  if (m_out.fail()) {
+    errorMsg = L"Cannot write plan " + m_file.wstring();
+    std::error_code ec;
+    fs::remove(m_file, ec);
+    return false;
+  }
+  return true;
+}
+
+void ExecutionPlan::Abandon() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_out.is_open())
+    return;
+  m_out.close();
+  m_buffer.clear();
+  std::error_code ec;
+  fs::remove(m_file, ec);
+}
+
+bool ExecutionPlan::Load(const fs::path &file, const fs::path &source,
+                         const fs::path &target, std::wstring &errorMsg) {
+  Clear();
+  std::vector<char> data;
+  if (!RecordLog::ReadFile(file, data)) {
+    errorMsg = L"No plan at " + file.wstring() + L"; run a preview first";
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_file = file;
+  m_fileBytes = (long long)data.size();
+  const std::string job = RecordLog::JobKey(source, target);
+  bool started = false, otherJob = false, complete = false;
+  const size_t good = RecordLog::Replay(
+      data, kMagic, kVersion, kPayloadFixed,
+      [&](const char *payload, size_t length) {
+        Entry entry;
+        entry.op = (Op)Get<unsigned char>(payload);
+        entry.source.type =
+            (BackupUtils::FileSnapshot::Type)Get<unsigned char>(payload + 1);
+        entry.source.size = Get<long long>(payload + 2);
+        entry.source.mtime = Get<long long>(payload + 10);
+        entry.path.assign(payload + kPayloadFixed, length - kPayloadFixed);
+        if (!started) {
+          started = true;
+          otherJob = entry.op != Op::Job || entry.path != job;
+          return !otherJob;
+        }
+        switch (entry.op) {
+        case Op::MakeDirectory:
+        case Op::Copy:
+        case Op::Link:
+        case Op::Delete:
+          Count(entry);
+          m_entries.push_back(std::move(entry));
+          break;
+        case Op::End:
+          complete = true;
+          break;
+        default:
+          break;
+        }
+        return !complete;
+      });
+  if (good == 0) {
+    errorMsg = L"Not a plan file: " + file.wstring();
+    return false;
+  }
+  if (otherJob) {
+    errorMsg = L"The plan " + file.wstring() +
+               L" was made for another source or target";
+    return false;
+  }
+  if (!complete) {
+    Clear();
+    errorMsg = L"The plan " + file.wstring() +
+               L" is incomplete or damaged; run the preview again";
+    return false;
+  }
+  return true;
+}
+
+void ExecutionPlan::Clear() {
+  std::vector<Entry>().swap(m_entries);
+  m_directories = m_copies = m_copyBytes = m_links = m_deletes = 0;
+}
+
+void ExecutionPlan::Count(const Entry &entry) {
+  switch (entry.op) {
+  case Op::MakeDirectory:
+    m_directories++;
+    break;
+  case Op::Copy:
+    m_copies++;
+    m_copyBytes += entry.source.size;
+    break;
+  case Op::Link:
+    m_links++;
+    break;
+  case Op::Delete:
+    m_deletes++;
+    break;
+  default:
+    break;
+  }
+}
+
+std::wstring ExecutionPlan::FormatStats() const {
+  return L"Plan: " + std::to_wstring(m_directories) + L" directories, " +
+         std::to_wstring(m_copies) + L" copies (" +
+         std::to_wstring(m_copyBytes / (1024 * 1024)) + L" MB), " +
+         std::to_wstring(m_links) + L" links, " + std::to_wstring(m_deletes) +
+         L" deletes in " + std::to_wstring(m_fileBytes / 1024) + L" KB";
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "BackupUtils.h"
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Execution plan of a preview run: the directory creations, copies, link
+// copies and deletions the Parallel engine decided on, each with the source
+// metadata the decision was based on. Applying the plan performs them
+// across the worker pool without walking or comparing the trees again;
+// only entries whose source changed since the preview are checked again.
+//
+// Like TargetCatalog the file is a 16-byte header followed by CRC-protected
+// records (RecordLog). The first record names the source and target, the last one marks
+// the plan complete: a preview that was stopped leaves a plan that cannot
+// be applied.
+//
+// Paths are relative to the roots, UTF-8 and '/' separated (KeyFor).
+class ExecutionPlan {
+public:
+  enum class Op : unsigned char {
+    Job = 1,
+    MakeDirectory = 2,
+    Copy = 3,
+    Link = 4,
+    Delete = 5,
+    End = 6
+  };
+  struct Entry {
+    Op op = Op::Copy;
+    BackupUtils::FileSnapshot source; // Type, size and mtime when planned
+    std::string path;
+  };
+
+  ExecutionPlan() = default;
+  ~ExecutionPlan() { Abandon(); }
+  ExecutionPlan(const ExecutionPlan &) = delete;
+  ExecutionPlan &operator=(const ExecutionPlan &) = delete;
+
+  static std::string KeyFor(const fs::path &relative);
+
+  // Preview side. Add may be called from any thread.
+  bool Create(const fs::path &file, const fs::path &source,
+              const fs::path &target, std::wstring &errorMsg);
+  bool IsRecording() const { return m_out.is_open(); }
+  void Add(Op op, const std::string &path,
+           const BackupUtils::FileSnapshot &source);
+  // Marks the plan complete and closes it.
+  bool Finish(std::wstring &errorMsg);
+  // Closes and deletes an unfinished plan.
+  void Abandon();
+
+  // Apply side: reads a complete plan made for source and target.
+  bool Load(const fs::path &file, const fs::path &source,
+            const fs::path &target, std::wstring &errorMsg);
+  const std::vector<Entry> &Entries() const { return m_entries; }
+  void Clear();
+
+  // "Plan: 12 directories, 1204 copies (3210 MB), 3 links, 20 deletes in
+  // 61 KB"
+  std::wstring FormatStats() const;
+
+private:
+  void Count(const Entry &entry);
+  void WriteBuffer();
+
+  fs::path m_file;
+  std::mutex m_mutex; // Guards the writing members and the counts
+  std::ofstream m_out;
+  std::vector<char> m_buffer; // Encoded records not yet written
+  long long m_fileBytes = 0;
+  std::vector<Entry> m_entries; // Loaded plan
+
+  long long m_directories = 0;
+  long long m_copies = 0;
+  long long m_copyBytes = 0;
+  long long m_links = 0;
+  long long m_deletes = 0;
+};
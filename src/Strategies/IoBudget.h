@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Caps the bytes being copied at once across all units of a set run
+// (SetScheduler). A copy leases its size before it starts and gives it back
+// when it ends. A lease larger than the whole budget is granted as soon as
+// nothing else is in flight, so no file is ever refused.
+class IoBudget {
+public:
+  explicit IoBudget(long long capacity) : m_capacity(capacity) {}
+
+  // Holds bytes of a budget for its lifetime. A null budget is unlimited.
+  // Refused when isAborted ended the wait: the caller must skip its copy
+  // instead of running it outside the budget.
+  class Lease {
+  public:
+    Lease(const std::shared_ptr<IoBudget> &budget, long long bytes,
+          const std::function<bool()> &isAborted = nullptr)
+        : m_budget(budget.get()) {
+      if (m_budget && !m_budget->Acquire(bytes, isAborted, m_bytes)) {
+        m_budget = nullptr;
+        m_refused = true;
+      }
+    }
+    ~Lease() {
+      if (m_budget)
+        m_budget->Release(m_bytes);
+    }
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+
+    bool Refused() const { return m_refused; }
+
+  private:
+    IoBudget *m_budget;
+    long long m_bytes = 0;
+    bool m_refused = false;
+  };
+
+  long long Capacity() const { return m_capacity; }
+  long long Peak() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_peak;
+  }
+
+private:
+  // Waits until the bytes fit. Returns false without holding anything once
+  // isAborted reports true.
+  bool Acquire(long long bytes, const std::function<bool()> &isAborted,
+               long long &granted) {
+    granted = std::min(std::max(bytes, 0LL), m_capacity);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_inFlight > 0 && m_inFlight + granted > m_capacity) {
+      if (isAborted && isAborted())
+        return false;
+      m_cv.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    m_inFlight += granted;
+    m_peak = std::max(m_peak, m_inFlight);
+    return true;
+  }
+
+  void Release(long long bytes) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_inFlight -= bytes;
+    }
+    m_cv.notify_all();
+  }
+
+  const long long m_capacity;
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cv;
+  long long m_inFlight = 0;
+  long long m_peak = 0;
+};
@@ -0,0 +1,292 @@
+#include "JobJournal.h"
+#include "RecordLog.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+namespace {
+using RecordLog::Get;
+using RecordLog::Put;
+
+// RecordLog framing. Payload: u8 op, four i64 values, UTF-8 key. The first
+// record is OpJob, whose key names the source and the target.
+const char kMagic[8] = {'S', 'B', 'J', 'R', 'N', 'L', '\0', '\0'};
+const unsigned int kVersion = 1;
+const size_t kValues = 4;
+const size_t kPayloadFixed = 1 + kValues * 8;
+
+void EncodeRecord(std::vector<char> &out, unsigned char op,
+                  const long long (&values)[kValues], const std::string &key) {
+  const size_t start = RecordLog::BeginRecord(out);
+  Put<unsigned char>(out, op);
+  for (long long value : values)
+    Put<long long>(out, value);
+  out.insert(out.end(), key.begin(), key.end());
+  RecordLog::EndRecord(out, start);
+}
+} // namespace
+
+bool JobJournal::Open(const fs::path &file, const fs::path &source,
+                      const fs::path &target, int syncMs,
+                      std::wstring &errorMsg) {
+  Close();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file = file;
+    m_target = target;
+    m_syncMs = std::max(0, syncMs);
+    m_files.clear();
+    m_ranges.clear();
+    m_pending.clear();
+    m_pendingData.clear();
+    m_partials.clear();
+    m_stop = false;
+    m_stats.loaded = 0;
+    m_stats.skippedFiles = 0;
+    m_stats.skippedBytes = 0;
+    m_stats.resumedRanges = 0;
+    m_stats.recorded = 0;
+    m_stats.commits = 0;
+    if (!Load(RecordLog::JobKey(source, target), errorMsg))
+      return false;
+    m_open = true;
+  }
+  if (m_syncMs > 0)
+    m_syncer = std::thread([this] {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (!m_stop) {
+        m_wake.wait_for(lock, std::chrono::milliseconds(m_syncMs));
+        lock.unlock();
+        Commit();
+        lock.lock();
+      }
+    });
+  return true;
+}
+
+bool JobJournal::Load(const std::string &job, std::wstring &errorMsg) {
+  std::vector<char> data;
+  RecordLog::ReadFile(m_file, data);
+
+  bool first = true, sameJob = false;
+  const size_t good = RecordLog::Replay(
+      data, kMagic, kVersion, kPayloadFixed,
+      [&](const char *payload, size_t length) {
+        unsigned char op = Get<unsigned char>(payload);
+        long long values[kValues];
+        for (size_t i = 0; i < kValues; ++i)
+          values[i] = Get<long long>(payload + 1 + i * 8);
+        std::string key(payload + kPayloadFixed, length - kPayloadFixed);
+        if (first) {
+          first = false;
+          sameJob = op == OpJob && key == job;
+          return sameJob;
+        }
+        Replay(op, values, std::move(key));
+        m_stats.loaded++;
+        return true;
+      });
+
+  std::error_code ec;
+  if (!sameJob) {
+    // Missing, unreadable or another job's: start a new journal.
+    m_files.clear();
+    m_ranges.clear();
+    m_stats.loaded = 0;
+    fs::create_directories(m_file.parent_path(), ec);
+    std::vector<char> header;
+    RecordLog::PutHeader(header, kMagic, kVersion);
+    const long long none[kValues] = {0, 0, 0, 0};
+    EncodeRecord(header, OpJob, none, job);
+    {
+      std::ofstream out(m_file, std::ios::binary | std::ios::trunc);
+      if (!out.write(header.data(), (std::streamsize)header.size())) {
+        errorMsg = L"Cannot create journal " + m_file.wstring();
+        return false;
+      }
+    }
+    BackupUtils::SyncFile(m_file);
+  } else if (good < data.size()) {
+    // Drop the records a crash left half written.
+    fs::resize_file(m_file, good, ec);
+    if (ec) {
+      errorMsg = L"Cannot repair journal " + m_file.wstring();
+      return false;
+    }
+  }
+  return true;
+}
+
+void JobJournal::Replay(unsigned char op, const long long *values,
+                        std::string key) {
+  switch (op) {
+  case OpFile: {
+    File &file = m_files[std::move(key)];
+    file.size = values[0];
+    file.mtime = values[1];
+    break;
+  }
+  case OpRange: {
+    const long long size = values[0], mtime = values[1];
+    const long long rangeSize = values[2], index = values[3];
+    if (rangeSize <= 0 || index < 0 || index * rangeSize >= size)
+      break;
+    RangeState &state = m_ranges[std::move(key)];
+    if (state.size != size || state.mtime != mtime ||
+        state.ranges.rangeSize != rangeSize) {
+      // The source changed between runs: earlier ranges are worthless.
+      state.size = size;
+      state.mtime = mtime;
+      state.ranges.rangeSize = rangeSize;
+      state.ranges.done.assign((size_t)((size + rangeSize - 1) / rangeSize),
+                               false);
+    }
+    state.ranges.done[(size_t)index] = true;
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void JobJournal::StopSyncer() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  if (m_syncer.joinable())
+    m_syncer.join();
+}
+
+void JobJournal::Close() {
+  if (!m_open)
+    return;
+  StopSyncer();
+  Commit();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_files.clear();
+  m_ranges.clear();
+  m_partials.clear();
+  m_open = false;
+}
+
+void JobJournal::Complete() {
+  if (!m_open)
+    return;
+  StopSyncer();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_pending.clear();
+  m_pendingData.clear();
+  m_files.clear();
+  m_ranges.clear();
+  std::error_code ec;
+  for (const fs::path &partial : m_partials)
+    fs::remove(partial, ec);
+  m_partials.clear();
+  fs::remove(m_file, ec);
+  m_open = false;
+}
+
+bool JobJournal::FindFile(const std::string &key,
+                          const BackupUtils::FileSnapshot &source) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_files.find(key);
+  if (it == m_files.end() || it->second.size != source.size ||
+      it->second.mtime != source.mtime)
+    return false;
+  m_stats.skippedFiles++;
+  m_stats.skippedBytes += source.size;
+  return true;
+}
+
+bool JobJournal::FindRanges(const std::string &key,
+                            const BackupUtils::FileSnapshot &source,
+                            Ranges &ranges) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_ranges.find(key);
+  if (it == m_ranges.end() || it->second.size != source.size ||
+      it->second.mtime != source.mtime)
+    return false;
+  ranges = it->second.ranges;
+  m_stats.resumedRanges +=
+      (long long)std::count(ranges.done.begin(), ranges.done.end(), true);
+  return true;
+}
+
+void JobJournal::RecordFile(const std::string &key,
+                            const BackupUtils::FileSnapshot &source,
+                            const fs::path &written) {
+  Append(OpFile, source.size, source.mtime, 0, 0, key, written);
+}
+
+void JobJournal::RecordRange(const std::string &key,
+                             const BackupUtils::FileSnapshot &source,
+                             long long rangeSize, long long index,
+                             const fs::path &partial) {
+  Append(OpRange, source.size, source.mtime, rangeSize, index, key, partial);
+}
+
+void JobJournal::KeepPartial(const fs::path &partial) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_open)
+    m_partials.push_back(partial);
+}
+
+void JobJournal::Append(unsigned char op, long long a, long long b,
+                        long long c, long long d, const std::string &key,
+                        const fs::path &written) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_open)
+      return;
+    const long long values[kValues] = {a, b, c, d};
+    EncodeRecord(m_pending, op, values, key);
+    if (!written.empty())
+      m_pendingData.push_back(written);
+    m_stats.recorded++;
+    if (m_syncMs > 0)
+      return;
+  }
+  Commit();
+}
+
+void JobJournal::Commit() {
+  std::lock_guard<std::mutex> commit(m_commitMutex);
+  std::vector<char> records;
+  std::vector<fs::path> data;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    records.swap(m_pending);
+    data.swap(m_pendingData);
+  }
+  if (records.empty())
+    return;
+
+  // The data first: a record must never be durable before what it vouches
+  // for. Files renamed since (committed partials) fail harmlessly; their
+  // final name is in the list too.
+  if (!data.empty() && !BackupUtils::SyncFileSystem(m_target)) {
+    std::sort(data.begin(), data.end());
+    data.erase(std::unique(data.begin(), data.end()), data.end());
+    for (const fs::path &path : data)
+      BackupUtils::SyncFile(path);
+  }
+  {
+    std::ofstream out(m_file, std::ios::binary | std::ios::app);
+    out.write(records.data(), (std::streamsize)records.size());
+  }
+  BackupUtils::SyncFile(m_file);
+  m_stats.commits++;
+}
+
+std::wstring JobJournal::FormatStats() const {
+  return L"Journal: " + std::to_wstring(m_stats.loaded.load()) +
+         L" records resumed (" + std::to_wstring(m_stats.skippedFiles.load()) +
+         L" files, " +
+         std::to_wstring(m_stats.skippedBytes.load() / (1024 * 1024)) +
+         L" MB skipped; " + std::to_wstring(m_stats.resumedRanges.load()) +
+         L" ranges kept), " + std::to_wstring(m_stats.recorded.load()) +
+         L" records written in " + std::to_wstring(m_stats.commits.load()) +
+         L" commits";
+}
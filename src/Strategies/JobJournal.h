@@ -0,0 +1,134 @@
+#pragma once
+#include "BackupUtils.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Checkpoint journal of one backup job, so that a run cut short (Abort, the
+// Suspend error policy, a crash or reboot) resumes where it stopped instead
+// of scanning and comparing the whole tree again.
+//
+// Like TargetCatalog it is an append-only log of CRC-protected records
+// (RecordLog), replayed on open up to the first damaged one. A record says that a file
+// (as of its source size and mtime) or one range of a ranged copy is done.
+// Records are committed in groups every syncMs: first the target data they
+// vouch for is synced (the whole target file system where syncfs exists,
+// else file by file), then they are appended and the journal itself is
+// synced. A record therefore never reaches the disk before its data, and a
+// crash loses at most the last interval's records, whose work is simply
+// done again.
+//
+// Directories are not recorded: a resumed run lists every directory again
+// and skips the recorded files that are unchanged. A directory's mtime only
+// changes with its own entries, not with files edited further down, so no
+// cheaper check could vouch for a whole subtree. The listing is what a
+// resume costs; the copies, comparisons and ranges are what it saves.
+//
+// The journal lives only while its job is unfinished: Complete deletes it.
+// Opening the journal an interrupted run of the same source and target left
+// behind resumes that run; one of another job is started over.
+//
+// Keys are paths relative to the source root, UTF-8 and '/' separated.
+// Thread-safe.
+class JobJournal {
+public:
+  // Ranges of a ranged copy whose data is durable in the partial file.
+  struct Ranges {
+    long long rangeSize = 0;
+    std::vector<bool> done;
+  };
+
+  struct Stats {
+    std::atomic<long long> loaded{0};       // Records replayed by Open
+    std::atomic<long long> skippedFiles{0}; // Resume: not compared again
+    std::atomic<long long> skippedBytes{0}; // In skipped files
+    std::atomic<long long> resumedRanges{0}; // Ranges not copied again
+    std::atomic<long long> recorded{0};      // Records appended this run
+    std::atomic<long long> commits{0};
+  };
+
+  JobJournal() = default;
+  ~JobJournal() { Close(); }
+  JobJournal(const JobJournal &) = delete;
+  JobJournal &operator=(const JobJournal &) = delete;
+
+  bool Open(const fs::path &file, const fs::path &source,
+            const fs::path &target, int syncMs, std::wstring &errorMsg);
+  bool IsOpen() const { return m_open; }
+  // True when Open found work of an interrupted run to resume.
+  bool IsResuming() const { return m_stats.loaded > 0; }
+  // The run stopped with work left: commits what is recorded and keeps the
+  // journal for the next run.
+  void Close();
+  // The job finished: the journal is deleted, and with it the partial files
+  // kept for a resume (KeepPartial).
+  void Complete();
+
+  // Resume lookups. Work is only done if the source has not changed since:
+  // the file keeps its size and mtime.
+  bool FindFile(const std::string &key,
+                const BackupUtils::FileSnapshot &source);
+  bool FindRanges(const std::string &key,
+                  const BackupUtils::FileSnapshot &source, Ranges &ranges);
+
+  // written: the target file the record vouches for, synced before the
+  // record is committed; empty when nothing was written (identical files).
+  void RecordFile(const std::string &key,
+                  const BackupUtils::FileSnapshot &source,
+                  const fs::path &written);
+  void RecordRange(const std::string &key,
+                   const BackupUtils::FileSnapshot &source,
+                   long long rangeSize, long long index,
+                   const fs::path &partial);
+  // The partial file of a ranged copy left unfinished, kept while the job
+  // may still be resumed.
+  void KeepPartial(const fs::path &partial);
+
+  const Stats &GetStats() const { return m_stats; }
+  std::wstring FormatStats() const;
+
+private:
+  enum Op : unsigned char {
+    OpJob = 1,
+    OpFile = 2,
+    OpRange = 4
+  };
+  struct File {
+    long long size = 0;
+    long long mtime = 0;
+  };
+  struct RangeState {
+    long long size = 0;
+    long long mtime = 0;
+    Ranges ranges;
+  };
+
+  bool Load(const std::string &job, std::wstring &errorMsg);
+  void Replay(unsigned char op, const long long *values, std::string key);
+  void Append(unsigned char op, long long a, long long b, long long c,
+              long long d, const std::string &key, const fs::path &written);
+  // Syncs the pending data files, then appends and syncs the records.
+  void Commit();
+  void StopSyncer();
+
+  mutable std::mutex m_mutex; // Guards the members below
+  fs::path m_file;
+  fs::path m_target;
+  int m_syncMs = 1000;
+  bool m_open = false;
+  std::unordered_map<std::string, File> m_files;
+  std::unordered_map<std::string, RangeState> m_ranges;
+  std::vector<char> m_pending;          // Encoded records not yet committed
+  std::vector<fs::path> m_pendingData;  // Files they vouch for
+  std::vector<fs::path> m_partials;     // KeepPartial, removed by Complete
+  bool m_stop = false;
+  std::condition_variable m_wake;
+
+  std::mutex m_commitMutex; // One commit at a time
+  std::thread m_syncer;
+  Stats m_stats;
+};
@@ -0,0 +1,263 @@
+#include "LogPipeline.h"
+#include <algorithm>
+#include <map>
+
+LogPipeline::LogPipeline(IBackupLogger *downstream, Overflow overflow,
+                         size_t capacity, std::chrono::milliseconds interval)
+    : m_downstream(downstream), m_overflow(overflow), m_interval(interval),
+      m_ring(std::max<size_t>(capacity, 64)) {
+  m_consumer = std::thread([this] { Consume(); });
+}
+
+LogPipeline::~LogPipeline() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  if (m_consumer.joinable())
+    m_consumer.join();
+}
+
+void LogPipeline::Enqueue(Event &event) {
+  if (!m_ring.TryPush(event)) {
+    if (m_overflow == Overflow::DropAll ||
+        (m_overflow == Overflow::DropProgress && IsProgress(event.kind))) {
+      m_dropped++;
+      return;
+    }
+    m_waits++;
+    for (int spins = 0; !m_ring.TryPush(event); ++spins) {
+      if (!m_wakeRequested.exchange(true))
+        m_wake.notify_one();
+      if (spins < 64)
+        std::this_thread::yield();
+      else
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  }
+  m_enqueued++;
+  // Past half full, do not wait for the timer.
+  if (m_ring.SizeApprox() > m_ring.Capacity() / 2 &&
+      !m_wakeRequested.exchange(true))
+    m_wake.notify_one();
+}
+
+void LogPipeline::Log(const std::wstring &message) {
+  Event event;
+  event.kind = Event::Kind::Log;
+  event.text = message;
+  Enqueue(event);
+}
+
+void LogPipeline::OnFileAction(const std::wstring &action,
+                               const std::wstring &path) {
+  Event event;
+  event.kind = Event::Kind::FileAction;
+  event.text = action;
+  event.detail = path;
+  Enqueue(event);
+}
+
+void LogPipeline::OnProgress(const std::wstring &path) {
+  Event event;
+  event.kind = Event::Kind::Progress;
+  event.text = path;
+  Enqueue(event);
+}
+
+void LogPipeline::OnProgressDetailed(const TaskProgress &progress) {
+  Event event;
+  event.kind = Event::Kind::Detailed;
+  event.progress = progress;
+  Enqueue(event);
+}
+
+void LogPipeline::OnWorkerProgress(int workerId, const std::wstring &file,
+                                   int percent) {
+  Event event;
+  event.kind = Event::Kind::Worker;
+  event.number = workerId;
+  event.text = file;
+  event.percent = percent;
+  Enqueue(event);
+}
+
+void LogPipeline::OnWorkersStarted(int count) {
+  Event event;
+  event.kind = Event::Kind::WorkersStarted;
+  event.number = count;
+  Enqueue(event);
+}
+
+void LogPipeline::OnUnitProgress(const std::wstring &unit,
+                                 const TaskProgress &progress) {
+  Event event;
+  event.kind = Event::Kind::Unit;
+  event.text = unit;
+  event.progress = progress;
+  Enqueue(event);
+}
+
+void LogPipeline::OnAggregatedProgress(const TaskProgress &progress,
+                                       const ProgressRates &rates) {
+  Event event;
+  event.kind = Event::Kind::Aggregated;
+  event.progress = progress;
+  event.rates = rates;
+  Enqueue(event);
+}
+
+void LogPipeline::Flush() {
+  const long long target = m_enqueued;
+  if (!m_wakeRequested.exchange(true))
+    m_wake.notify_one();
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_delivered.wait(lock, [&] { return m_deliveredCount >= target; });
+}
+
+void LogPipeline::Consume() {
+  for (;;) {
+    bool stopping;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait_for(lock, m_interval,
+                      [&] { return m_stop || m_wakeRequested; });
+      stopping = m_stop;
+    }
+    m_wakeRequested = false;
+    while (DeliverBatch()) {
+    }
+    if (stopping)
+      return;
+  }
+}
+
+bool LogPipeline::DeliverBatch() {
+  std::wstring lines;
+  bool haveLines = false;
+  auto deliverLines = [&] {
+    if (haveLines && m_downstream)
+      m_downstream->Log(lines);
+    lines.clear();
+    haveLines = false;
+  };
+
+  // Latest progress of the batch; superseded events are simply skipped.
+  const Event *progress = nullptr;
+  const Event *detailed = nullptr; // Detailed or aggregated
+  std::map<int, const Event *> workers;
+  std::vector<const Event *> units;
+  // The events stay alive until the batch is delivered.
+  std::vector<Event> &batch = m_batch;
+  batch.clear();
+
+  const size_t limit = m_ring.Capacity();
+  Event event;
+  while (batch.size() < limit && m_ring.TryPop(event))
+    batch.push_back(std::move(event));
+  m_ring.PublishHead();
+  if (batch.empty())
+    return false;
+
+  for (const Event &e : batch) {
+    switch (e.kind) {
+    case Event::Kind::Log:
+      if (haveLines)
+        lines += L'\n';
+      lines += e.text;
+      haveLines = true;
+      break;
+    case Event::Kind::FileAction:
+      deliverLines();
+      if (m_downstream)
+        m_downstream->OnFileAction(e.text, e.detail);
+      break;
+    case Event::Kind::WorkersStarted:
+      // Worker updates before it belong to the previous run.
+      deliverLines();
+      workers.clear();
+      if (m_downstream)
+        m_downstream->OnWorkersStarted(e.number);
+      break;
+    case Event::Kind::Progress:
+      progress = &e;
+      break;
+    case Event::Kind::Detailed:
+    case Event::Kind::Aggregated:
+      detailed = &e;
+      break;
+    case Event::Kind::Worker:
+      workers[e.number] = &e;
+      break;
+    case Event::Kind::Unit: {
+      auto same =
+          std::find_if(units.begin(), units.end(),
+                       [&](const Event *u) { return u->text == e.text; });
+      if (same != units.end())
+        *same = &e;
+      else
+        units.push_back(&e);
+      break;
+    }
+    }
+  }
+  deliverLines();
+  if (m_downstream) {
+    if (progress)
+      m_downstream->OnProgress(progress->text);
+    for (const auto &worker : workers)
+      m_downstream->OnWorkerProgress(worker.first, worker.second->text,
+                                     worker.second->percent);
+    for (const Event *unit : units)
+      m_downstream->OnUnitProgress(unit->text, unit->progress);
+    if (detailed && detailed->kind == Event::Kind::Aggregated)
+      m_downstream->OnAggregatedProgress(detailed->progress, detailed->rates);
+    else if (detailed)
+      m_downstream->OnProgressDetailed(detailed->progress);
+  }
+
+  m_batches++;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_deliveredCount += (long long)batch.size();
+  }
+  m_delivered.notify_all();
+  return true;
+}
+
+std::wstring LogPipeline::FormatStats() const {
+  return L"Log pipeline: " + std::to_wstring(m_enqueued.load()) +
+         L" events in " + std::to_wstring(m_batches.load()) + L" batches, " +
+         std::to_wstring(m_waits.load()) + L" waits for room, " +
+         std::to_wstring(m_dropped.load()) + L" dropped";
+}
+
+HeadlessLogger::HeadlessLogger(const fs::path &file)
+    : m_file(file, std::ios::out | std::ios::trunc) {}
+
+void HeadlessLogger::Log(const std::wstring &message) {
+  m_file << message << L'\n';
+  m_file.flush();
+  m_writes++;
+  m_lines += 1 + std::count(message.begin(), message.end(), L'\n');
+}
+
+void HeadlessLogger::OnFileAction(const std::wstring &action,
+                                  const std::wstring &path) {
+  m_file << L"[" << action << L"] " << path << L'\n';
+  m_file.flush();
+  m_writes++;
+  m_lines++;
+}
+
+void HeadlessLogger::OnProgress(const std::wstring &) { m_progressUpdates++; }
+
+void HeadlessLogger::OnProgressDetailed(const TaskProgress &progress) {
+  m_lastProgress = progress;
+  m_progressUpdates++;
+}
+
+void HeadlessLogger::OnWorkerProgress(int, const std::wstring &, int) {
+  m_progressUpdates++;
+}
@@ -0,0 +1,333 @@
+#include "LogWriter.h"
+#include <algorithm>
+#include <initializer_list>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace {
+
+// Producers wait while this many full buffers are queued.
+const size_t kMaxQueuedBuffers = 4;
+
+// Entry points of the codec libraries, resolved once. The signatures are
+// those of zstd.h and lz4frame.h.
+struct Codecs {
+  size_t (*zstdBound)(size_t) = nullptr;
+  size_t (*zstdCompress)(void *, size_t, const void *, size_t, int) = nullptr;
+  unsigned (*zstdIsError)(size_t) = nullptr;
+  size_t (*lz4Bound)(size_t, const void *) = nullptr;
+  size_t (*lz4Compress)(void *, size_t, const void *, size_t,
+                        const void *) = nullptr;
+  unsigned (*lz4IsError)(size_t) = nullptr;
+
+  Codecs() {
+    if (void *zstd = OpenLibrary({
+#ifdef _WIN32
+            "libzstd.dll", "zstd.dll"
+#else
+            "libzstd.so.1", "libzstd.so", "libzstd.1.dylib"
+#endif
+        })) {
+      Resolve(zstd, "ZSTD_compressBound", zstdBound);
+      Resolve(zstd, "ZSTD_compress", zstdCompress);
+      Resolve(zstd, "ZSTD_isError", zstdIsError);
+    }
+    if (void *lz4 = OpenLibrary({
+#ifdef _WIN32
+            "liblz4.dll", "lz4.dll"
+#else
+            "liblz4.so.1", "liblz4.so", "liblz4.1.dylib"
+#endif
+        })) {
+      Resolve(lz4, "LZ4F_compressFrameBound", lz4Bound);
+      Resolve(lz4, "LZ4F_compressFrame", lz4Compress);
+      Resolve(lz4, "LZ4F_isError", lz4IsError);
+    }
+  }
+
+  bool Zstd() const { return zstdBound && zstdCompress && zstdIsError; }
+  bool Lz4() const { return lz4Bound && lz4Compress && lz4IsError; }
+
+  // The libraries stay loaded for the life of the process.
+  static void *OpenLibrary(std::initializer_list<const char *> names) {
+    for (const char *name : names) {
+#ifdef _WIN32
+      if (HMODULE module = LoadLibraryA(name))
+        return (void *)module;
+#else
+      if (void *handle = dlopen(name, RTLD_NOW | RTLD_LOCAL))
+        return handle;
+#endif
+    }
+    return nullptr;
+  }
+  template <typename F>
+  static void Resolve(void *library, const char *symbol, F &function) {
+#ifdef _WIN32
+    function = (F)(void *)GetProcAddress((HMODULE)library, symbol);
+#else
+    function = (F)dlsym(library, symbol);
+#endif
+  }
+};
+
+const Codecs &LoadCodecs() {
+  static const Codecs codecs;
+  return codecs;
+}
+
+// Appends message as UTF-8. wchar_t is UTF-16 on Windows, UTF-32 elsewhere;
+// unpaired surrogates become U+FFFD.
+void AppendUtf8(std::string &out, const std::wstring &message) {
+  for (size_t i = 0; i < message.size(); ++i) {
+    unsigned long c = (unsigned long)message[i];
+    if (c >= 0xD800 && c <= 0xDBFF && i + 1 < message.size() &&
+        (unsigned long)message[i + 1] >= 0xDC00 &&
+        (unsigned long)message[i + 1] <= 0xDFFF) {
+      c = 0x10000 + ((c - 0xD800) << 10) +
+          ((unsigned long)message[++i] - 0xDC00);
+    } else if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+      c = 0xFFFD;
+    }
+    if (c < 0x80) {
+      out += (char)c;
+    } else if (c < 0x800) {
+      out += (char)(0xC0 | (c >> 6));
+      out += (char)(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+      out += (char)(0xE0 | (c >> 12));
+      out += (char)(0x80 | ((c >> 6) & 0x3F));
+      out += (char)(0x80 | (c & 0x3F));
+    } else {
+      out += (char)(0xF0 | (c >> 18));
+      out += (char)(0x80 | ((c >> 12) & 0x3F));
+      out += (char)(0x80 | ((c >> 6) & 0x3F));
+      out += (char)(0x80 | (c & 0x3F));
+    }
+  }
+}
+
+} // namespace
+
+LogWriter::LogWriter() : LogWriter(Options()) {}
+
+LogWriter::LogWriter(const Options &options) : m_options(options) {}
+
+LogWriter::~LogWriter() { Close(); }
+
+bool LogWriter::Available(Compression compression) {
+  switch (compression) {
+  case Compression::Zstd:
+    return LoadCodecs().Zstd();
+  case Compression::Lz4:
+    return LoadCodecs().Lz4();
+  default:
+    return true;
+  }
+}
+
+const wchar_t *LogWriter::Extension(Compression compression) {
+  switch (compression) {
+  case Compression::Zstd:
+    return L".zst";
+  case Compression::Lz4:
+    return L".lz4";
+  default:
+    return L"";
+  }
+}
+
+bool LogWriter::Open(const fs::path &file, std::wstring &error) {
+  Close();
+  m_active = Available(m_options.compression) ? m_options.compression
+                                              : Compression::None;
+  m_file.open(file, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!m_file.is_open()) {
+    error = L"Cannot create log file " + file.wstring();
+    return false;
+  }
+  m_path = file;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  // What was written while closed (or after the last writer thread had
+  // finished) starts the new log.
+  if (m_dropped > 0) {
+    m_current += "[" + std::to_string(m_dropped) +
+                 " log lines dropped while no log file was open]\n";
+    m_dropped = 0;
+  }
+  m_current.reserve(m_options.bufferBytes);
+  m_accepted = (long long)m_current.size();
+  m_lines = std::count(m_current.begin(), m_current.end(), '\n');
+  for (const std::string &block : m_full) {
+    m_accepted += (long long)block.size();
+    m_lines += std::count(block.begin(), block.end(), '\n');
+  }
+  m_written = m_flushTarget = 0;
+  m_writes = m_flushes = m_fileBytes = 0;
+  m_stop = false;
+  m_running = true;
+  m_writer = std::thread([this] { Run(); });
+  return true;
+}
+
+void LogWriter::Write(const std::wstring &message) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_running && m_current.size() >= m_options.bufferBytes) {
+    m_dropped++;
+    return;
+  }
+  const size_t before = m_current.size();
+  AppendUtf8(m_current, message);
+  m_current += '\n';
+  m_accepted += (long long)(m_current.size() - before);
+  m_lines += 1 + std::count(message.begin(), message.end(), L'\n');
+  if (!m_running || m_current.size() < m_options.bufferBytes)
+    return;
+
+  // A slow disk holds the producers back rather than the memory growing.
+  // Once Close began nobody waits: the writer drains until both the queue
+  // and the current buffer are empty.
+  m_progress.wait(lock, [&] {
+    return m_full.size() < kMaxQueuedBuffers || m_stop || !m_running;
+  });
+  // The writer may have taken the buffer meanwhile. Queued after the writer
+  // finished, it waits for the next Open like lines written while closed.
+  if (m_current.size() < m_options.bufferBytes)
+    return;
+  m_full.push_back(std::move(m_current));
+  m_current = std::string();
+  m_current.reserve(m_options.bufferBytes);
+  m_wake.notify_one();
+}
+
+void LogWriter::Flush() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_running)
+    return;
+  const long long target = m_accepted;
+  m_flushTarget = std::max(m_flushTarget, target);
+  m_wake.notify_one();
+  m_progress.wait(lock, [&] { return m_written >= target || !m_running; });
+}
+
+void LogWriter::Close() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_running)
+      return;
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_progress.notify_all();
+  m_writer.join();
+  m_file.close();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_running = false;
+  m_progress.notify_all();
+}
+
+bool LogWriter::Finalize(const fs::path &archive, std::wstring &error) {
+  Close();
+  if (m_path.empty()) {
+    error = L"No log to archive";
+    return false;
+  }
+  std::error_code ec;
+  fs::rename(m_path, archive, ec);
+  if (ec) {
+    ec.clear();
+    fs::copy_file(m_path, archive, fs::copy_options::overwrite_existing, ec);
+    if (!ec)
+      fs::remove(m_path, ec);
+  }
+  if (ec) {
+    const std::string what = ec.message();
+    error = L"Cannot archive log to " + archive.wstring() + L": " +
+            std::wstring(what.begin(), what.end());
+    return false;
+  }
+  m_path.clear();
+  return true;
+}
+
+void LogWriter::Run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    const bool woken = m_wake.wait_for(lock, m_options.flushInterval, [&] {
+      return m_stop || !m_full.empty() || m_flushTarget > m_written;
+    });
+    // A filled buffer alone goes out by itself; a timeout, Flush or Close
+    // takes the partial one too.
+    const bool everything = !woken || m_stop || m_flushTarget > m_written;
+    std::vector<std::string> blocks;
+    blocks.swap(m_full);
+    if (everything && !m_current.empty()) {
+      blocks.push_back(std::move(m_current));
+      m_current = std::string();
+      m_current.reserve(m_options.bufferBytes);
+    }
+    if (!blocks.empty()) {
+      // Room for the producers while the blocks are written.
+      m_progress.notify_all();
+      lock.unlock();
+      long long bytes = 0;
+      for (const std::string &block : blocks) {
+        WriteBlock(block);
+        bytes += (long long)block.size();
+      }
+      m_file.flush();
+      lock.lock();
+      m_written += bytes;
+      m_writes += (long long)blocks.size();
+      m_flushes++;
+      m_progress.notify_all();
+    }
+    if (m_stop && m_full.empty() && m_current.empty())
+      return;
+  }
+}
+
+void LogWriter::WriteBlock(const std::string &block) {
+  const Codecs &codecs = LoadCodecs();
+  size_t size = 0;
+  if (m_active == Compression::Zstd) {
+    m_compressed.resize(codecs.zstdBound(block.size()));
+    size = codecs.zstdCompress(m_compressed.data(), m_compressed.size(),
+                               block.data(), block.size(), 3);
+    if (codecs.zstdIsError(size))
+      size = 0;
+  } else if (m_active == Compression::Lz4) {
+    m_compressed.resize(codecs.lz4Bound(block.size(), nullptr));
+    size = codecs.lz4Compress(m_compressed.data(), m_compressed.size(),
+                              block.data(), block.size(), nullptr);
+    if (codecs.lz4IsError(size))
+      size = 0;
+  }
+  // Uncompressed blocks would corrupt a compressed file; a codec failure
+  // (out of memory) loses the block instead.
+  if (m_active != Compression::None) {
+    m_file.write(m_compressed.data(), (std::streamsize)size);
+  } else {
+    m_file.write(block.data(), (std::streamsize)block.size());
+    size = block.size();
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_fileBytes += (long long)size;
+}
+
+std::wstring LogWriter::FormatStats() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::wstring stats = L"Log writer: " + std::to_wstring(m_lines) +
+                       L" lines, " + std::to_wstring(m_written / 1024) +
+                       L" KB in " + std::to_wstring(m_writes) + L" writes, " +
+                       std::to_wstring(m_flushes) + L" flushes";
+  if (m_active == Compression::Zstd)
+    stats += L", " + std::to_wstring(m_fileBytes / 1024) + L" KB after zstd";
+  else if (m_active == Compression::Lz4)
+    stats += L", " + std::to_wstring(m_fileBytes / 1024) + L" KB after LZ4";
+  return stats;
+}
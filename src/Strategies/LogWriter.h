@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Types.h"
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Background writer of a run's log file.
+//
+// Lines are encoded as UTF-8 into a large buffer under a short lock. A
+// writer thread writes and flushes them as a group: when a buffer fills, when
+// the flush interval elapses, or on Flush. A log of millions of lines costs
+// a few hundred writes instead of a flush per line. Producers wait only when
+// several full buffers are already queued for a slow disk.
+//
+// Optionally each written block is compressed as an independent zstd or LZ4
+// frame. A file of concatenated frames is a valid .zst or .lz4 file, so the
+// log can be read with "zstd -dc" or "lz4 -dc" even while it is still being
+// written. The codec libraries are loaded at run time (libzstd, liblz4). When
+// one is missing, the log is written uncompressed.
+//
+// Finalize moves the finished log to its archive name with one rename.
+class LogWriter {
+public:
+  enum class Compression { None, Zstd, Lz4 };
+  struct Options {
+    size_t bufferBytes = 1024 * 1024;
+    std::chrono::milliseconds flushInterval = std::chrono::milliseconds(1000);
+    Compression compression = Compression::None;
+  };
+
+  LogWriter();
+  explicit LogWriter(const Options &options);
+  ~LogWriter();
+  LogWriter(const LogWriter &) = delete;
+  LogWriter &operator=(const LogWriter &) = delete;
+
+  // Whether the codec's library could be loaded.
+  static bool Available(Compression compression);
+  // "", ".zst" or ".lz4": what archive names of this codec should end with.
+  static const wchar_t *Extension(Compression compression);
+
+  // Starts a new log in file, truncating it. Closes the previous one. The
+  // options' codec is used when available (see ActiveCompression). Lines
+  // written while no log was open go first.
+  bool Open(const fs::path &file, std::wstring &error);
+  bool IsOpen() const { return m_file.is_open(); }
+  Compression ActiveCompression() const { return m_active; }
+
+  // Appends message and a line break. Any thread. While closed, lines are
+  // kept for the next Open up to one buffer; beyond that they are dropped,
+  // and that Open logs how many.
+  void Write(const std::wstring &message);
+  // Waits until everything written before the call is in the file.
+  void Flush();
+  // Writes what is pending, stops the writer thread and closes the file.
+  void Close();
+  // Closes the log and renames it to archive; the caller Opens the next one.
+  // Falls back to copy and remove if the rename fails (another volume).
+  bool Finalize(const fs::path &archive, std::wstring &error);
+
+  // "Log writer: 1204531 lines, 98304 KB in 96 writes, 12 flushes, 9210 KB
+  // after zstd"
+  std::wstring FormatStats() const;
+
+private:
+  void Run();
+  // Writer thread: writes one block, compressed if a codec is active.
+  void WriteBlock(const std::string &block);
+
+  const Options m_options;
+  Compression m_active = Compression::None;
+  fs::path m_path;
+  std::ofstream m_file;
+
+  mutable std::mutex m_mutex; // Guards the members below
+  std::condition_variable m_wake;     // Writer: work is queued
+  std::condition_variable m_progress; // Producers: blocks were written
+  std::string m_current;              // Being filled
+  std::vector<std::string> m_full;    // Handed to the writer, oldest first
+  long long m_accepted = 0;           // Bytes appended so far
+  long long m_written = 0;            // Of those, bytes in the file
+  long long m_flushTarget = 0;        // Flush wants m_written to reach it
+  bool m_running = false; // Open and the writer thread started
+  bool m_stop = false;
+  long long m_dropped = 0; // Lines refused while closed, since the last Open
+  long long m_lines = 0;
+  long long m_writes = 0;
+  long long m_flushes = 0;
+  long long m_fileBytes = 0; // After compression
+  std::thread m_writer;
+
+  std::vector<char> m_compressed; // Writer thread only
+};
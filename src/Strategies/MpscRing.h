@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Lock-free bounded multi-producer, single-consumer ring (Vyukov's bounded
+// queue with one consumer).
+//
+// Every cell carries a sequence number that says whose turn it is: equal to
+// the position, the cell is free for the producer that claims that position
+// (one CAS on m_tail); one past it, it holds an item for the consumer. A
+// producer never waits for another one, and the consumer takes no atomic
+// read-modify-write at all. A full ring fails TryPush instead of blocking;
+// what to do then is the caller's policy.
+template <typename T> class MpscRing {
+public:
+  // capacity is rounded up to a power of two.
+  explicit MpscRing(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity)
+      size *= 2;
+    m_mask = size - 1;
+    m_cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i)
+      m_cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  MpscRing(const MpscRing &) = delete;
+  MpscRing &operator=(const MpscRing &) = delete;
+
+  // Any thread. Moves from item only on success.
+  bool TryPush(T &item) {
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+      cell = &m_cells[pos & m_mask];
+      const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const std::ptrdiff_t diff = (std::ptrdiff_t)(sequence - pos);
+      if (diff == 0) {
+        if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false; // The consumer has not freed this lap's cell yet
+      } else {
+        pos = m_tail.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(item);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only.
+  bool TryPop(T &item) {
+    Cell &cell = m_cells[m_head & m_mask];
+    const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if ((std::ptrdiff_t)(sequence - (m_head + 1)) < 0)
+      return false;
+    item = std::move(cell.value);
+    cell.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+    ++m_head;
+    return true;
+  }
+
+  size_t Capacity() const { return m_mask + 1; }
+  // Approximate: claimed positions, some of which may still be in flight.
+  size_t SizeApprox() const {
+    return m_tail.load(std::memory_order_relaxed) -
+           m_headPublished.load(std::memory_order_relaxed);
+  }
+  // Consumer only: makes the consumed count visible to SizeApprox.
+  void PublishHead() {
+    m_headPublished.store(m_head, std::memory_order_relaxed);
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> m_cells;
+  size_t m_mask = 0;
+  // Producers contend on the tail; keep it away from the consumer's head.
+  alignas(64) std::atomic<size_t> m_tail{0};
+  alignas(64) size_t m_head = 0;
+  std::atomic<size_t> m_headPublished{0};
+};
@@ -1,16 +1,113 @@
 #include "ParallelBackupStrategy.h"
+#include "AdaptiveConcurrency.h"
 #include "BackupUtils.h"
+#include "DevicePools.h"
+#include "DirHandles.h"
+#include "IoBudget.h"
+#include "ParallelTreeWalker.h"
+#include "PathArena.h"
+#include "PathFilter.h"
+#include "ProgressAggregator.h"
+#include <algorithm>
 #include <atomic>
-#include <condition_variable>
-#include <deque>
+#include <functional>
+#include <memory>
 #include <sstream>
 #include <thread>
+#include <unordered_map>
 
-struct WorkItem {
+// Smallest range a large file is split into; below this the per-range open
+// and scheduling cost starts to show.
+static const long long kMinRangeSize = 64LL * 1024 * 1024;
+
+// A file copied by several workers at once. Its range items share this
+// state; the worker finishing the last range renames the partial file into
+// place. A partial file that is not committed is removed when the last item
+// referencing it goes away, unless the copy was only stopped (abort, cancel)
+// while the job journal records its ranges: then it is kept for a resumed
+// run until the journal completes.
+struct RangedFile {
   fs::path source;
   fs::path target;
+  fs::path partial;
+  BackupUtils::FileSnapshot info;
+  std::string journalKey;                      // Empty when not journaling
+  JobJournal *journal = nullptr;               // Set with journalKey
+  long long rangeSize = 0;
+  // Per-range source hashes for hash verification; each range writes its
+  // own slot, read only by the worker that commits the file.
+  std::vector<unsigned long long> rangeHashes;
+  std::atomic<int> remaining{0};
+  std::atomic<long long> copied{0}; // Bytes landed across all ranges
+  std::atomic<bool> failed{false};
+  std::mutex errorMutex;
+  std::wstring error; // First non-cancel error of a range or the commit
+  bool committed = false;
+
+  ~RangedFile() {
+    if (committed)
+      return;
+    if (journal && error.empty()) {
+      journal->KeepPartial(partial);
+      return;
+    }
+    std::error_code ec;
+    fs::remove(partial, ec);
+  }
+};
+
+struct WorkItem {
+  // The entry's directory and name, relative to the roots (see PathArena).
+  // The root item has no name.
+  PathArena::NodeId parent = PathArena::kRoot;
+  fs::path::string_type name;
+  BackupUtils::FileSnapshot info; // Source metadata from the enumeration
+  // Target metadata from the parent's merge-join listing, when available.
+  BackupUtils::FileSnapshot targetInfo;
+  bool targetKnown = false;
+  // Trusted catalog: resolve targetInfo through it instead of a query.
+  bool fromCatalog = false;
+  // Sync mode: target entry without a source counterpart, to be removed.
+  bool deleteExtra = false;
+  // From an execution plan: the decision is made, info is what the preview
+  // saw of the source.
+  bool planned = false;
+  // One range [rangeOffset, rangeOffset + rangeLength) of a ranged file.
+  std::shared_ptr<RangedFile> ranged;
+  long long rangeOffset = 0;
+  long long rangeLength = 0;
 };
 
+// Spill encoding for the traversal memory budget. Range items share their
+// RangedFile with the other ranges, so they stay in memory.
+static ParallelTreeWalker<WorkItem>::SpillCodec WorkItemCodec() {
+  using namespace SpillEncoding;
+  ParallelTreeWalker<WorkItem>::SpillCodec codec;
+  codec.bytes = [](const WorkItem &item) {
+    return sizeof(WorkItem) + StringBytes(item.name);
+  };
+  codec.encode = [](const WorkItem &item, std::string &out) {
+    if (item.ranged)
+      return false;
+    Put(out, item.parent);
+    Put(out, item.name);
+    Put(out, item.info);
+    Put(out, item.targetInfo);
+    Put(out, item.targetKnown);
+    Put(out, item.fromCatalog);
+    Put(out, item.deleteExtra);
+    Put(out, item.planned);
+    return true;
+  };
+  codec.decode = [](const char *&p, const char *end, WorkItem &item) {
+    return Get(p, end, item.parent) && Get(p, end, item.name) &&
+           Get(p, end, item.info) && Get(p, end, item.targetInfo) &&
+           Get(p, end, item.targetKnown) && Get(p, end, item.fromCatalog) &&
+           Get(p, end, item.deleteExtra) && Get(p, end, item.planned);
+  };
+  return codec;
+}
+
 void ParallelBackupStrategy::CancelWorker(int index) {
   std::lock_guard<std::mutex> lock(m_cancelMutex);
   if (index >= 0 && index < (int)m_cancelFlags.size()) {
@@ -51,19 +148,87 @@ void ParallelBackupStrategy::Execute(const BackupTask &task,
     return;
   }
 
-  // Pre-scan for progress
+  // A preview records what it decided; applying performs that instead of
+  // walking the trees.
+  if (task.applyPlan) {
+    std::wstring planError;
+    if (!m_plan.Load(task.planPath, sourcePath, targetPath, planError)) {
+      SafeLog(logger, L"ERROR: " + planError);
+      return;
+    }
+    SafeLog(logger, m_plan.FormatStats());
+  } else if (dryRun && !task.planPath.empty()) {
+    std::wstring planError;
+    if (!m_plan.Create(task.planPath, sourcePath, targetPath, planError))
+      SafeLog(logger,
+              L"WARNING: " + planError + L" (continuing without it)");
+  }
+
+  // Journal of finished work; an interrupted run of this job left one when
+  // there is something to resume. A plan is simply applied again.
+  if (!dryRun && !task.applyPlan && !task.journalPath.empty()) {
+    std::wstring journalError;
+    if (!m_journal.Open(task.journalPath, sourcePath, targetPath,
+                        task.journalSyncMs, journalError))
+      SafeLog(logger,
+              L"WARNING: " + journalError + L" (continuing without it)");
+    else if (m_journal.IsResuming())
+      SafeLog(logger, L"Resuming interrupted run (" +
+                          std::to_wstring(m_journal.GetStats().loaded.load()) +
+                          L" journal records)");
+  }
+
+  const bool usedJournal = m_journal.IsOpen();
+
+  if (task.filter)
+    SafeLog(logger, task.filter->FormatStats());
+
+  // Pre-scan for progress. A resumed run does not walk the tree twice: the
+  // totals are found along the way.
   TaskProgress progress;
-  if (logger) {
-    SafeLog(logger, L"Scanning source... please wait.");
-    BackupUtils::ScanSource(sourcePath, progress.totalFiles,
-                            progress.totalBytes);
+  if (task.applyPlan) {
+    for (const ExecutionPlan::Entry &entry : m_plan.Entries()) {
+      if (entry.op == ExecutionPlan::Op::Copy ||
+          entry.op == ExecutionPlan::Op::Link)
+        BackupUtils::CountEntry(entry.source, progress.totalFiles,
+                                progress.totalBytes);
+    }
+  } else if (logger) {
+    if (task.streamingScan || m_journal.IsResuming()) {
+      BackupUtils::BeginStreamingScan(sourcePath, progress);
+    } else {
+      SafeLog(logger, L"Scanning source... please wait.");
+      BackupUtils::ScanSource(sourcePath, progress.totalFiles,
+                              progress.totalBytes, 0, task.filter.get());
+    }
   }
 
   try {
+    // Sync deletions are scheduled by the traversal itself, so there is no
+    // separate SyncDelete pass.
+    m_metadata.Reset();
+    std::wstring catalogError;
+    if (!m_catalog.OpenForTask(task, dryRun, catalogError) &&
+        !catalogError.empty())
+      SafeLog(logger,
+              L"WARNING: " + catalogError + L" (continuing without it)");
     ProcessDirectory(sourcePath, targetPath, task, logger, dryRun, progress);
-    if (task.mode == BackupMode::Sync &&
-        (!task.IsAborted || !task.IsAborted())) {
-      SyncDelete(sourcePath, targetPath, task, logger, dryRun);
+    if (progress.isEstimate && (!task.IsAborted || !task.IsAborted())) {
+      // All workers drained the queue, so the streamed totals are final.
+      progress.isEstimate = false;
+      logger->OnProgressDetailed(progress);
+    }
+    // Everything is done: nothing is left to resume.
+    if (!task.IsAborted || !task.IsAborted()) {
+      m_journal.Complete();
+      if (m_plan.IsRecording()) {
+        std::wstring planError;
+        if (m_plan.Finish(planError))
+          SafeLog(logger, m_plan.FormatStats() + L", saved to " +
+                              task.planPath);
+        else
+          SafeLog(logger, L"WARNING: " + planError);
+      }
     }
   } catch (const std::exception &e) {
     std::string what = e.what();
@@ -71,7 +236,25 @@ void ParallelBackupStrategy::Execute(const BackupTask &task,
             L"CRITICAL ERROR: " + std::wstring(what.begin(), what.end()));
   }
 
+  bool usedCatalog = m_catalog.IsOpen();
+  std::wstring catalogError;
+  if (!m_catalog.Close(catalogError))
+    SafeLog(logger, L"WARNING: " + catalogError);
+  m_journal.Close();
+  // An interrupted preview leaves no plan to apply.
+  if (m_plan.IsRecording()) {
+    m_plan.Abandon();
+    SafeLog(logger, L"Plan not saved: the preview did not finish.");
+  }
+  m_plan.Clear();
+
   if (logger) {
+    SafeLog(logger, BackupUtils::FormatMetadataStats(m_metadata));
+    SafeLog(logger, BackupUtils::FormatMemoryStats());
+    if (usedCatalog)
+      SafeLog(logger, m_catalog.FormatStats());
+    if (usedJournal)
+      SafeLog(logger, m_journal.FormatStats());
     SafeLog(logger, L"--------------------------------------------------");
     if (task.IsAborted && task.IsAborted()) {
       SafeLog(logger, L"PROCESS INTERRUPTED BY USER.");
@@ -86,23 +269,12 @@ void ParallelBackupStrategy::Execute(const BackupTask &task,
 void ParallelBackupStrategy::ProcessDirectory(
     const fs::path &source, const fs::path &target, const BackupTask &task,
     IBackupLogger *logger, bool dryRun, TaskProgress &aggregateProgress) {
-  std::deque<WorkItem> queue;
-  std::mutex queueMutex;
-  std::condition_variable cv;
-  std::atomic<int> activeWorkers(0);
   std::atomic<bool> globalAbort(false);
-  std::atomic<bool> finished(false);
 
-  // Progress tracking
-  std::mutex progressMutex;
-
-  {
-    std::lock_guard<std::mutex> lock(queueMutex);
-    queue.push_back({source, target});
-  }
+  const int numThreads = std::max(1, task.workerCount);
 
-  // Limit to 4 threads as requested for UI matching
-  const int numThreads = 4; // Fixed to 4 for UI
+  // Workers only count; the aggregator reports ten times a second.
+  ProgressAggregator progress(logger, numThreads, aggregateProgress);
 
   // Initialize cancel flags
   {
@@ -113,243 +285,651 @@ void ParallelBackupStrategy::ProcessDirectory(
     }
   }
 
-  auto worker = [&](int threadIndex) {
-    activeWorkers++;
-    while (true) {
-      WorkItem item;
-      {
-        std::unique_lock<std::mutex> lock(queueMutex);
-        cv.wait(lock, [&] {
-          return !queue.empty() || finished || globalAbort ||
-                 (task.IsAborted && task.IsAborted());
-        });
+  auto isAborted = [&] {
+    return globalAbort || (task.IsAborted && task.IsAborted());
+  };
 
-        if (globalAbort || (task.IsAborted && task.IsAborted()))
-          break;
-        if (queue.empty() && finished)
-          break;
-
-        if (queue.empty()) {
-          activeWorkers--;
-          if (activeWorkers == 0) {
-            finished = true;
-            if (logger)
-              logger->OnWorkerProgress(threadIndex, L"Idle", 0); // Clear status
-            cv.notify_all();
-          } else {
-            if (logger)
-              logger->OnWorkerProgress(threadIndex, L"Waiting...", 0);
-            cv.wait(lock, [&] {
-              return !queue.empty() || finished || globalAbort ||
-                     (task.IsAborted && task.IsAborted());
-            });
-            activeWorkers++;
-            if (globalAbort || (task.IsAborted && task.IsAborted()) ||
-                (queue.empty() && finished))
-              break;
-            if (!queue.empty()) {
-              item = queue.front();
-              queue.pop_front();
-            } else
-              continue;
-          }
-          if (finished)
-            break;
-        } else {
-          item = queue.front();
-          queue.pop_front();
+  std::shared_ptr<DevicePools> pools = task.devicePools;
+  if (!pools)
+    pools = std::make_shared<DevicePools>();
+  DevicePools::Device *sourceDevice = pools->Register(source);
+  DevicePools::Device *targetDevice = pools->Register(target);
+  SafeLog(logger, L"Source device " + sourceDevice->Describe());
+  SafeLog(logger, L"Target device " + targetDevice->Describe());
+  // Ranges of one file on a device that takes one transfer at a time would
+  // only queue behind each other; with a journal they are still worth it as
+  // resume points.
+  const bool journaling = m_journal.IsOpen();
+  const bool resuming = m_journal.IsResuming();
+  const bool sequentialDevice =
+      (sourceDevice->Limit() == 1 || targetDevice->Limit() == 1) &&
+      !journaling;
+
+  PathArena arena;
+  DirHandles sourceDirs(arena, source, BackupUtils::MetadataRole::Source,
+                        &m_metadata);
+  DirHandles targetDirs(arena, target, BackupUtils::MetadataRole::Target,
+                        &m_metadata);
+
+  // Preview: the decisions go into the plan as well as the log.
+  const bool planning = m_plan.IsRecording();
+  // Apply: entries whose source changed or vanished since the preview.
+  std::atomic<long long> planChanged(0), planSkipped(0);
+
+  // The partial file of a ranged copy: "<name>.sbpart", or "<name>.sbpart~N"
+  // when the source directory has an entry of that name, so a partial file
+  // never lands on a file of the unit. The same source gives the same name,
+  // which is how a resumed run finds it again.
+  const fs::path::string_type partialSuffix = fs::path(L".sbpart").native();
+  auto partialName = [&](PathArena::NodeId parent,
+                         const fs::path::string_type &name) {
+    for (int i = 0;; ++i) {
+      fs::path::string_type partial = name + partialSuffix;
+      if (i > 0)
+        partial += fs::path(L"~" + std::to_wstring(i)).native();
+      if (!sourceDirs.Snapshot(parent, partial).Exists())
+        return partial;
+    }
+  };
+  // A target-only name that is the partial file of a source entry. Sync
+  // keeps those of a journaled run: they hold the ranges it will resume.
+  auto isPartialFile = [&](PathArena::NodeId parent,
+                           const fs::path::string_type &name) {
+    const size_t at = name.rfind(partialSuffix);
+    if (at == fs::path::string_type::npos || at == 0)
+      return false;
+    const fs::path::string_type base = name.substr(0, at);
+    return sourceDirs.Snapshot(parent, base).Exists() &&
+           partialName(parent, base) == name;
+  };
+
+  // Publishes a ranged file once its last range landed.
+  auto commitRanged = [&](RangedFile &file, int threadIndex) {
+    std::wstring err = file.error;
+    bool done = false;
+    if (!file.failed && BackupUtils::CommitRangeTarget(
+                            file.source, file.partial, file.target, err)) {
+      file.committed = true;
+      progress.AddFiles(threadIndex);
+      m_catalog.Record(file.target, file.info);
+      // With range hashes only the target is read back, range by range.
+      bool verified = true;
+      if (task.verify && file.rangeHashes.empty()) {
+        verified = BackupUtils::CompareFilesBinary(file.source, file.target);
+      } else if (task.verify) {
+        for (size_t i = 0; verified && i < file.rangeHashes.size(); ++i) {
+          unsigned long long hash = 0;
+          verified = BackupUtils::HashFile(file.target, hash,
+                                           (long long)i * file.rangeSize,
+                                           file.rangeSize) &&
+                     hash == file.rangeHashes[i];
         }
       }
+      if (!verified) {
+        SafeLog(logger, L"  VERIFICATION FAILED: " + file.target.wstring());
+        if (task.errorPolicy == ErrorPolicy::Suspend)
+          globalAbort = true;
+      }
+      done = verified;
+    } else if (!err.empty()) {
+      file.error = err; // Nothing to resume: the partial file goes
+      SafeLog(logger, L"  Copy Error: " + err);
+      if (task.errorPolicy == ErrorPolicy::Suspend)
+        globalAbort = true;
+    }
+    if (done && !file.journalKey.empty())
+      m_journal.RecordFile(file.journalKey, file.info, file.target);
+  };
 
-      if (item.source.empty())
-        continue;
+  typedef ParallelTreeWalker<WorkItem> Walker;
+  auto visit = [&](WorkItem &item, Walker::Context &ctx) {
+    const int threadIndex = ctx.WorkerIndex();
+    // Full paths exist only while the item is visited.
+    const fs::path itemSource = arena.Path(source, item.parent, item.name);
+    const fs::path itemTarget = arena.Path(target, item.parent, item.name);
+    // The journal's and the plan's name for the entry.
+    auto relativeKey = [&] {
+      return arena.Path(fs::path(), item.parent, item.name).generic_u8string();
+    };
 
-      // Check per-worker cancel flag
-      int *myCancelFlag = nullptr;
-      {
-        std::lock_guard<std::mutex> lk(m_cancelMutex);
-        if (threadIndex < (int)m_cancelFlags.size()) {
-          myCancelFlag = m_cancelFlags[threadIndex].get();
-          *myCancelFlag = 0;
+    if (item.deleteExtra) {
+      // Planned deletion of an entry the source has again: not extra now.
+      if (item.planned &&
+          sourceDirs.Snapshot(item.parent, item.name).Exists()) {
+        SafeLog(logger, L"Keep (source appeared since the preview): " +
+                            itemTarget.wstring());
+        planSkipped++;
+        return;
+      }
+      SafeLog(logger, L"Delete: " + itemTarget.wstring());
+      if (planning)
+        m_plan.Add(ExecutionPlan::Op::Delete, relativeKey(), item.info);
+      if (!dryRun) {
+        if (!targetDirs.RemoveAll(item.parent, item.name)) {
+          SafeLog(logger, L"  Delete Failed: " + itemTarget.wstring());
+          if (task.errorPolicy == ErrorPolicy::Suspend)
+            globalAbort = true;
+        } else {
+          m_catalog.Forget(itemTarget, true);
         }
       }
+      return;
+    }
 
-      long long lastTransferred = 0;
-      auto progressCallback = [&](long long total, long long transferred) {
-        if (total > 0 && logger) {
-          int pct = (int)((transferred * 100) / total);
-          logger->OnWorkerProgress(threadIndex,
-                                   item.source.filename().wstring(), pct);
-        }
+    // Journal: a file or link is recorded at most once, however the visit
+    // ends. Directories are not recorded (see JobJournal); ranged files are
+    // recorded by commitRanged.
+    const std::string journalKey =
+        journaling && !item.ranged ? relativeKey() : std::string();
+    bool reported = !journaling || item.ranged || item.info.IsDirectory();
+    auto finishFile = [&](bool ok, const fs::path &written) {
+      if (reported)
+        return;
+      reported = true;
+      if (ok)
+        m_journal.RecordFile(journalKey, item.info, written);
+    };
 
-        // Update aggregate progress bytes
-        if (logger) {
-          std::lock_guard<std::mutex> pLock(progressMutex);
-          aggregateProgress.processedBytes += (transferred - lastTransferred);
+    // Check per-worker cancel flag
+    int *myCancelFlag = nullptr;
+    {
+      std::lock_guard<std::mutex> lk(m_cancelMutex);
+      if (threadIndex < (int)m_cancelFlags.size()) {
+        myCancelFlag = m_cancelFlags[threadIndex].get();
+        *myCancelFlag = 0;
+      }
+    }
+
+    if (item.ranged) {
+      RangedFile &file = *item.ranged;
+      const std::wstring name = file.source.filename().wstring();
+      // A failed or cancelled range dooms the whole file; the rest of its
+      // ranges are only counted down.
+      if (!file.failed) {
+        long long lastTransferred = 0;
+        auto rangeProgress = [&](long long, long long transferred) {
+          long long delta = transferred - lastTransferred;
           lastTransferred = transferred;
-          aggregateProgress.currentFile = item.source.filename().wstring();
-          logger->OnProgressDetailed(aggregateProgress);
+          long long done = (file.copied += delta);
+          progress.SetPercent(threadIndex,
+                              (int)((done * 100) / file.info.size));
+          progress.AddBytes(threadIndex, delta);
+        };
+        progress.BeginFile(threadIndex, name);
+        std::wstring err;
+        unsigned long long *rangeHash =
+            file.rangeHashes.empty()
+                ? nullptr
+                : &file.rangeHashes[item.rangeOffset / file.rangeSize];
+        DevicePools::Slot slot(sourceDevice, targetDevice, isAborted);
+        IoBudget::Lease lease(task.ioBudget, item.rangeLength, isAborted);
+        // Refused only while the run aborts: the range is dropped unread.
+        const bool refused = slot.Refused() || lease.Refused();
+        if (refused ||
+            !BackupUtils::CopyRange(file.source, file.partial,
+                                    item.rangeOffset, item.rangeLength, err,
+                                    myCancelFlag, rangeProgress, rangeHash)) {
+          const bool first = !file.failed.exchange(true);
+          if (refused || (myCancelFlag && *myCancelFlag)) {
+            if (!refused)
+              SafeLog(logger, L"Worker " + std::to_wstring(threadIndex + 1) +
+                                  L" Cancelled.");
+            // The file's other ranges are dropped with it.
+            if (first)
+              SafeLog(logger,
+                      L"  Ranged copy abandoned: " + file.target.wstring());
+          } else {
+            std::lock_guard<std::mutex> eLock(file.errorMutex);
+            if (file.error.empty())
+              file.error = err;
+          }
+        } else if (!file.journalKey.empty()) {
+          m_journal.RecordRange(file.journalKey, file.info, file.rangeSize,
+                                item.rangeOffset / file.rangeSize,
+                                file.partial);
         }
-      };
-
-      if (logger)
-        logger->OnWorkerProgress(threadIndex, item.source.filename().wstring(),
-                                 0);
-
-      try {
-        if (fs::is_symlink(item.source)) {
-          if (BackupUtils::NeedsUpdate(item.source, item.target, task)) {
-            SafeLog(logger, L"Link: " + item.source.wstring() + L" -> " +
-                                item.target.wstring());
-            if (!dryRun) {
-              std::wstring err;
-              if (!BackupUtils::RobustCopy(item.source, item.target, true, err,
-                                           myCancelFlag, progressCallback)) {
-
-                // If cancelled
-                if (myCancelFlag && *myCancelFlag) {
-                  SafeLog(logger, L"Worker " +
-                                      std::to_wstring(threadIndex + 1) +
-                                      L" Cancelled.");
-                } else {
-                  SafeLog(logger, L"  Link Error: " + err);
-                  if (task.errorPolicy == ErrorPolicy::Suspend)
-                    globalAbort = true;
-                }
+      }
+      // Last range landed: publish the file in one rename.
+      if (--file.remaining == 0)
+        commitRanged(file, threadIndex);
+      return;
+    }
+
+    long long lastTransferred = 0;
+    auto progressCallback = [&](long long total, long long transferred) {
+      if (total > 0)
+        progress.SetPercent(threadIndex, (int)((transferred * 100) / total));
+      progress.AddBytes(threadIndex, transferred - lastTransferred);
+      lastTransferred = transferred;
+    };
+
+    progress.BeginFile(threadIndex, itemSource.filename().wstring());
+
+    try {
+      // Apply: the preview decided already. Only a source that changed since
+      // is looked at again, the way a normal run would.
+      if (item.planned) {
+        const BackupUtils::FileSnapshot now =
+            sourceDirs.Snapshot(item.parent, item.name);
+        if (!now.Exists()) {
+          SafeLog(logger, L"Skip (source gone since the preview): " +
+                              itemSource.wstring());
+          planSkipped++;
+          return;
+        }
+        // Listings give only the type of links (d_type); files compare by
+        // size and mtime too.
+        if (now.type != item.info.type ||
+            (now.type == BackupUtils::FileSnapshot::Type::File &&
+             (now.size != item.info.size || now.mtime != item.info.mtime))) {
+          item.info = now;
+          item.planned = false;
+          planChanged++;
+        }
+      }
+
+      // A planned copy overwrites the target, whatever it is.
+      BackupUtils::FileSnapshot targetInfo;
+      if (item.targetKnown)
+        targetInfo = item.targetInfo;
+      else if (item.fromCatalog)
+        targetInfo = m_catalog.ResolveTarget(itemTarget, &m_metadata);
+      else if (!item.planned)
+        targetInfo = targetDirs.Snapshot(item.parent, item.name);
+
+      // Resume: done by the interrupted run and unchanged since, so not
+      // compared again.
+      if (resuming && !reported && targetInfo.Exists() &&
+          (item.info.IsSymlink() || targetInfo.size == item.info.size) &&
+          m_journal.FindFile(journalKey, item.info)) {
+        progress.AddFiles(threadIndex);
+        progress.AddBytes(threadIndex,
+                          item.info.IsSymlink() ? 0 : item.info.size);
+        return;
+      }
+
+      if (item.info.IsSymlink()) {
+        if (item.planned ||
+            BackupUtils::NeedsUpdate(item.info, targetInfo, itemSource,
+                                     itemTarget, task)) {
+          SafeLog(logger, L"Link: " + itemSource.wstring() + L" -> " +
+                              itemTarget.wstring());
+          if (planning)
+            m_plan.Add(ExecutionPlan::Op::Link, relativeKey(), item.info);
+          if (!dryRun) {
+            std::wstring err;
+            if (!BackupUtils::RobustCopy(itemSource, itemTarget, true, err,
+                                         myCancelFlag, progressCallback)) {
+
+              // If cancelled
+              if (myCancelFlag && *myCancelFlag) {
+                SafeLog(logger, L"Worker " +
+                                    std::to_wstring(threadIndex + 1) +
+                                    L" Cancelled.");
               } else {
-                // Symbolic links don't usually invoke RobustCopy callbacks for
-                // bytes, so we manually increment file count
-                std::lock_guard<std::mutex> pLock(progressMutex);
-                aggregateProgress.processedFiles++;
-                logger->OnProgressDetailed(aggregateProgress);
+                SafeLog(logger, L"  Link Error: " + err);
+                if (task.errorPolicy == ErrorPolicy::Suspend)
+                  globalAbort = true;
               }
+              finishFile(false, fs::path());
+            } else {
+              // Symbolic links don't usually invoke RobustCopy callbacks for
+              // bytes, so we manually increment file count
+              progress.AddFiles(threadIndex);
+              finishFile(true, itemTarget);
             }
           }
-          continue;
         }
+        finishFile(true, fs::path());
+        return;
+      }
 
-        if (fs::is_directory(item.source)) {
-          if (!fs::exists(item.target) && !dryRun) {
-            fs::create_directories(item.target);
-          }
-          {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            for (const auto &entry : fs::directory_iterator(item.source)) {
-              queue.push_back(
-                  {entry.path(), item.target / entry.path().filename()});
-            }
-            cv.notify_all();
-          }
-        } else {
-          bool updated =
-              BackupUtils::NeedsUpdate(item.source, item.target, task);
-          if (updated) {
-            SafeLog(logger, L"Copy: " + item.source.wstring() + L" -> " +
-                                item.target.wstring());
-            if (!dryRun) {
-              std::wstring err;
-              bool success =
-                  BackupUtils::RobustCopy(item.source, item.target, false, err,
-                                          myCancelFlag, progressCallback);
-              if (success) {
-                {
-                  std::lock_guard<std::mutex> pLock(progressMutex);
-                  aggregateProgress.processedFiles++;
-                  logger->OnProgressDetailed(aggregateProgress);
-                }
-                if (task.verify) {
-                  if (BackupUtils::CompareFilesBinary(item.source,
-                                                      item.target)) {
-                    // verified
-                  } else {
-                    SafeLog(logger,
-                            L"  VERIFICATION FAILED: " + item.target.wstring());
-                    if (task.errorPolicy == ErrorPolicy::Suspend)
-                      globalAbort = true;
-                  }
+      if (item.info.IsDirectory()) {
+        if (!targetInfo.Exists() && !dryRun) {
+          targetDirs.MakeDirectory(item.parent, item.name);
+        } else if (!targetInfo.Exists() && planning && !item.name.empty()) {
+          m_plan.Add(ExecutionPlan::Op::MakeDirectory, relativeKey(),
+                     item.info);
+        }
+        // Merge-join both listings: matches carry their target metadata
+        // to the child item, target-only names become parallel delete items.
+        // A trusted catalog stands in for the target listing outside sync.
+        const bool useCatalog = m_catalog.IsTrusted() &&
+                                task.mode != BackupMode::Sync &&
+                                targetInfo.IsDirectory();
+        const PathArena::NodeId node =
+            item.name.empty() ? item.parent
+                              : arena.Add(item.parent, item.name);
+        // An incomplete source listing would turn the target entries it
+        // missed into delete items: skip the directory. Without a complete
+        // target listing the children query their targets one by one.
+        std::vector<BackupUtils::ListedEntry> sourceEntries;
+        if (!sourceDirs.List(node, sourceEntries)) {
+          SafeLog(logger, L"  List Error (skipped): " + itemSource.wstring());
+          if (task.errorPolicy == ErrorPolicy::Suspend)
+            globalAbort = true;
+          finishFile(false, fs::path());
+          return;
+        }
+        std::vector<BackupUtils::ListedEntry> targetEntries;
+        bool targetListed = !useCatalog;
+        if (targetInfo.IsDirectory() && !useCatalog &&
+            !targetDirs.List(node, targetEntries)) {
+          SafeLog(logger, L"  List Error: " + itemTarget.wstring());
+          if (task.errorPolicy == ErrorPolicy::Suspend)
+            globalAbort = true;
+          targetEntries.clear();
+          targetListed = false;
+        }
+
+        // Excluded source entries are neither copied nor entered; excluded
+        // target-only entries are not deleted. The path below the root is
+        // only built when a rule looks past the name.
+        auto excluded = [&](const BackupUtils::ListedEntry &entry) {
+          if (!task.filter)
+            return false;
+          const fs::path name = entry.path.filename();
+          return task.filter->Excludes(
+              task.filter->NeedsPath()
+                  ? arena.Path(fs::path(), node, name.native())
+                  : name,
+              entry.info);
+        };
+
+        long long foundFiles = 0, foundBytes = 0;
+        std::vector<WorkItem> children;
+        BackupUtils::MergeJoin(
+            sourceEntries, targetEntries,
+            [&](const BackupUtils::ListedEntry *src,
+                const BackupUtils::ListedEntry *dst) {
+              if (src && excluded(*src))
+                return;
+              WorkItem child;
+              if (src) {
+                if (aggregateProgress.isEstimate)
+                  BackupUtils::CountEntry(src->info, foundFiles, foundBytes);
+                child.parent = node;
+                child.name = src->path.filename().native();
+                child.info = src->info;
+                if (useCatalog) {
+                  child.fromCatalog = !src->info.IsDirectory();
+                } else if (targetListed) {
+                  child.targetKnown = true;
+                  if (dst)
+                    child.targetInfo = dst->info;
                 }
+              } else if (task.mode == BackupMode::Sync &&
+                         !m_catalog.IsCatalogFile(itemTarget /
+                                                  dst->path.filename()) &&
+                         !excluded(*dst) &&
+                         !(journaling &&
+                           isPartialFile(node,
+                                         dst->path.filename().native()))) {
+                child.parent = node;
+                child.name = dst->path.filename().native();
+                child.deleteExtra = true;
               } else {
-                if (myCancelFlag && *myCancelFlag) {
-                  SafeLog(logger, L"Worker " +
-                                      std::to_wstring(threadIndex + 1) +
-                                      L" Cancelled.");
+                return;
+              }
+              children.push_back(std::move(child));
+            });
+        if (foundFiles > 0)
+          progress.AddTotals(foundFiles, foundBytes);
+        for (WorkItem &child : children)
+          ctx.Push(std::move(child));
+      } else {
+        bool updated =
+            item.planned || BackupUtils::NeedsUpdate(item.info, targetInfo,
+                                                     itemSource, itemTarget,
+                                                     task);
+        if (updated) {
+          SafeLog(logger, L"Copy: " + itemSource.wstring() + L" -> " +
+                              itemTarget.wstring());
+          if (!dryRun && task.rangeCopyThreshold > 0 && !sequentialDevice &&
+              item.info.size >= task.rangeCopyThreshold &&
+              BackupUtils::CanCopyInRanges(itemSource)) {
+            // Split the file so idle workers can help instead of leaving
+            // one thread on it for the tail of the run.
+            auto file = std::make_shared<RangedFile>();
+            file->source = itemSource;
+            file->target = itemTarget;
+            file->partial =
+                arena.Path(target, item.parent, partialName(item.parent,
+                                                            item.name));
+            file->info = item.info;
+            file->journalKey = journalKey;
+            if (journaling)
+              file->journal = &m_journal;
+            // Resume: the interrupted run's partial file keeps the ranges
+            // the journal says are durable in it.
+            JobJournal::Ranges resumed;
+            std::error_code ec;
+            const bool resume =
+                resuming &&
+                fs::file_size(file->partial, ec) ==
+                    (std::uintmax_t)item.info.size &&
+                !ec && m_journal.FindRanges(journalKey, item.info, resumed);
+            std::wstring err;
+            if (resume || BackupUtils::CreateRangeTarget(
+                              file->partial, item.info.size, err)) {
+              // Whole MB ranges keep every range start aligned for the
+              // unbuffered read-back of hash verification.
+              const long long mb = 1024 * 1024;
+              const long long rangeSize =
+                  resume ? resumed.rangeSize
+                         : std::max(kMinRangeSize,
+                                    item.info.size / (numThreads * 8) / mb *
+                                        mb);
+              const int count =
+                  (int)((item.info.size + rangeSize - 1) / rangeSize);
+              resumed.done.resize(count, false);
+              file->rangeSize = rangeSize;
+              // Resumed ranges have no hash: such files are compared whole.
+              if (task.verify && task.verifyMethod == VerifyMethod::Hash &&
+                  !resume)
+                file->rangeHashes.assign(count, 0);
+              std::vector<WorkItem> ranges;
+              long long resumedBytes = 0;
+              for (int i = 0; i < count; ++i) {
+                WorkItem range;
+                range.ranged = file;
+                range.rangeOffset = i * rangeSize;
+                range.rangeLength =
+                    std::min(rangeSize, item.info.size - range.rangeOffset);
+                if (resumed.done[i])
+                  resumedBytes += range.rangeLength;
+                else
+                  ranges.push_back(std::move(range));
+              }
+              file->remaining = (int)ranges.size();
+              file->copied = resumedBytes;
+              progress.AddBytes(threadIndex, resumedBytes);
+              reported = true;
+              SafeLog(logger,
+                      L"  Ranged copy: " + std::to_wstring(count) + L" parts" +
+                          (resumedBytes > 0
+                               ? L", " +
+                                     std::to_wstring(count - ranges.size()) +
+                                     L" resumed"
+                               : L""));
+              if (ranges.empty())
+                commitRanged(*file, threadIndex);
+              for (WorkItem &range : ranges)
+                ctx.Push(std::move(range));
+              return;
+            }
+            file->error = err;
+            SafeLog(logger, L"  Ranged copy unavailable (" + err +
+                                L"), copying whole file");
+          }
+          if (!dryRun) {
+            // Held through the verification read-back as well.
+            DevicePools::Slot slot(sourceDevice, targetDevice, isAborted);
+            std::wstring err;
+            unsigned long long hash = 0;
+            const bool hashVerify =
+                task.verify && task.verifyMethod == VerifyMethod::Hash;
+            bool success;
+            {
+              IoBudget::Lease lease(task.ioBudget, item.info.size, isAborted);
+              // Refused only while the run aborts: skip the copy rather
+              // than run it past the limits.
+              if (slot.Refused() || lease.Refused()) {
+                finishFile(false, fs::path());
+                return;
+              }
+              success = BackupUtils::RobustCopy(
+                  itemSource, itemTarget, false, err, myCancelFlag,
+                  progressCallback, hashVerify ? &hash : nullptr);
+            }
+            if (success) {
+              progress.AddFiles(threadIndex);
+              m_catalog.Record(itemTarget, item.info, hash);
+              if (task.verify) {
+                if (BackupUtils::VerifyCopy(itemSource, itemTarget, hash)) {
+                  // verified
                 } else {
-                  SafeLog(logger, L"  Copy Error: " + err);
+                  SafeLog(logger,
+                          L"  VERIFICATION FAILED: " + itemTarget.wstring());
                   if (task.errorPolicy == ErrorPolicy::Suspend)
                     globalAbort = true;
+                  success = false;
                 }
               }
+              finishFile(success, itemTarget);
             } else {
-              // Dry Run aggregate progress
-              std::lock_guard<std::mutex> pLock(progressMutex);
-              aggregateProgress.processedFiles++;
-              try {
-                aggregateProgress.processedBytes += fs::file_size(item.source);
-              } catch (...) {
+              if (myCancelFlag && *myCancelFlag) {
+                SafeLog(logger, L"Worker " +
+                                    std::to_wstring(threadIndex + 1) +
+                                    L" Cancelled.");
+              } else {
+                SafeLog(logger, L"  Copy Error: " + err);
+                if (task.errorPolicy == ErrorPolicy::Suspend)
+                  globalAbort = true;
               }
-              logger->OnProgressDetailed(aggregateProgress);
+              finishFile(false, fs::path());
             }
           } else {
-            // Skiped item (Identical) - still count towards aggregate
-            std::lock_guard<std::mutex> pLock(progressMutex);
-            aggregateProgress.processedFiles++;
-            try {
-              aggregateProgress.processedBytes += fs::file_size(item.source);
-            } catch (...) {
-            }
-            logger->OnProgressDetailed(aggregateProgress);
+            if (planning)
+              m_plan.Add(ExecutionPlan::Op::Copy, relativeKey(), item.info);
+            // Dry Run aggregate progress
+            progress.AddFiles(threadIndex);
+            progress.AddBytes(threadIndex, item.info.size);
           }
+        } else {
+          // Skiped item (Identical) - still count towards aggregate
+          m_catalog.Record(itemTarget, targetInfo);
+          progress.AddFiles(threadIndex);
+          progress.AddBytes(threadIndex, item.info.size);
+          finishFile(true, fs::path());
         }
-      } catch (...) {
-        if (task.errorPolicy == ErrorPolicy::Suspend)
-          globalAbort = true;
       }
-    }
-    activeWorkers--;
-    if (activeWorkers == 0) {
-      finished = true;
-      if (logger)
-        logger->OnWorkerProgress(threadIndex, L"Done", 100);
-      cv.notify_all();
+    } catch (...) {
+      if (task.errorPolicy == ErrorPolicy::Suspend)
+        globalAbort = true;
+      finishFile(false, fs::path());
     }
   };
 
-  std::vector<std::thread> workers;
-  for (int i = 0; i < numThreads; ++i)
-    workers.push_back(std::thread(worker, i));
-  for (auto &t : workers)
-    t.join();
+  Walker walker(numThreads);
+  walker.SetMemoryBudget(task.traversalMemoryBudget, WorkItemCodec());
+  if (logger)
+    logger->OnWorkersStarted(numThreads);
 
-  if (globalAbort)
-    throw std::runtime_error(
-        "Parallel operation suspended due to error policy.");
-}
-
-void ParallelBackupStrategy::SyncDelete(const fs::path &source,
-                                        const fs::path &target,
-                                        const BackupTask &task,
-                                        IBackupLogger *logger, bool dryRun) {
-  if (task.IsAborted && task.IsAborted())
-    return;
-  if (!fs::exists(target))
-    return;
+  // Adaptive mode: all numThreads workers exist, the controller decides how
+  // many take work. It starts from the old fixed default.
+  AdaptiveConcurrency adaptive(numThreads, 4);
+  if (task.adaptiveWorkers) {
+    walker.SetActiveLimit(adaptive.Limit());
+    adaptive.Start(
+        [&](long long &bytes, long long &files) {
+          const TaskProgress totals = progress.Totals();
+          bytes = totals.processedBytes;
+          files = totals.processedFiles;
+        },
+        [&](int limit) {
+          walker.SetActiveLimit(limit);
+          for (int i = limit; i < numThreads; ++i)
+            progress.BeginFile(i, L"Idle");
+        });
+  }
 
-  // SyncDelete is recursive and single-threaded in this implementation logic
-  // (recursively called). To make it parallel or cancel-aware per worker, would
-  // require refactoring into the queue. For now, we leave it as is but check
-  // global abort. Ideally, SyncDelete should also use the queue.
-
-  for (const auto &entry : fs::directory_iterator(target)) {
-    if (task.IsAborted && task.IsAborted())
-      break;
-    auto item = entry.path();
-    auto src = source / item.filename();
-    if (!fs::exists(src)) {
-      SafeLog(logger, L"Delete: " + item.wstring());
-      if (!dryRun)
-        fs::remove_all(item);
-    } else if (fs::is_directory(item) && !fs::is_symlink(item)) {
-      SyncDelete(src, item, task, logger, dryRun);
+  std::vector<WorkItem> roots;
+  if (task.applyPlan) {
+    // The plan's entries are the walk: directories are created in plan
+    // order (parents first), the rest is spread over the workers.
+    std::unordered_map<std::string, PathArena::NodeId> nodes;
+    nodes.emplace(std::string(), PathArena::kRoot);
+    std::function<PathArena::NodeId(const fs::path &)> nodeFor =
+        [&](const fs::path &dir) {
+          const std::string key = ExecutionPlan::KeyFor(dir);
+          auto it = nodes.find(key);
+          if (it != nodes.end())
+            return it->second;
+          const PathArena::NodeId node =
+              arena.Add(nodeFor(dir.parent_path()), dir.filename().native());
+          nodes.emplace(key, node);
+          return node;
+        };
+    for (const ExecutionPlan::Entry &entry : m_plan.Entries()) {
+      if (isAborted())
+        break;
+      const fs::path relative = fs::u8path(entry.path);
+      // Never leave the roots, whatever the file says.
+      if (relative.empty() || relative.is_absolute() ||
+          std::find(relative.begin(), relative.end(), fs::path(L"..")) !=
+              relative.end())
+        continue;
+      WorkItem item;
+      item.parent = nodeFor(relative.parent_path());
+      item.name = relative.filename().native();
+      if (entry.op == ExecutionPlan::Op::MakeDirectory) {
+        targetDirs.MakeDirectory(item.parent, item.name);
+        continue;
+      }
+      item.info = entry.source;
+      item.planned = true;
+      item.deleteExtra = entry.op == ExecutionPlan::Op::Delete;
+      roots.push_back(std::move(item));
     }
+  } else {
+    WorkItem root;
+    root.info = BackupUtils::SnapshotSource(source, &m_metadata);
+    roots.push_back(std::move(root));
+  }
+  progress.Start();
+  Walker::Stats walkStats = walker.Run(std::move(roots), visit, isAborted);
+  if (task.adaptiveWorkers) {
+    adaptive.Stop();
+    SafeLog(logger, adaptive.Describe());
   }
+  progress.Stop();
+  aggregateProgress = progress.Totals();
+  if (task.traversalMemoryBudget > 0)
+    SafeLog(logger, BackupUtils::FormatTraversalStats(
+                        task.traversalMemoryBudget, walkStats.peakQueuedBytes,
+                        walkStats.spilled, walkStats.peakSpillBytes));
+  if (task.applyPlan)
+    SafeLog(logger, L"Plan applied: " + std::to_wstring(planChanged.load()) +
+                        L" entries changed since the preview and were checked "
+                        L"again, " +
+                        std::to_wstring(planSkipped.load()) + L" skipped");
+  SafeLog(logger, arena.FormatStats());
+  for (const DirHandles *dirs : {&sourceDirs, &targetDirs}) {
+    const std::wstring stats = dirs->FormatStats();
+    if (!stats.empty())
+      SafeLog(logger, stats);
+  }
+  SafeLog(logger, L"Device slots: " + sourceDevice->FormatStats() +
+                      (targetDevice != sourceDevice
+                           ? L"; " + targetDevice->FormatStats()
+                           : L""));
+  if (logger) {
+    for (int i = 0; i < numThreads; ++i)
+      logger->OnWorkerProgress(i, L"Done", 100);
+  }
+
+  if (globalAbort)
+    throw std::runtime_error(
+        "Parallel operation suspended due to error policy.");
 }
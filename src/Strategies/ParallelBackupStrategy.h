@@ -1,4 +1,7 @@
+#include "ExecutionPlan.h"
 #include "IBackupStrategy.h"
+#include "JobJournal.h"
+#include "TargetCatalog.h"
 #include "Types.h"
 #include <future>
 #include <mutex>
@@ -15,12 +18,14 @@ private:
                         const BackupTask &task, IBackupLogger *logger,
                         bool dryRun, TaskProgress &aggregateProgress);
 
-  void SyncDelete(const fs::path &source, const fs::path &target,
-                  const BackupTask &task, IBackupLogger *logger, bool dryRun);
-
   std::mutex m_loggerMutex;
   void SafeLog(IBackupLogger *logger, const std::wstring &msg);
 
   std::vector<std::shared_ptr<int>> m_cancelFlags;
   std::mutex m_cancelMutex;
+
+  TargetCatalog m_catalog;
+  BackupUtils::MetadataStats m_metadata;
+  JobJournal m_journal;
+  ExecutionPlan m_plan;
 };
@@ -0,0 +1,531 @@
+#pragma once
+
+#include "Types.h"
+#include "WorkStealingDeque.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Byte encoding used by the spill codecs of walker items: trivially
+// copyable values verbatim, paths as a length and their native characters.
+namespace SpillEncoding {
+template <typename T> void Put(std::string &out, const T &value) {
+  static_assert(std::is_trivially_copyable<T>::value, "encode field-wise");
+  out.append((const char *)&value, sizeof(T));
+}
+inline void Put(std::string &out, const fs::path::string_type &s) {
+  Put(out, (unsigned)s.size());
+  out.append((const char *)s.data(), s.size() * sizeof(fs::path::value_type));
+}
+inline void Put(std::string &out, const fs::path &path) {
+  Put(out, path.native());
+}
+template <typename T> bool Get(const char *&p, const char *end, T &value) {
+  static_assert(std::is_trivially_copyable<T>::value, "decode field-wise");
+  if ((size_t)(end - p) < sizeof(T))
+    return false;
+  std::memcpy(&value, p, sizeof(T));
+  p += sizeof(T);
+  return true;
+}
+inline bool Get(const char *&p, const char *end, fs::path::string_type &s) {
+  unsigned length = 0;
+  if (!Get(p, end, length))
+    return false;
+  const size_t bytes = (size_t)length * sizeof(fs::path::value_type);
+  if ((size_t)(end - p) < bytes)
+    return false;
+  s.assign(length, fs::path::value_type());
+  if (length > 0)
+    std::memcpy(&s[0], p, bytes);
+  p += bytes;
+  return true;
+}
+inline bool Get(const char *&p, const char *end, fs::path &path) {
+  fs::path::string_type s;
+  if (!Get(p, end, s))
+    return false;
+  path = fs::path(std::move(s));
+  return true;
+}
+// Heap bytes a string or path holds, for the budget estimate.
+inline size_t StringBytes(const fs::path::string_type &s) {
+  return s.capacity() * sizeof(fs::path::value_type);
+}
+inline size_t PathBytes(const fs::path &path) {
+  return StringBytes(path.native());
+}
+} // namespace SpillEncoding
+
+// Multi-threaded tree walker with per-worker work-stealing deques.
+//
+// Every worker owns a lock-free Chase-Lev deque (WorkStealingDeque). Items a
+// worker discovers (typically the children of the directory it just listed)
+// are pushed onto its own deque and popped LIFO, which keeps a worker on its
+// own subtree without taking any lock. An idle worker steals the oldest item
+// from a sibling's deque, which tends to be a large unexplored subtree.
+//
+// A worker that finds nothing to pop or steal parks on a condition variable.
+// Pushes wake one parked worker, and only when someone is parked, so listing
+// a directory does not turn into a notify_all storm. The walk is complete
+// when the count of pushed-but-unfinished items drops to zero; the worker
+// that finishes the last item wakes everyone to exit.
+//
+// SetActiveLimit parks the workers at or above the limit (they stop taking
+// items; whatever is left in their deques is stolen by the active ones), so
+// an adaptive controller can vary concurrency while the walk runs.
+//
+// SetMemoryBudget bounds the bytes of queued items. A push that would exceed
+// the budget first moves the owner's oldest queued items to a temporary
+// spill file, so the newest, deepest work stays in memory and the walk
+// leans depth-first. Spilled items come back in blocks, the most recently
+// written first, once no worker has anything in memory left to pop or
+// steal. The listing of the directory being visited is the visitor's own
+// memory and not counted.
+template <typename Item> class ParallelTreeWalker {
+public:
+  class Context {
+  public:
+    // Queues an item discovered while visiting the current one.
+    void Push(Item item) { m_walker->PushLocal(m_worker, std::move(item)); }
+    int WorkerIndex() const { return m_worker; }
+
+  private:
+    friend class ParallelTreeWalker;
+    Context(ParallelTreeWalker *walker, int worker)
+        : m_walker(walker), m_worker(worker) {}
+    ParallelTreeWalker *m_walker;
+    int m_worker;
+  };
+
+  typedef std::function<void(Item &item, Context &ctx)> Visitor;
+
+  struct Stats {
+    long long visited = 0;
+    long long steals = 0;
+    long long parks = 0; // Times a worker went to sleep for lack of work
+    // Memory budget mode only.
+    long long spilled = 0; // Items written to the spill file
+    long long peakQueuedBytes = 0;
+    long long peakSpillBytes = 0;
+  };
+
+  // How items are measured, written to and read from the spill file. encode
+  // appends the item to out, or returns false for items that cannot be
+  // spilled (they stay in memory); decode reads one back and advances p.
+  struct SpillCodec {
+    std::function<size_t(const Item &)> bytes;
+    std::function<bool(const Item &, std::string &out)> encode;
+    std::function<bool(const char *&p, const char *end, Item &item)> decode;
+  };
+
+  explicit ParallelTreeWalker(int numThreads)
+      : m_numThreads(numThreads > 0 ? numThreads : DefaultThreadCount()),
+        m_activeLimit(m_numThreads) {}
+
+  static int DefaultThreadCount() {
+    unsigned int hw = std::thread::hardware_concurrency();
+    return hw == 0 ? 4 : (int)hw;
+  }
+
+  int ThreadCount() const { return m_numThreads; }
+
+  // Number of workers allowed to take items, 1..ThreadCount(). May be
+  // called before or during Run.
+  void SetActiveLimit(int limit) {
+    if (limit < 1)
+      limit = 1;
+    if (limit > m_numThreads)
+      limit = m_numThreads;
+    {
+      std::lock_guard<std::mutex> lock(m_idleMutex);
+      m_activeLimit = limit;
+    }
+    m_limitCv.notify_all();
+  }
+  int ActiveLimit() const { return m_activeLimit; }
+
+  // Caps the queued items at about bytes (0 = unbounded), spilling the rest
+  // to a file in the temporary directory. Call before Run.
+  void SetMemoryBudget(long long bytes, const SpillCodec &codec) {
+    m_budget = bytes > 0 ? bytes : 0;
+    m_codec = codec;
+  }
+
+  // Visits the roots and everything pushed from them. Returns once the walk
+  // is complete or isAborted() reports true. The first exception escaping a
+  // visitor stops the walk and is rethrown here after all workers joined.
+  Stats Run(std::vector<Item> roots, const Visitor &visit,
+            const std::function<bool()> &isAborted = nullptr) {
+    m_queues.clear();
+    for (int i = 0; i < m_numThreads; ++i)
+      m_queues.push_back(std::make_unique<WorkStealingDeque<Item>>());
+    m_pending = 0;
+    m_stop = false;
+    m_steals = 0;
+    m_parks = 0;
+    m_visited = 0;
+    m_error = nullptr;
+    m_queuedBytes = 0;
+    m_peakQueuedBytes = 0;
+    m_spilled = 0;
+    m_spillBlocks.clear();
+    m_spillBlockCount = 0;
+    m_spillEnd = 0;
+    m_peakSpillBytes = 0;
+    m_workerSpill.assign(m_numThreads, std::string());
+    m_spillBlockBytes = std::min(
+        kMaxSpillBlock, std::max(kMinSpillBlock, (size_t)(m_budget / 4) /
+                                                     (size_t)m_numThreads));
+    struct SpillCleanup {
+      ParallelTreeWalker *walker;
+      ~SpillCleanup() { walker->CloseSpill(); }
+    } spillCleanup{this};
+    if (m_budget > 0)
+      OpenSpill();
+
+    // The deques belong to their workers, but the threads are not running
+    // yet, so seeding them from here is safe.
+    for (size_t i = 0; i < roots.size(); ++i) {
+      m_pending++;
+      if (m_budget > 0)
+        m_queuedBytes += (long long)m_codec.bytes(roots[i]);
+      m_queues[i % m_numThreads]->Push(std::move(roots[i]));
+    }
+    if (m_pending == 0)
+      return Stats();
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < m_numThreads; ++i) {
+      workers.push_back(
+          std::thread([&, i]() { WorkerLoop(i, visit, isAborted); }));
+    }
+    for (auto &t : workers)
+      t.join();
+
+    if (m_error)
+      std::rethrow_exception(m_error);
+
+    Stats stats;
+    stats.visited = m_visited;
+    stats.steals = m_steals;
+    stats.parks = m_parks;
+    stats.spilled = m_spilled;
+    stats.peakQueuedBytes = m_peakQueuedBytes;
+    stats.peakSpillBytes = m_peakSpillBytes;
+    return stats;
+  }
+
+private:
+  // Encoded items are written in blocks of at most this size, and of a
+  // fraction of the budget, so that every worker can refill one at a time
+  // without overshooting it by much.
+  static constexpr size_t kMaxSpillBlock = 256 * 1024;
+  static constexpr size_t kMinSpillBlock = 4 * 1024;
+
+  struct SpillBlock {
+    long long offset;
+    size_t size;
+  };
+
+  // Called from the worker that owns the deque only.
+  void PushLocal(int worker, Item item) {
+    m_pending++;
+    if (m_budget > 0 && !Admit(worker, item))
+      return;
+    PushQueued(worker, std::move(item));
+  }
+
+  // Budget mode: makes room for item by spilling the worker's oldest queued
+  // items. Returns false when item itself went to the spill buffer instead.
+  bool Admit(int worker, const Item &item) {
+    const long long bytes = (long long)m_codec.bytes(item);
+    std::string &buffer = m_workerSpill[worker];
+    while (m_queuedBytes.load(std::memory_order_relaxed) + bytes > m_budget) {
+      std::unique_ptr<Item> oldest(m_queues[worker]->Steal());
+      if (!oldest)
+        break;
+      const long long oldBytes = (long long)m_codec.bytes(*oldest);
+      if (!m_codec.encode(*oldest, buffer)) {
+        // Not spillable: back to the queue, and stop evicting.
+        m_queues[worker]->Push(std::move(*oldest));
+        break;
+      }
+      m_queuedBytes -= oldBytes;
+      m_spilled++;
+    }
+    bool admitted = true;
+    if (m_queuedBytes.load(std::memory_order_relaxed) + bytes > m_budget &&
+        m_codec.encode(item, buffer)) {
+      m_spilled++;
+      admitted = false;
+    } else {
+      AddQueuedBytes(bytes);
+    }
+    if (buffer.size() >= m_spillBlockBytes)
+      FlushSpill(worker);
+    return admitted;
+  }
+
+  void AddQueuedBytes(long long bytes) {
+    long long queued = m_queuedBytes += bytes;
+    long long peak = m_peakQueuedBytes.load(std::memory_order_relaxed);
+    while (queued > peak &&
+           !m_peakQueuedBytes.compare_exchange_weak(peak, queued))
+      ;
+  }
+
+  void PushQueued(int worker, Item item) {
+    m_queues[worker]->Push(std::move(item));
+    // Pairs with the fence in ParkIdle: either the parking worker sees the
+    // new item or this thread sees it registered as a sleeper.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers.load(std::memory_order_relaxed) > 0) {
+      {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        m_wakeups++;
+      }
+      m_idleCv.notify_one();
+    }
+  }
+
+  Item *Steal(int worker) {
+    for (int n = 1; n < m_numThreads; ++n) {
+      Item *item = m_queues[(worker + n) % m_numThreads]->Steal();
+      if (item) {
+        m_steals++;
+        return item;
+      }
+    }
+    return nullptr;
+  }
+
+  bool AnyQueued() const {
+    if (m_spillBlockCount.load() > 0)
+      return true;
+    for (const auto &q : m_queues)
+      if (!q->Empty())
+        return true;
+    return false;
+  }
+
+  void OpenSpill() {
+    static std::atomic<unsigned> s_sequence{0};
+    std::error_code ec;
+    fs::path dir = fs::temp_directory_path(ec);
+    m_spillPath =
+        dir / (L"surebackup-walk-" +
+               std::to_wstring(std::chrono::steady_clock::now()
+                                   .time_since_epoch()
+                                   .count()) +
+               L"-" + std::to_wstring(s_sequence++) + L".spill");
+    m_spillFile.open(m_spillPath, std::ios::in | std::ios::out |
+                                      std::ios::binary | std::ios::trunc);
+    if (!m_spillFile)
+      throw std::runtime_error("Cannot create the traversal spill file in " +
+                               dir.string());
+  }
+
+  void CloseSpill() {
+    if (m_spillFile.is_open())
+      m_spillFile.close();
+    if (!m_spillPath.empty()) {
+      std::error_code ec;
+      fs::remove(m_spillPath, ec);
+      m_spillPath.clear();
+    }
+  }
+
+  // Appends the worker's encoded items to the spill file as one block.
+  void FlushSpill(int worker) {
+    std::string &buffer = m_workerSpill[worker];
+    if (buffer.empty())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(m_spillMutex);
+      m_spillFile.seekp(m_spillEnd);
+      m_spillFile.write(buffer.data(), (std::streamsize)buffer.size());
+      if (!m_spillFile)
+        throw std::runtime_error("Cannot write the traversal spill file");
+      m_spillBlocks.push_back({m_spillEnd, buffer.size()});
+      m_spillEnd += (long long)buffer.size();
+      m_peakSpillBytes = std::max(m_peakSpillBytes, m_spillEnd);
+      m_spillBlockCount++;
+    }
+    buffer.clear();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers.load(std::memory_order_relaxed) > 0) {
+      {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        m_wakeups++;
+      }
+      m_idleCv.notify_one();
+    }
+  }
+
+  // Moves the most recently spilled block into the worker's deque. The
+  // file is used as a stack, so it never grows beyond the peak spill.
+  bool Refill(int worker) {
+    std::string block;
+    {
+      std::lock_guard<std::mutex> lock(m_spillMutex);
+      if (m_spillBlocks.empty())
+        return false;
+      SpillBlock last = m_spillBlocks.back();
+      m_spillBlocks.pop_back();
+      block.resize(last.size);
+      m_spillFile.seekg(last.offset);
+      m_spillFile.read(&block[0], (std::streamsize)last.size);
+      if (!m_spillFile)
+        throw std::runtime_error("Cannot read the traversal spill file");
+      m_spillEnd = last.offset;
+      m_spillBlockCount--;
+    }
+    const char *p = block.data();
+    const char *end = p + block.size();
+    while (p < end) {
+      Item item;
+      if (!m_codec.decode(p, end, item))
+        throw std::runtime_error("Damaged traversal spill block");
+      AddQueuedBytes((long long)m_codec.bytes(item));
+      PushQueued(worker, std::move(item));
+    }
+    return true;
+  }
+
+  void ParkIdle() {
+    unsigned long long wakeups;
+    {
+      std::lock_guard<std::mutex> lock(m_idleMutex);
+      wakeups = m_wakeups;
+    }
+    m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Re-check after registering: a push that raced with the failed
+    // steal is visible now, or its pusher will wake us. A steal can also
+    // fail by losing a race on a non-empty deque.
+    if (!m_stop && !AnyQueued()) {
+      std::unique_lock<std::mutex> lock(m_idleMutex);
+      m_parks++;
+      m_idleCv.wait(lock, [&] { return m_stop || m_wakeups != wakeups; });
+    }
+    m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void ParkInactive(int worker) {
+    std::unique_lock<std::mutex> lock(m_idleMutex);
+    m_limitCv.wait(lock, [&] { return m_stop || worker < m_activeLimit; });
+  }
+
+  // Records the current exception as the walk's error and stops the walk.
+  void Fail() {
+    {
+      std::lock_guard<std::mutex> lock(m_idleMutex);
+      if (!m_error)
+        m_error = std::current_exception();
+    }
+    Finish();
+  }
+
+  void Finish() {
+    {
+      std::lock_guard<std::mutex> lock(m_idleMutex);
+      m_stop = true;
+    }
+    m_idleCv.notify_all();
+    m_limitCv.notify_all();
+  }
+
+  void WorkerLoop(int worker, const Visitor &visit,
+                  const std::function<bool()> &isAborted) {
+    Context ctx(this, worker);
+    while (!m_stop) {
+      if (isAborted && isAborted()) {
+        Finish();
+        break;
+      }
+
+      if (worker >= m_activeLimit) {
+        ParkInactive(worker);
+        continue;
+      }
+
+      std::unique_ptr<Item> item(m_queues[worker]->Pop());
+      if (!item)
+        item.reset(Steal(worker));
+      if (!item && m_budget > 0) {
+        try {
+          if (Refill(worker))
+            continue;
+        } catch (...) {
+          Fail();
+          continue;
+        }
+      }
+      if (!item) {
+        // Nothing to do right now: another worker is still listing a
+        // directory that may produce more items, or the walk is complete
+        // and the last worker is about to wake everyone.
+        ParkIdle();
+        continue;
+      }
+
+      if (m_budget > 0)
+        m_queuedBytes -= (long long)m_codec.bytes(*item);
+      try {
+        visit(*item, ctx);
+        // Children spilled during the visit become visible to the others.
+        if (m_budget > 0)
+          FlushSpill(worker);
+      } catch (...) {
+        Fail();
+      }
+      m_visited++;
+      if (--m_pending == 0)
+        Finish();
+    }
+  }
+
+  int m_numThreads;
+  std::atomic<int> m_activeLimit;
+  std::vector<std::unique_ptr<WorkStealingDeque<Item>>> m_queues;
+  std::atomic<long long> m_pending{0};
+  std::atomic<long long> m_visited{0};
+  std::atomic<long long> m_steals{0};
+  std::atomic<long long> m_parks{0};
+  std::atomic<int> m_sleepers{0};
+  std::atomic<bool> m_stop{false};
+  std::mutex m_idleMutex;
+  unsigned long long m_wakeups = 0; // Guarded by m_idleMutex
+  std::condition_variable m_idleCv;  // Out of work
+  std::condition_variable m_limitCv; // Above the active limit
+  std::exception_ptr m_error;
+
+  // Memory budget mode.
+  long long m_budget = 0;
+  SpillCodec m_codec;
+  std::atomic<long long> m_queuedBytes{0};
+  std::atomic<long long> m_peakQueuedBytes{0};
+  std::atomic<long long> m_spilled{0};
+  std::atomic<long long> m_spillBlockCount{0};
+  size_t m_spillBlockBytes = kMaxSpillBlock;
+  std::vector<std::string> m_workerSpill; // Per worker, owner only
+  std::mutex m_spillMutex;                // Guards the members below
+  fs::path m_spillPath;
+  std::fstream m_spillFile;
+  std::vector<SpillBlock> m_spillBlocks;
+  long long m_spillEnd = 0;
+  long long m_peakSpillBytes = 0;
+};
@@ -0,0 +1,121 @@
+#include "PathArena.h"
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// A name is stored as its length in one character followed by its
+// characters, and never crosses a chunk boundary. File systems limit a
+// name to 255 bytes (UTF-16 units on Windows), so one character holds it.
+static const size_t kMaxName = 255;
+
+typedef std::make_unsigned<fs::path::value_type>::type UnsignedChar;
+
+PathArena::PathArena()
+    : m_nodes(new std::unique_ptr<Node[]>[kMaxChunks]),
+      m_names(new std::unique_ptr<Char[]>[kMaxChunks]) {
+  m_nodes[0].reset(new Node[kChunkSize]);
+  m_nodes[0][kRoot] = {kRoot, InternName(String())};
+  m_nodeCount = 1;
+}
+
+uint32_t PathArena::InternName(const String &name) {
+  auto found = m_interned.find(std::basic_string_view<Char>(name));
+  if (found != m_interned.end())
+    return found->second;
+  if (name.size() > kMaxName)
+    throw std::length_error("Path component too long for the path arena");
+  const uint32_t length = (uint32_t)name.size() + 1;
+  uint32_t offset = m_nameEnd;
+  if ((offset & (kChunkSize - 1)) + length > kChunkSize)
+    offset = (offset | (kChunkSize - 1)) + 1; // Start the next chunk
+  const uint32_t chunk = offset >> kChunkBits;
+  if (chunk >= kMaxChunks)
+    throw std::length_error("Path arena is full");
+  if (!m_names[chunk])
+    m_names[chunk].reset(new Char[kChunkSize]);
+  Char *p = &m_names[chunk][offset & (kChunkSize - 1)];
+  p[0] = (Char)name.size();
+  std::memcpy(p + 1, name.data(), name.size() * sizeof(Char));
+  m_nameEnd = offset + length;
+  m_interned.emplace(std::basic_string_view<Char>(p + 1, name.size()),
+                     offset);
+  return offset;
+}
+
+PathArena::NodeId PathArena::Add(NodeId parent, const String &name) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const NodeId id = m_nodeCount;
+  const uint32_t chunk = id >> kChunkBits;
+  if (chunk >= kMaxChunks)
+    throw std::length_error("Path arena is full");
+  if (!m_nodes[chunk])
+    m_nodes[chunk].reset(new Node[kChunkSize]);
+  m_nodes[chunk][id & (kChunkSize - 1)] = {parent, InternName(name)};
+  m_nodeCount++;
+  return id;
+}
+
+std::basic_string_view<PathArena::Char> PathArena::Name(NodeId node) const {
+  const Node &n = m_nodes[node >> kChunkBits][node & (kChunkSize - 1)];
+  const Char *p = &m_names[n.name >> kChunkBits][n.name & (kChunkSize - 1)];
+  return std::basic_string_view<Char>(p + 1, (size_t)(UnsignedChar)p[0]);
+}
+
+PathArena::NodeId PathArena::Parent(NodeId node) const {
+  return m_nodes[node >> kChunkBits][node & (kChunkSize - 1)].parent;
+}
+
+fs::path PathArena::Path(const fs::path &root, NodeId node,
+                         const String &leaf) const {
+  // Collect the chain bottom-up, then build the native string in one go:
+  // joining component by component would re-parse the path each time.
+  std::vector<NodeId> chain;
+  chain.reserve(32);
+  for (NodeId n = node; n != kRoot;
+       n = m_nodes[n >> kChunkBits][n & (kChunkSize - 1)].parent)
+    chain.push_back(n);
+
+  String s = root.native();
+  auto append = [&](std::basic_string_view<Char> name) {
+    if (!s.empty() && s.back() != fs::path::preferred_separator
+#ifdef _WIN32
+        && s.back() != L'/'
+#endif
+    )
+      s += fs::path::preferred_separator;
+    s.append(name.data(), name.size());
+  };
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+    append(Name(*it));
+  if (!leaf.empty())
+    append(leaf);
+  return fs::path(std::move(s));
+}
+
+size_t PathArena::NodeCount() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_nodeCount;
+}
+
+size_t PathArena::MemoryBytes() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const size_t nodeChunks = (m_nodeCount + kChunkSize - 1) >> kChunkBits;
+  const size_t nameChunks = (m_nameEnd + kChunkSize - 1) >> kChunkBits;
+  return kMaxChunks * (sizeof(m_nodes[0]) + sizeof(m_names[0])) +
+         nodeChunks * kChunkSize * sizeof(Node) +
+         nameChunks * kChunkSize * sizeof(Char) +
+         m_interned.size() * (sizeof(std::basic_string_view<Char>) +
+                              sizeof(uint32_t) + 2 * sizeof(void *));
+}
+
+std::wstring PathArena::FormatStats() const {
+  size_t names;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    names = m_interned.size() - 1; // Not the root's empty name
+  }
+  return L"Path arena: " + std::to_wstring(NodeCount() - 1) +
+         L" directories, " + std::to_wstring(names) + L" distinct names, " +
+         std::to_wstring((MemoryBytes() + 1023) / 1024) + L" KB";
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Types.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Directory tree of one walk, stored as nodes of a parent index and an
+// interned name, so work items carry a 4-byte node id and their own name
+// instead of two full paths. A path is materialized only when a visitor
+// needs it for a system call, by joining a root (source or target) with the
+// node's chain of names; since both sides share the relative path, one node
+// serves both.
+//
+// Only directories get nodes: the arena never shrinks, and files, which
+// outnumber directories by far, are finished as soon as they are visited.
+// Names repeat a lot across a tree ("src", ".git", "2024"), so each
+// distinct directory name is stored once.
+//
+// Add takes a mutex (once per directory visited); Path, Name and Parent
+// take none. A node may be read by any thread that received its id through
+// a synchronized hand-off, such as the walker's deques.
+class PathArena {
+public:
+  typedef uint32_t NodeId;
+  typedef fs::path::value_type Char;
+  typedef fs::path::string_type String;
+
+  // The walk's root: the empty relative path.
+  static constexpr NodeId kRoot = 0;
+
+  PathArena();
+  PathArena(const PathArena &) = delete;
+  PathArena &operator=(const PathArena &) = delete;
+
+  // Node for the directory name inside parent. Not deduplicated: every
+  // directory is visited, and so added, once.
+  NodeId Add(NodeId parent, const String &name);
+
+  // root / (names from kRoot down to node) / leaf; leaf may be empty.
+  fs::path Path(const fs::path &root, NodeId node,
+                const String &leaf = String()) const;
+  std::basic_string_view<Char> Name(NodeId node) const;
+  NodeId Parent(NodeId node) const; // kRoot for kRoot
+
+  size_t NodeCount() const;
+  // Bytes held by nodes, names and the intern table, roughly.
+  size_t MemoryBytes() const;
+  // "Path arena: 81234 directories, 1906 distinct names, 1536 KB"
+  std::wstring FormatStats() const;
+
+private:
+  struct Node {
+    NodeId parent;
+    uint32_t name; // Offset into m_names
+  };
+  // Nodes, or name characters, per chunk.
+  static constexpr uint32_t kChunkBits = 16;
+  static constexpr uint32_t kChunkSize = 1u << kChunkBits;
+  static constexpr uint32_t kMaxChunks = 1u << 16;
+
+  uint32_t InternName(const String &name);
+
+  // Fixed tables of chunk pointers, so readers never see them move.
+  std::unique_ptr<std::unique_ptr<Node[]>[]> m_nodes;
+  std::unique_ptr<std::unique_ptr<Char[]>[]> m_names;
+  mutable std::mutex m_mutex; // Guards the members below and appends
+  uint32_t m_nodeCount = 0;
+  uint32_t m_nameEnd = 0; // Next free name offset
+  std::unordered_map<std::basic_string_view<Char>, uint32_t> m_interned;
+};
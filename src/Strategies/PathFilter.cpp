@@ -0,0 +1,505 @@
+#include "PathFilter.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cwchar>
+#include <cwctype>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace {
+
+typedef PathFilter::Char Char;
+typedef PathFilter::String String;
+typedef PathFilter::View View;
+
+// Entry types a rule applies to.
+const unsigned char kFile = 1; // Anything that is not a directory
+const unsigned char kDirectory = 2;
+
+#ifdef _WIN32
+const Char kSeparators[] = {L'/', L'\\', 0};
+// FILETIME: 100 ns units since 1601, like FileSnapshot::mtime.
+const long long kTicksPerSecond = 10000000LL;
+long long NowTicks() {
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  return ((long long)now.dwHighDateTime << 32) | now.dwLowDateTime;
+}
+#else
+const Char kSeparators[] = {'/', 0};
+// Nanoseconds since 1970, like FileSnapshot::mtime.
+const long long kTicksPerSecond = 1000000000LL;
+long long NowTicks() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+#endif
+const Char kWildcards[] = {'*', '?', '[', 0};
+const Char kAnyDepth[] = {'*', '*', '/', 0};
+
+bool IsSeparator(Char c) {
+#ifdef _WIN32
+  return c == L'/' || c == L'\\';
+#else
+  return c == '/';
+#endif
+}
+
+// Steps over one character of text. Native strings are UTF-8 outside
+// Windows, so '?' and '*' must not stop inside a multibyte sequence.
+size_t NextChar(View text, size_t at) {
+  ++at;
+#ifndef _WIN32
+  while (at < text.size() && ((unsigned char)text[at] & 0xC0) == 0x80)
+    ++at;
+#endif
+  return at;
+}
+
+// Matches the class starting at pattern[at] ('[') against c. Sets end to
+// just past the closing ']'; false and end = npos when it is unterminated.
+bool MatchClass(View pattern, size_t at, Char c, size_t &end) {
+  size_t i = at + 1;
+  bool negate = false;
+  if (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^')) {
+    negate = true;
+    ++i;
+  }
+  bool found = false;
+  for (bool first = true; i < pattern.size(); first = false) {
+    if (pattern[i] == ']' && !first) {
+      end = i + 1;
+      return found != negate && !IsSeparator(c);
+    }
+    Char low = pattern[i], high = low;
+    if (i + 2 < pattern.size() && pattern[i + 1] == '-' &&
+        pattern[i + 2] != ']') {
+      high = pattern[i + 2];
+      i += 3;
+    } else {
+      ++i;
+    }
+    if (low <= c && c <= high)
+      found = true;
+  }
+  end = View::npos;
+  return false;
+}
+
+// Glob match of the whole text. '*' and '?' stay within a component; '**'
+// crosses separators, and "**/" also matches no directory at all.
+bool GlobMatch(View pattern, View text) {
+  size_t p = 0, t = 0;
+  size_t starP = View::npos, starT = 0;
+  while (t < text.size()) {
+    if (p < pattern.size()) {
+      const Char c = pattern[p];
+      if (c == '*') {
+        if (p + 1 < pattern.size() && pattern[p + 1] == '*') {
+          View rest = pattern.substr(p + 2);
+          if (!rest.empty() && IsSeparator(rest[0]) &&
+              GlobMatch(rest.substr(1), text.substr(t)))
+            return true;
+          for (size_t k = t; k <= text.size(); ++k)
+            if (GlobMatch(rest, text.substr(k)))
+              return true;
+          return false;
+        }
+        starP = ++p;
+        starT = t;
+        continue;
+      }
+      if (c == '?' && !IsSeparator(text[t])) {
+        ++p;
+        t = NextChar(text, t);
+        continue;
+      }
+      if (c == '[') {
+        size_t end;
+        if (MatchClass(pattern, p, text[t], end)) {
+          p = end;
+          t = NextChar(text, t);
+          continue;
+        }
+        // Unterminated: a literal '['.
+        if (end == View::npos && text[t] == '[') {
+          ++p;
+          ++t;
+          continue;
+        }
+      } else if (c == text[t] || (IsSeparator(c) && IsSeparator(text[t]))) {
+        ++p;
+        ++t;
+        continue;
+      }
+    }
+    // Let the last '*' take one more character, but never a separator.
+    if (starP == View::npos || IsSeparator(text[starT]))
+      return false;
+    starT = NextChar(text, starT);
+    t = starT;
+    p = starP;
+  }
+  while (p < pattern.size() && pattern[p] == '*')
+    ++p;
+  return p == pattern.size();
+}
+
+bool EndsWith(View text, View suffix) {
+  return text.size() >= suffix.size() &&
+         text.compare(text.size() - suffix.size(), suffix.size(), suffix) ==
+             0;
+}
+
+std::wstring Trim(const std::wstring &text) {
+  size_t begin = 0, end = text.size();
+  while (begin < end && iswspace(text[begin]))
+    ++begin;
+  while (end > begin && iswspace(text[end - 1]))
+    --end;
+  return text.substr(begin, end - begin);
+}
+
+// "100M" -> bytes, "30d" -> mtime ticks. False on garbage or overflow.
+bool ParseQuantity(const std::wstring &text, bool size, long long &value) {
+  size_t used = 0;
+  long long number;
+  try {
+    number = std::stoll(text, &used);
+  } catch (...) {
+    return false;
+  }
+  if (number < 0)
+    return false;
+  std::wstring unit = text.substr(used);
+  for (wchar_t &c : unit)
+    c = (wchar_t)towlower(c);
+  long long scale = 1;
+  if (size) {
+    if (unit.size() == 2 && unit[1] == L'b')
+      unit.erase(1);
+    if (unit == L"k")
+      scale = 1LL << 10;
+    else if (unit == L"m")
+      scale = 1LL << 20;
+    else if (unit == L"g")
+      scale = 1LL << 30;
+    else if (unit == L"t")
+      scale = 1LL << 40;
+    else if (!unit.empty() && unit != L"b")
+      return false;
+  } else {
+    if (unit == L"s")
+      scale = 1;
+    else if (unit == L"m")
+      scale = 60;
+    else if (unit == L"h")
+      scale = 3600;
+    else if (unit == L"d" || unit.empty())
+      scale = 86400;
+    else if (unit == L"w")
+      scale = 7 * 86400;
+    else
+      return false;
+    if (scale > LLONG_MAX / kTicksPerSecond)
+      return false;
+    scale *= kTicksPerSecond;
+  }
+  if (number > LLONG_MAX / scale)
+    return false;
+  value = number * scale;
+  return true;
+}
+
+} // namespace
+
+PathFilter::RuleSet::RuleSet()
+    : sizeAbove(LLONG_MAX), sizeBelow(LLONG_MIN), mtimeBefore(LLONG_MIN),
+      mtimeAfter(LLONG_MAX) {}
+
+bool PathFilter::Compile(const std::wstring &rules, std::wstring &errorMsg) {
+  const long long now = NowTicks();
+  size_t at = 0;
+  while (at <= rules.size()) {
+    size_t end = rules.find(L';', at);
+    if (end == std::wstring::npos)
+      end = rules.size();
+    const std::wstring rule = Trim(rules.substr(at, end - at));
+    if (!rule.empty() && !AddRule(rule, now, errorMsg))
+      return false;
+    at = end + 1;
+  }
+  return true;
+}
+
+bool PathFilter::AddRule(const std::wstring &rule, long long now,
+                         std::wstring &errorMsg) {
+  std::wstring text = rule;
+  bool include = false;
+  if (text[0] == L'+' || text[0] == L'-') {
+    include = text[0] == L'+';
+    text = Trim(text.substr(1));
+  }
+  RuleSet &set = include ? m_include : m_exclude;
+
+  // size>N, size<N, age>N, age<N
+  for (const wchar_t *limit : {L"size", L"age"}) {
+    const size_t length = wcslen(limit);
+    if (text.compare(0, length, limit) != 0 || text.size() <= length ||
+        (text[length] != L'<' && text[length] != L'>'))
+      continue;
+    const bool above = text[length] == L'>';
+    const bool size = length == 4;
+    long long value;
+    if (!ParseQuantity(Trim(text.substr(length + 1)), size, value)) {
+      errorMsg = L"Invalid filter rule \"" + rule + L"\"";
+      return false;
+    }
+    if (size && above && value < set.sizeAbove)
+      set.sizeAbove = value;
+    else if (size && !above && value > set.sizeBelow)
+      set.sizeBelow = value;
+    else if (!size && above && now - value > set.mtimeBefore)
+      set.mtimeBefore = now - value; // Older than value
+    else if (!size && !above && now - value < set.mtimeAfter)
+      set.mtimeAfter = now - value; // Newer than value
+    set.any = true;
+    m_limits++;
+    m_rules++;
+    return true;
+  }
+
+  String pattern = fs::path(text).native();
+  unsigned char types = kFile | kDirectory;
+#ifdef _WIN32
+  for (Char &c : pattern)
+    c = c == L'\\' ? L'/' : (Char)towlower(c);
+#endif
+  if (!pattern.empty() && pattern.back() == '/') {
+    types = kDirectory;
+    while (!pattern.empty() && pattern.back() == '/')
+      pattern.pop_back();
+  }
+  bool anchored = false;
+  if (!pattern.empty() && pattern[0] == '/') {
+    anchored = true;
+    while (!pattern.empty() && pattern[0] == '/')
+      pattern.erase(0, 1);
+  }
+  while (pattern.compare(0, 3, kAnyDepth) == 0) {
+    anchored = false;
+    pattern.erase(0, 3);
+  }
+  if (pattern.empty()) {
+    errorMsg = L"Invalid filter rule \"" + rule + L"\"";
+    return false;
+  }
+  if (pattern.find('/') != String::npos)
+    anchored = true;
+  AddPattern(set, pattern, anchored, types);
+  set.any = true;
+  m_rules++;
+  return true;
+}
+
+void PathFilter::AddPattern(RuleSet &set, const String &pattern,
+                            bool anchored, unsigned char types) {
+  const bool wild = pattern.find_first_of(kWildcards) != String::npos;
+  if (anchored) {
+    m_needsPath = true;
+    if (wild) {
+      set.pathGlobs.push_back({Store(pattern), types});
+      m_globs++;
+      return;
+    }
+    size_t node = 0, at = 0;
+    while (at < pattern.size()) {
+      size_t end = pattern.find('/', at);
+      if (end == String::npos)
+        end = pattern.size();
+      if (end > at) {
+        const View part = View(pattern).substr(at, end - at);
+        auto it = set.trie[node].children.find(part);
+        if (it == set.trie[node].children.end()) {
+          set.trie.emplace_back();
+          it = set.trie[node]
+                   .children.emplace(Store(part), set.trie.size() - 1)
+                   .first;
+        }
+        node = it->second;
+      }
+      at = end + 1;
+    }
+    set.trie[node].types |= types;
+    m_paths++;
+    return;
+  }
+
+  if (!wild) {
+    set.names[Store(pattern)] |= types;
+    m_names++;
+    return;
+  }
+  // *.ext and *.tar.gz: a suffix, looked up by its last extension.
+  const size_t dot = pattern.rfind('.');
+  if (pattern[0] == '*' &&
+      pattern.find_first_of(kWildcards, 1) == String::npos &&
+      dot != String::npos) {
+    const View suffix = Store(View(pattern).substr(1));
+    set.suffixes[suffix.substr(suffix.rfind('.'))].push_back({suffix, types});
+    m_extensions++;
+    return;
+  }
+  // Other name globs only need to be tried on names starting with their
+  // literal prefix, or failing that ending in their literal extension.
+  static const Char kGlobChars[] = {'*', '?', '[', ']', 0};
+  const View stored = Store(pattern);
+  const size_t prefix = pattern.find_first_of(kWildcards);
+  if (prefix > 0) {
+    set.prefixGlobs[stored.substr(0, prefix)].push_back({stored, types});
+    auto at = std::lower_bound(set.prefixLengths.begin(),
+                               set.prefixLengths.end(), prefix);
+    if (at == set.prefixLengths.end() || *at != prefix)
+      set.prefixLengths.insert(at, prefix);
+  } else if (dot != String::npos &&
+             pattern.find_first_of(kGlobChars, dot) == String::npos) {
+    set.nameGlobs[stored.substr(dot)].push_back({stored, types});
+  } else {
+    set.otherGlobs.push_back({stored, types});
+  }
+  m_globs++;
+}
+
+PathFilter::View PathFilter::Store(View text) {
+  m_strings.emplace_back(text);
+  return View(m_strings.back());
+}
+
+bool PathFilter::Excludes(const fs::path &relative,
+                          const BackupUtils::FileSnapshot &info) const {
+  return ExcludesView(View(relative.native()), info);
+}
+
+bool PathFilter::Excludes(const fs::path &root, const fs::path &path,
+                          const BackupUtils::FileSnapshot &info) const {
+  View relative(path.native());
+  const View base(root.native());
+  if (relative.compare(0, base.size(), base) == 0) {
+    relative.remove_prefix(base.size());
+    while (!relative.empty() && IsSeparator(relative[0]))
+      relative.remove_prefix(1);
+  }
+  return ExcludesView(relative, info);
+}
+
+bool PathFilter::ExcludesView(View relative,
+                              const BackupUtils::FileSnapshot &info) const {
+  if (m_rules == 0)
+    return false;
+#ifdef _WIN32
+  String folded(relative);
+  for (Char &c : folded)
+    c = (Char)towlower(c);
+  relative = folded;
+#endif
+  const size_t slash = relative.find_last_of(kSeparators);
+  const View name =
+      slash == View::npos ? relative : relative.substr(slash + 1);
+  const unsigned char type = info.IsDirectory() ? kDirectory : kFile;
+  if (Matches(m_exclude, relative, name, type, info))
+    return true;
+  return m_include.any && type == kFile &&
+         !Matches(m_include, relative, name, type, info);
+}
+
+bool PathFilter::Matches(const RuleSet &set, View relative, View name,
+                         unsigned char type,
+                         const BackupUtils::FileSnapshot &info) {
+  if (!set.any)
+    return false;
+  if (!set.names.empty()) {
+    auto it = set.names.find(name);
+    if (it != set.names.end() && (it->second & type))
+      return true;
+  }
+  const size_t dot = name.rfind('.');
+  if (dot != View::npos) {
+    const View extension = name.substr(dot);
+    if (!set.suffixes.empty()) {
+      auto it = set.suffixes.find(extension);
+      if (it != set.suffixes.end())
+        for (const Suffix &suffix : it->second)
+          if ((suffix.types & type) && EndsWith(name, suffix.suffix))
+            return true;
+    }
+    if (!set.nameGlobs.empty()) {
+      auto it = set.nameGlobs.find(extension);
+      if (it != set.nameGlobs.end())
+        for (const Glob &glob : it->second)
+          if ((glob.types & type) && GlobMatch(glob.pattern, name))
+            return true;
+    }
+  }
+  for (size_t length : set.prefixLengths) {
+    if (length > name.size())
+      break;
+    auto it = set.prefixGlobs.find(name.substr(0, length));
+    if (it != set.prefixGlobs.end())
+      for (const Glob &glob : it->second)
+        if ((glob.types & type) && GlobMatch(glob.pattern, name))
+          return true;
+  }
+  for (const Glob &glob : set.otherGlobs)
+    if ((glob.types & type) && GlobMatch(glob.pattern, name))
+      return true;
+
+  // Anchored paths: a rule ending at any component matches everything
+  // below it.
+  if (!set.trie[0].children.empty()) {
+    size_t node = 0, at = 0;
+    for (;;) {
+      size_t end = relative.find_first_of(kSeparators, at);
+      if (end == View::npos)
+        end = relative.size();
+      if (end > at) {
+        const auto &children = set.trie[node].children;
+        auto it = children.find(relative.substr(at, end - at));
+        if (it == children.end())
+          break;
+        node = it->second;
+        const bool last = end == relative.size();
+        if (set.trie[node].types & (last ? type : kDirectory))
+          return true;
+      }
+      if (end == relative.size())
+        break;
+      at = end + 1;
+    }
+  }
+  for (const Glob &glob : set.pathGlobs)
+    if ((glob.types & type) && GlobMatch(glob.pattern, relative))
+      return true;
+
+  if (info.type == BackupUtils::FileSnapshot::Type::File &&
+      (info.size > set.sizeAbove || info.size < set.sizeBelow ||
+       info.mtime < set.mtimeBefore || info.mtime > set.mtimeAfter))
+    return true;
+  return false;
+}
+
+std::wstring PathFilter::FormatStats() const {
+  auto count = [](size_t n, const wchar_t *one, const wchar_t *many) {
+    return std::to_wstring(n) + L" " + (n == 1 ? one : many);
+  };
+  std::wstring stats = L"Filter: " + count(m_rules, L"rule", L"rules") +
+                       L" (" + count(m_names, L"name", L"names") + L", " +
+                       count(m_extensions, L"extension", L"extensions") +
+                       L", " + count(m_paths, L"path", L"paths") + L", " +
+                       count(m_globs, L"glob", L"globs");
+  if (m_limits > 0)
+    stats += L", " + count(m_limits, L"size/age limit", L"size/age limits");
+  return stats + L")";
+}
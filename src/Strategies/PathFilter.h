@@ -0,0 +1,120 @@
+#pragma once
+#include "BackupUtils.h"
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Include/exclude rules of a unit, compiled once per run into lookup tables
+// so that an entry is classified in a few hash probes however many rules
+// there are:
+//
+//   names       node_modules, Thumbs.db      hash of whole names
+//   extensions  *.tmp, *.tar.gz              hash of the last extension,
+//                                            then a suffix compare
+//   paths       /build, src/gen/             trie of path components
+//   globs       cache-*.log, /logs/**/*.gz   bucketed by their literal
+//                                            prefix or extension
+//   size>100M, size<1K, age>30d, age<12h     one bound per direction
+//
+// The engines ask while they list a directory, so an excluded directory is
+// never descended into, and ScanSource uses the same rules for its totals.
+//
+// Rules are separated by ';'. A leading '-' (the default) excludes, '+'
+// includes. An entry is excluded when an exclude rule matches it; when
+// there are include rules, a file (not a directory) must also match one of
+// them. A trailing '/' restricts a pattern to directories. A pattern with a
+// '/' is anchored at the source root and matches everything below it; one
+// without matches names at any depth ("**/" in front means the same). '*'
+// and '?' stay within a path component, '**' crosses them, [a-z] and [!a]
+// are character classes. size and age apply to regular files only; sizes
+// take K, M, G, T (1024-based), ages s, m, h, d (the default) or w.
+// Names compare case-insensitively on Windows.
+//
+// Excluded entries are outside the unit: they are not copied, compared or
+// counted, and sync leaves them on the target. Thread-safe once compiled.
+class PathFilter {
+public:
+  typedef fs::path::value_type Char;
+  typedef fs::path::string_type String;
+  typedef std::basic_string_view<Char> View;
+
+  PathFilter() = default;
+  PathFilter(const PathFilter &) = delete;
+  PathFilter &operator=(const PathFilter &) = delete;
+
+  // False with errorMsg naming the first malformed rule.
+  bool Compile(const std::wstring &rules, std::wstring &errorMsg);
+  bool Empty() const { return m_rules == 0; }
+  // True when some rule looks past the entry's name, so callers must pass
+  // the path relative to the source root; otherwise the name suffices.
+  bool NeedsPath() const { return m_needsPath; }
+
+  // relative: the entry's path below the source root (or just its name,
+  // see NeedsPath).
+  bool Excludes(const fs::path &relative,
+                const BackupUtils::FileSnapshot &info) const;
+  // The same for path, an entry listed somewhere below root.
+  bool Excludes(const fs::path &root, const fs::path &path,
+                const BackupUtils::FileSnapshot &info) const;
+
+  // "Filter: 12 rules (3 names, 5 extensions, 2 paths, 1 glob, 1 size/age
+  // limit)"
+  std::wstring FormatStats() const;
+
+private:
+  struct Glob {
+    View pattern;
+    unsigned char types;
+  };
+  struct Suffix {
+    View suffix;
+    unsigned char types;
+  };
+  struct TrieNode {
+    std::unordered_map<View, size_t> children;
+    unsigned char types = 0; // Nonzero: a rule ends here
+  };
+  // The compiled rules of one direction (include or exclude).
+  struct RuleSet {
+    std::unordered_map<View, unsigned char> names;
+    std::unordered_map<View, std::vector<Suffix>> suffixes; // By extension
+    // Name globs by the literal text before their first wildcard, probed
+    // with each distinct prefix length; then those starting with a
+    // wildcard by their literal extension; the rest are tried on every name.
+    std::unordered_map<View, std::vector<Glob>> prefixGlobs;
+    std::vector<size_t> prefixLengths; // Ascending
+    std::unordered_map<View, std::vector<Glob>> nameGlobs;
+    std::vector<Glob> otherGlobs;
+    std::vector<Glob> pathGlobs;
+    std::vector<TrieNode> trie{TrieNode()};
+    // Regular files matching size > sizeAbove, size < sizeBelow,
+    // mtime < mtimeBefore (older) or mtime > mtimeAfter (newer).
+    long long sizeAbove;
+    long long sizeBelow;
+    long long mtimeBefore;
+    long long mtimeAfter;
+    bool any = false;
+    RuleSet();
+  };
+
+  bool AddRule(const std::wstring &rule, long long now,
+               std::wstring &errorMsg);
+  void AddPattern(RuleSet &set, const String &pattern, bool anchored,
+                  unsigned char types);
+  View Store(View text);
+  bool ExcludesView(View relative,
+                    const BackupUtils::FileSnapshot &info) const;
+  static bool Matches(const RuleSet &set, View relative, View name,
+                      unsigned char type,
+                      const BackupUtils::FileSnapshot &info);
+
+  RuleSet m_exclude;
+  RuleSet m_include;
+  std::deque<String> m_strings; // Backing store of the views above
+  bool m_needsPath = false;
+  size_t m_rules = 0;
+  size_t m_names = 0, m_extensions = 0, m_paths = 0, m_globs = 0,
+         m_limits = 0;
+};
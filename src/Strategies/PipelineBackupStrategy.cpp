@@ -0,0 +1,753 @@
+#include "PipelineBackupStrategy.h"
+#include "BackupUtils.h"
+#include "BoundedQueue.h"
+#include "DevicePools.h"
+#include "IoBudget.h"
+#include "ParallelTreeWalker.h"
+#include "PathFilter.h"
+#include "UringCopier.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+// Capacity of the queue in front of each stage. File items are small (two
+// paths and two snapshots), so even full queues stay within a few MB. The
+// queues in front of copy and verify are short: their items each stand for
+// a whole transfer, and a long backlog there only delays the back-pressure
+// that should slow enumeration down.
+const size_t kDecideQueue = 4096;
+const size_t kCopyQueue = 256;
+const size_t kVerifyQueue = 256;
+const size_t kMetadataQueue = 4096;
+
+// A directory for the enumeration stage.
+struct DirItem {
+  fs::path source;
+  fs::path target;
+  BackupUtils::FileSnapshot info;
+  BackupUtils::FileSnapshot targetInfo;
+  bool targetKnown = false;
+};
+
+// A file, symlink or sync extra travelling through the later stages.
+struct FileItem {
+  fs::path source;
+  fs::path target;
+  BackupUtils::FileSnapshot info; // Source metadata from the enumeration
+  // Target metadata from the parent's merge-join listing, when available.
+  BackupUtils::FileSnapshot targetInfo;
+  bool targetKnown = false;
+  // Trusted catalog: resolve targetInfo through it instead of a query.
+  bool fromCatalog = false;
+  // Sync mode: target entry without a source counterpart, to be removed.
+  bool deleteExtra = false;
+  // Set by the copy stage: the target now holds info, whose content hashed
+  // to hash (0 when not hashed). Otherwise the target was already identical.
+  bool copied = false;
+  unsigned long long hash = 0;
+};
+
+// The threads of one stage, consuming its input queue. Finish closes the
+// input and waits for the threads to drain it; the destructor does the same,
+// so stages unwound by an exception cannot leave threads blocked in Pop.
+template <typename T> class Stage {
+public:
+  Stage(BoundedQueue<T> &input, int count,
+        const std::function<void(int)> &body)
+      : m_input(input) {
+    for (int i = 0; i < count; ++i)
+      m_threads.emplace_back(body, i);
+  }
+  ~Stage() { Finish(); }
+  void Finish() {
+    m_input.Close();
+    for (auto &t : m_threads)
+      if (t.joinable())
+        t.join();
+  }
+  int Count() const { return (int)m_threads.size(); }
+
+private:
+  BoundedQueue<T> &m_input;
+  std::vector<std::thread> m_threads;
+};
+
+template <typename T>
+std::wstring DescribeQueue(const wchar_t *name, const BoundedQueue<T> &queue) {
+  std::wstringstream ss;
+  ss.precision(1);
+  ss << std::fixed << L"  " << name << L" queue: peak " << queue.Peak()
+     << L"/" << queue.Capacity() << L", producers waited "
+     << queue.PushWaitSeconds() << L" s, consumers waited "
+     << queue.PopWaitSeconds() << L" s";
+  return ss.str();
+}
+
+// Spill encoding for the traversal memory budget.
+ParallelTreeWalker<DirItem>::SpillCodec DirItemCodec() {
+  using namespace SpillEncoding;
+  ParallelTreeWalker<DirItem>::SpillCodec codec;
+  codec.bytes = [](const DirItem &dir) {
+    return sizeof(DirItem) + PathBytes(dir.source) + PathBytes(dir.target);
+  };
+  codec.encode = [](const DirItem &dir, std::string &out) {
+    Put(out, dir.source);
+    Put(out, dir.target);
+    Put(out, dir.info);
+    Put(out, dir.targetInfo);
+    Put(out, dir.targetKnown);
+    return true;
+  };
+  codec.decode = [](const char *&p, const char *end, DirItem &dir) {
+    return Get(p, end, dir.source) && Get(p, end, dir.target) &&
+           Get(p, end, dir.info) && Get(p, end, dir.targetInfo) &&
+           Get(p, end, dir.targetKnown);
+  };
+  return codec;
+}
+} // namespace
+
+void PipelineBackupStrategy::CancelWorker(int index) {
+  std::lock_guard<std::mutex> lock(m_cancelMutex);
+  if (m_copier) {
+    for (int slot = index; slot < m_copier->Slots(); slot += m_copierRows)
+      m_copier->Cancel(slot);
+    return;
+  }
+  if (index >= 0 && index < (int)m_cancelFlags.size()) {
+    if (m_cancelFlags[index]) {
+      *m_cancelFlags[index] = 1;
+    }
+  }
+}
+
+void PipelineBackupStrategy::SafeLog(IBackupLogger *logger,
+                                     const std::wstring &msg) {
+  std::lock_guard<std::mutex> lock(m_loggerMutex);
+  if (logger) {
+    logger->Log(msg);
+  }
+}
+
+void PipelineBackupStrategy::Execute(const BackupTask &task,
+                                     IBackupLogger *logger, bool dryRun) {
+  if (logger) {
+    std::wstringstream ss;
+    ss << L"--------------------------------------------------\n"
+       << (dryRun ? L"PIPELINE PREVIEW / SIMULATION MODE\n"
+                  : L"PIPELINE BACKUP EXECUTION MODE\n")
+       << L"Name: " << task.name << L" ("
+       << (task.mode == BackupMode::Sync ? L"Sync" : L"Copy") << L")\n"
+       << L"Source: " << task.sourcePath << L"\n"
+       << L"Target: " << task.targetPath << L"\n"
+       << L"--------------------------------------------------";
+    SafeLog(logger, ss.str());
+  }
+
+  fs::path sourcePath(task.sourcePath);
+  fs::path targetPath(task.targetPath);
+
+  if (!fs::exists(sourcePath)) {
+    SafeLog(logger, L"ERROR: Source path does not exist.");
+    return;
+  }
+  if (task.filter)
+    SafeLog(logger, task.filter->FormatStats());
+
+  TaskProgress progress;
+  if (logger) {
+    if (task.streamingScan) {
+      BackupUtils::BeginStreamingScan(sourcePath, progress);
+    } else {
+      SafeLog(logger, L"Scanning source... please wait.");
+      BackupUtils::ScanSource(sourcePath, progress.totalFiles,
+                              progress.totalBytes, 0, task.filter.get());
+    }
+  }
+
+  try {
+    m_metadata.Reset();
+    std::wstring catalogError;
+    if (!m_catalog.OpenForTask(task, dryRun, catalogError) &&
+        !catalogError.empty())
+      SafeLog(logger,
+              L"WARNING: " + catalogError + L" (continuing without it)");
+    RunPipeline(sourcePath, targetPath, task, logger, dryRun, progress);
+    if (progress.isEstimate && (!task.IsAborted || !task.IsAborted())) {
+      // Every stage drained, so the streamed totals are final.
+      progress.isEstimate = false;
+      logger->OnProgressDetailed(progress);
+    }
+  } catch (const std::exception &e) {
+    std::string what = e.what();
+    SafeLog(logger,
+            L"CRITICAL ERROR: " + std::wstring(what.begin(), what.end()));
+  }
+
+  bool usedCatalog = m_catalog.IsOpen();
+  std::wstring catalogError;
+  if (!m_catalog.Close(catalogError))
+    SafeLog(logger, L"WARNING: " + catalogError);
+
+  if (logger) {
+    SafeLog(logger, BackupUtils::FormatMetadataStats(m_metadata));
+    SafeLog(logger, BackupUtils::FormatMemoryStats());
+    if (usedCatalog)
+      SafeLog(logger, m_catalog.FormatStats());
+    SafeLog(logger, L"--------------------------------------------------");
+    if (task.IsAborted && task.IsAborted()) {
+      SafeLog(logger, L"PROCESS INTERRUPTED BY USER.");
+    } else {
+      SafeLog(logger, dryRun ? L"Pipeline Preview finished."
+                             : L"Pipeline Backup finished.");
+    }
+    SafeLog(logger, L"--------------------------------------------------");
+  }
+}
+
+void PipelineBackupStrategy::RunPipeline(const fs::path &source,
+                                         const fs::path &target,
+                                         const BackupTask &task,
+                                         IBackupLogger *logger, bool dryRun,
+                                         TaskProgress &progress) {
+  std::atomic<bool> globalAbort(false);
+  std::mutex progressMutex;
+
+  // workerCount sizes the copy stage; the metadata-bound stages need fewer
+  // threads because their calls rarely wait on the device for long.
+  const int copyThreads = std::max(1, task.workerCount);
+  const int enumerateThreads = std::max(1, copyThreads / 4);
+  const int decideThreads =
+      task.criteriaData ? std::max(1, copyThreads / 2)
+                        : std::max(1, copyThreads / 4);
+  const int verifyThreads =
+      task.verify && !dryRun ? std::max(1, copyThreads / 2) : 0;
+
+  {
+    std::lock_guard<std::mutex> lock(m_cancelMutex);
+    m_cancelFlags.clear();
+    for (int i = 0; i < copyThreads; ++i) {
+      m_cancelFlags.push_back(std::make_shared<int>(0));
+    }
+  }
+
+  auto isAborted = [&] {
+    return globalAbort || (task.IsAborted && task.IsAborted());
+  };
+  auto fail = [&] {
+    if (task.errorPolicy == ErrorPolicy::Suspend)
+      globalAbort = true;
+  };
+
+  std::shared_ptr<DevicePools> pools = task.devicePools;
+  if (!pools)
+    pools = std::make_shared<DevicePools>();
+  DevicePools::Device *sourceDevice = pools->Register(source);
+  DevicePools::Device *targetDevice = pools->Register(target);
+  SafeLog(logger, L"Source device " + sourceDevice->Describe());
+  SafeLog(logger, L"Target device " + targetDevice->Describe());
+
+  BoundedQueue<FileItem> decideQueue(kDecideQueue);
+  BoundedQueue<FileItem> copyQueue(kCopyQueue);
+  BoundedQueue<FileItem> verifyQueue(kVerifyQueue);
+  BoundedQueue<FileItem> metadataQueue(kMetadataQueue);
+
+  // Metadata: the only writer of catalog records and finished-file counts.
+  Stage<FileItem> metadataStage(metadataQueue, 1, [&](int) {
+    FileItem item;
+    while (metadataQueue.Pop(item)) {
+      const bool link = item.info.IsSymlink();
+      if (item.copied)
+        m_catalog.Record(item.target, item.info, item.hash);
+      else if (!link)
+        m_catalog.Record(item.target, item.targetInfo);
+      if (logger) {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progress.processedFiles++;
+        // Copied bytes were counted as they landed; links carry none.
+        if (!item.copied && !link)
+          progress.processedBytes += item.info.size;
+        logger->OnProgressDetailed(progress);
+      }
+    }
+  });
+
+  // Verify: reads back each copy. Only verified copies reach the catalog.
+  Stage<FileItem> verifyStage(verifyQueue, verifyThreads, [&](int) {
+    FileItem item;
+    while (verifyQueue.Pop(item)) {
+      if (isAborted())
+        continue;
+      bool verified;
+      {
+        // Hash verification reads only the target.
+        DevicePools::Slot slot(targetDevice,
+                               item.hash == 0 ? sourceDevice : nullptr,
+                               isAborted);
+        // Refused only while the run aborts: the copy goes unverified.
+        if (slot.Refused())
+          continue;
+        verified = BackupUtils::VerifyCopy(item.source, item.target, item.hash);
+      }
+      if (verified) {
+        metadataQueue.Push(std::move(item));
+      } else {
+        SafeLog(logger, L"  VERIFICATION FAILED: " + item.target.wstring());
+        fail();
+      }
+    }
+  });
+
+  // Files the io_uring copier had in flight when its ring broke; the
+  // fallback copy workers take them before the queue.
+  std::mutex retryMutex;
+  std::vector<FileItem> retry;
+  auto nextCopy = [&](FileItem &item) {
+    {
+      std::lock_guard<std::mutex> lock(retryMutex);
+      if (!retry.empty()) {
+        item = std::move(retry.back());
+        retry.pop_back();
+        return true;
+      }
+    }
+    return copyQueue.Pop(item);
+  };
+
+  // Copy: the dashboard's workers.
+  auto copyWorker = [&](int index) {
+    int *cancelFlag = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(m_cancelMutex);
+      cancelFlag = m_cancelFlags[index].get();
+    }
+    const bool hashVerify =
+        task.verify && task.verifyMethod == VerifyMethod::Hash;
+    FileItem item;
+    while (nextCopy(item)) {
+      if (isAborted())
+        continue;
+      *cancelFlag = 0;
+      const std::wstring name = item.source.filename().wstring();
+      if (logger)
+        logger->OnWorkerProgress(index, name, 0);
+      long long lastTransferred = 0;
+      auto progressCallback = [&](long long total, long long transferred) {
+        if (!logger)
+          return;
+        if (total > 0)
+          logger->OnWorkerProgress(index, name,
+                                   (int)((transferred * 100) / total));
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progress.processedBytes += transferred - lastTransferred;
+        lastTransferred = transferred;
+        progress.currentFile = name;
+        logger->OnProgressDetailed(progress);
+      };
+
+      std::wstring err;
+      bool success;
+      {
+        DevicePools::Slot slot(sourceDevice, targetDevice, isAborted);
+        IoBudget::Lease lease(task.ioBudget, item.info.size, isAborted);
+        // Refused only while the run aborts: drop the item uncopied.
+        if (slot.Refused() || lease.Refused())
+          continue;
+        success = BackupUtils::RobustCopy(item.source, item.target, false, err,
+                                          cancelFlag, progressCallback,
+                                          hashVerify ? &item.hash : nullptr);
+      }
+      if (!success) {
+        if (*cancelFlag) {
+          SafeLog(logger,
+                  L"Worker " + std::to_wstring(index + 1) + L" Cancelled.");
+        } else {
+          SafeLog(logger, L"  Copy Error: " + err);
+          fail();
+        }
+        continue;
+      }
+      item.copied = true;
+      if (verifyThreads > 0)
+        verifyQueue.Push(std::move(item));
+      else
+        metadataQueue.Push(std::move(item));
+    }
+  };
+
+  // io_uring: one thread keeps up to eight files per worker in flight, but
+  // no more than the devices take at once.
+  std::unique_ptr<UringCopier> copier;
+  if (m_backend == CopyBackend::IoUring && !dryRun) {
+    int files = std::min(std::max(copyThreads * 8, 8), 64);
+    if (sourceDevice->Limit() > 0)
+      files = std::min(files, sourceDevice->Limit());
+    if (targetDevice->Limit() > 0)
+      files = std::min(files, targetDevice->Limit());
+    copier.reset(new UringCopier(files));
+    std::wstring err;
+    if (copier->Open(err)) {
+      const int slots = copier->Slots();
+      SafeLog(logger, L"Copy backend: io_uring, " + std::to_wstring(slots) +
+                          (slots == 1 ? L" file" : L" files") +
+                          L" in flight");
+      std::lock_guard<std::mutex> lock(m_cancelMutex);
+      m_copier = copier.get();
+      m_copierRows = copyThreads;
+    } else {
+      SafeLog(logger, L"io_uring unavailable (" + err + L"); copying with " +
+                          std::to_wstring(copyThreads) + L" threads.");
+      copier.reset();
+    }
+  }
+
+  // Ring slot i is shown on dashboard row i % copyThreads.
+  auto ringWorker = [&](int) {
+    const bool hashVerify =
+        task.verify && task.verifyMethod == VerifyMethod::Hash;
+    std::vector<FileItem> items(copier->Slots());
+    std::vector<long long> lastCopied(items.size(), 0);
+    auto fetch = [&](int slot, UringCopier::Job &job, bool wait) {
+      FileItem &item = items[slot];
+      do {
+        bool closed;
+        if (wait ? !copyQueue.Pop(item) : !copyQueue.TryPop(item, closed))
+          return false;
+      } while (isAborted());
+      job.source = item.source;
+      job.target = item.target;
+      job.hash = hashVerify;
+      lastCopied[slot] = 0;
+      if (logger)
+        logger->OnWorkerProgress(slot % copyThreads,
+                                 item.source.filename().wstring(), 0);
+      return true;
+    };
+    auto onProgress = [&](int slot, const UringCopier::Job &job,
+                          long long total, long long copied) {
+      if (!logger)
+        return;
+      const std::wstring name = job.source.filename().wstring();
+      if (total > 0)
+        logger->OnWorkerProgress(slot % copyThreads, name,
+                                 (int)((copied * 100) / total));
+      std::lock_guard<std::mutex> lock(progressMutex);
+      progress.processedBytes += copied - lastCopied[slot];
+      lastCopied[slot] = copied;
+      progress.currentFile = name;
+      logger->OnProgressDetailed(progress);
+    };
+    auto onDone = [&](int slot, const UringCopier::Job &,
+                      UringCopier::Outcome outcome, unsigned long long hash,
+                      const std::wstring &err) {
+      FileItem &item = items[slot];
+      if (outcome == UringCopier::Outcome::Cancelled) {
+        if (!isAborted())
+          SafeLog(logger, L"Worker " + std::to_wstring(slot % copyThreads + 1) +
+                              L" Cancelled.");
+        return;
+      }
+      if (outcome == UringCopier::Outcome::Failed) {
+        SafeLog(logger, L"  Copy Error: " + err);
+        fail();
+        return;
+      }
+      if (outcome == UringCopier::Outcome::Retry) {
+        // Copied again from the start, so its bytes count again too.
+        {
+          std::lock_guard<std::mutex> lock(progressMutex);
+          progress.processedBytes -= lastCopied[slot];
+        }
+        std::lock_guard<std::mutex> lock(retryMutex);
+        retry.push_back(std::move(item));
+        return;
+      }
+      item.copied = true;
+      item.hash = hash;
+      if (verifyThreads > 0)
+        verifyQueue.Push(std::move(item));
+      else
+        metadataQueue.Push(std::move(item));
+    };
+    std::wstring err;
+    if (!copier->Run(fetch, onProgress, onDone, isAborted, err)) {
+      {
+        std::lock_guard<std::mutex> lock(m_cancelMutex);
+        m_copier = nullptr;
+      }
+      SafeLog(logger, L"io_uring failed (" + err +
+                          L"); copying the rest with " +
+                          std::to_wstring(copyThreads) + L" threads.");
+      std::vector<std::thread> threads;
+      for (int i = 0; i < copyThreads; ++i)
+        threads.emplace_back(copyWorker, i);
+      for (auto &t : threads)
+        t.join();
+    }
+    // After an abort the ring stops fetching; drain what the decide stage
+    // still queues so it cannot block on a full queue.
+    FileItem skipped;
+    while (copyQueue.Pop(skipped)) {
+    }
+  };
+
+  Stage<FileItem> copyStage(
+      copyQueue, copier ? 1 : copyThreads,
+      copier ? std::function<void(int)>(ringWorker)
+             : std::function<void(int)>(copyWorker));
+
+  // Decide: one target query (or catalog lookup) and NeedsUpdate per file.
+  Stage<FileItem> decideStage(decideQueue, decideThreads, [&](int) {
+    FileItem item;
+    while (decideQueue.Pop(item)) {
+      if (isAborted())
+        continue;
+      try {
+        if (item.deleteExtra) {
+          SafeLog(logger, L"Delete: " + item.target.wstring());
+          if (!dryRun) {
+            std::error_code ec;
+            fs::remove_all(item.target, ec);
+            if (ec) {
+              SafeLog(logger, L"  Delete Failed: " + item.target.wstring());
+              fail();
+            } else {
+              m_catalog.Forget(item.target, true);
+            }
+          }
+          continue;
+        }
+
+        if (item.fromCatalog)
+          item.targetInfo = m_catalog.ResolveTarget(item.target, &m_metadata);
+        else if (!item.targetKnown)
+          item.targetInfo =
+              BackupUtils::SnapshotTarget(item.target, &m_metadata);
+
+        bool updated;
+        {
+          // A content comparison reads both files.
+          DevicePools::Slot slot(task.criteriaData ? sourceDevice : nullptr,
+                                 task.criteriaData ? targetDevice : nullptr,
+                                 isAborted);
+          // Refused only while the run aborts: drop the item undecided.
+          if (slot.Refused())
+            continue;
+          updated = BackupUtils::NeedsUpdate(item.info, item.targetInfo,
+                                             item.source, item.target, task);
+        }
+        if (!updated) {
+          metadataQueue.Push(std::move(item));
+          continue;
+        }
+
+        if (item.info.IsSymlink()) {
+          SafeLog(logger, L"Link: " + item.source.wstring() + L" -> " +
+                              item.target.wstring());
+          if (dryRun)
+            continue;
+          std::wstring err;
+          if (BackupUtils::RobustCopy(item.source, item.target, true, err)) {
+            if (logger) {
+              std::lock_guard<std::mutex> lock(progressMutex);
+              progress.processedFiles++;
+              logger->OnProgressDetailed(progress);
+            }
+          } else {
+            SafeLog(logger, L"  Link Error: " + err);
+            fail();
+          }
+          continue;
+        }
+
+        SafeLog(logger, L"Copy: " + item.source.wstring() + L" -> " +
+                            item.target.wstring());
+        if (dryRun) {
+          if (logger) {
+            std::lock_guard<std::mutex> lock(progressMutex);
+            progress.processedFiles++;
+            progress.processedBytes += item.info.size;
+            logger->OnProgressDetailed(progress);
+          }
+          continue;
+        }
+        copyQueue.Push(std::move(item));
+      } catch (...) {
+        fail();
+      }
+    }
+  });
+
+  // Enumerate: directories go back to the walker, everything else to the
+  // decide stage. A full decide queue blocks the walker's workers, which is
+  // what keeps a fast listing from running arbitrarily far ahead.
+  typedef ParallelTreeWalker<DirItem> Walker;
+  auto visit = [&](DirItem &dir, Walker::Context &ctx) {
+    try {
+      BackupUtils::FileSnapshot targetInfo =
+          dir.targetKnown ? dir.targetInfo
+                          : BackupUtils::SnapshotTarget(dir.target,
+                                                        &m_metadata);
+      if (!targetInfo.Exists() && !dryRun)
+        fs::create_directories(dir.target);
+      // A trusted catalog stands in for the target listing outside sync.
+      const bool useCatalog = m_catalog.IsTrusted() &&
+                              task.mode != BackupMode::Sync &&
+                              targetInfo.IsDirectory();
+      // An incomplete source listing would turn the target entries it
+      // missed into deletions: skip the directory. Without a complete
+      // target listing the entries are resolved one by one instead.
+      std::vector<BackupUtils::ListedEntry> sourceEntries;
+      if (!BackupUtils::ListDirectory(dir.source,
+                                      BackupUtils::MetadataRole::Source,
+                                      sourceEntries, &m_metadata)) {
+        SafeLog(logger, L"  List Error (skipped): " + dir.source.wstring());
+        fail();
+        return;
+      }
+      std::vector<BackupUtils::ListedEntry> targetEntries;
+      bool targetListed = !useCatalog;
+      if (targetInfo.IsDirectory() && !useCatalog &&
+          !BackupUtils::ListDirectory(dir.target,
+                                      BackupUtils::MetadataRole::Target,
+                                      targetEntries, &m_metadata)) {
+        SafeLog(logger, L"  List Error: " + dir.target.wstring());
+        fail();
+        targetEntries.clear();
+        targetListed = false;
+      }
+      // Excluded source entries are neither copied nor entered; excluded
+      // target-only entries are not deleted. Filtering in the merge rather
+      // than the listing keeps an excluded entry's target counterpart paired,
+      // so Sync does not take it for an extra.
+      auto excluded = [&](const BackupUtils::ListedEntry &entry) {
+        return task.filter &&
+               task.filter->Excludes(source, entry.path, entry.info);
+      };
+
+      long long foundFiles = 0, foundBytes = 0;
+      BackupUtils::MergeJoin(
+          sourceEntries, targetEntries,
+          [&](const BackupUtils::ListedEntry *src,
+              const BackupUtils::ListedEntry *dst) {
+            if (src && excluded(*src))
+              return;
+            if (src && src->info.IsDirectory()) {
+              DirItem child;
+              child.source = src->path;
+              child.target = dir.target / src->path.filename();
+              child.info = src->info;
+              if (targetListed) {
+                child.targetKnown = true;
+                if (dst)
+                  child.targetInfo = dst->info;
+              }
+              ctx.Push(std::move(child));
+              return;
+            }
+            FileItem file;
+            if (src) {
+              if (progress.isEstimate)
+                BackupUtils::CountEntry(src->info, foundFiles, foundBytes);
+              file.source = src->path;
+              file.target = dir.target / src->path.filename();
+              file.info = src->info;
+              if (useCatalog) {
+                file.fromCatalog = true;
+              } else if (targetListed) {
+                file.targetKnown = true;
+                if (dst)
+                  file.targetInfo = dst->info;
+              }
+            } else if (task.mode == BackupMode::Sync &&
+                       !m_catalog.IsCatalogFile(dst->path) &&
+                       !(task.filter &&
+                         task.filter->Excludes(target, dst->path,
+                                               dst->info))) {
+              file.target = dst->path;
+              file.deleteExtra = true;
+            } else {
+              return;
+            }
+            decideQueue.Push(std::move(file));
+          });
+      if (foundFiles > 0 && logger) {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progress.totalFiles += foundFiles;
+        progress.totalBytes += foundBytes;
+        logger->OnProgressDetailed(progress);
+      }
+    } catch (...) {
+      fail();
+    }
+  };
+
+  if (logger)
+    logger->OnWorkersStarted(copyThreads);
+
+  // Each stage's input closes once all of its producers are done, so the
+  // stages finish in order and every queued item is drained.
+  std::exception_ptr error;
+  Walker::Stats walkStats;
+  try {
+    DirItem root;
+    root.source = source;
+    root.target = target;
+    root.info = BackupUtils::SnapshotSource(source, &m_metadata);
+    if (root.info.IsDirectory()) {
+      Walker walker(enumerateThreads);
+      walker.SetMemoryBudget(task.traversalMemoryBudget, DirItemCodec());
+      walkStats = walker.Run({root}, visit, isAborted);
+    } else {
+      FileItem file;
+      file.source = source;
+      file.target = target;
+      file.info = root.info;
+      decideQueue.Push(std::move(file));
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+  decideStage.Finish();
+  copyStage.Finish();
+  verifyStage.Finish();
+  metadataStage.Finish();
+  {
+    std::lock_guard<std::mutex> lock(m_cancelMutex);
+    m_copier = nullptr;
+  }
+  if (error)
+    std::rethrow_exception(error);
+
+  if (logger) {
+    for (int i = 0; i < copyThreads; ++i)
+      logger->OnWorkerProgress(i, L"Done", 100);
+    std::wstringstream ss;
+    ss << L"Pipeline threads: enumerate " << enumerateThreads << L", decide "
+       << decideStage.Count() << L", copy "
+       << (copier ? std::wstring(L"1 (io_uring)")
+                  : std::to_wstring(copyStage.Count()))
+       << L", verify " << verifyStage.Count() << L", metadata "
+       << metadataStage.Count() << L"\n"
+       << DescribeQueue(L"Decide", decideQueue) << L"\n"
+       << DescribeQueue(L"Copy", copyQueue) << L"\n"
+       << DescribeQueue(L"Verify", verifyQueue) << L"\n"
+       << DescribeQueue(L"Metadata", metadataQueue);
+    if (copier)
+      ss << L"\n" << copier->FormatStats();
+    if (task.traversalMemoryBudget > 0)
+      ss << L"\n"
+         << BackupUtils::FormatTraversalStats(
+                task.traversalMemoryBudget, walkStats.peakQueuedBytes,
+                walkStats.spilled, walkStats.peakSpillBytes);
+    SafeLog(logger, ss.str());
+  }
+
+  if (globalAbort)
+    throw std::runtime_error(
+        "Pipeline operation suspended due to error policy.");
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "IBackupStrategy.h"
+#include "TargetCatalog.h"
+#include "Types.h"
+#include "UringCopier.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Staged variant of the Parallel engine. Instead of every worker carrying an
+// item through all steps, each step is a stage with its own threads, joined
+// to the next one by a BoundedQueue:
+//
+//   enumerate -> decide -> copy -> verify -> metadata
+//
+// enumerate  lists source and target directories (ParallelTreeWalker) and
+//            creates target directories;
+// decide     resolves target metadata, runs NeedsUpdate, deletes sync
+//            extras and recreates symlinks;
+// copy       RobustCopy, hashing the source when verification wants it;
+// verify     reads back the copy (VerifyCopy);
+// metadata   one thread that records results in the target catalog and
+//            counts finished files.
+//
+// Listing and decisions thus run ahead while copies and verification keep
+// the devices busy, and a slow verification no longer holds up the next
+// copy. Full queues block their producers, which bounds memory however far
+// enumeration could run ahead. Files are always copied whole; units that
+// need ranged copies of very large files use the Parallel engine.
+//
+// With the IoUring backend the copy stage is a single thread driving a
+// UringCopier, which keeps many files in flight without a thread for each.
+// It sizes itself by the device limits but takes no DevicePools slots and no
+// IoBudget leases: its fixed buffer ring bounds the bytes in flight. Where
+// io_uring is unavailable the stage falls back to the copy threads.
+class PipelineBackupStrategy : public IBackupStrategy {
+public:
+  enum class CopyBackend { Threads, IoUring };
+
+  explicit PipelineBackupStrategy(CopyBackend backend = CopyBackend::Threads)
+      : m_backend(backend) {}
+
+  void Execute(const BackupTask &task, IBackupLogger *logger,
+               bool dryRun) override;
+  // Index of a copy thread; those are the workers on the dashboard. With
+  // io_uring, the files of the ring slots shown on that row.
+  void CancelWorker(int index) override;
+
+private:
+  void RunPipeline(const fs::path &source, const fs::path &target,
+                   const BackupTask &task, IBackupLogger *logger, bool dryRun,
+                   TaskProgress &progress);
+
+  std::mutex m_loggerMutex;
+  void SafeLog(IBackupLogger *logger, const std::wstring &msg);
+
+  const CopyBackend m_backend;
+
+  std::vector<std::shared_ptr<int>> m_cancelFlags;
+  UringCopier *m_copier = nullptr; // While the io_uring copy stage runs
+  int m_copierRows = 0;
+  std::mutex m_cancelMutex;
+
+  TargetCatalog m_catalog;
+  BackupUtils::MetadataStats m_metadata;
+};
@@ -0,0 +1,128 @@
+#include "ProgressAggregator.h"
+#include <algorithm>
+
+ProgressAggregator::ProgressAggregator(IBackupLogger *logger, int workers,
+                                       const TaskProgress &initial,
+                                       std::chrono::milliseconds interval)
+    : m_logger(logger), m_workers(std::max(1, workers)), m_interval(interval),
+      m_initial(initial), m_slots(new Slot[std::max(1, workers)]),
+      m_totalFiles(initial.totalFiles), m_totalBytes(initial.totalBytes),
+      m_shown(std::max(1, workers)) {}
+
+ProgressAggregator::~ProgressAggregator() { Stop(); }
+
+void ProgressAggregator::Start() {
+  if (m_sampler.joinable() || !m_logger)
+    return;
+  m_start = std::chrono::steady_clock::now();
+  m_history.assign(1, Sample{m_start, 0, 0});
+  m_stop = false;
+  m_sampler = std::thread([this] { Run(); });
+}
+
+void ProgressAggregator::Stop() {
+  if (!m_sampler.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_sampler.join();
+}
+
+void ProgressAggregator::BeginFile(int worker, const std::wstring &name) {
+  Slot &slot = m_slots[Index(worker)];
+  {
+    std::lock_guard<std::mutex> lock(slot.nameMutex);
+    slot.name = name;
+  }
+  slot.percent.store(0, std::memory_order_relaxed);
+  slot.generation.fetch_add(1, std::memory_order_release);
+}
+
+TaskProgress ProgressAggregator::Totals() const {
+  TaskProgress progress;
+  progress.totalFiles = m_totalFiles.load(std::memory_order_relaxed);
+  progress.totalBytes = m_totalBytes.load(std::memory_order_relaxed);
+  progress.processedFiles = m_initial.processedFiles;
+  progress.processedBytes = m_initial.processedBytes;
+  for (int i = 0; i < m_workers; ++i) {
+    progress.processedFiles += m_slots[i].files.load(std::memory_order_relaxed);
+    progress.processedBytes += m_slots[i].bytes.load(std::memory_order_relaxed);
+  }
+  progress.isEstimate = m_initial.isEstimate;
+  return progress;
+}
+
+void ProgressAggregator::Run() {
+  for (;;) {
+    bool stopping;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait_for(lock, m_interval, [&] { return m_stop; });
+      stopping = m_stop;
+    }
+    Publish();
+    if (stopping)
+      return;
+  }
+}
+
+void ProgressAggregator::Publish() {
+  TaskProgress progress = Totals();
+  const auto now = std::chrono::steady_clock::now();
+
+  // Workers whose file or percentage moved. The status line shows the file
+  // of the next worker, in turn, that began one since the last sample.
+  int current = -1;
+  for (int n = 1; n <= m_workers; ++n) {
+    const int i = (m_lastCurrent + n) % m_workers;
+    Slot &slot = m_slots[i];
+    Shown &shown = m_shown[i];
+    const unsigned generation = slot.generation.load(std::memory_order_acquire);
+    const int percent = slot.percent.load(std::memory_order_relaxed);
+    if (generation == shown.generation && percent == shown.percent)
+      continue;
+    if (generation != shown.generation) {
+      std::lock_guard<std::mutex> lock(slot.nameMutex);
+      shown.name = slot.name;
+      if (current < 0)
+        current = i;
+    }
+    shown.generation = generation;
+    shown.percent = percent;
+    m_logger->OnWorkerProgress(i, shown.name, percent);
+  }
+  if (current >= 0) {
+    m_lastCurrent = current;
+    m_currentFile = m_shown[current].name;
+  }
+  progress.currentFile = m_currentFile;
+
+  ProgressRates rates;
+  rates.elapsedSeconds = std::chrono::duration<double>(now - m_start).count();
+  const long long bytes = progress.processedBytes - m_initial.processedBytes;
+  const long long files = progress.processedFiles - m_initial.processedFiles;
+  if (rates.elapsedSeconds > 0) {
+    rates.averageBytesPerSecond = bytes / rates.elapsedSeconds;
+    rates.averageFilesPerSecond = files / rates.elapsedSeconds;
+  }
+  // Current rates over the oldest sample within the last second.
+  m_history.push_back({now, bytes, files});
+  while (m_history.size() > 2 &&
+         now - m_history[1].time >= std::chrono::seconds(1))
+    m_history.pop_front();
+  const Sample &oldest = m_history.front();
+  const double window =
+      std::chrono::duration<double>(now - oldest.time).count();
+  if (window > 0) {
+    rates.currentBytesPerSecond = (bytes - oldest.bytes) / window;
+    rates.currentFilesPerSecond = (files - oldest.files) / window;
+  } else {
+    rates.currentBytesPerSecond = rates.averageBytesPerSecond;
+    rates.currentFilesPerSecond = rates.averageFilesPerSecond;
+  }
+
+  m_logger->OnAggregatedProgress(progress, rates);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Types.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Progress of a parallel run: counted by the workers, reported by a sampler
+// thread at a fixed rate.
+//
+// Reporting every copy chunk (lock a shared TaskProgress, format and paint
+// the status line) costs more than the copy itself on trees of small files.
+// Here a worker only adds to its own counters, relaxed atomics on a cache
+// line no other worker writes. Once per interval the sampler sums them and
+// publishes a single OnAggregatedProgress with the current and average
+// rates, then OnWorkerProgress for each worker whose file or percentage
+// changed since the previous sample. The logger is only ever called from
+// the sampler thread (and from Stop).
+class ProgressAggregator {
+public:
+  // initial: totals known before the run (the pre-scan's, or the streaming
+  // scan's provisional ones, which stay estimates until the run is done).
+  ProgressAggregator(IBackupLogger *logger, int workers,
+                     const TaskProgress &initial,
+                     std::chrono::milliseconds interval =
+                         std::chrono::milliseconds(100));
+  ~ProgressAggregator();
+  ProgressAggregator(const ProgressAggregator &) = delete;
+  ProgressAggregator &operator=(const ProgressAggregator &) = delete;
+
+  void Start();
+  // Publishes a last sample, then stops the sampler. Idempotent.
+  void Stop();
+
+  // Worker side. All lock-free but BeginFile, which takes the worker's own
+  // lock once per file for the name.
+  void BeginFile(int worker, const std::wstring &name);
+  void SetPercent(int worker, int percent) {
+    m_slots[Index(worker)].percent.store(percent, std::memory_order_relaxed);
+  }
+  void AddBytes(int worker, long long bytes) {
+    m_slots[Index(worker)].bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  void AddFiles(int worker, long long files = 1) {
+    m_slots[Index(worker)].files.fetch_add(files, std::memory_order_relaxed);
+  }
+  // Streaming scan: files and bytes found by listing a directory.
+  void AddTotals(long long files, long long bytes) {
+    m_totalFiles.fetch_add(files, std::memory_order_relaxed);
+    m_totalBytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  // Sum of the counters now, without currentFile. Any thread.
+  TaskProgress Totals() const;
+
+private:
+  struct alignas(64) Slot {
+    std::atomic<long long> bytes{0};
+    std::atomic<long long> files{0};
+    std::atomic<int> percent{0};
+    std::atomic<unsigned> generation{0}; // Bumped by BeginFile
+    std::mutex nameMutex;
+    std::wstring name;
+  };
+  // What the sampler last published for a worker.
+  struct Shown {
+    unsigned generation = 0;
+    int percent = -1;
+    std::wstring name;
+  };
+  struct Sample {
+    std::chrono::steady_clock::time_point time;
+    long long bytes;
+    long long files;
+  };
+
+  size_t Index(int worker) const {
+    return worker >= 0 && worker < m_workers ? (size_t)worker : 0;
+  }
+  void Run();
+  void Publish();
+
+  IBackupLogger *m_logger;
+  const int m_workers;
+  const std::chrono::milliseconds m_interval;
+  const TaskProgress m_initial;
+  std::unique_ptr<Slot[]> m_slots;
+  std::atomic<long long> m_totalFiles;
+  std::atomic<long long> m_totalBytes;
+
+  // Sampler only.
+  std::vector<Shown> m_shown;
+  std::deque<Sample> m_history; // About the last second, oldest first
+  std::chrono::steady_clock::time_point m_start;
+  std::wstring m_currentFile;
+  int m_lastCurrent = -1; // Worker whose file is m_currentFile
+
+  std::mutex m_mutex; // For m_stop and the condition variable
+  std::condition_variable m_wake;
+  bool m_stop = false;
+  std::thread m_sampler;
+};
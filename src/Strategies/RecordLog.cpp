@@ -0,0 +1,46 @@
+#include "RecordLog.h"
+#include <fstream>
+
+namespace RecordLog {
+
+void PutHeader(std::vector<char> &out, const char (&magic)[8],
+               unsigned int version) {
+  out.insert(out.end(), magic, magic + sizeof(magic));
+  Put<unsigned int>(out, version);
+  Put<unsigned int>(out, 0);
+}
+
+size_t BeginRecord(std::vector<char> &out) {
+  const size_t start = out.size();
+  out.resize(start + kRecordPrefix);
+  return start;
+}
+
+void EndRecord(std::vector<char> &out, size_t start) {
+  const unsigned int length =
+      (unsigned int)(out.size() - start - kRecordPrefix);
+  const unsigned int crc =
+      BackupUtils::Crc32(out.data() + start + kRecordPrefix, length);
+  std::memcpy(out.data() + start, &length, sizeof(length));
+  std::memcpy(out.data() + start + 4, &crc, sizeof(crc));
+}
+
+bool ReadFile(const fs::path &file, std::vector<char> &data) {
+  data.clear();
+  std::ifstream in(file, std::ios::binary | std::ios::ate);
+  if (!in)
+    return false;
+  std::streamoff size = in.tellg();
+  data.resize((size_t)size);
+  in.seekg(0);
+  if (size > 0 && !in.read(data.data(), size))
+    data.clear();
+  return true;
+}
+
+std::string JobKey(const fs::path &source, const fs::path &target) {
+  return source.lexically_normal().generic_u8string() + "\n" +
+         target.lexically_normal().generic_u8string();
+}
+
+} // namespace RecordLog
@@ -0,0 +1,73 @@
+#pragma once
+#include "BackupUtils.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Framing shared by the append-only binary logs (TargetCatalog, JobJournal,
+// ExecutionPlan): a 16-byte header (8-byte magic, u32 format version, u32
+// reserved), then records of u32 payload length, u32 CRC-32 of the payload
+// and the payload. What a payload holds is up to each log.
+//
+// Integers are stored in host byte order; every supported platform is
+// little-endian.
+namespace RecordLog {
+const size_t kHeaderSize = 16;
+const size_t kRecordPrefix = 8;
+
+template <typename T> void Put(std::vector<char> &out, T value) {
+  size_t at = out.size();
+  out.resize(at + sizeof(T));
+  std::memcpy(out.data() + at, &value, sizeof(T));
+}
+
+template <typename T> T Get(const char *p) {
+  T value;
+  std::memcpy(&value, p, sizeof(T));
+  return value;
+}
+
+void PutHeader(std::vector<char> &out, const char (&magic)[8],
+               unsigned int version);
+
+// A record is its payload Put between BeginRecord and EndRecord, which fills
+// in the length and CRC.
+size_t BeginRecord(std::vector<char> &out);
+void EndRecord(std::vector<char> &out, size_t start);
+
+// The whole file; false when it cannot be opened. A file that cannot be
+// read leaves data empty.
+bool ReadFile(const fs::path &file, std::vector<char> &data);
+
+// Calls visit(payload, length) for each record of data in order, up to the
+// first damaged one (a torn tail), one shorter than minPayload, or one visit
+// returns false for. Returns the end of the last record visited with true
+// (kHeaderSize when there is none), or 0 when data does not start with the
+// header of magic and version.
+template <typename Visit>
+size_t Replay(const std::vector<char> &data, const char (&magic)[8],
+              unsigned int version, size_t minPayload, Visit &&visit) {
+  if (data.size() < kHeaderSize ||
+      std::memcmp(data.data(), magic, sizeof(magic)) != 0 ||
+      Get<unsigned int>(data.data() + 8) != version)
+    return 0;
+  size_t good = kHeaderSize;
+  while (data.size() - good >= kRecordPrefix) {
+    const char *p = data.data() + good;
+    unsigned int length = Get<unsigned int>(p);
+    unsigned int crc = Get<unsigned int>(p + 4);
+    if (length < minPayload || length > data.size() - good - kRecordPrefix)
+      break; // Torn tail
+    const char *payload = p + kRecordPrefix;
+    if (BackupUtils::Crc32(payload, length) != crc)
+      break;
+    if (!visit(payload, (size_t)length))
+      break;
+    good += kRecordPrefix + length;
+  }
+  return good;
+}
+
+// Names a job by its roots: "source\ntarget", normalized, UTF-8.
+std::string JobKey(const fs::path &source, const fs::path &target);
+} // namespace RecordLog
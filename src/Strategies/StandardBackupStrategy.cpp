@@ -1,7 +1,10 @@
 #include "StandardBackupStrategy.h"
 #include "BackupUtils.h"
+#include "IoBudget.h"
+#include "PathFilter.h"
 #include <sstream>
-#include <windows.h>
+#include <stdexcept>
+#include <vector>
 
 void StandardBackupStrategy::Execute(const BackupTask &task,
                                      IBackupLogger *logger, bool dryRun) {
@@ -30,19 +33,39 @@ void StandardBackupStrategy::Execute(const BackupTask &task,
       logger->Log(L"ERROR: Source path found.");
     return;
   }
+  if (task.filter && logger)
+    logger->Log(task.filter->FormatStats());
+  m_sourceRoot = sourcePath;
+  m_targetRoot = targetPath;
 
   try {
     TaskProgress progress;
     if (logger) {
-      logger->Log(L"Scanning source... please wait.");
-      BackupUtils::ScanSource(sourcePath, progress.totalFiles,
-                              progress.totalBytes);
+      if (task.streamingScan) {
+        BackupUtils::BeginStreamingScan(sourcePath, progress);
+      } else {
+        logger->Log(L"Scanning source... please wait.");
+        BackupUtils::ScanSource(sourcePath, progress.totalFiles,
+                                progress.totalBytes, 0, task.filter.get());
+      }
     }
 
-    ProcessDirectory(sourcePath, targetPath, task, logger, dryRun, progress);
-    if (task.mode == BackupMode::Sync &&
-        (!task.IsAborted || !task.IsAborted())) {
-      SyncDelete(sourcePath, targetPath, task, logger, dryRun);
+    // Sync deletions are found while the tree is traversed (see
+    // ProcessDirectory), so there is no separate SyncDelete pass.
+    m_metadata.Reset();
+    std::wstring catalogError;
+    if (!m_catalog.OpenForTask(task, dryRun, catalogError) &&
+        !catalogError.empty() && logger)
+      logger->Log(L"WARNING: " + catalogError + L" (continuing without it)");
+    ProcessDirectory(sourcePath, targetPath,
+                     BackupUtils::SnapshotSource(sourcePath, &m_metadata),
+                     BackupUtils::SnapshotTarget(targetPath, &m_metadata), task,
+                     logger,
+                     dryRun, progress);
+    if (progress.isEstimate && (!task.IsAborted || !task.IsAborted())) {
+      // Traversal completed, so the streamed totals are now final.
+      progress.isEstimate = false;
+      logger->OnProgressDetailed(progress);
     }
   } catch (const std::exception &e) {
     if (logger) {
@@ -51,7 +74,15 @@ void StandardBackupStrategy::Execute(const BackupTask &task,
     }
   }
 
+  bool usedCatalog = m_catalog.IsOpen();
+  std::wstring catalogError;
+  if (!m_catalog.Close(catalogError) && logger)
+    logger->Log(L"WARNING: " + catalogError);
+
   if (logger) {
+    LogStats(logger);
+    if (usedCatalog)
+      logger->Log(m_catalog.FormatStats());
     logger->Log(L"--------------------------------------------------");
     if (task.IsAborted && task.IsAborted()) {
       logger->Log(L"PROCESS INTERRUPTED BY USER.");
@@ -64,7 +95,9 @@ void StandardBackupStrategy::Execute(const BackupTask &task,
 }
 
 void StandardBackupStrategy::ProcessDirectory(
-    const fs::path &source, const fs::path &target, const BackupTask &task,
+    const fs::path &source, const fs::path &target,
+    const BackupUtils::FileSnapshot &sourceInfo,
+    const BackupUtils::FileSnapshot &targetInfo, const BackupTask &task,
     IBackupLogger *logger, bool dryRun, TaskProgress &progress) {
   if (task.IsAborted && task.IsAborted())
     return;
@@ -72,10 +105,9 @@ void StandardBackupStrategy::ProcessDirectory(
   if (logger)
     logger->OnProgress(source.wstring());
 
-  bool isSymlink = fs::is_symlink(source);
-
-  if (isSymlink) {
-    if (BackupUtils::NeedsUpdate(source, target, task)) {
+  if (sourceInfo.IsSymlink()) {
+    if (BackupUtils::NeedsUpdate(sourceInfo, targetInfo, source, target,
+                                 task)) {
       if (logger) {
         logger->OnFileAction(L"Link", (dryRun ? L"[PREVIEW] " : L"") +
                                           source.wstring() + L" -> " +
@@ -94,11 +126,13 @@ void StandardBackupStrategy::ProcessDirectory(
     return;
   }
 
-  if (fs::is_directory(source)) {
+  if (sourceInfo.IsDirectory()) {
+    bool targetExists = targetInfo.Exists();
     if (task.mode != BackupMode::Verify) {
-      if (!fs::exists(target) && !dryRun) {
+      if (!targetExists && !dryRun) {
         try {
           fs::create_directories(target);
+          targetExists = true;
         } catch (...) {
           if (logger)
             logger->Log(L"  Dir Create Error: " + target.wstring());
@@ -109,19 +143,95 @@ void StandardBackupStrategy::ProcessDirectory(
       }
     } else {
       // In Verify mode, if directory doesn't exist on target, report it
-      if (!fs::exists(target)) {
+      if (!targetExists) {
         if (logger)
           logger->Log(L"Verify Fail (Missing Dir): " + target.wstring());
       }
     }
 
-    for (const auto &entry : fs::directory_iterator(source)) {
-      if (task.IsAborted && task.IsAborted())
-        break;
-      ProcessDirectory(entry.path(), target / entry.path().filename(), task,
-                       logger, dryRun, progress);
+    // List both sides once and merge-join them by name. Matching entries
+    // reuse the target metadata from the listing; target-only entries are
+    // the sync deletions. A symlinked target directory is never listed, so
+    // deletions cannot escape through it. A trusted catalog replaces the
+    // target listing unless sync needs it to find the deletions.
+    const bool useCatalog = m_catalog.IsTrusted() &&
+                            task.mode != BackupMode::Sync &&
+                            targetInfo.IsDirectory();
+    // An incomplete source listing would make every target entry it missed
+    // look extra, so such a directory is neither synced nor entered. An
+    // incomplete target listing only costs a query per entry.
+    std::vector<BackupUtils::ListedEntry> sourceEntries;
+    if (!BackupUtils::ListDirectory(source, BackupUtils::MetadataRole::Source,
+                                    sourceEntries, &m_metadata)) {
+      if (logger)
+        logger->Log(L"  List Error (skipped): " + source.wstring());
+      if (task.errorPolicy == ErrorPolicy::Suspend)
+        throw std::runtime_error("Cannot list source directory");
+      return;
     }
-    if (task.mode != BackupMode::Verify && !dryRun && fs::exists(target)) {
+    std::vector<BackupUtils::ListedEntry> targetEntries;
+    bool targetListed = true;
+    if (targetInfo.IsDirectory() && !useCatalog &&
+        !BackupUtils::ListDirectory(target, BackupUtils::MetadataRole::Target,
+                                    targetEntries, &m_metadata)) {
+      if (logger)
+        logger->Log(L"  List Error: " + target.wstring());
+      if (task.errorPolicy == ErrorPolicy::Suspend)
+        throw std::runtime_error("Cannot list target directory");
+      targetEntries.clear();
+      targetListed = false;
+    }
+    // Excluded source entries are neither copied nor entered; excluded
+    // target-only entries are not deleted. They stay in the listing, so the
+    // target entry of an excluded source entry is matched and left alone
+    // instead of looking like an extra.
+    auto excluded = [&](const BackupUtils::ListedEntry &entry) {
+      return task.filter &&
+             task.filter->Excludes(m_sourceRoot, entry.path, entry.info);
+    };
+
+    // Streaming scan: account for the whole listing before descending so
+    // the totals stay ahead of the processed counters.
+    if (progress.isEstimate) {
+      for (const auto &entry : sourceEntries)
+        if (!excluded(entry))
+          BackupUtils::CountEntry(entry.info, progress.totalFiles,
+                                  progress.totalBytes);
+      if (logger)
+        logger->OnProgressDetailed(progress);
+    }
+
+    const BackupUtils::FileSnapshot missing;
+    BackupUtils::MergeJoin(
+        sourceEntries, targetEntries,
+        [&](const BackupUtils::ListedEntry *src,
+            const BackupUtils::ListedEntry *dst) {
+          if (task.IsAborted && task.IsAborted())
+            return;
+          if (src && excluded(*src))
+            return;
+          if (src) {
+            fs::path childTarget = target / src->path.filename();
+            BackupUtils::FileSnapshot childInfo = dst ? dst->info : missing;
+            if (!targetListed)
+              childInfo = BackupUtils::SnapshotTarget(childTarget, &m_metadata);
+            else if (useCatalog)
+              childInfo = src->info.IsDirectory()
+                              ? BackupUtils::SnapshotTarget(childTarget,
+                                                            &m_metadata)
+                              : m_catalog.ResolveTarget(childTarget,
+                                                        &m_metadata);
+            ProcessDirectory(src->path, childTarget, src->info, childInfo,
+                             task, logger, dryRun, progress);
+          } else if (task.mode == BackupMode::Sync &&
+                     !m_catalog.IsCatalogFile(dst->path) &&
+                     !(task.filter &&
+                       task.filter->Excludes(m_targetRoot, dst->path,
+                                             dst->info))) {
+            DeleteExtra(dst->path, task, logger, dryRun);
+          }
+        });
+    if (task.mode != BackupMode::Verify && !dryRun && targetExists) {
       BackupUtils::SetFileTimestamps(source, target);
     }
   } else {
@@ -135,7 +245,7 @@ void StandardBackupStrategy::ProcessDirectory(
       bool match = true;
       // Verify assumes we want to check it.
       // If file doesn't exist on target -> Error/Missing
-      if (!fs::exists(target)) {
+      if (!targetInfo.Exists()) {
         match = false;
         if (logger)
           logger->Log(L"Verify Fail (Missing): " + source.wstring());
@@ -148,7 +258,8 @@ void StandardBackupStrategy::ProcessDirectory(
           if (!BackupUtils::CompareFilesBinary(source, target))
             match = false;
         } else {
-          if (BackupUtils::NeedsUpdate(source, target, task))
+          if (BackupUtils::NeedsUpdate(sourceInfo, targetInfo, source, target,
+                                       task))
             match = false;
         }
       }
@@ -156,7 +267,7 @@ void StandardBackupStrategy::ProcessDirectory(
       if (match) {
         // Good
       } else {
-        if (logger && fs::exists(target))
+        if (logger && targetInfo.Exists())
           logger->Log(L"Verify Fail (Mismatch): " + source.wstring());
         if (task.errorPolicy == ErrorPolicy::Suspend) {
           // handle error
@@ -165,14 +276,12 @@ void StandardBackupStrategy::ProcessDirectory(
 
       // Always increment progress in Verify Mode
       progress.processedFiles++;
-      try {
-        progress.processedBytes += fs::file_size(source);
-      } catch (...) {
-      }
+      progress.processedBytes += sourceInfo.size;
       if (logger)
         logger->OnProgressDetailed(progress);
 
-    } else if (BackupUtils::NeedsUpdate(source, target, task)) {
+    } else if (BackupUtils::NeedsUpdate(sourceInfo, targetInfo, source,
+                                        target, task)) {
 
       progress.currentFile = source.filename().wstring();
       if (logger)
@@ -193,21 +302,34 @@ void StandardBackupStrategy::ProcessDirectory(
             logger->OnProgressDetailed(progress);
         };
 
-        if (BackupUtils::RobustCopy(source, target, false, err, nullptr,
-                                    progressCb)) {
+        // Hash verification takes the source hash during the copy, so only
+        // the target has to be read again afterwards.
+        unsigned long long hash = 0;
+        const bool hashVerify =
+            task.verify && task.verifyMethod == VerifyMethod::Hash;
+        bool copied;
+        {
+          IoBudget::Lease lease(task.ioBudget, sourceInfo.size,
+                                task.IsAborted);
+          // Refused only while the run aborts: skip the copy.
+          if (lease.Refused())
+            return;
+          copied = CopyFileData(source, target, sourceInfo, err, progressCb,
+                                hashVerify ? &hash : nullptr);
+        }
+        if (copied) {
 
-          // Finalize progress for this file
-          try {
-            // Use actual file size to match ScanSource
-            progress.processedBytes = startBytes + fs::file_size(source);
-          } catch (...) {
-          }
+          // Finalize progress for this file using the enumerated size so it
+          // matches the scan totals.
+          progress.processedBytes = startBytes + sourceInfo.size;
           progress.processedFiles++;
           if (logger)
             logger->OnProgressDetailed(progress);
+          // The copy carries the source size and write time over.
+          m_catalog.Record(target, sourceInfo, hash);
 
           if (task.verify) {
-            if (BackupUtils::CompareFilesBinary(source, target)) {
+            if (BackupUtils::VerifyCopy(source, target, hash)) {
               // OK
             } else {
               if (logger)
@@ -225,59 +347,51 @@ void StandardBackupStrategy::ProcessDirectory(
       } else {
         // Dry run progress
         progress.processedFiles++;
-        try {
-          progress.processedBytes += fs::file_size(source);
-        } catch (...) {
-        }
+        progress.processedBytes += sourceInfo.size;
         if (logger)
           logger->OnProgressDetailed(progress);
       }
     } else {
       // If files are identical, just update progress metrics (skipped file)
+      m_catalog.Record(target, targetInfo);
       progress.processedFiles++;
-      try {
-        progress.processedBytes += fs::file_size(source);
-      } catch (...) {
-      }
+      progress.processedBytes += sourceInfo.size;
       if (logger)
         logger->OnProgressDetailed(progress);
     }
   }
 }
 
-void StandardBackupStrategy::SyncDelete(const fs::path &source,
-                                        const fs::path &target,
-                                        const BackupTask &task,
-                                        IBackupLogger *logger, bool dryRun) {
-  if (task.IsAborted && task.IsAborted())
-    return;
-
-  if (!fs::exists(target))
-    return;
+bool StandardBackupStrategy::CopyFileData(
+    const fs::path &source, const fs::path &target,
+    const BackupUtils::FileSnapshot & /*sourceInfo*/, std::wstring &errorMsg,
+    BackupUtils::CopyProgressCallback progressCb,
+    unsigned long long *contentHash) {
+  return BackupUtils::RobustCopy(source, target, false, errorMsg, nullptr,
+                                 progressCb, contentHash);
+}
 
-  for (const auto &entry : fs::directory_iterator(target)) {
-    if (task.IsAborted && task.IsAborted())
-      break;
-    const auto &targetItem = entry.path();
-    auto sourceFullPath = source / targetItem.filename();
+void StandardBackupStrategy::LogStats(IBackupLogger *logger) {
+  logger->Log(BackupUtils::FormatMetadataStats(m_metadata));
+  logger->Log(BackupUtils::FormatMemoryStats());
+}
 
-    if (!fs::exists(sourceFullPath)) {
-      if (logger) {
-        logger->OnFileAction(L"Delete", (dryRun ? L"[PREVIEW] " : L"") +
-                                            targetItem.wstring());
-      }
-      if (!dryRun) {
-        try {
-          fs::remove_all(targetItem);
-        } catch (...) {
-          if (logger)
-            logger->Log(L"  Delete Failed: " + targetItem.wstring());
-          if (task.errorPolicy == ErrorPolicy::Suspend)
-            throw std::runtime_error("Delete failed");
-        }
-      }
-    } else if (fs::is_directory(targetItem) && !fs::is_symlink(targetItem)) {
-      SyncDelete(sourceFullPath, targetItem, task, logger, dryRun);
+void StandardBackupStrategy::DeleteExtra(const fs::path &targetItem,
+                                         const BackupTask &task,
+                                         IBackupLogger *logger, bool dryRun) {
+  if (logger) {
+    logger->OnFileAction(L"Delete",
+                         (dryRun ? L"[PREVIEW] " : L"") + targetItem.wstring());
+  }
+  if (!dryRun) {
+    try {
+      fs::remove_all(targetItem);
+      m_catalog.Forget(targetItem, true);
+    } catch (...) {
+      if (logger)
+        logger->Log(L"  Delete Failed: " + targetItem.wstring());
+      if (task.errorPolicy == ErrorPolicy::Suspend)
+        throw std::runtime_error("Delete failed");
     }
   }
 }
@@ -1,17 +1,42 @@
 #pragma once
 
+#include "BackupUtils.h"
 #include "IBackupStrategy.h"
+#include "TargetCatalog.h"
 
 class StandardBackupStrategy : public IBackupStrategy {
 public:
   void Execute(const BackupTask &task, IBackupLogger *logger,
                bool dryRun) override;
 
+protected:
+  // Writes the data of one regular file. The default is RobustCopy; engines
+  // with a cheaper way to produce the target (block cloning) override it.
+  // contentHash, when given, receives the source hash for verification, or
+  // 0 if the data was not hashed on the way.
+  virtual bool CopyFileData(const fs::path &source, const fs::path &target,
+                            const BackupUtils::FileSnapshot &sourceInfo,
+                            std::wstring &errorMsg,
+                            BackupUtils::CopyProgressCallback progressCb,
+                            unsigned long long *contentHash);
+  // End-of-run statistics, logged before the closing banner.
+  virtual void LogStats(IBackupLogger *logger);
+
 private:
   void ProcessDirectory(const fs::path &source, const fs::path &target,
+                        const BackupUtils::FileSnapshot &sourceInfo,
+                        const BackupUtils::FileSnapshot &targetInfo,
                         const BackupTask &task, IBackupLogger *logger,
                         bool dryRun, TaskProgress &progress);
-  void SyncDelete(const fs::path &source, const fs::path &target,
-                  const BackupTask &task, IBackupLogger *logger, bool dryRun);
+  // Removes a target entry that has no source counterpart (Sync mode).
+  void DeleteExtra(const fs::path &targetItem, const BackupTask &task,
+                   IBackupLogger *logger, bool dryRun);
   bool NeedsUpdate(const fs::path &sourceFile, const fs::path &targetFile);
+
+  TargetCatalog m_catalog;
+  BackupUtils::MetadataStats m_metadata;
+  // Roots of the running task, against which task.filter's anchored rules
+  // are matched.
+  fs::path m_sourceRoot;
+  fs::path m_targetRoot;
 };
@@ -0,0 +1,369 @@
+#include "TargetCatalog.h"
+#include "RecordLog.h"
+#include <chrono>
+#include <fstream>
+
+namespace {
+using RecordLog::Get;
+using RecordLog::Put;
+
+// RecordLog framing. Payload: u8 op, i64 size, i64 mtime, u64 hash, UTF-8
+// path relative to the target.
+const char kMagic[8] = {'S', 'B', 'C', 'A', 'T', 'L', 'G', '\0'};
+const unsigned int kVersion = 1;
+const size_t kPayloadFixed = 1 + 8 + 8 + 8;
+const size_t kFlushThreshold = 64 * 1024;
+const long long kCompactMinDead = 4096;
+
+void EncodeRecord(std::vector<char> &out, unsigned char op,
+                  const std::string &key, const TargetCatalog::Entry &entry) {
+  const size_t start = RecordLog::BeginRecord(out);
+  Put<unsigned char>(out, op);
+  Put<long long>(out, entry.size);
+  Put<long long>(out, entry.mtime);
+  Put<unsigned long long>(out, entry.hash);
+  out.insert(out.end(), key.begin(), key.end());
+  RecordLog::EndRecord(out, start);
+}
+
+std::vector<char> EncodeHeader() {
+  std::vector<char> header;
+  RecordLog::PutHeader(header, kMagic, kVersion);
+  return header;
+}
+
+fs::path TempFileFor(const fs::path &file) {
+  fs::path tmp = file;
+  tmp += L".tmp";
+  return tmp;
+}
+} // namespace
+
+bool TargetCatalog::Open(const fs::path &file, const fs::path &targetRoot,
+                         bool readOnly, std::wstring &errorMsg) {
+  Close();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_file = file;
+  m_root = targetRoot;
+  m_readOnly = readOnly;
+  m_trusted = false;
+  m_entries.clear();
+  m_deadRecords = 0;
+  m_pending.clear();
+  m_flushAt = kFlushThreshold;
+  m_stats.loaded = 0;
+  m_stats.trusted = 0;
+  m_stats.revalidated = 0;
+  m_stats.stale = 0;
+  m_stats.written = 0;
+  // A different revalidation sample on every run.
+  m_seed = (unsigned long long)std::chrono::steady_clock::now()
+               .time_since_epoch()
+               .count();
+
+  if (!Load(errorMsg))
+    return false;
+  m_stats.loaded = (long long)m_entries.size();
+  m_open = true;
+  return true;
+}
+
+bool TargetCatalog::OpenForTask(const BackupTask &task, bool dryRun,
+                                std::wstring &errorMsg) {
+  Close();
+  if (task.catalogMode == CatalogMode::Off || task.catalogPath.empty())
+    return false;
+  if (!Open(task.catalogPath, task.targetPath, dryRun, errorMsg))
+    return false;
+  m_trusted = task.catalogMode == CatalogMode::Trust &&
+              task.mode != BackupMode::Verify;
+  SetRevalidatePercent(task.catalogRevalidatePercent);
+  return true;
+}
+
+bool TargetCatalog::Load(std::wstring &errorMsg) {
+  std::error_code ec;
+  std::vector<char> data;
+  RecordLog::ReadFile(m_file, data);
+
+  m_entries.reserve(data.size() / 48);
+  const size_t good = RecordLog::Replay(
+      data, kMagic, kVersion, kPayloadFixed,
+      [&](const char *payload, size_t length) {
+        unsigned char op = Get<unsigned char>(payload);
+        std::string key(payload + kPayloadFixed, length - kPayloadFixed);
+        if (op == OpPut) {
+          Entry entry;
+          entry.size = Get<long long>(payload + 1);
+          entry.mtime = Get<long long>(payload + 9);
+          entry.hash = Get<unsigned long long>(payload + 17);
+          auto result = m_entries.insert({std::move(key), entry});
+          if (!result.second) {
+            result.first->second = entry;
+            m_deadRecords++;
+          }
+        } else {
+          m_deadRecords += m_entries.erase(key) ? 2 : 1;
+        }
+        return true;
+      });
+
+  if (m_readOnly)
+    return true;
+
+  if (good == 0) {
+    // Missing or unreadable: the catalog is only a cache, so start over.
+    fs::create_directories(m_file.parent_path(), ec);
+    std::ofstream out(m_file, std::ios::binary | std::ios::trunc);
+    std::vector<char> header = EncodeHeader();
+    if (!out.write(header.data(), (std::streamsize)header.size())) {
+      errorMsg = L"Cannot create catalog " + m_file.wstring();
+      return false;
+    }
+  } else if (good < data.size()) {
+    // Drop the records a crash left half written.
+    fs::resize_file(m_file, good, ec);
+    if (ec) {
+      errorMsg = L"Cannot repair catalog " + m_file.wstring();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TargetCatalog::Close(std::wstring &errorMsg) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_open)
+    return true;
+  bool ok = true;
+  if (!m_readOnly) {
+    if (!FlushLocked()) {
+      // The log lacks this run's last records, so it could vouch for files
+      // that were since replaced or deleted. The catalog is only a cache:
+      // drop it rather than let a Trust run believe it.
+      ok = false;
+      errorMsg = L"Cannot write catalog " + m_file.wstring() +
+                 L"; it is rebuilt by the next run";
+      std::error_code ec;
+      fs::remove(m_file, ec);
+      m_pending.clear();
+    } else {
+      if (m_deadRecords > kCompactMinDead &&
+          m_deadRecords > (long long)m_entries.size())
+        CompactLocked();
+      // What this run recorded must survive a power loss, not only a crash
+      // of the process.
+      if (m_stats.written > 0)
+        BackupUtils::SyncFile(m_file);
+    }
+  }
+  m_entries.clear();
+  m_open = false;
+  return ok;
+}
+
+void TargetCatalog::SetRevalidatePercent(int percent) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_revalidatePercent = percent < 0 ? 0 : (percent > 100 ? 100 : percent);
+}
+
+std::string TargetCatalog::KeyFor(const fs::path &target) const {
+  return target.lexically_relative(m_root).generic_u8string();
+}
+
+bool TargetCatalog::Lookup(const fs::path &target, Entry &entry) {
+  std::string key = KeyFor(target);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(key);
+  if (it == m_entries.end())
+    return false;
+  entry = it->second;
+  return true;
+}
+
+bool TargetCatalog::ShouldRevalidate(const std::string &key) const {
+  if (m_revalidatePercent <= 0)
+    return false;
+  if (m_revalidatePercent >= 100)
+    return true;
+  unsigned long long h = std::hash<std::string>()(key) ^ m_seed;
+  h *= 0x9E3779B97F4A7C15ULL; // Spread the low bits before taking the modulus
+  return (int)((h >> 32) % 100) < m_revalidatePercent;
+}
+
+BackupUtils::FileSnapshot
+TargetCatalog::ResolveTarget(const fs::path &target,
+                             BackupUtils::MetadataStats *stats) {
+  std::string key = KeyFor(target);
+  Entry entry;
+  bool known = false, revalidate = true;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+      entry = it->second;
+      known = true;
+      revalidate = ShouldRevalidate(key);
+    }
+  }
+
+  if (!revalidate) {
+    m_stats.trusted++;
+    BackupUtils::FileSnapshot info;
+    info.type = BackupUtils::FileSnapshot::Type::File;
+    info.size = entry.size;
+    info.mtime = entry.mtime;
+    return info;
+  }
+
+  BackupUtils::FileSnapshot actual = BackupUtils::SnapshotTarget(target, stats);
+  if (known) {
+    m_stats.revalidated++;
+    if (actual.type != BackupUtils::FileSnapshot::Type::File ||
+        actual.size != entry.size || actual.mtime != entry.mtime) {
+      // Someone changed the target behind our back: the catalog no longer
+      // describes this file, so stop trusting it until it is rewritten.
+      m_stats.stale++;
+      Forget(target, false);
+    }
+  }
+  return actual;
+}
+
+void TargetCatalog::Record(const fs::path &target,
+                           const BackupUtils::FileSnapshot &info,
+                           unsigned long long hash) {
+  if (info.type != BackupUtils::FileSnapshot::Type::File)
+    return;
+  std::string key = KeyFor(target);
+  Entry entry;
+  entry.size = info.size;
+  entry.mtime = info.mtime;
+  entry.hash = hash;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_open || m_readOnly)
+    return;
+  auto it = m_entries.find(key);
+  if (it != m_entries.end()) {
+    Entry &old = it->second;
+    if (old.size == entry.size && old.mtime == entry.mtime &&
+        (hash == 0 || old.hash == hash))
+      return;
+    old = entry;
+    m_deadRecords++;
+  } else {
+    m_entries.insert({key, entry});
+  }
+  AppendRecord(OpPut, key, entry);
+}
+
+void TargetCatalog::Forget(const fs::path &target, bool recursive) {
+  std::string key = KeyFor(target);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_open || m_readOnly)
+    return;
+  if (m_entries.erase(key)) {
+    AppendRecord(OpRemove, key, Entry());
+    m_deadRecords += 2;
+  }
+  if (!recursive)
+    return;
+  // Only files are recorded, so a directory costs a scan of the whole map.
+  std::string prefix = key + "/";
+  for (auto it = m_entries.begin(); it != m_entries.end();) {
+    if (it->first.compare(0, prefix.size(), prefix) == 0) {
+      AppendRecord(OpRemove, it->first, Entry());
+      m_deadRecords += 2;
+      it = m_entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool TargetCatalog::IsCatalogFile(const fs::path &path) const {
+  if (!m_open)
+    return false;
+  fs::path p = path.lexically_normal();
+  return p == m_file.lexically_normal() ||
+         p == TempFileFor(m_file).lexically_normal();
+}
+
+void TargetCatalog::AppendRecord(Op op, const std::string &key,
+                                 const Entry &entry) {
+  EncodeRecord(m_pending, op, key, entry);
+  m_stats.written++;
+  if (m_pending.size() >= m_flushAt)
+    FlushLocked();
+}
+
+bool TargetCatalog::FlushLocked() {
+  if (m_pending.empty())
+    return true;
+  std::error_code ec;
+  const std::uintmax_t size = fs::file_size(m_file, ec);
+  {
+    std::ofstream out(m_file, std::ios::binary | std::ios::app);
+    out.write(m_pending.data(), (std::streamsize)m_pending.size());
+    out.close();
+    if (out) {
+      m_pending.clear();
+      m_flushAt = kFlushThreshold;
+      return true;
+    }
+  }
+  // A full disk or an I/O error: cut off what was torn, so later appends
+  // are not hidden behind a damaged record, and try again once another
+  // block of records has piled up.
+  if (!ec)
+    fs::resize_file(m_file, size, ec);
+  m_flushAt = m_pending.size() + kFlushThreshold;
+  return false;
+}
+
+bool TargetCatalog::CompactLocked() {
+  fs::path tmp = TempFileFor(m_file);
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    std::vector<char> buffer = EncodeHeader();
+    for (const auto &item : m_entries) {
+      EncodeRecord(buffer, OpPut, item.first, item.second);
+      if (buffer.size() >= kFlushThreshold) {
+        out.write(buffer.data(), (std::streamsize)buffer.size());
+        buffer.clear();
+      }
+    }
+    out.write(buffer.data(), (std::streamsize)buffer.size());
+    out.flush();
+    if (!out)
+      return false;
+  }
+  // The rename replaces the old log in one step, so a crash leaves either the
+  // old or the compacted catalog behind, never a mix. That holds only if the
+  // new data reaches the device before the rename does, and the rename
+  // itself before the old log's records are considered gone.
+  std::error_code ec;
+  if (!BackupUtils::SyncFile(tmp)) {
+    fs::remove(tmp, ec);
+    return false;
+  }
+  fs::rename(tmp, m_file, ec);
+  if (ec) {
+    fs::remove(tmp, ec);
+    return false;
+  }
+  BackupUtils::SyncDirectory(m_file.parent_path());
+  m_deadRecords = 0;
+  return true;
+}
+
+std::wstring TargetCatalog::FormatStats() const {
+  return L"Catalog: " + std::to_wstring(m_stats.loaded.load()) +
+         L" entries loaded, " + std::to_wstring(m_stats.trusted.load()) +
+         L" trusted, " + std::to_wstring(m_stats.revalidated.load()) +
+         L" revalidated (" + std::to_wstring(m_stats.stale.load()) +
+         L" stale), " + std::to_wstring(m_stats.written.load()) +
+         L" records written";
+}
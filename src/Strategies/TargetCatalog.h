@@ -0,0 +1,116 @@
+#pragma once
+#include "BackupUtils.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Persistent record of what SureBackup last wrote to a target, so repeat runs
+// can decide updates without querying a slow target volume.
+//
+// On disk the catalog is an append-only log (RecordLog): a 16 byte header
+// followed by length-prefixed, CRC-protected records that either put or
+// remove one file. Loading replays the log into a hash map and stops at the
+// first damaged record, so a crash can at worst lose the tail that was still
+// buffered. Close syncs the log to its device. Once the log holds more
+// superseded records than live ones it is rewritten to a temporary file,
+// which is synced before it is swapped in with a rename.
+//
+// All members are safe to call from several worker threads.
+class TargetCatalog {
+public:
+  struct Entry {
+    long long size = 0;
+    long long mtime = 0;            // FileSnapshot::mtime of the written file
+    unsigned long long hash = 0;    // Content hash; 0 when none was computed
+  };
+
+  struct Stats {
+    std::atomic<long long> loaded{0};      // Live entries after Open
+    std::atomic<long long> trusted{0};     // Decisions served by the catalog
+    std::atomic<long long> revalidated{0}; // Sampled checks against the target
+    std::atomic<long long> stale{0};       // Sampled checks that disagreed
+    std::atomic<long long> written{0};     // Records appended this run
+  };
+
+  TargetCatalog() = default;
+  ~TargetCatalog() { Close(); }
+  TargetCatalog(const TargetCatalog &) = delete;
+  TargetCatalog &operator=(const TargetCatalog &) = delete;
+
+  // Loads the catalog at file (creating it when missing) for the target tree
+  // rooted at targetRoot. A read-only catalog answers lookups but never
+  // writes, which is what preview runs use.
+  bool Open(const fs::path &file, const fs::path &targetRoot, bool readOnly,
+            std::wstring &errorMsg);
+  // Opens task.catalogPath as task.catalogMode asks. Preview runs open it
+  // read-only and Verify runs never trust it. Returns false when the task
+  // has no catalog or it could not be opened (errorMsg is set then).
+  bool OpenForTask(const BackupTask &task, bool dryRun, std::wstring &errorMsg);
+  // Flushes pending records and compacts the log when worthwhile. False
+  // with errorMsg set when records could not be written; the catalog file
+  // is then deleted, so the next run rebuilds it instead of trusting it.
+  bool Close(std::wstring &errorMsg);
+  void Close() {
+    std::wstring ignored;
+    Close(ignored);
+  }
+  bool IsOpen() const { return m_open; }
+  // True when update decisions may be answered by ResolveTarget.
+  bool IsTrusted() const { return m_open && m_trusted; }
+
+  // Percentage (0-100) of trusted lookups that are still checked against the
+  // real target. 100 revalidates everything, 0 trusts the catalog blindly.
+  void SetRevalidatePercent(int percent);
+
+  bool Lookup(const fs::path &target, Entry &entry);
+
+  // Target metadata for a file without listing the target directory. Known
+  // files are answered from the catalog, except for the revalidation sample
+  // and unknown files, which cost one query against the target (counted in
+  // stats when given).
+  BackupUtils::FileSnapshot
+  ResolveTarget(const fs::path &target,
+                BackupUtils::MetadataStats *stats = nullptr);
+
+  // Records that target now holds a file described by info. Appends nothing
+  // when the catalog already says the same.
+  void Record(const fs::path &target, const BackupUtils::FileSnapshot &info,
+              unsigned long long hash = 0);
+  // Drops target and, when recursive (a deleted directory), everything
+  // below it.
+  void Forget(const fs::path &target, bool recursive);
+
+  // True for the catalog's own files, which sync must never delete when the
+  // catalog is stored inside the target tree.
+  bool IsCatalogFile(const fs::path &path) const;
+
+  const Stats &GetStats() const { return m_stats; }
+  std::wstring FormatStats() const;
+
+private:
+  enum Op : unsigned char { OpPut = 1, OpRemove = 2 };
+
+  std::string KeyFor(const fs::path &target) const;
+  bool Load(std::wstring &errorMsg);
+  void AppendRecord(Op op, const std::string &key, const Entry &entry);
+  // False when the records could not be written; they stay pending.
+  bool FlushLocked();
+  bool CompactLocked();
+  bool ShouldRevalidate(const std::string &key) const;
+
+  mutable std::mutex m_mutex;
+  fs::path m_file;
+  fs::path m_root;
+  bool m_open = false;
+  bool m_readOnly = false;
+  bool m_trusted = false;
+  int m_revalidatePercent = 5;
+  unsigned long long m_seed = 0;
+  std::unordered_map<std::string, Entry> m_entries;
+  long long m_deadRecords = 0; // Records in the log superseded by later ones
+  std::vector<char> m_pending; // Encoded records not yet appended
+  size_t m_flushAt = 0;        // Pending bytes that trigger the next flush
+  Stats m_stats;
+};
@@ -5,6 +5,7 @@
 #endif
 
 #include <functional>
+#include <memory>
 #include <string>
 
 // Robust filesystem detection using version check
@@ -18,6 +19,16 @@ namespace fs = std::experimental::filesystem;
 
 enum class BackupMode { Copy, Sync, Verify };
 enum class ErrorPolicy { Continue, Suspend };
+// Target catalog: Record keeps it up to date, Trust also answers update
+// decisions from it instead of listing the target.
+enum class CatalogMode { Off, Record, Trust };
+// How task.verify checks a copied file. Compare re-reads source and target;
+// Hash hashes the source while it is copied and reads back only the target.
+enum class VerifyMethod { Compare, Hash };
+
+class IoBudget;
+class DevicePools;
+class PathFilter;
 
 struct BackupTask {
   std::wstring name;
@@ -26,15 +37,63 @@ struct BackupTask {
   BackupMode mode;
   bool verify;
   ErrorPolicy errorPolicy;
+  VerifyMethod verifyMethod = VerifyMethod::Hash;
   std::function<bool()>
       IsAborted; // Callback to check if user stopped the process
   bool parallelMode = false;
+  // Worker threads of the Parallel and Comparing engines. With
+  // adaptiveWorkers this is the ceiling and AdaptiveConcurrency decides how
+  // many of them are active.
+  int workerCount = 4;
+  bool adaptiveWorkers = false;
 
   // New: Criteria for file comparison
   bool criteriaSize = true;  // Use file size?
   bool criteriaTime = true;  // Use timestamp?
   bool criteriaData = false; // Use full binary difference? (Expensive)
 
+  // Streaming scan: skip the up-front ScanSource pass and grow the progress
+  // totals as the copy traversal discovers each directory.
+  bool streamingScan = true;
+
+  // Persistent catalog of the files written to the target (TargetCatalog).
+  CatalogMode catalogMode = CatalogMode::Off;
+  std::wstring catalogPath;
+  int catalogRevalidatePercent = 5; // Share of trusted entries still checked
+
+  // Parallel engine: files at least this large are split into ranges that
+  // several workers copy concurrently. 0 copies every file whole.
+  long long rangeCopyThreshold = 0;
+
+  // Parallel, Comparing and Pipeline engines: bytes of queued traversal
+  // items kept in memory; the rest waits in a temporary spill file (see
+  // ParallelTreeWalker::SetMemoryBudget). 0 means unbounded.
+  long long traversalMemoryBudget = 0;
+
+  // Parallel engine: job journal (see JobJournal) recording finished files,
+  // directories and ranges, so that a run cut short resumes where it
+  // stopped. Empty disables it. journalSyncMs is how often recorded work is
+  // made durable; 0 syncs every record.
+  std::wstring journalPath;
+  int journalSyncMs = 1000;
+
+  // Parallel engine: execution plan (see ExecutionPlan). A preview writes
+  // the operations it decided on to planPath. With applyPlan a run performs
+  // the plan in planPath instead of walking and comparing the trees.
+  std::wstring planPath;
+  bool applyPlan = false;
+
+  // Include/exclude rules (see PathFilter), applied while directories are
+  // listed and by ScanSource. Null backs up everything.
+  std::shared_ptr<const PathFilter> filter;
+
+  // Bytes in flight shared with the other units of a concurrent set run
+  // (see IoBudget). Null means unlimited.
+  std::shared_ptr<IoBudget> ioBudget;
+  // Per-device transfer limits (see DevicePools), shared by the units of a
+  // set run. Null lets the Parallel and Comparing engines probe their own.
+  std::shared_ptr<DevicePools> devicePools;
+
   // NOTE: If mode is Verify, we typically want full data check, but we'll
   // respect flags or default to Data for Verify mode if user wants. Actually,
   // for "Verify Only" strategy, we typically want to check integrity.
@@ -46,6 +105,19 @@ struct TaskProgress {
   long long totalBytes = 0;
   long long processedBytes = 0;
   std::wstring currentFile;
+  // True while a streaming scan is still discovering the tree, i.e. the totals
+  // are provisional and will keep growing until the traversal finishes.
+  bool isEstimate = false;
+};
+
+// Throughput published with aggregated progress (see ProgressAggregator).
+// "Current" rates cover about the last second, "average" ones the whole run.
+struct ProgressRates {
+  double currentBytesPerSecond = 0;
+  double averageBytesPerSecond = 0;
+  double currentFilesPerSecond = 0;
+  double averageFilesPerSecond = 0;
+  double elapsedSeconds = 0;
 };
 
 class IBackupLogger {
@@ -58,4 +130,17 @@ public:
   virtual void OnProgressDetailed(const TaskProgress &progress) = 0;
   virtual void OnWorkerProgress(int workerId, const std::wstring &file,
                                 int percent) = 0;
+  // Called before the first OnWorkerProgress with the number of workers
+  // (worker ids are 0..count-1).
+  virtual void OnWorkersStarted(int /*count*/) {}
+  // Set runs: progress of one unit. OnProgressDetailed then reports the sum
+  // over all units of the set.
+  virtual void OnUnitProgress(const std::wstring & /*unit*/,
+                              const TaskProgress & /*progress*/) {}
+  // Progress sampled at a fixed rate instead of reported per event, with
+  // the throughput. Loggers that do not show rates get OnProgressDetailed.
+  virtual void OnAggregatedProgress(const TaskProgress &progress,
+                                    const ProgressRates & /*rates*/) {
+    OnProgressDetailed(progress);
+  }
 };
@@ -0,0 +1,824 @@
+#include "UringCopier.h"
+#include "BackupUtils.h"
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+// Submission queue size. Each file has at most two metadata operations and
+// kChunksPerFile transfers in flight, and the transfers share kBufferCount
+// buffers, so the queue never holds more than ~200 entries.
+const unsigned kRingEntries = 256;
+const int kBufferCount = 64;
+const unsigned kBufferSize = 512 * 1024;
+// Chunks of one file in flight at once: enough read-ahead to keep a large
+// file streaming, few enough that the buffers are shared among files.
+const int kChunksPerFile = 8;
+const int kMaxFiles = 64;
+// Progress is reported at most every this many bytes, plus at the end.
+const long long kProgressStep = 8LL * 1024 * 1024;
+
+enum Op : unsigned long long {
+  OpOpenSource = 1,
+  OpStat,
+  OpOpenTarget,
+  OpRead,
+  OpWrite,
+  OpCloseSource,
+  OpCloseTarget
+};
+
+// user_data layout: operation in the top byte, slot in the next 32 bits,
+// buffer index in the low 24.
+unsigned long long Tag(Op op, int slot, int buffer = 0) {
+  return ((unsigned long long)op << 56) |
+         ((unsigned long long)(unsigned)slot << 24) | (unsigned)buffer;
+}
+
+std::wstring ErrnoMessage(int err) {
+  std::string msg = std::strerror(err);
+  return std::wstring(msg.begin(), msg.end());
+}
+
+// The three system calls behind io_uring, without liburing: the submission
+// and completion rings are mapped from the ring descriptor and driven with
+// acquire/release loads and stores of their head and tail counters.
+class Ring {
+public:
+  Ring() = default;
+  Ring(const Ring &) = delete;
+  Ring &operator=(const Ring &) = delete;
+  ~Ring() { Close(); }
+
+  // Waits for the completions of every operation the kernel took, then
+  // unmaps the rings and closes the descriptor. Closing alone does not stop
+  // them: the kernel tears the ring down asynchronously, and a read still in
+  // flight could land in memory the caller has already freed. Completions
+  // drained here are dropped. Safe to call twice.
+  void Close() {
+    while (m_fd >= 0 && reaped < submitted) {
+      int ret = (int)::syscall(__NR_io_uring_enter, m_fd, 0, 1,
+                               IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        break; // The ring itself is gone; nothing is left to wait for
+      Reap([](unsigned long long, int) {});
+    }
+    if (m_sqes)
+      ::munmap(m_sqes, m_sqesSize);
+    if (m_cqRing && m_cqRing != m_sqRing)
+      ::munmap(m_cqRing, m_cqSize);
+    if (m_sqRing)
+      ::munmap(m_sqRing, m_sqSize);
+    if (m_fd >= 0)
+      ::close(m_fd);
+    m_sqes = nullptr;
+    m_cqRing = m_sqRing = nullptr;
+    m_fd = -1;
+  }
+
+  bool Init(unsigned entries, std::wstring &error) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    m_fd = (int)::syscall(__NR_io_uring_setup, entries, &p);
+    if (m_fd < 0) {
+      error = L"io_uring_setup: " + ErrnoMessage(errno);
+      return false;
+    }
+    m_sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+      m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+    m_sqRing = Map(m_sqSize, IORING_OFF_SQ_RING);
+    if (!m_sqRing)
+      return Failed(L"mmap", error);
+    m_cqRing = single ? m_sqRing : Map(m_cqSize, IORING_OFF_CQ_RING);
+    if (!m_cqRing)
+      return Failed(L"mmap", error);
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *)Map(m_sqesSize, IORING_OFF_SQES);
+    if (!m_sqes)
+      return Failed(L"mmap", error);
+
+    char *sq = (char *)m_sqRing;
+    m_sqHead = (unsigned *)(sq + p.sq_off.head);
+    m_sqTail = (unsigned *)(sq + p.sq_off.tail);
+    m_sqMask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    m_sqArray = (unsigned *)(sq + p.sq_off.array);
+    m_sqEntries = p.sq_entries;
+    m_sqeTail = *m_sqTail;
+    char *cq = (char *)m_cqRing;
+    m_cqHead = (unsigned *)(cq + p.cq_off.head);
+    m_cqTail = (unsigned *)(cq + p.cq_off.tail);
+    m_cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+  }
+
+  int Fd() const { return m_fd; }
+
+  // A zeroed submission entry, or nullptr while the queue is full.
+  io_uring_sqe *Next() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqeTail - head >= m_sqEntries)
+      return nullptr;
+    unsigned index = m_sqeTail & m_sqMask;
+    io_uring_sqe *sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    m_sqeTail++;
+    m_pending++;
+    return sqe;
+  }
+
+  // Hands the prepared entries to the kernel and, with wait, blocks until a
+  // completion is available. Returns 0 or a negative errno; EAGAIN and EBUSY
+  // mean the completion queue must be drained first.
+  int Submit(bool wait) {
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    if (m_pending == 0 && !wait)
+      return 0;
+    int ret = (int)::syscall(__NR_io_uring_enter, m_fd, m_pending,
+                             wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0,
+                             nullptr, 0);
+    enters++;
+    if (ret < 0)
+      return errno == EINTR ? 0 : -errno;
+    submitted += ret;
+    m_pending -= (unsigned)ret;
+    return 0;
+  }
+
+  // Calls f(user_data, res) for every completion that arrived.
+  template <typename F> void Reap(F f) {
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      const io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+      unsigned long long data = cqe.user_data;
+      int res = cqe.res;
+      head++;
+      __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+      reaped++;
+      f(data, res);
+    }
+  }
+
+  long long submitted = 0; // Taken by the kernel
+  long long reaped = 0;    // Completions seen by Reap
+  long long enters = 0;
+
+private:
+  void *Map(size_t size, unsigned long long offset) {
+    void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_fd, (off_t)offset);
+    return p == MAP_FAILED ? nullptr : p;
+  }
+  bool Failed(const wchar_t *what, std::wstring &error) {
+    error = std::wstring(what) + L": " + ErrnoMessage(errno);
+    return false;
+  }
+
+  int m_fd = -1;
+  void *m_sqRing = nullptr;
+  void *m_cqRing = nullptr;
+  io_uring_sqe *m_sqes = nullptr;
+  size_t m_sqSize = 0, m_cqSize = 0, m_sqesSize = 0;
+  unsigned *m_sqHead = nullptr, *m_sqTail = nullptr, *m_sqArray = nullptr;
+  unsigned m_sqMask = 0, m_sqEntries = 0;
+  unsigned m_sqeTail = 0; // Local tail, published by Submit
+  unsigned m_pending = 0; // Prepared but not yet consumed by the kernel
+  unsigned *m_cqHead = nullptr, *m_cqTail = nullptr;
+  unsigned m_cqMask = 0;
+  io_uring_cqe *m_cqes = nullptr;
+};
+} // namespace
+
+struct UringCopier::State {
+  // One file in flight. Its phases follow the system calls: Open (source
+  // openat and statx together), OpenTarget, Copy (chunked reads and writes),
+  // Close.
+  struct File {
+    enum class Phase { Open, OpenTarget, Copy, Close };
+    bool busy = false;
+    Job job;
+    std::string source, target; // Kept alive for openat and statx
+    struct statx stx;
+    Phase phase = Phase::Open;
+    int srcFd = -1, dstFd = -1;
+    bool targetCreated = false;
+    int ops = 0;    // Operations in flight
+    int chunks = 0; // Buffers held
+    long long size = 0, readOffset = 0, written = 0, hashed = 0;
+    long long reported = 0;
+    // Chunks read but waiting for the hash to reach them: offset -> buffer.
+    std::map<long long, int> ready;
+    BackupUtils::ContentHasher hasher;
+    bool failed = false;
+    bool cancelled = false;
+    std::wstring error;
+  };
+  struct Buffer {
+    char *data = nullptr;
+    int slot = -1;
+    long long offset = 0;
+    unsigned length = 0; // Requested, then read
+    unsigned done = 0;   // Written so far
+  };
+
+  explicit State(int maxFiles)
+      : files(std::min(std::max(maxFiles, 1), kMaxFiles)),
+        cancel(new std::atomic<bool>[files.size()]) {
+    for (size_t i = 0; i < files.size(); ++i)
+      cancel[i] = false;
+  }
+  ~State() {
+    // The kernel may still own buffers of operations in flight (a broken
+    // ring); the ring drains them first so none outlives the memory.
+    ring.Close();
+    if (memory)
+      ::munmap(memory, (size_t)kBufferCount * kBufferSize);
+  }
+
+  Ring ring;
+  bool open = false;
+  bool fixed = false; // Buffers registered: READ_FIXED / WRITE_FIXED
+  std::wstring registerError;
+  char *memory = nullptr;
+  std::vector<Buffer> buffers;
+  std::vector<int> freeBuffers;
+  std::vector<File> files;
+  std::unique_ptr<std::atomic<bool>[]> cancel;
+  int active = 0;
+  int inFlight = 0;
+  int roundRobin = 0;
+  bool broken = false;
+  std::wstring brokenError;
+
+  const ProgressFn *progress = nullptr;
+  const DoneFn *done = nullptr;
+
+  long long filesCopied = 0, filesFailed = 0, bytes = 0;
+  int peakInFlight = 0;
+
+  io_uring_sqe *Sqe(Op op, int slot, int buffer = 0) {
+    io_uring_sqe *sqe = ring.Next();
+    if (!sqe) {
+      // Full: hand the prepared entries over to make room.
+      int ret = ring.Submit(false);
+      if (ret < 0 && ret != -EAGAIN && ret != -EBUSY)
+        Break(-ret);
+      sqe = ring.Next();
+      if (!sqe)
+        return nullptr;
+    }
+    sqe->user_data = Tag(op, slot, buffer);
+    inFlight++;
+    peakInFlight = std::max(peakInFlight, inFlight);
+    files[slot].ops++;
+    return sqe;
+  }
+
+  void Break(int err) {
+    if (!broken) {
+      broken = true;
+      brokenError = L"io_uring_enter: " + ErrnoMessage(err);
+    }
+  }
+
+  void Fail(int slot, const std::wstring &error) {
+    File &f = files[slot];
+    if (!f.failed) {
+      f.failed = true;
+      f.error = error;
+    }
+  }
+
+  void Start(int slot, Job &&job) {
+    File &f = files[slot];
+    f = File();
+    f.busy = true;
+    f.job = std::move(job);
+    f.source = f.job.source.string();
+    f.target = f.job.target.string();
+    active++;
+    io_uring_sqe *sqe = Sqe(OpOpenSource, slot);
+    if (!sqe) {
+      Fail(slot, L"io_uring submission queue full");
+      Settle(slot);
+      return;
+    }
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long long)f.source.c_str();
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe = Sqe(OpStat, slot);
+    if (!sqe) {
+      Fail(slot, L"io_uring submission queue full");
+      return;
+    }
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long long)f.source.c_str();
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = (unsigned long long)&f.stx;
+  }
+
+  void SubmitTransfer(Op op, int slot, int b) {
+    Buffer &buf = buffers[b];
+    io_uring_sqe *sqe = Sqe(op, slot, b);
+    if (!sqe) {
+      Fail(slot, L"io_uring submission queue full");
+      Release(b);
+      return;
+    }
+    const File &f = files[slot];
+    const bool read = op == OpRead;
+    if (fixed) {
+      sqe->opcode = read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+      sqe->buf_index = (unsigned short)b;
+    } else {
+      sqe->opcode = read ? IORING_OP_READ : IORING_OP_WRITE;
+    }
+    sqe->fd = read ? f.srcFd : f.dstFd;
+    sqe->addr = (unsigned long long)(buf.data + (read ? 0 : buf.done));
+    sqe->len = read ? buf.length : buf.length - buf.done;
+    sqe->off = (unsigned long long)(buf.offset + (read ? 0 : buf.done));
+  }
+
+  void Release(int b) {
+    Buffer &buf = buffers[b];
+    if (buf.slot >= 0)
+      files[buf.slot].chunks--;
+    buf.slot = -1;
+    freeBuffers.push_back(b);
+  }
+
+  // Hands out free buffers round-robin, one chunk per eligible file per
+  // pass, so a large file cannot starve the small ones behind it.
+  void IssueReads() {
+    const int n = (int)files.size();
+    bool issued = true;
+    while (issued && !freeBuffers.empty() && !broken) {
+      issued = false;
+      for (int i = 0; i < n && !freeBuffers.empty(); ++i) {
+        int slot = (roundRobin + i) % n;
+        File &f = files[slot];
+        if (!f.busy || f.failed || f.phase != File::Phase::Copy ||
+            f.readOffset >= f.size || f.chunks >= kChunksPerFile)
+          continue;
+        int b = freeBuffers.back();
+        freeBuffers.pop_back();
+        Buffer &buf = buffers[b];
+        buf.slot = slot;
+        buf.offset = f.readOffset;
+        buf.length = (unsigned)std::min<long long>(kBufferSize,
+                                                   f.size - f.readOffset);
+        buf.done = 0;
+        f.chunks++;
+        f.readOffset += buf.length;
+        SubmitTransfer(OpRead, slot, b);
+        issued = true;
+      }
+    }
+    roundRobin = (roundRobin + 1) % n;
+  }
+
+  void Complete(unsigned long long data, int res) {
+    const Op op = (Op)(data >> 56);
+    const int slot = (int)((data >> 24) & 0xffffffffULL);
+    const int b = (int)(data & 0xffffff);
+    inFlight--;
+    File &f = files[slot];
+    f.ops--;
+    switch (op) {
+    case OpOpenSource:
+      if (res < 0)
+        Fail(slot, ErrnoMessage(-res));
+      else
+        f.srcFd = res;
+      break;
+    case OpStat:
+      if (res < 0)
+        Fail(slot, ErrnoMessage(-res));
+      break;
+    case OpOpenTarget:
+      if (res < 0) {
+        Fail(slot, ErrnoMessage(-res));
+      } else {
+        f.dstFd = res;
+        f.targetCreated = true;
+      }
+      break;
+    case OpRead:
+      OnRead(slot, b, res);
+      break;
+    case OpWrite:
+      OnWrite(slot, b, res);
+      break;
+    case OpCloseSource:
+      break;
+    case OpCloseTarget:
+      // Deferred write errors (NFS, full disks) are only reported here.
+      if (res < 0)
+        Fail(slot, ErrnoMessage(-res));
+      break;
+    }
+    Settle(slot);
+  }
+
+  void OnRead(int slot, int b, int res) {
+    File &f = files[slot];
+    Buffer &buf = buffers[b];
+    if (f.failed) {
+      Release(b);
+      return;
+    }
+    if (res == -EINTR || res == -EAGAIN) {
+      SubmitTransfer(OpRead, slot, b);
+      return;
+    }
+    if (res < 0) {
+      Fail(slot, ErrnoMessage(-res));
+      Release(b);
+      return;
+    }
+    if ((unsigned)res < buf.length) {
+      // The source shrank since statx: copy what is there. Chunks past the
+      // new end are dropped, even if the file grows again meanwhile.
+      f.size = std::min(f.size, buf.offset + res);
+      buf.length = (unsigned)res;
+      for (auto it = f.ready.lower_bound(f.size); it != f.ready.end();) {
+        Release(it->second);
+        it = f.ready.erase(it);
+      }
+    }
+    if (res == 0 || buf.offset >= f.size) {
+      Release(b);
+      return;
+    }
+    if (!f.job.hash) {
+      SubmitTransfer(OpWrite, slot, b);
+      return;
+    }
+    // The hash takes the chunks in file order; later ones wait for their
+    // predecessors before they are written.
+    f.ready[buf.offset] = b;
+    for (auto it = f.ready.begin();
+         it != f.ready.end() && it->first == f.hashed; it = f.ready.erase(it)) {
+      Buffer &next = buffers[it->second];
+      f.hasher.Update(next.data, next.length);
+      f.hashed += next.length;
+      SubmitTransfer(OpWrite, slot, it->second);
+    }
+  }
+
+  void OnWrite(int slot, int b, int res) {
+    File &f = files[slot];
+    Buffer &buf = buffers[b];
+    if (f.failed) {
+      Release(b);
+      return;
+    }
+    if (res == -EINTR || res == -EAGAIN) {
+      SubmitTransfer(OpWrite, slot, b);
+      return;
+    }
+    if (res <= 0) {
+      Fail(slot, ErrnoMessage(res < 0 ? -res : ENOSPC));
+      Release(b);
+      return;
+    }
+    buf.done += (unsigned)res;
+    f.written += res;
+    bytes += res;
+    if (buf.done < buf.length) {
+      SubmitTransfer(OpWrite, slot, b); // Short write: the rest
+      return;
+    }
+    Release(b);
+    if (f.written - f.reported >= kProgressStep) {
+      f.reported = f.written;
+      (*progress)(slot, f.job, f.size, f.written);
+    }
+  }
+
+  // Moves a file on once its outstanding operations allow it.
+  void Settle(int slot) {
+    File &f = files[slot];
+    if (!f.busy || f.ops > 0)
+      return;
+    if (f.failed) {
+      Abandon(slot);
+      return;
+    }
+    switch (f.phase) {
+    case File::Phase::Open: {
+      f.phase = File::Phase::OpenTarget;
+      io_uring_sqe *sqe = Sqe(OpOpenTarget, slot);
+      if (!sqe) {
+        Fail(slot, L"io_uring submission queue full");
+        Abandon(slot);
+        return;
+      }
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (unsigned long long)f.target.c_str();
+      sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+      sqe->len = f.stx.stx_mode & 07777;
+      break;
+    }
+    case File::Phase::OpenTarget:
+      f.phase = File::Phase::Copy;
+      f.size = (long long)f.stx.stx_size;
+      (*progress)(slot, f.job, f.size, 0);
+      Settle(slot); // Empty files are done already
+      break;
+    case File::Phase::Copy:
+      if (f.chunks == 0 && f.readOffset >= f.size && f.written >= f.size)
+        Finish(slot);
+      break;
+    case File::Phase::Close: {
+      f.busy = false;
+      active--;
+      filesCopied++;
+      if (f.reported < f.written || f.size == 0)
+        (*progress)(slot, f.job, f.size, f.written);
+      (*done)(slot, f.job, Outcome::Copied,
+              f.job.hash ? f.hasher.Final() : 0, std::wstring());
+      break;
+    }
+    }
+  }
+
+  // All data is written: carry mode and timestamps over like RobustCopy,
+  // then close both descriptors through the ring.
+  void Finish(int slot) {
+    File &f = files[slot];
+    // An existing target keeps its old mode through O_TRUNC.
+    ::fchmod(f.dstFd, f.stx.stx_mode & 07777);
+    struct timespec times[2];
+    times[0].tv_sec = f.stx.stx_atime.tv_sec;
+    times[0].tv_nsec = f.stx.stx_atime.tv_nsec;
+    times[1].tv_sec = f.stx.stx_mtime.tv_sec;
+    times[1].tv_nsec = f.stx.stx_mtime.tv_nsec;
+    if (::futimens(f.dstFd, times) != 0) {
+      Fail(slot, ErrnoMessage(errno));
+      Abandon(slot);
+      return;
+    }
+    f.phase = File::Phase::Close;
+    const int fds[2] = {f.srcFd, f.dstFd};
+    const Op ops[2] = {OpCloseSource, OpCloseTarget};
+    f.srcFd = f.dstFd = -1;
+    for (int i = 0; i < 2; ++i) {
+      io_uring_sqe *sqe = Sqe(ops[i], slot);
+      if (!sqe) {
+        if (::close(fds[i]) != 0 && i == 1)
+          Fail(slot, ErrnoMessage(errno));
+        continue;
+      }
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = fds[i];
+    }
+    Settle(slot);
+  }
+
+  // Nothing of the file is in flight any more: release it and report the
+  // failure. Like a cancelled RobustCopy, no partial target remains.
+  void Abandon(int slot) {
+    File &f = files[slot];
+    for (auto &entry : f.ready)
+      Release(entry.second);
+    f.ready.clear();
+    if (f.srcFd >= 0)
+      ::close(f.srcFd);
+    if (f.dstFd >= 0)
+      ::close(f.dstFd);
+    f.srcFd = f.dstFd = -1;
+    if (f.targetCreated)
+      ::unlink(f.target.c_str());
+    f.busy = false;
+    active--;
+    const Outcome outcome = f.cancelled ? Outcome::Cancelled
+                            : broken    ? Outcome::Retry
+                                        : Outcome::Failed;
+    if (outcome != Outcome::Retry)
+      filesFailed++;
+    (*done)(slot, f.job, outcome, 0, f.error);
+  }
+};
+
+UringCopier::UringCopier(int maxFiles) : m_state(new State(maxFiles)) {}
+
+UringCopier::~UringCopier() {}
+
+int UringCopier::Slots() const { return (int)m_state->files.size(); }
+
+bool UringCopier::Open(std::wstring &error) {
+  State &s = *m_state;
+  if (s.open)
+    return true;
+  if (!s.ring.Init(kRingEntries, error))
+    return false;
+
+  // Every operation the copier submits must be known to the kernel; the
+  // probe itself arrived in 5.6 together with openat, statx and close.
+  const unsigned probeOps = 256;
+  std::vector<char> probeMemory(sizeof(io_uring_probe) +
+                                probeOps * sizeof(io_uring_probe_op));
+  io_uring_probe *probe = (io_uring_probe *)probeMemory.data();
+  if (::syscall(__NR_io_uring_register, s.ring.Fd(), IORING_REGISTER_PROBE,
+                probe, probeOps) < 0) {
+    error = L"io_uring probe: " + ErrnoMessage(errno) +
+            L" (Linux 5.6 or later required)";
+    return false;
+  }
+  const unsigned needed[] = {IORING_OP_OPENAT,     IORING_OP_STATX,
+                             IORING_OP_READ,       IORING_OP_WRITE,
+                             IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED,
+                             IORING_OP_CLOSE};
+  for (unsigned op : needed) {
+    if (op > probe->last_op ||
+        !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      error = L"io_uring operation " + std::to_wstring(op) +
+              L" is not supported by this kernel";
+      return false;
+    }
+  }
+
+  void *memory = ::mmap(nullptr, (size_t)kBufferCount * kBufferSize,
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+  if (memory == MAP_FAILED) {
+    error = L"mmap: " + ErrnoMessage(errno);
+    return false;
+  }
+  s.memory = (char *)memory;
+  s.buffers.resize(kBufferCount);
+  std::vector<iovec> iovecs(kBufferCount);
+  for (int i = 0; i < kBufferCount; ++i) {
+    s.buffers[i].data = s.memory + (size_t)i * kBufferSize;
+    iovecs[i].iov_base = s.buffers[i].data;
+    iovecs[i].iov_len = kBufferSize;
+    s.freeBuffers.push_back(kBufferCount - 1 - i);
+  }
+  // Registration pins the pages once instead of per request. It counts
+  // against RLIMIT_MEMLOCK on older kernels; plain reads and writes work
+  // without it.
+  s.fixed = ::syscall(__NR_io_uring_register, s.ring.Fd(),
+                      IORING_REGISTER_BUFFERS, iovecs.data(),
+                      (unsigned)kBufferCount) == 0;
+  if (!s.fixed)
+    s.registerError = ErrnoMessage(errno);
+  s.open = true;
+  return true;
+}
+
+bool UringCopier::Run(const FetchFn &fetch, const ProgressFn &progress,
+                      const DoneFn &done,
+                      const std::function<bool()> &isAborted,
+                      std::wstring &error) {
+  State &s = *m_state;
+  if (!s.open) {
+    error = L"io_uring is not open";
+    return false;
+  }
+  s.progress = &progress;
+  s.done = &done;
+  const int slots = (int)s.files.size();
+  bool more = true;
+  bool aborting = false;
+  for (;;) {
+    if (!aborting && isAborted && isAborted()) {
+      aborting = true;
+      more = false;
+    }
+    for (int i = 0; i < slots; ++i) {
+      State::File &f = s.files[i];
+      if (f.busy && !f.failed && (aborting || s.cancel[i])) {
+        s.Fail(i, L"Operation cancelled");
+        f.cancelled = true;
+        s.Settle(i);
+      }
+    }
+
+    // Take new files while there is a free slot; block for one only when
+    // nothing is in flight.
+    while (more && !s.broken && s.active < slots) {
+      int slot = 0;
+      while (s.files[slot].busy)
+        slot++;
+      Job job;
+      if (!fetch(slot, job, s.active == 0)) {
+        if (s.active == 0)
+          more = false;
+        break;
+      }
+      s.cancel[slot] = false;
+      s.Start(slot, std::move(job));
+    }
+    s.IssueReads();
+
+    if (s.broken) {
+      // The ring cannot be trusted any more. The kernel still owns the
+      // buffers of operations in flight, so they are never reused. The
+      // files are handed back for another copier (Outcome::Retry).
+      for (int i = 0; i < slots; ++i) {
+        if (s.files[i].busy) {
+          s.Fail(i, s.brokenError);
+          s.files[i].ops = 0;
+          s.Abandon(i);
+        }
+      }
+      error = s.brokenError;
+      return false;
+    }
+    if (s.active == 0 && !more)
+      break;
+    if (s.active == 0)
+      continue;
+
+    int ret = s.ring.Submit(s.inFlight > 0);
+    if (ret < 0 && ret != -EAGAIN && ret != -EBUSY)
+      s.Break(-ret);
+    s.ring.Reap(
+        [&](unsigned long long data, int res) { s.Complete(data, res); });
+  }
+  return true;
+}
+
+void UringCopier::Cancel(int slot) {
+  if (slot >= 0 && slot < (int)m_state->files.size())
+    m_state->cancel[slot] = true;
+}
+
+std::wstring UringCopier::FormatStats() const {
+  const State &s = *m_state;
+  std::wstringstream ss;
+  ss.precision(1);
+  ss << std::fixed << L"io_uring: " << s.filesCopied << L" files copied, "
+     << s.filesFailed << L" failed, " << s.bytes / (1024 * 1024) << L" MB in "
+     << s.files.size() << L" slots; " << s.ring.submitted << L" SQEs in "
+     << s.ring.enters << L" submits ("
+     << (s.ring.enters ? (double)s.ring.submitted / s.ring.enters : 0.0)
+     << L" per call), peak " << s.peakInFlight << L" in flight; "
+     << kBufferCount << L" x " << kBufferSize / 1024 << L" KB buffers, "
+     << (s.fixed ? L"registered"
+                 : L"not registered (" + s.registerError + L")");
+  return ss.str();
+}
+
+#else // !HAVE_IO_URING
+
+struct UringCopier::State {
+  explicit State(int maxFiles)
+      : slots(std::min(std::max(maxFiles, 1), 64)) {}
+  int slots;
+};
+
+UringCopier::UringCopier(int maxFiles) : m_state(new State(maxFiles)) {}
+
+UringCopier::~UringCopier() {}
+
+int UringCopier::Slots() const { return m_state->slots; }
+
+bool UringCopier::Open(std::wstring &error) {
+#ifdef __linux__
+  error = L"built without io_uring headers";
+#else
+  error = L"io_uring requires Linux";
+#endif
+  return false;
+}
+
+bool UringCopier::Run(const FetchFn &, const ProgressFn &, const DoneFn &,
+                      const std::function<bool()> &, std::wstring &error) {
+  Open(error);
+  return false;
+}
+
+void UringCopier::Cancel(int) {}
+
+std::wstring UringCopier::FormatStats() const { return std::wstring(); }
+
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+#include "Types.h"
+#include <functional>
+#include <memory>
+#include <string>
+
+// Copies whole files through a single io_uring instance (Linux 5.6 or
+// later). One thread keeps many files in flight: it submits the openat and
+// statx of new files, the reads and writes of open ones and the closes of
+// finished ones in batches, and handles their completions as they arrive,
+// so a flash device sees a deep queue without a thread per transfer.
+//
+// Data moves through a fixed ring of buffers registered with the kernel
+// (plain reads and writes when registration is refused), up to a few chunks
+// per file at once. Writes are positional, so chunks may complete out of
+// order; when the source is hashed the hash still consumes them in order.
+// Mode and timestamps are applied like RobustCopy does, and a failed or
+// cancelled copy leaves no partial target behind.
+//
+// Elsewhere, or when the kernel refuses io_uring (too old, disabled by
+// sysctl or a seccomp profile), Open fails and the caller copies with
+// threads instead.
+class UringCopier {
+public:
+  struct Job {
+    fs::path source;
+    fs::path target;
+    bool hash = false; // Compute the source's ContentHasher digest
+  };
+  // Retry: the ring broke while the file was in flight. Nothing of the
+  // target remains, and the job is to be copied another way.
+  enum class Outcome { Copied, Failed, Cancelled, Retry };
+
+  // Fills job for the given slot. With wait false it must not block and
+  // returns false when nothing is queued right now; with wait true false
+  // means no more jobs will come.
+  typedef std::function<bool(int slot, Job &job, bool wait)> FetchFn;
+  typedef std::function<void(int slot, const Job &job, long long total,
+                             long long copied)>
+      ProgressFn;
+  typedef std::function<void(int slot, const Job &job, Outcome outcome,
+                             unsigned long long hash,
+                             const std::wstring &error)>
+      DoneFn;
+
+  // maxFiles bounds the files in flight; it is clamped to 1-64.
+  explicit UringCopier(int maxFiles);
+  ~UringCopier();
+  UringCopier(const UringCopier &) = delete;
+  UringCopier &operator=(const UringCopier &) = delete;
+
+  // Sets up the ring and its buffers. False (error says why) when io_uring
+  // cannot be used here.
+  bool Open(std::wstring &error);
+  int Slots() const;
+
+  // Copies jobs until fetch reports the end or isAborted turns true. Every
+  // fetched job gets exactly one done call, from this thread, as does every
+  // progress call. Returns false when the ring itself failed (error says
+  // why); the files in flight then end with Retry, and jobs not fetched yet
+  // are left for another copier.
+  bool Run(const FetchFn &fetch, const ProgressFn &progress,
+           const DoneFn &done, const std::function<bool()> &isAborted,
+           std::wstring &error);
+
+  // Cancels the file in slot, if any. Safe from any thread.
+  void Cancel(int slot);
+
+  // "io_uring: 3000 files, 9400 SQEs in 610 submits (15.4 per call), ..."
+  std::wstring FormatStats() const;
+
+private:
+  struct State;
+  std::unique_ptr<State> m_state;
+};
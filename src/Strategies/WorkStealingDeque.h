@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Lock-free Chase-Lev work-stealing deque ("Dynamic Circular Work-Stealing
+// Deque", with the C11 memory orderings of Le, Pop, Cohen and Zappa Nardelli).
+//
+// One owner thread calls Push and Pop at the bottom end (LIFO); any thread
+// may call Steal at the top end (FIFO). Only the last element is contended:
+// the owner and thieves settle it with one CAS on m_top. Slots hold pointers
+// so that items of any type can be published with a single atomic store.
+//
+// The ring doubles when full. Retired rings stay alive until the deque is
+// destroyed because a thief may still be reading from one; with doubling
+// they add up to less than the live ring.
+template <typename Item> class WorkStealingDeque {
+public:
+  WorkStealingDeque() : m_ring(new Ring(kInitialCapacity)) {
+    m_rings.emplace_back(m_ring.load(std::memory_order_relaxed));
+  }
+  ~WorkStealingDeque() {
+    Item *item;
+    while ((item = Pop()) != nullptr)
+      delete item;
+  }
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  // Owner only.
+  void Push(Item item) {
+    long long b = m_bottom.load(std::memory_order_relaxed);
+    long long t = m_top.load(std::memory_order_acquire);
+    Ring *ring = m_ring.load(std::memory_order_relaxed);
+    if (b - t > ring->mask)
+      ring = Grow(ring, t, b);
+    ring->Put(b, new Item(std::move(item)));
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only. Returns the newest item (caller deletes it) or nullptr.
+  Item *Pop() {
+    long long b = m_bottom.load(std::memory_order_relaxed) - 1;
+    Ring *ring = m_ring.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long t = m_top.load(std::memory_order_relaxed);
+    if (t > b) {
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Item *item = ring->Get(b);
+    if (t == b) {
+      // Last element: race the thieves for it.
+      if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+        item = nullptr;
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  // Any thread. Returns the oldest item (caller deletes it) or nullptr when
+  // the deque looked empty or another thread won the race for the item.
+  Item *Steal() {
+    long long t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b)
+      return nullptr;
+    Item *item = m_ring.load(std::memory_order_acquire)->Get(t);
+    if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+      return nullptr;
+    return item;
+  }
+
+  // Approximate; exact only when no other thread is using the deque.
+  bool Empty() const {
+    return m_bottom.load(std::memory_order_acquire) <=
+           m_top.load(std::memory_order_acquire);
+  }
+
+private:
+  static const long long kInitialCapacity = 256;
+
+  struct Ring {
+    explicit Ring(long long capacity)
+        : mask(capacity - 1), slots(new std::atomic<Item *>[capacity]) {}
+    // Release/acquire on the slot itself is free on x86 and makes the item
+    // hand-off visible to race detectors, which do not model the fences.
+    Item *Get(long long i) const {
+      return slots[i & mask].load(std::memory_order_acquire);
+    }
+    void Put(long long i, Item *item) {
+      slots[i & mask].store(item, std::memory_order_release);
+    }
+    long long mask;
+    std::unique_ptr<std::atomic<Item *>[]> slots;
+  };
+
+  Ring *Grow(Ring *old, long long t, long long b) {
+    Ring *ring = new Ring((old->mask + 1) * 2);
+    for (long long i = t; i < b; ++i)
+      ring->Put(i, old->Get(i));
+    m_rings.emplace_back(ring);
+    m_ring.store(ring, std::memory_order_release);
+    return ring;
+  }
+
+  // Owner and thieves write different ends; keep them on separate lines.
+  alignas(64) std::atomic<long long> m_top{0};
+  alignas(64) std::atomic<long long> m_bottom{0};
+  alignas(64) std::atomic<Ring *> m_ring;
+  std::vector<std::unique_ptr<Ring>> m_rings; // Owner only
+};
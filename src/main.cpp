@@ -23,11 +23,14 @@
 #include <shlwapi.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -39,9 +42,15 @@
 #include "BackupEngine.h"
 #include "Configuration.h"
 #include "Localization.h"
+#include "SetScheduler.h"
+#include "Strategies/BlockCloneStrategy.h"
 #include "Strategies/ComparingBackupStrategy.h"
 #include "Strategies/IBackupStrategy.h"
+#include "Strategies/LogPipeline.h"
+#include "Strategies/LogWriter.h"
 #include "Strategies/ParallelBackupStrategy.h"
+#include "Strategies/PathFilter.h"
+#include "Strategies/PipelineBackupStrategy.h"
 #include "Strategies/StandardBackupStrategy.h"
 #include "resources/resource.h"
 
@@ -68,7 +77,10 @@ HWND hSrcPathLabel, hDstPathLabel, hStopButton, hLogMaxButton, hProgressLabel,
     hProgressBar;
 HWND hMainWindow, hToolTip = NULL;
 HWND hMainStrategyCombo, hMainModeCombo;
-BackupEngine *g_currentEngine = nullptr;
+// Set by the run thread while its scheduler runs.
+std::atomic<SetScheduler *> g_currentRun{nullptr};
+// From RunBackup until the run thread is done with the loggers.
+std::atomic<bool> g_runActive{false};
 bool g_logMaximized = false;
 HIMAGELIST g_hImageList = NULL;
 
@@ -125,6 +137,7 @@ int g_selectedUnitIndex = -1;
 #define IDM_BACKUP_RUN 701
 #define IDM_BACKUP_PREVIEW 702
 #define IDM_BACKUP_VERIFY 705
+#define IDM_BACKUP_APPLY_PLAN 706
 #define IDM_BACKUP_STOP 703
 #define IDM_LOG_MAXIMIZE 704
 #define IDM_HELP_ABOUT 801
@@ -144,6 +157,9 @@ int g_selectedUnitIndex = -1;
 #define IDC_COMBO_WEEKDAY 510
 #define IDC_EDIT_SCHED_HOUR 511
 #define IDC_EDIT_SCHED_MIN 512
+#define IDC_EDIT_SET_UNITS 513
+#define IDC_EDIT_SET_THREADS 514
+#define IDC_EDIT_SET_INFLIGHT 515
 
 #define IDC_EDIT_UNIT_NAME 601
 #define IDC_EDIT_UNIT_SRC 602
@@ -161,6 +177,10 @@ int g_selectedUnitIndex = -1;
 #define IDC_CHK_CRITERIA_DATA 617
 #define IDC_CB_ENGINE 621
 #define IDC_BTN_NET_CONN 622
+#define IDC_CB_CATALOG 623
+#define IDC_CHK_CATALOG_TARGET 624
+#define IDC_EDIT_WORKERS 625
+#define IDC_CHK_WORKERS_ADAPTIVE 626
 
 class WindowLogger : public IBackupLogger {
 public:
@@ -176,26 +196,29 @@ public:
 
     std::wstring cfgPath = ConfigManager::GetConfigPath();
     fs::path p(cfgPath);
-    m_logFile.open(p.parent_path() / L"last_run.txt",
-                   std::ios::out | std::ios::trunc);
+    std::wstring error;
+    m_logWriter.Open(p.parent_path() / L"last_run.txt", error);
   }
 
   bool HasErrors() const { return m_hasErrors; }
   void ClearErrorFlag() { m_hasErrors = false; }
 
-  ~WindowLogger() {
-    if (m_logFile.is_open())
-      m_logFile.close();
-  }
+  ~WindowLogger() { m_logWriter.Close(); }
 
+  // One call may carry several lines (LogPipeline batches them), so the
+  // edit control gets them all in one append.
   void Log(const std::wstring &message) override {
-    std::wstring msg = message + L"\r\n";
+    std::wstring msg;
+    msg.reserve(message.size() + 2);
+    for (wchar_t c : message) {
+      if (c == L'\n' && (msg.empty() || msg.back() != L'\r'))
+        msg += L'\r';
+      msg += c;
+    }
+    msg += L"\r\n";
     SendMessageW(m_hEdit, EM_SETSEL, (WPARAM)-1, (LPARAM)-1);
     SendMessageW(m_hEdit, EM_REPLACESEL, 0, (LPARAM)msg.c_str());
-    if (m_logFile.is_open()) {
-      m_logFile << message << std::endl;
-      m_logFile.flush();
-    }
+    m_logWriter.Write(message);
   }
 
   void OnFileAction(const std::wstring &action,
@@ -203,10 +226,7 @@ public:
     std::wstring msg = L"[" + action + L"] " + path + L"\r\n";
     SendMessageW(m_hEdit, EM_SETSEL, (WPARAM)-1, (LPARAM)-1);
     SendMessageW(m_hEdit, EM_REPLACESEL, 0, (LPARAM)msg.c_str());
-    if (m_logFile.is_open()) {
-      m_logFile << L"[" << action << L"] " << path << std::endl;
-      m_logFile.flush();
-    }
+    m_logWriter.Write(L"[" + action + L"] " + path);
     if (action.find(L"Error") != std::wstring::npos ||
         action.find(L"Fail") != std::wstring::npos) {
       m_hasErrors = true;
@@ -214,8 +234,10 @@ public:
   }
 
   void FinalizeLog(const std::wstring &title) {
-    if (m_logFile.is_open())
-      m_logFile.close();
+    {
+      std::lock_guard<std::mutex> lock(m_workerMutex);
+      m_unitPercents.clear();
+    }
 
     std::wstring cfgPath = ConfigManager::GetConfigPath();
     fs::path p(cfgPath);
@@ -244,31 +266,70 @@ public:
         safeTitle + L"_" + ss.str() + (m_hasErrors ? L"_ERR" : L"") + L".txt";
     fs::path dstFile = baseDir / finalName;
 
-    try {
-      if (fs::exists(srcFile)) {
-        fs::copy_file(srcFile, dstFile, fs::copy_options::overwrite_existing);
-      }
-    } catch (...) {
-    }
+    // The finished log becomes the archive in one rename.
+    std::wstring error;
+    m_logWriter.Finalize(dstFile, error);
 
     // Reopen last_run.txt for next run session
-    m_logFile.open(srcFile, std::ios::out | std::ios::trunc);
+    m_logWriter.Open(srcFile, error);
     // Clear flag ONLY after we successfully copy the log to a timestamped file,
     // though usually RunBackup will clear it at start.
   }
 
+  void OnWorkersStarted(int count) override {
+    std::lock_guard<std::mutex> lock(m_workerMutex);
+    m_workerCount = count;
+    m_workerPercents.assign(count, 0);
+    m_unitPercents.clear();
+  }
+
+  // Workers shown by one dashboard row. With more workers than rows, each
+  // row stands for a contiguous group of them.
+  std::vector<int> WorkersInRow(int row) {
+    std::lock_guard<std::mutex> lock(m_workerMutex);
+    int perRow = WorkersPerRow();
+    std::vector<int> workers;
+    for (int i = row * perRow;
+         i < (row + 1) * perRow && (perRow == 1 || i < m_workerCount); ++i)
+      workers.push_back(i);
+    return workers;
+  }
+
   void OnWorkerProgress(int workerId, const std::wstring &file,
                         int percent) override {
-    if (workerId >= 0 && workerId < MAX_WORKERS) {
-      // Only update controls if they exist (they're now removed from UI)
-      if (m_workerLabels[workerId]) {
-        std::wstringstream ss;
+    int row = workerId;
+    std::wstringstream ss;
+    {
+      std::lock_guard<std::mutex> lock(m_workerMutex);
+      int perRow = WorkersPerRow();
+      if (perRow > 1) {
+        // Aggregated view: the row shows the group's latest file and the
+        // average progress of its workers.
+        if (workerId < 0 || workerId >= m_workerCount)
+          return;
+        if (percent >= 0)
+          m_workerPercents[workerId] = percent;
+        row = workerId / perRow;
+        int first = row * perRow;
+        int last = std::min(m_workerCount, first + perRow);
+        int sum = 0;
+        for (int i = first; i < last; ++i)
+          sum += m_workerPercents[i];
+        percent = sum / (last - first);
+        ss << L"Workers " << (first + 1) << L"-" << last << L": " << file;
+      } else {
         ss << L"Worker " << (workerId + 1) << L": " << file;
-        SetWindowTextW(m_workerLabels[workerId], ss.str().c_str());
+      }
+    }
+
+    if (row >= 0 && row < MAX_WORKERS) {
+      // Only update controls if they exist (they're now removed from UI)
+      if (m_workerLabels[row]) {
+        SetWindowTextW(m_workerLabels[row], ss.str().c_str());
       }
 
-      if (m_workerProgs[workerId] && percent >= 0) {
-        SendMessageW(m_workerProgs[workerId], PBM_SETPOS, (WPARAM)percent, 0);
+      if (m_workerProgs[row] && percent >= 0) {
+        SendMessageW(m_workerProgs[row], PBM_SETPOS, (WPARAM)percent, 0);
       }
     }
   }
@@ -278,7 +339,33 @@ public:
     SetWindowTextW(m_hProgress, txt.c_str());
   }
 
+  // Set runs: remember each running unit's share for the status line.
+  void OnUnitProgress(const std::wstring &unit,
+                      const TaskProgress &progress) override {
+    int pct = progress.totalBytes > 0
+                  ? (int)((progress.processedBytes * 100) / progress.totalBytes)
+                  : 0;
+    std::lock_guard<std::mutex> lock(m_workerMutex);
+    for (auto &entry : m_unitPercents) {
+      if (entry.first == unit) {
+        entry.second = pct;
+        return;
+      }
+    }
+    m_unitPercents.push_back({unit, pct});
+  }
+
   void OnProgressDetailed(const TaskProgress &progress) override {
+    ShowProgress(progress, nullptr);
+  }
+
+  void OnAggregatedProgress(const TaskProgress &progress,
+                            const ProgressRates &rates) override {
+    ShowProgress(progress, &rates);
+  }
+
+private:
+  void ShowProgress(const TaskProgress &progress, const ProgressRates *rates) {
     if (m_hProgressBar) {
       if (progress.totalBytes > 0) {
         int pct = (int)((progress.processedBytes * 100) / progress.totalBytes);
@@ -288,28 +375,57 @@ public:
       }
     }
 
-    // Format a nice status string
+    // Format a nice status string. Provisional totals from a streaming scan
+    // are prefixed with '~' until the traversal has seen the whole tree.
+    const wchar_t *approx = progress.isEstimate ? L"~" : L"";
     std::wstringstream ss;
     ss << L"Processing: " << progress.currentFile << L" | Files: "
-       << progress.processedFiles << L"/" << progress.totalFiles << L" | MB: "
-       << (progress.processedBytes / 1024 / 1024) << L"/"
-       << (progress.totalBytes / 1024 / 1024);
+       << progress.processedFiles << L"/" << approx << progress.totalFiles
+       << L" | MB: " << (progress.processedBytes / 1024 / 1024) << L"/"
+       << approx << (progress.totalBytes / 1024 / 1024);
+    if (rates) {
+      const double mb = 1024.0 * 1024.0;
+      ss << std::fixed << std::setprecision(1) << L" | "
+         << rates->currentBytesPerSecond / mb << L" MB/s (avg "
+         << rates->averageBytesPerSecond / mb << L") | "
+         << std::setprecision(0) << rates->currentFilesPerSecond
+         << L" files/s (avg " << rates->averageFilesPerSecond << L")";
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_workerMutex);
+      for (const auto &entry : m_unitPercents)
+        if (entry.second < 100)
+          ss << L" | " << entry.first << L": " << entry.second << L"%";
+    }
 
     SetWindowTextW(m_hProgress, ss.str().c_str());
   }
 
-private:
   HWND m_hEdit;
   HWND m_hProgress;
   HWND m_hProgressBar;
   HWND m_workerProgs[MAX_WORKERS];
   HWND m_workerBtns[MAX_WORKERS];
   HWND m_workerLabels[MAX_WORKERS];
-  std::wofstream m_logFile;
+  std::mutex m_workerMutex;
+  int m_workerCount = 0;
+  std::vector<int> m_workerPercents; // Per worker, for the aggregated rows
+  std::vector<std::pair<std::wstring, int>> m_unitPercents; // Set runs
+  LogWriter m_logWriter; // last_run.txt
   bool m_hasErrors = false;
+
+  int WorkersPerRow() const {
+    return m_workerCount > MAX_WORKERS
+               ? (m_workerCount + MAX_WORKERS - 1) / MAX_WORKERS
+               : 1;
+  }
 };
 
 WindowLogger *g_logger = nullptr;
+// Engine threads log through this; it drives g_logger from its own thread.
+// The GUI thread keeps calling g_logger directly, since it must never wait
+// for the pipeline, whose consumer may be waiting on the GUI thread.
+LogPipeline *g_logPipeline = nullptr;
 
 void AddToolTip(HWND hParent, HWND hControl, const wchar_t *text) {
   if (!hToolTip) {
@@ -711,13 +827,18 @@ static void InitializeUnitEditDlg(HWND hWnd, BackupUnit *pUnit, HFONT hFont) {
                  200, IDC_CB_ENGINE);
 
   const StrId engines[] = {StrId::Eng_Std, StrId::Eng_Par, StrId::Eng_Blk,
-                           StrId::Eng_Vss, StrId::Eng_Cmp};
+                           StrId::Eng_Vss, StrId::Eng_Cmp, StrId::Eng_Pipe,
+                           StrId::Eng_Uring};
   for (auto id : engines) {
     SendMessageW(hEngineCombo, CB_ADDSTRING, 0, (LPARAM)Localization::Get(id));
   }
 
   int selIdx = 0;
-  if (pUnit->comparisonMode)
+  if (pUnit->uringMode)
+    selIdx = 6;
+  else if (pUnit->pipelineMode)
+    selIdx = 5;
+  else if (pUnit->comparisonMode)
     selIdx = 4;
   else if (pUnit->shadowCopyMode)
     selIdx = 3;
@@ -727,8 +848,33 @@ static void InitializeUnitEditDlg(HWND hWnd, BackupUnit *pUnit, HFONT hFont) {
     selIdx = 1;
   SendMessageW(hEngineCombo, CB_SETCURSEL, selIdx, 0);
 
+  CreateCtrl(L"STATIC", Localization::Get(StrId::Dlg_Catalog), 0, 290, 345,
+             250, 20, 0);
+  HWND hCatalogCombo =
+      CreateCtrl(L"COMBOBOX", NULL, CBS_DROPDOWNLIST | WS_VSCROLL, 290, 365,
+                 250, 200, IDC_CB_CATALOG);
+  const StrId catalogModes[] = {StrId::Cat_Off, StrId::Cat_Record,
+                                StrId::Cat_Trust};
+  for (auto id : catalogModes) {
+    SendMessageW(hCatalogCombo, CB_ADDSTRING, 0, (LPARAM)Localization::Get(id));
+  }
+  SendMessageW(hCatalogCombo, CB_SETCURSEL, (int)pUnit->catalogMode, 0);
+  CreateCtrl(L"BUTTON", Localization::Get(StrId::Dlg_CatalogInTarget),
+             BS_AUTOCHECKBOX, 20, 400, 400, 25, IDC_CHK_CATALOG_TARGET);
+  if (pUnit->catalogInTarget)
+    CheckDlgButton(hWnd, IDC_CHK_CATALOG_TARGET, BST_CHECKED);
+
+  CreateCtrl(L"STATIC", Localization::Get(StrId::Dlg_Workers), 0, 20, 438, 120,
+             20, 0);
+  CreateCtrl(L"EDIT", std::to_wstring(pUnit->workerCount).c_str(),
+             WS_BORDER | ES_NUMBER, 145, 435, 50, 25, IDC_EDIT_WORKERS);
+  CreateCtrl(L"BUTTON", Localization::Get(StrId::Dlg_WorkersAdaptive),
+             BS_AUTOCHECKBOX, 210, 435, 330, 25, IDC_CHK_WORKERS_ADAPTIVE);
+  if (pUnit->adaptiveWorkers)
+    CheckDlgButton(hWnd, IDC_CHK_WORKERS_ADAPTIVE, BST_CHECKED);
+
   CreateCtrl(L"BUTTON", Localization::Get(StrId::Dlg_Btn_Save), BS_PUSHBUTTON,
-             300, 445, 240, 30, IDC_BTN_UNIT_SAVE);
+             300, 480, 240, 30, IDC_BTN_UNIT_SAVE);
 }
 
 static void SaveUnitEditDlgData(HWND hWnd, BackupUnit *pUnit) {
@@ -769,6 +915,21 @@ static void SaveUnitEditDlgData(HWND hWnd, BackupUnit *pUnit) {
   pUnit->blockCloneMode = (selEng == 2);
   pUnit->shadowCopyMode = (selEng == 3);
   pUnit->comparisonMode = (selEng == 4);
+  pUnit->pipelineMode = (selEng == 5);
+  pUnit->uringMode = (selEng == 6);
+
+  int selCat =
+      (int)SendMessageW(GetDlgItem(hWnd, IDC_CB_CATALOG), CB_GETCURSEL, 0, 0);
+  pUnit->catalogMode = (selCat == 2)   ? CatalogMode::Trust
+                       : (selCat == 1) ? CatalogMode::Record
+                                       : CatalogMode::Off;
+  pUnit->catalogInTarget =
+      IsDlgButtonChecked(hWnd, IDC_CHK_CATALOG_TARGET) == BST_CHECKED;
+
+  int workers = (int)GetDlgItemInt(hWnd, IDC_EDIT_WORKERS, NULL, FALSE);
+  pUnit->workerCount = std::min(std::max(workers, 1), kMaxWorkerCount);
+  pUnit->adaptiveWorkers =
+      IsDlgButtonChecked(hWnd, IDC_CHK_WORKERS_ADAPTIVE) == BST_CHECKED;
 
   DestroyWindow(hWnd);
 }
@@ -849,8 +1010,22 @@ static void InitializeSetEditDlg(HWND hWnd, BackupSet *pSet, HFONT hFont) {
     SendMessageW(hCombo, CB_ADDSTRING, 0, (LPARAM)Localization::Get(days[i]));
   SendMessageW(hCombo, CB_SETCURSEL, pSet->scheduleDayOfWeek, 0);
 
+  // Set run budget (SetScheduler)
+  CreateCtrl(L"STATIC", Localization::Get(StrId::Dlg_SetUnitsAtOnce), 0, 20,
+             378, 170, 20, 0);
+  CreateCtrl(L"EDIT", std::to_wstring(pSet->concurrentUnits).c_str(),
+             WS_BORDER | ES_NUMBER, 195, 375, 40, 25, IDC_EDIT_SET_UNITS);
+  CreateCtrl(L"STATIC", Localization::Get(StrId::Dlg_SetMaxThreads), 0, 250,
+             378, 160, 20, 0);
+  CreateCtrl(L"EDIT", std::to_wstring(pSet->maxThreads).c_str(),
+             WS_BORDER | ES_NUMBER, 415, 375, 45, 25, IDC_EDIT_SET_THREADS);
+  CreateCtrl(L"STATIC", Localization::Get(StrId::Dlg_SetInFlightMB), 0, 20,
+             413, 300, 20, 0);
+  CreateCtrl(L"EDIT", std::to_wstring(pSet->maxInFlightMB).c_str(),
+             WS_BORDER | ES_NUMBER, 325, 410, 70, 25, IDC_EDIT_SET_INFLIGHT);
+
   CreateCtrl(L"BUTTON", Localization::Get(StrId::Dlg_Btn_SaveSet),
-             BS_PUSHBUTTON, 300, 335, 240, 30, IDC_BTN_SET_SAVE);
+             BS_PUSHBUTTON, 220, 450, 240, 30, IDC_BTN_SET_SAVE);
 }
 
 static void SaveSetEditDlgData(HWND hWnd, BackupSet *pSet) {
@@ -874,6 +1049,14 @@ static void SaveSetEditDlgData(HWND hWnd, BackupSet *pSet) {
   pSet->scheduleDayOfWeek = (int)SendMessageW(
       GetDlgItem(hWnd, IDC_COMBO_WEEKDAY), CB_GETCURSEL, 0, 0);
 
+  pSet->concurrentUnits =
+      std::max(1, (int)GetDlgItemInt(hWnd, IDC_EDIT_SET_UNITS, NULL, FALSE));
+  pSet->maxThreads = std::min(
+      std::max(1, (int)GetDlgItemInt(hWnd, IDC_EDIT_SET_THREADS, NULL, FALSE)),
+      kMaxSetThreads);
+  pSet->maxInFlightMB =
+      (int)GetDlgItemInt(hWnd, IDC_EDIT_SET_INFLIGHT, NULL, FALSE);
+
   DestroyWindow(hWnd);
 }
 
@@ -1157,7 +1340,7 @@ LRESULT CALLBACK SetEditDlgProc(HWND hWnd, UINT message, WPARAM wParam,
   return 0;
 }
 
-enum class RunMode { Backup, Preview, Verify };
+enum class RunMode { Backup, Preview, Verify, ApplyPlan };
 
 void OnSetUpdate(HWND hWnd) {
   if (g_selectedSetIndex < 0)
@@ -1166,7 +1349,7 @@ void OnSetUpdate(HWND hWnd) {
   HWND hDlg =
       CreateWindowExW(WS_EX_DLGMODALFRAME, L"SetEditDlgClass",
                       Localization::Get(StrId::Ctx_EditSet),
-                      WS_VISIBLE | WS_SYSMENU | WS_CAPTION, 200, 200, 500, 420,
+                      WS_VISIBLE | WS_SYSMENU | WS_CAPTION, 200, 200, 500, 530,
                       hWnd, NULL, hInst, &g_backupSets[g_selectedSetIndex]);
 
   if (!hDlg) {
@@ -1196,7 +1379,7 @@ void OnUnitUpdate(HWND hWnd) {
   HWND hDlg = CreateWindowExW(
       WS_EX_DLGMODALFRAME, L"UnitEditDlgClass",
       Localization::Get(StrId::Ctx_EditUnit),
-      WS_VISIBLE | WS_SYSMENU | WS_CAPTION, 200, 200, 560, 540, hWnd, NULL,
+      WS_VISIBLE | WS_SYSMENU | WS_CAPTION, 200, 200, 560, 575, hWnd, NULL,
       hInst, &g_backupSets[g_selectedSetIndex].units[g_selectedUnitIndex]);
 
   if (!hDlg) {
@@ -1234,7 +1417,7 @@ void OnUnitCreate(HWND hWnd) {
     HWND hDlg = CreateWindowExW(WS_EX_DLGMODALFRAME, L"UnitCreateDlgClass",
                                 Localization::Get(StrId::Ctx_AddUnit),
                                 WS_VISIBLE | WS_SYSMENU | WS_CAPTION, 200, 200,
-                                560, 540, hWnd, NULL, hInst, &nu);
+                                560, 575, hWnd, NULL, hInst, &nu);
     if (!hDlg)
       return;
 
@@ -1305,6 +1488,8 @@ static void InitializeMainUI(HWND hWnd) {
               Localization::Get(StrId::Menu_Preview));
   AppendMenuW(hBackup, MF_STRING, IDM_BACKUP_VERIFY,
               Localization::Get(StrId::Menu_Verify));
+  AppendMenuW(hBackup, MF_STRING, IDM_BACKUP_APPLY_PLAN,
+              Localization::Get(StrId::Menu_ApplyPlan));
   AppendMenuW(hBackup, MF_SEPARATOR, 0, NULL);
   AppendMenuW(hBackup, MF_STRING, IDM_BACKUP_STOP,
               Localization::Get(StrId::Main_Stop));
@@ -1394,7 +1579,8 @@ static void InitializeMainUI(HWND hWnd) {
       L"COMBOBOX", L"", WS_CHILD | WS_VISIBLE | CBS_DROPDOWNLIST, 0, 0, 0, 0,
       hWnd, (HMENU)ID_MAIN_STRATEGY_COMBO, hInst, NULL);
   const StrId engines[] = {StrId::Eng_Std, StrId::Eng_Par, StrId::Eng_Blk,
-                           StrId::Eng_Vss, StrId::Eng_Cmp};
+                           StrId::Eng_Vss, StrId::Eng_Cmp, StrId::Eng_Pipe,
+                           StrId::Eng_Uring};
   for (auto id : engines) {
     SendMessageW(hMainStrategyCombo, CB_ADDSTRING, 0,
                  (LPARAM)Localization::Get(id));
@@ -1424,6 +1610,7 @@ static void InitializeMainUI(HWND hWnd) {
   // 10. Logger and Initial Data
   g_logger = new WindowLogger(hLogEdit, hProgressLabel, hProgressBar,
                               hWorkerProgs, hWorkerBtns, hWorkerLabels);
+  g_logPipeline = new LogPipeline(g_logger);
 
   g_backupSets = ConfigManager::Load();
   PopulateDriveTree(hSrcTreeView);
@@ -1542,7 +1729,11 @@ static void HandleNotify(HWND hWnd, LPARAM lParam) {
         SendMessageW(hMainModeCombo, CB_SETCURSEL, modeIdx, 0);
 
         int engIdx = 0;
-        if (u.comparisonMode)
+        if (u.uringMode)
+          engIdx = 6;
+        else if (u.pipelineMode)
+          engIdx = 5;
+        else if (u.comparisonMode)
           engIdx = 4;
         else if (u.shadowCopyMode)
           engIdx = 3;
@@ -1704,7 +1895,7 @@ void RunBackup(RunMode runMode) {
     return;
   }
 
-  if (g_currentEngine) {
+  if (g_currentRun) {
     MessageBoxW(hMainWindow, Localization::Get(StrId::Err_AlreadyRunning),
                 Localization::Get(StrId::Main_Error), MB_OK | MB_ICONERROR);
     return;
@@ -1713,20 +1904,26 @@ void RunBackup(RunMode runMode) {
   // Capture setup data to avoid race conditions
   std::vector<BackupUnit> unitsToRun;
   std::wstring taskTitle;
+  const BackupSet &set = g_backupSets[g_selectedSetIndex];
   if (g_selectedUnitIndex >= 0) {
-    unitsToRun.push_back(
-        g_backupSets[g_selectedSetIndex].units[g_selectedUnitIndex]);
+    unitsToRun.push_back(set.units[g_selectedUnitIndex]);
     taskTitle = unitsToRun[0].name;
   } else {
-    unitsToRun = g_backupSets[g_selectedSetIndex].units;
-    taskTitle = g_backupSets[g_selectedSetIndex].name;
+    unitsToRun = set.units;
+    taskTitle = set.name;
   }
 
+  SetBudget budget;
+  budget.maxConcurrentUnits = set.concurrentUnits;
+  budget.maxThreads = set.maxThreads;
+  budget.maxInFlightBytes = (long long)set.maxInFlightMB * 1024 * 1024;
+
   EnableWindow(hStopButton, TRUE);
   if (g_logger)
     g_logger->ClearErrorFlag();
 
-  std::thread t([runMode, dryRun, unitsToRun, taskTitle]() {
+  g_runActive = true;
+  std::thread t([runMode, dryRun, unitsToRun, taskTitle, budget]() {
     // RAII guard for power state
     struct PowerGuard {
       PowerGuard() {
@@ -1736,50 +1933,101 @@ void RunBackup(RunMode runMode) {
       ~PowerGuard() { SetThreadExecutionState(ES_CONTINUOUS); }
     } guard;
 
-    BackupEngine engine(g_logger);
-    g_currentEngine = &engine;
-
+    std::vector<SetJob> jobs;
     for (const auto &u : unitsToRun) {
-      if (engine.IsAborted())
-        break;
-
-      if (runMode == RunMode::Verify || u.comparisonMode)
-        engine.SetStrategy(std::make_unique<ComparingBackupStrategy>());
-      else if (u.blockCloneMode) {
-        // Future: engine.SetStrategy(std::make_unique<BlockCloneStrategy>());
-        // For now, fallback to Standard or Log
-        engine.SetStrategy(std::make_unique<StandardBackupStrategy>());
-        if (g_logger)
-          g_logger->Log(L"NOTE: Block Clone Engine not fully implemented. "
-                        L"Using Standard.");
-      } else if (u.shadowCopyMode) {
-        // Future: engine.SetStrategy(std::make_unique<VssBackupStrategy>());
-        engine.SetStrategy(std::make_unique<StandardBackupStrategy>());
-        if (g_logger)
-          g_logger->Log(L"NOTE: VSS Engine requires Admin privs. Using "
-                        L"Standard fallback.");
-      } else if (u.parallelMode)
-        engine.SetStrategy(std::make_unique<ParallelBackupStrategy>());
-      else
-        engine.SetStrategy(std::make_unique<StandardBackupStrategy>());
-
-      BackupTask task;
+      SetJob job;
+      const bool comparing = runMode == RunMode::Verify || u.comparisonMode;
+      // Plans are made and applied by the Parallel engine.
+      const bool applying = runMode == RunMode::ApplyPlan;
+      const bool planning = !comparing && u.parallelMode && !u.blockCloneMode &&
+                            !u.shadowCopyMode && !u.pipelineMode &&
+                            !u.uringMode;
+      job.makeStrategy = [comparing, applying,
+                          u]() -> std::unique_ptr<IBackupStrategy> {
+        if (applying)
+          return std::make_unique<ParallelBackupStrategy>();
+        if (comparing)
+          return std::make_unique<ComparingBackupStrategy>();
+        if (u.blockCloneMode)
+          return std::make_unique<BlockCloneStrategy>();
+        if (u.shadowCopyMode) {
+          // Future: return std::make_unique<VssBackupStrategy>();
+          if (g_logPipeline)
+            g_logPipeline->Log(L"NOTE: VSS Engine requires Admin privs. "
+                               L"Using Standard fallback.");
+          return std::make_unique<StandardBackupStrategy>();
+        }
+        if (u.uringMode)
+          return std::make_unique<PipelineBackupStrategy>(
+              PipelineBackupStrategy::CopyBackend::IoUring);
+        if (u.pipelineMode)
+          return std::make_unique<PipelineBackupStrategy>();
+        if (u.parallelMode)
+          return std::make_unique<ParallelBackupStrategy>();
+        return std::make_unique<StandardBackupStrategy>();
+      };
+      const bool pooled =
+          comparing || applying ||
+          ((u.parallelMode || u.pipelineMode || u.uringMode) &&
+           !u.blockCloneMode && !u.shadowCopyMode);
+      job.threads = pooled ? u.workerCount : 1;
+
+      BackupTask &task = job.task;
       task.name = u.name;
       task.sourcePath = u.source;
       task.targetPath = u.target;
       task.mode = (runMode == RunMode::Verify) ? BackupMode::Verify : u.mode;
       task.verify = u.verify;
       task.errorPolicy = u.errorPolicy;
-      engine.Run(task, dryRun);
+      task.verifyMethod = u.verifyMethod;
+      task.workerCount = u.workerCount;
+      task.adaptiveWorkers = u.adaptiveWorkers;
+      task.catalogMode = u.catalogMode;
+      if (u.catalogMode != CatalogMode::Off)
+        task.catalogPath = ConfigManager::GetCatalogPath(u);
+      task.catalogRevalidatePercent = u.catalogRevalidatePercent;
+      task.rangeCopyThreshold = (long long)u.rangeCopyThresholdMB * 1024 * 1024;
+      task.traversalMemoryBudget =
+          (long long)u.traversalBudgetMB * 1024 * 1024;
+      // A verify run checks everything; it neither resumes nor is resumed.
+      if (u.resumable && task.mode != BackupMode::Verify)
+        task.journalPath = ConfigManager::GetJournalPath(u);
+      task.journalSyncMs = u.journalSyncMs;
+      // A preview keeps its plan; Apply Preview Plan performs it.
+      if ((dryRun && planning) || applying)
+        task.planPath = ConfigManager::GetPlanPath(u);
+      task.applyPlan = applying;
+      if (!u.filterRules.empty()) {
+        // A unit whose rules do not compile is skipped rather than run
+        // unfiltered.
+        auto filter = std::make_shared<PathFilter>();
+        std::wstring filterError;
+        if (!filter->Compile(u.filterRules, filterError)) {
+          if (g_logPipeline)
+            g_logPipeline->Log(L"ERROR: " + u.name + L": " + filterError +
+                               L"; unit skipped.");
+          continue;
+        }
+        task.filter = std::move(filter);
+      }
+      jobs.push_back(std::move(job));
     }
 
+    SetScheduler scheduler(g_logPipeline, budget);
+    g_currentRun = &scheduler;
+    scheduler.Run(std::move(jobs), dryRun);
+
     if (g_logger) {
+      // Everything the run logged must be in last_run.txt before it is
+      // archived.
+      g_logPipeline->Flush();
       g_logger->FinalizeLog(taskTitle);
       g_logger->Log(L"--- Task completed: " + taskTitle + L" ---");
     }
 
-    g_currentEngine = nullptr;
+    g_currentRun = nullptr;
     PostMessage(hMainWindow, WM_USER + 100, 0, 0);
+    g_runActive = false;
   });
   t.detach();
 }
@@ -1792,7 +2040,50 @@ static void HandleCommand_FileExit(HWND hWnd) {
   if (MessageBoxW(hWnd, Localization::Get(StrId::Msg_ConfirmExit),
                   Localization::Get(StrId::Msg_ConfirmTitle),
                   MB_YESNO | MB_ICONQUESTION) == IDYES) {
-    PostQuitMessage(0);
+    // Through WM_CLOSE, so a running backup and the log pipeline are
+    // stopped before the window goes.
+    PostMessage(hWnd, WM_CLOSE, 0, 0);
+  }
+}
+
+// Handles the messages other threads send to this one until done() holds.
+// Posted messages (input included) stay queued, so nothing re-enters the
+// caller.
+static void WaitPumpingSentMessages(const std::function<bool()> &done) {
+  MSG msg;
+  while (!done()) {
+    MsgWaitForMultipleObjects(0, NULL, FALSE, 20, QS_SENDMESSAGE);
+    PeekMessageW(&msg, NULL, 0, 0, PM_NOREMOVE | PM_QS_SENDMESSAGE);
+  }
+}
+
+// Aborts a running backup and stops the log pipeline, both while the window
+// still answers: the run thread and the pipeline's consumer deliver log
+// lines with SendMessageW, so waiting for them in a plain join would hang.
+static void StopRunAndLogging() {
+  if (g_runActive) {
+    if (g_logger)
+      g_logger->Log(L"ABORT REQUESTED BY USER...");
+    // The run thread may not have published its scheduler yet.
+    SetScheduler *aborted = nullptr;
+    WaitPumpingSentMessages([&] {
+      SetScheduler *run = g_currentRun;
+      if (run && run != aborted) {
+        run->Abort();
+        aborted = run;
+      }
+      return !g_runActive;
+    });
+  }
+  if (LogPipeline *pipeline = g_logPipeline) {
+    g_logPipeline = nullptr;
+    std::atomic<bool> stopped(false);
+    std::thread stopper([pipeline, &stopped] {
+      delete pipeline; // Delivers what is still queued
+      stopped = true;
+    });
+    WaitPumpingSentMessages([&] { return stopped.load(); });
+    stopper.join();
   }
 }
 
@@ -1807,16 +2098,20 @@ static void HandleCommand_LogMaximize(HWND hWnd) {
 }
 
 static void HandleCommand_BackupStop() {
-  if (g_currentEngine) {
+  if (SetScheduler *run = g_currentRun) {
     if (g_logger)
       g_logger->Log(L"ABORT REQUESTED BY USER...");
-    g_currentEngine->Abort();
+    run->Abort();
   }
 }
 
 static void HandleCommand_WorkerStop(int workerIndex) {
-  if (g_currentEngine) {
-    g_currentEngine->CancelWorker(workerIndex);
+  if (SetScheduler *run = g_currentRun) {
+    // A dashboard row may stand for a group of workers.
+    std::vector<int> workers = g_logger ? g_logger->WorkersInRow(workerIndex)
+                                        : std::vector<int>{workerIndex};
+    for (int worker : workers)
+      run->CancelWorker(worker);
   }
 }
 
@@ -1932,6 +2227,8 @@ static void HandleCommand_MainStrategyChange() {
   u.blockCloneMode = (sel == 2);
   u.shadowCopyMode = (sel == 3);
   u.comparisonMode = (sel == 4);
+  u.pipelineMode = (sel == 5);
+  u.uringMode = (sel == 6);
 
   ConfigManager::Save(g_backupSets);
   RefreshTreeView();
@@ -2010,6 +2307,9 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam,
     case IDM_BACKUP_VERIFY:
       RunBackup(RunMode::Verify);
       break;
+    case IDM_BACKUP_APPLY_PLAN:
+      RunBackup(RunMode::ApplyPlan);
+      break;
     case IDM_BACKUP_STOP:
       HandleCommand_BackupStop();
       break;
@@ -2045,7 +2345,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam,
   case WM_SIZE:
     ResizeMainLayout(hWnd, LOWORD(lParam), HIWORD(lParam));
     break;
+  case WM_CLOSE:
+    StopRunAndLogging();
+    DestroyWindow(hWnd);
+    break;
   case WM_DESTROY:
+    StopRunAndLogging(); // Already done unless destroyed without WM_CLOSE
     if (g_logger)
       delete g_logger;
     PostQuitMessage(0);